@@ -17,7 +17,17 @@ void App_init(void);
 
 void App_cleanup(void);
 
-void App_addMetadata(musicMetadata_t*);
+// Keeps the FILES page selection on the same song after a song was removed from the
+// library. positions has the position it had in each library view.
+void App_songRemoved(const int *positions);
+
+// Moves the FILES page selection to the song with this library id, if it is listed.
+void App_selectTrack(int id);
+// Library id of the song selected on the FILES page, or -1 if the list is empty.
+int App_getSelectedTrack(void);
+
+int App_getPage(void);
+void App_setPage(int page);
 
 void App_joystickRight(void);
 void App_joystickLeft(void);
@@ -29,8 +39,24 @@ void App_prevPage(void);
 
 void App_joystickPressed(void);
 
+// The rotary encoder turned step clicks (positive is clockwise). It changes the volume,
+// or picks a letter while a FILES page filter is being edited.
+void App_rotaryTurned(int step);
+
+// The rotary encoder was pressed. It pauses or resumes, or on the FILES page switches
+// between the library views (load order, artist, album, duration).
+void App_rotaryPressed(void);
+
 void App_updateVolume(int);
 
+// Wakes the display to redraw the current page. State the app owns redraws by itself;
+// this is for other modules whose changes would otherwise wait for the next poll.
+void App_requestRedraw(void);
+
+// The display draws at most maxFramesPerSecond, and the playtime on the MAIN page
+// moves progressTicksPerSecond times a second while playing. Both must be positive.
+void App_setFrameRate(int maxFramesPerSecond, int progressTicksPerSecond);
+
 void App_togglePlaybackStatus();
 
 
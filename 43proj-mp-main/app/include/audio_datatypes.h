@@ -3,26 +3,41 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+// Strings are offsets into the string arena (see string_arena.h)
 typedef struct {
-	char* title;
-	char* artist;
-	char* album;
+	uint32_t title;
+	uint32_t artist;
+	uint32_t album;
 	double lengthSeconds;
 } musicMetadata_t;
 
 typedef struct {
 	int numSamples;
-	short *pData;
+	int numChannels; // 1 or 2; the mixer plays mono on both channels
+	const short *pData;
+	// Set when pData points into a read-only mapping of the file instead of a malloc'd buffer
+	void *pMapping;
+	size_t mappingSize;
 	//bool playingInMixer;
 } soundData_t;
 
 
+// How a loaded song's audio is kept in memory
+typedef enum {
+	eMUSIC_STORAGE_PCM,        // fully decoded samples in pData
+	eMUSIC_STORAGE_COMPRESSED, // compressed bytes in pStream, decoded just ahead of playback
+} eMusicStorage_t;
+
+typedef struct sMusicStream sMusicStream_t;
+
 typedef struct {
 	size_t numSamples;
 	void *pData;
 	bool playingInMixer;
-
+	eMusicStorage_t storage;
+	sMusicStream_t *pStream;
 } musicData_t;
 
 // typedef struct {
@@ -1,11 +1,16 @@
 #ifndef AUDIO_MIXER_H
 #define AUDIO_MIXER_H
 
-// Module allows playing and loading multiple mp3 files. Also can support .wav files.
+// Module allows playing and loading multiple music files (MP3, FLAC and WAV) and .wav sound effects.
 
 #define AUDIOMIXER_MAX_VOLUME 100
 
+#include <stdbool.h>
+
 #include "audio_datatypes.h"
+
+typedef struct sLoadedFile sLoadedFile;
+
 // init() must be called before any other functions,
 // cleanup() must be called last to stop playback threads and free memory.
 void AudioMixer_init(void);
@@ -15,22 +20,39 @@ void AudioMixer_cleanup(void);
 // the pData pointer in this structure will be dynamically allocated in
 // readWaveFileIntoMemory(), and is freed by calling freeWaveFileData().
 void AudioMixer_readWaveFileIntoMemory(char *fileName, soundData_t *pSound);
-void AudioMixer_readMp3FileIntoMemory(char *filename, musicData_t *pSound, musicMetadata_t *pMetadata);
+// The music functions below read any format the codec module supports.
+// pMetadata may be NULL if the tags were already read.
+void AudioMixer_readMusicFileIntoMemory(char *filename, musicData_t *pSound, musicMetadata_t *pMetadata);
+// Same as readMusicFileIntoMemory() but keeps only the compressed bytes (about a tenth of
+// the PCM size for MP3); the mixer decodes them just ahead of playback.
+void AudioMixer_readMusicFileCompressed(char *filename, musicData_t *pSound, musicMetadata_t *pMetadata);
+// Same as readMusicFileIntoMemory() but splits an MP3 decode across every core.
+void AudioMixer_readMusicFileParallel(char *filename, musicData_t *pSound, musicMetadata_t *pMetadata);
+// Reads the tags and an estimated length without decoding anything.
+void AudioMixer_readMusicMetadata(char *filename, musicMetadata_t *pMetadata);
+// Length in seconds of loaded music data
+double AudioMixer_getMusicLength(musicData_t *pMusic);
 void AudioMixer_freeWaveFileData(soundData_t *pSound);
-void AudioMixer_freeMp3FileData(musicData_t *pSound);
-void AudioMixer_freeMp3MetaData(musicMetadata_t *pMetadata);
+void AudioMixer_freeMusicFileData(musicData_t *pSound);
 
 // Queue up another sound bite to play as soon as possible.
 void AudioMixer_queueSound(soundData_t *pSound);
 void AudioMixer_clearSoundQueue(void);
 
-void AudioMixer_queueMusic(musicData_t *pMusic);
-void AudioMixer_nextMusic();
-void AudioMixer_prevMusic();
+// Music plays from the play queue (see play_queue.h), which audio playback fills.
+// The mixer moves the queue on to the next song when one ends.
+// Songs may be queued before they are decoded. When the current or next song has no
+// samples yet, callback is called once for it from the playback thread; the mixer
+// stays silent on an undecoded current song until its samples are published.
+void AudioMixer_setDecodeCallback(void (*callback)(sLoadedFile *pFile, bool isCurrent));
 void AudioMixer_restartMusic();
-void AudioMixer_clearMusicQueue(void);
+// Stops the current song right away. Once this returns the mixer no longer uses it,
+// so it can be freed if it was also removed from the play queue.
+void AudioMixer_stopMusic(void);
 
 double AudioMixer_getPlaytime(void);
+// Frames of the current song played so far
+size_t AudioMixer_getPosition(void);
 
 void AudioMixer_pauseMusic(void);
 void AudioMixer_resumeMusic(void);
@@ -5,12 +5,14 @@
 // Users should be able to play, pause, skip, play previous, and change volume
 
 #include "audio_datatypes.h"
+#include "play_queue.h"
 
-typedef struct 
+typedef struct sLoadedFile
 {
     char* filename;
     musicData_t* musicData;
     musicMetadata_t* metadata;
+    int queueRefs; // entries for this song in the play queue; guarded by the queue
 } sLoadedFile;
 
 // Initializes Audio Playback module
@@ -19,15 +21,66 @@ void AudioPlayback_init(void);
 // Cleans up the Audio Playback module
 void AudioPlayback_cleanup(void);
 
-void AudioPlayback_queueSong(sLoadedFile*);
+// Adds the song to the end of the play queue. Returns its queue entry.
+playQueueId_t AudioPlayback_queueSong(sLoadedFile*);
 
-int AudioPlayback_fillQueueInfo(char** strs, double* songlens, int bufLen, int numSongsToDisp);
+// Same as queueSong() but playback starts startFrame frames into the song.
+playQueueId_t AudioPlayback_queueSongAt(sLoadedFile*, size_t startFrame);
+
+// Adds the song to play straight after the current one.
+playQueueId_t AudioPlayback_queueSongNext(sLoadedFile*);
+
+// Adds a song that has not been decoded yet to the end of the play queue. Nothing plays
+// while it is current until its samples are in; the decode callback asks for them.
+playQueueId_t AudioPlayback_queueUndecodedSong(sLoadedFile*);
+
+// Called from the playback thread once for each queued song that is current or next
+// but not decoded yet. isCurrent is true if playback is waiting on it.
+void AudioPlayback_setDecodeCallback(void (*callback)(sLoadedFile*, bool isCurrent));
+
+// Removes a queue entry, or moves it to position (0 is the first entry).
+void AudioPlayback_unqueue(playQueueId_t);
+// Removes every entry for the song, e.g. one that could not be decoded.
+void AudioPlayback_unqueueFile(sLoadedFile*);
+void AudioPlayback_moveInQueue(playQueueId_t, int position);
+
+// Fills files with the song playing now followed by the songs queued after it.
+// Returns how many were filled in.
+int AudioPlayback_getQueue(sLoadedFile **files, int maxFiles);
+
+// Entries in the whole queue, played ones included
+int AudioPlayback_getQueueLength(void);
+
+// The queue around the current song for display, read without locking (see play_queue.h).
+// The version changes whenever the snapshot would.
+uint64_t AudioPlayback_getQueueVersion(void);
+const sQueueSnapshot_t* AudioPlayback_acquireQueueSnapshot(void);
+void AudioPlayback_releaseQueueSnapshot(const sQueueSnapshot_t*);
 
 void AudioPlayback_clearQueue(void);
 
 // Loads the song to be played. Automatically adds the song to the queue. 
+// Tags are only read if readSongInfo() has not already been called for the file.
 void AudioPlayback_loadSong(char*, sLoadedFile*);
 
+// Reads only the song's tags and estimated length, so it can be listed before it is decoded.
+void AudioPlayback_readSongInfo(char*, musicMetadata_t*);
+
+// Frees the song's audio data. Its metadata is left alone.
+void AudioPlayback_unloadSong(sLoadedFile*);
+
+// True if the song is anywhere in the play queue, including already played songs.
+bool AudioPlayback_isQueued(sLoadedFile*);
+
+// Same as loadSong() but decodes on every core. For a song the user is waiting on.
+void AudioPlayback_loadSongUrgent(char*, sLoadedFile*);
+
+// Points the song at new copies of its tags; safe while it is queued or playing.
+void AudioPlayback_setSongTags(sLoadedFile*, const musicMetadata_t*);
+
+// Chooses whether songs loaded from now on are kept fully decoded or compressed.
+void AudioPlayback_setStorageMode(eMusicStorage_t);
+
 // Pauses music playback
 void AudioPlayback_pauseMusic(void);
 
@@ -43,12 +96,22 @@ void AudioPlayback_restart(void);
 // Plays the previous song
 void AudioPlayback_previous(void);
 
+// Shuffle and repeat; see play_queue.h
+void AudioPlayback_setShuffle(bool);
+bool AudioPlayback_getShuffle(void);
+void AudioPlayback_setRepeat(eRepeatMode_t);
+eRepeatMode_t AudioPlayback_getRepeat(void);
+
 // Sets the volume (int from 0-100) 
 void AudioPlayback_setVolume(int);
 
-musicMetadata_t* AudioPlayback_getCurrentMetadata(void);
+// Copies the metadata of the song playing now. Returns false if nothing is queued.
+bool AudioPlayback_getCurrentMetadata(musicMetadata_t *pMetadata);
 
 
 double AudioPlayback_getSongPlaytime(void);
 
+// Frames of the current song played so far
+size_t AudioPlayback_getPosition(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+// Module brings up the other modules as a dependency graph: every step starts
+// as soon as the steps it depends on have finished, so independent modules
+// initialize in parallel. Also times the boot.
+
+#define BOOT_MAX_DEPS 8
+
+typedef struct {
+    const char *name;
+    void (*init)(void);
+    // Names of steps that must finish first; unused entries are NULL
+    const char *deps[BOOT_MAX_DEPS];
+} sBootStep_t;
+
+// Runs every step and returns once all of them have finished, then prints how
+// long each one took. Exits if a dependency is unknown or the graph has a cycle.
+void Boot_run(const sBootStep_t *steps, int numSteps);
+
+// Called when the first frame reaches the screen and the first music reaches
+// ALSA; each prints its time since boot the first time it is called.
+void Boot_markFirstFrame(void);
+void Boot_markFirstAudio(void);
+
+#endif
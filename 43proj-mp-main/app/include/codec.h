@@ -0,0 +1,94 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+// Module decodes music files of every supported format behind one interface.
+// Each format is a plugin (an sCodec_t) that decodes a whole file held in memory into
+// interleaved 16-bit samples. The plugin for a file is picked from its first bytes,
+// never from its name. Decoders always return the mixer's format: songs at another
+// rate or channel count are converted as they are read.
+// mpg123_init() must have been called before anything is decoded.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_datatypes.h"
+
+// Enough of the start of a file for every plugin's probe
+#define CODEC_PROBE_BYTES 12
+
+// The mixer's format, which every decoder returns
+#define CODEC_SAMPLE_RATE 44100
+#define CODEC_NUM_CHANNELS 2
+
+typedef struct {
+    long sampleRate;
+    int numChannels;
+    size_t numSamples; // interleaved samples in the whole song, 0 if unknown
+} sCodecFormat_t;
+
+typedef struct {
+    const char *name;
+
+    // True if the first numBytes (at least CODEC_PROBE_BYTES unless the file is shorter)
+    // of a file are in this format.
+    bool (*probe)(const unsigned char *pHeader, size_t numBytes);
+
+    // Opens a decoder over the whole file in pBytes, which must outlive it.
+    // Returns the plugin's decoder state, or NULL on failure.
+    void* (*open)(const unsigned char *pBytes, size_t numBytes, sCodecFormat_t *pFormat);
+
+    // Decodes up to numSamples interleaved samples into dest and returns how many were written.
+    // Sets *pFinished once there is nothing left.
+    size_t (*read)(void *pState, short *dest, size_t numSamples, bool *pFinished);
+
+    // Moves to an interleaved sample index. Returns false if that is not possible.
+    bool (*seek)(void *pState, size_t sample);
+
+    void (*close)(void *pState);
+
+    // Reads the tags and length from the file at path without decoding it.
+    // Tags go in the string arena; anything missing is "Unknown".
+    void (*readFileMetadata)(const char *path, musicMetadata_t *pMetadata);
+    // The same for a whole file already in memory.
+    void (*readMetadata)(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata);
+} sCodec_t;
+
+typedef struct sCodecDecoder sCodecDecoder_t;
+
+// Plugin for a file starting with pHeader, or NULL if no plugin supports it.
+const sCodec_t* Codec_probe(const unsigned char *pHeader, size_t numBytes);
+
+// Opens a decoder over a whole file in memory, which must outlive the decoder.
+// Returns NULL if the format is not supported or the file is damaged.
+// Its format is always CODEC_SAMPLE_RATE and CODEC_NUM_CHANNELS.
+sCodecDecoder_t* Codec_open(const unsigned char *pBytes, size_t numBytes);
+void Codec_close(sCodecDecoder_t *pDecoder);
+
+const sCodec_t* Codec_getCodec(sCodecDecoder_t *pDecoder);
+void Codec_getFormat(sCodecDecoder_t *pDecoder, sCodecFormat_t *pFormat);
+
+// See sCodec_t
+size_t Codec_read(sCodecDecoder_t *pDecoder, short *dest, size_t numSamples, bool *pFinished);
+bool Codec_seek(sCodecDecoder_t *pDecoder, size_t sample);
+
+// Reads tags and length from the file at path with whichever plugin supports it.
+// Unsupported or unreadable files get "Unknown" tags and a length of 0.
+void Codec_readFileMetadata(const char *path, musicMetadata_t *pMetadata);
+// The same for a whole file already in memory, so a song being decoded isn't read again.
+void Codec_readMetadata(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata);
+
+// Converts from srcRate to CODEC_SAMPLE_RATE by linear interpolation, a block at a time.
+// src holds numSrcFrames frames of numChannels samples, the first being frame srcStart of
+// the song. Output frames are written to dest from frame *pOutFrame on while both source
+// frames around them are in src, or up to the last one if isEnd. Stops after maxFrames.
+// Advances *pOutFrame and returns the number of frames written.
+size_t Codec_resample(const short *src, size_t numSrcFrames, uint64_t srcStart, int numChannels, long srcRate,
+                      bool isEnd, uint64_t *pOutFrame, short *dest, size_t maxFrames);
+// Frames a song of numSrcFrames frames at srcRate has once resampled.
+size_t Codec_getResampledLength(size_t numSrcFrames, long srcRate);
+
+// Fills in "Unknown" for every tag and a length of 0. For plugins.
+void Codec_setUnknownMetadata(musicMetadata_t *pMetadata);
+
+#endif
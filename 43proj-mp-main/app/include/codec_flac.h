@@ -0,0 +1,10 @@
+#ifndef _CODEC_FLAC_H_
+#define _CODEC_FLAC_H_
+
+// FLAC plugin for the codec module, decoded with libFLAC.
+
+#include "codec.h"
+
+extern const sCodec_t CODEC_FLAC;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _CODEC_MP3_H_
+#define _CODEC_MP3_H_
+
+// MP3 plugin for the codec module, decoded with mpg123.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <mpg123.h>
+
+#include "codec.h"
+
+extern const sCodec_t CODEC_MP3;
+
+// Opens mp3Handle on numBytes of MP3 data in memory, which must outlive the handle.
+// Output is set to 16-bit stereo at CODEC_SAMPLE_RATE whatever the file's own format.
+// Set any parameters that must be in place before opening first.
+// Several handles may read the same bytes concurrently.
+bool CodecMp3_attach(mpg123_handle *mp3Handle, const unsigned char *pBytes, size_t numBytes);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _CODEC_WAV_H_
+#define _CODEC_WAV_H_
+
+// PCM WAV plugin for the codec module. Reads the RIFF chunks instead of assuming
+// a fixed size header. 8, 16, 24 and 32-bit integer PCM are converted to 16-bit as they are read.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "codec.h"
+
+typedef struct {
+    int numChannels;
+    long sampleRate;
+    int bitsPerSample;
+    size_t dataOffset; // from the start of the file
+    size_t dataSize;   // in bytes, whole frames only
+} sWavInfo_t;
+
+extern const sCodec_t CODEC_WAV;
+
+// Finds the fmt and data chunks of a whole file in memory.
+// Returns false if it is not an integer PCM WAV file.
+bool CodecWav_parse(const unsigned char *pBytes, size_t numBytes, sWavInfo_t *pInfo);
+// Converts numSamples little-endian samples of bitsPerSample bits to 16-bit.
+void CodecWav_convertSamples(const unsigned char *pSrc, int bitsPerSample, short *dest, size_t numSamples);
+
+#endif
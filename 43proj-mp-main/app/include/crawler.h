@@ -0,0 +1,26 @@
+#ifndef _CRAWLER_H_
+#define _CRAWLER_H_
+
+// Module finds every music file under a directory.
+// Directories are read on a small pool of threads, each opening entries relative to
+// its directory (openat/fstatat) instead of by full path. Files are kept if their
+// extension and first bytes both look like a supported format. Hidden files and
+// directories are skipped. Results are sorted by path so the order never depends on
+// the filesystem or on thread timing.
+
+#include <stdbool.h>
+
+// Called from the crawl threads for every directory found, including rootDir.
+typedef void (*CrawlerDirectoryCallback)(const char *path);
+
+// Returns a malloc'd array of *pNumFiles malloc'd paths (rootDir/...), sorted by path.
+// numThreads of 0 picks a default. onDirectory may be NULL.
+// Free the result with Crawler_freeFiles().
+char** Crawler_findMusicFiles(const char *rootDir, int numThreads, CrawlerDirectoryCallback onDirectory, int *pNumFiles);
+
+void Crawler_freeFiles(char **files, int numFiles);
+
+// True if the file at path has a music file extension and header.
+bool Crawler_isMusicFile(const char *path);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "fonts.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include "audio_datatypes.h"
 
 #define PROGRESS_BAR_MAX UINT8_MAX
@@ -60,7 +61,8 @@ typedef struct {
 void Display_init(Display_Opts_t layout);
 
 /**
- * Updates the screen.
+ * Updates the screen. Every update only sends the parts of the screen that changed
+ * since the last one.
  * @param request
  */
 void Display_updateHomeScreen(Display_Request_t request);
@@ -71,6 +73,12 @@ void Display_updateSongListScreen(char** songNames, int numSongs, int selectedSo
 
 void Display_updateQueueScreen(File_List_Display_Request_t request);
 
+/** Bytes of pixels sent to the panel since init. */
+uint64_t Display_getBytesPushed(void);
+
+/** Time spent drawing frames into memory since init, before they are sent. */
+uint64_t Display_getRenderNs(void);
+
 void Display_cleanup(void);
 
 void Display_drawSong(char*, int);
@@ -0,0 +1,37 @@
+#ifndef _EFFECT_BANK_H_
+#define _EFFECT_BANK_H_
+
+// A single packed file holding every sound effect as mixer-ready PCM, with a
+// name index at the front. The file is mapped, not read, so an effect's
+// samples are only paged in the first time it plays.
+
+#include <stdbool.h>
+#include "audio_datatypes.h"
+
+#define EFFECT_BANK_MAX_NAME_LEN 32
+
+typedef struct sEffectBank sEffectBank_t;
+
+// Packs the named wave files into a bank at path. Each file is converted to the
+// mixer's format once, here. The bank is written next to path and renamed over it,
+// so a reader never sees a half written bank.
+// Requires the audio mixer to be initialized.
+bool EffectBank_build(const char *path, const char **names, const char **wavFiles, int numEffects);
+
+// Opens and maps a bank; the only I/O is one open and one mmap.
+// Returns NULL if the file is missing or is not a valid bank.
+sEffectBank_t* EffectBank_open(const char *path);
+void EffectBank_close(sEffectBank_t *pBank);
+
+// Points pSound at the named effect's samples inside the bank. The data stays
+// owned by the bank: do not pass pSound to AudioMixer_freeWaveFileData().
+bool EffectBank_find(sEffectBank_t *pBank, const char *name, soundData_t *pSound);
+
+// True if the bank has the named effect and wavFile still has the size and
+// modification time it had when the effect was packed.
+bool EffectBank_isCurrent(sEffectBank_t *pBank, const char *name, const char *wavFile);
+
+// Asks the kernel to start paging in an effect that is about to play.
+void EffectBank_prefetch(sEffectBank_t *pBank, const soundData_t *pSound);
+
+#endif
@@ -2,12 +2,20 @@
 #ifndef EFFECT_LOADER_H
 #define EFFECT_LOADER_H
 
+#include <stdbool.h>
+
 typedef enum { EFFECT_SOUND1, EFFECT_SOUND2, EFFECT_SOUND3, EFFECT_SOUND_COLLECTION_SIZE } EffectCollection;
 
 void EffectLoader_requestToBeQued(EffectCollection);
 void EffectLoader_init(void);
 void EffectLoader_cleanup(void);
 
+// Adds an effect that can then be played by name. Effects registered before init()
+// are packed into the effect bank; ones registered later are read from their wave file.
+bool EffectLoader_registerEffect(const char *name, const char *wavFile);
+// Queues the named effect in the mixer. Returns false if no effect has that name.
+bool EffectLoader_play(const char *name);
+
 
 
 #endif
@@ -3,20 +3,57 @@
 
 #include "audio_playback.h"
 
-#define MAX_NUM_LOADED_FILES 256
-
 // This module should load and store music data
 // Loading should be done in the background so it doesn't hold up the app
+// The library is scanned on its own thread, listing each file once its tags are read.
+// Listed files are decoded meanwhile: selected song first, then queued songs, then
+// songs near the cursor, so a long scan doesn't hold up what the user asked for.
+// The music directory is watched so files added or removed later update the library.
+// Files are identified by their library id (see library.h).
 
 
 void FileLoader_init(void);
 
 void FileLoader_cleanup(void);
 
+// Queues the file for playback. If it is not decoded yet it joins the queue right away
+// and is decoded before the rest of the library; playback waits if it gets there first.
 void FileLoader_queueFile(int);
 
+// Clears the queue and plays the file, decoding it on all cores if needed.
 void FileLoader_replaceFile(int);
 
+// Clears the queue and queues every song of a playlist (M3U, M3U8 or PLS) that is in
+// the library. Only the first song is decoded now; the rest are decoded as playback
+// reaches them. Returns false if the playlist could not be read or had no such songs.
+bool FileLoader_loadPlaylist(const char *path);
+
+// Saves the playing song and every song queued after it as a playlist, in the format
+// path's extension names. Returns false if it could not be written.
+bool FileLoader_savePlaylist(const char *path);
+
+// Fills paths with the playlists in the music directory, sorted by name. Returns the
+// number found; the caller frees them.
+int FileLoader_findPlaylists(char **paths, int maxPaths);
+
+// The songs around the FILES page cursor, as the current view or filter lists them,
+// nearest first. They are decoded before the rest of the library.
+void FileLoader_setNearCursor(const int *ids, int numIds);
+
+// Restores a play queue saved by the session module. The first song is decoded before the
+// library is scanned and starts startFrame frames in; the others are queued, and the
+// song at cursorPath selected, once the scan has listed them. Must be called before init().
+void FileLoader_restoreSession(char **queuePaths, int numPaths, size_t startFrame, const char *cursorPath);
+
+// Copies the paths of the playing song and every song queued after it, including ones
+// still being decoded. *pStartFrame is set to how far into the first song playback is.
+// Returns an array of *pNumPaths paths; the caller frees each path and the array.
+char** FileLoader_getQueue(int *pNumPaths, size_t *pStartFrame);
+
+// Brings the library up to date with a file or directory that was added, rewritten,
+// or removed. Called by the library watcher.
+void FileLoader_libraryChanged(const char *path);
+
 void FileLoader_initFileType(sLoadedFile*);
 
 void FileLoader_freeFileType(sLoadedFile* pLoadedFile);
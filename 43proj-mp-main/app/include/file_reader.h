@@ -0,0 +1,25 @@
+#ifndef _FILE_READER_H_
+#define _FILE_READER_H_
+
+// Module reads whole music files into memory ahead of the decoder.
+// Files the loader will decode soon are requested up front and read by a pool of
+// reader threads, so several large reads are in flight at once and the storage
+// queue never runs dry while a song is being decoded.
+
+#include <stddef.h>
+
+void FileReader_init(void);
+void FileReader_cleanup(void);
+
+// Starts reading path in the background. Ignored if it is already requested or
+// too many reads are outstanding.
+void FileReader_request(const char *path);
+
+// Returns the contents of path in a malloc'd buffer the caller must free, or NULL on failure.
+// Waits for a read already in progress; otherwise reads the file on the calling thread.
+unsigned char* FileReader_take(const char *path, size_t *pNumBytes);
+
+// Prints how many files were read ahead and how many takes had to wait or read themselves
+void FileReader_printStats(void);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _LIBRARY_H_
+#define _LIBRARY_H_
+
+// Module holds the metadata of every song in the music library.
+// Each field is stored in its own array, split into fixed-size pages so the library
+// grows without moving existing songs, and all strings live in the string arena,
+// which must be initialized first.
+// A song costs a few dozen bytes plus its strings.
+//
+// Songs are referred to by an id that stays the same until the song is released.
+// Listed songs can be shown in several orders (views). Each sorted view is kept in
+// order as songs are added and removed, so showing or scrolling one never sorts.
+// Songs are added to and removed from the search index (see search_index.h) as they
+// are added and removed here.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_datatypes.h"
+
+typedef enum {
+    eLIBRARY_VIEW_LOADED,   // the order songs were found in
+    eLIBRARY_VIEW_ARTIST,   // by artist, then album, then title
+    eLIBRARY_VIEW_ALBUM,    // by album, then title
+    eLIBRARY_VIEW_DURATION, // shortest first
+    eNUM_LIBRARY_VIEWS,
+} eLibraryView_t;
+
+void Library_init(void);
+void Library_cleanup(void);
+
+// Adds a song to the end of the load order and to its place in every other view.
+// The path is copied; the tags must already be in the string arena. Returns the song's id.
+int Library_addTrack(const char *path, const musicMetadata_t *pMetadata);
+
+// Takes the song out of every view. Its data stays readable until releaseTrack().
+// If positions is not NULL, it is filled with the position the song had in each view.
+void Library_removeTrack(int id, int *positions);
+
+// Lets the id of a removed song be reused.
+void Library_releaseTrack(int id);
+
+// Copies the path and tags of every song not yet released into the string arena's
+// current generation and points the songs at the copies (see string_arena.h).
+void Library_copyStrings(void);
+
+// Number of listed songs
+int Library_getNumTracks(void);
+
+// Id of the song at position in a view, or -1 if there is none. O(log n).
+int Library_getTrackAt(eLibraryView_t view, int position);
+
+// Position of a listed song in a view, or -1. O(log n), except O(n) for the load order.
+int Library_getPosition(eLibraryView_t view, int id);
+
+// The artist or album the song at position is grouped under in the artist or album
+// view, as a string arena offset. STRING_ARENA_EMPTY in other views.
+uint32_t Library_getGroup(eLibraryView_t view, int position);
+
+// All ids are below this
+int Library_getIdLimit(void);
+
+// True if id is a listed song
+bool Library_isTrack(int id);
+
+// Id of the listed song with this path, or -1. O(1) through a hash table of paths.
+int Library_findTrack(const char *path);
+
+const char* Library_getPath(int id);
+
+// Fills in pMetadata with the song's tags. The strings belong to the library.
+void Library_getMetadata(int id, musicMetadata_t *pMetadata);
+
+// Also moves the song to its new place in the duration view
+void Library_setLength(int id, double lengthSeconds);
+
+// Copies the titles and lengths of up to count songs starting at position in a view.
+// Returns the number of songs copied.
+int Library_getWindow(eLibraryView_t view, int position, int count, char **titles, int titleLen, double *lengths);
+
+// Same as getWindow() for the songs with these ids, e.g. search matches.
+// Songs that are no longer listed are skipped.
+int Library_getTitles(const int *ids, int count, char **titles, int titleLen, double *lengths);
+
+// Bytes used by the library's arrays, not counting strings
+size_t Library_getMemoryUsage(void);
+
+#endif
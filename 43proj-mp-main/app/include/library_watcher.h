@@ -0,0 +1,17 @@
+#ifndef _LIBRARY_WATCHER_H_
+#define _LIBRARY_WATCHER_H_
+
+// Module watches the music directory tree with inotify so files added, changed or
+// removed while the player is running show up without a restart.
+// Events are collected until the directory has been quiet for a moment, then each
+// changed path is reported once to FileLoader_libraryChanged() on the watcher's own thread.
+
+// rootDir must stay valid until cleanup(). Changes are reported as paths below it.
+void LibraryWatcher_init(const char *rootDir);
+void LibraryWatcher_cleanup(void);
+
+// Starts watching a single directory. New subdirectories are watched automatically,
+// existing ones must be added by whoever scans the tree.
+void LibraryWatcher_watchDirectory(const char *path);
+
+#endif
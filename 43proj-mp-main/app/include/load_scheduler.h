@@ -0,0 +1,53 @@
+#ifndef _LOAD_SCHEDULER_H_
+#define _LOAD_SCHEDULER_H_
+
+// Module decides which file the loader decodes next.
+// Pending files sit in a priority queue ordered by what the user is waiting on.
+// Files keep their place within a priority level in the order they were raised to it.
+
+#include <stdbool.h>
+
+enum eLoadPriority
+{
+    eLOAD_BACKGROUND,  // everything else, in file order
+    eLOAD_NEAR_CURSOR, // in the window around the FILES page cursor, nearest first
+    eLOAD_QUEUED,      // waiting in the play queue, in queue order
+    eLOAD_SELECTED,    // the user is waiting for this one to start playing
+    eNUM_LOAD_PRIORITIES,
+};
+
+void LoadScheduler_init(void);
+void LoadScheduler_cleanup(void);
+
+// Adds a file that needs decoding. Ignored if the file is already pending.
+void LoadScheduler_add(int fileInd);
+
+// Raises a pending file to at least priority. Returns false if the file is not pending.
+bool LoadScheduler_raise(int fileInd, enum eLoadPriority priority);
+
+// Drops a pending file back to background (or near-cursor) priority.
+void LoadScheduler_reset(int fileInd);
+
+// Removes a pending file without decoding it.
+void LoadScheduler_cancel(int fileInd);
+
+// Files in fileInds get near-cursor priority, earlier ones first; files that leave the
+// window lose it. Only the first LOAD_SCHEDULER_MAX_WINDOW are kept.
+#define LOAD_SCHEDULER_MAX_WINDOW 64
+void LoadScheduler_setWindow(const int *fileInds, int numFiles);
+
+// Blocks until a file is pending, removes and returns it. *pPriority is set to its priority.
+// Returns -1 once stop() has been called.
+int LoadScheduler_waitForNext(enum eLoadPriority *pPriority);
+
+// Copies up to maxFiles (at most 16) of the files waitForNext() would return next, in order,
+// without removing them. Returns the number copied.
+int LoadScheduler_peek(int *fileInds, int maxFiles);
+
+// waitForNext() only returns jobs of at least this priority; the rest stay pending.
+void LoadScheduler_setMinPriority(enum eLoadPriority priority);
+
+// Wakes and releases any thread blocked in waitForNext().
+void LoadScheduler_stop(void);
+
+#endif
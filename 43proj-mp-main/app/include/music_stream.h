@@ -0,0 +1,45 @@
+#ifndef _MUSIC_STREAM_H_
+#define _MUSIC_STREAM_H_
+
+// Module keeps a song's compressed bytes in memory and decodes them just ahead of
+// the mixer's play cursor into a small PCM ring buffer. Any format the codec module
+// supports can be streamed.
+// A background decode thread services the few streams that are currently wanted
+// (the playing song and a prefetched next song); all other streams only cost their
+// compressed size.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <mpg123.h>
+
+#include "audio_datatypes.h"
+
+// init() must be called after mpg123_init() and before any other function.
+void MusicStream_init(void);
+void MusicStream_cleanup(void);
+
+// Creates a stream over numBytes of compressed data. Takes ownership of pBytes,
+// which must have been allocated with malloc(). Freed by MusicStream_destroy().
+sMusicStream_t* MusicStream_create(unsigned char *pBytes, size_t numBytes);
+void MusicStream_destroy(sMusicStream_t *pStream);
+
+size_t MusicStream_getCompressedSize(sMusicStream_t *pStream);
+
+// Opens a caller-created mpg123 handle on the stream's bytes, which must be MP3.
+// Several handles may read one stream concurrently.
+bool MusicStream_attachDecoder(sMusicStream_t *pStream, mpg123_handle *mp3Handle);
+
+// Copies up to numSamples decoded samples, starting at sample index location, into dest.
+// Never blocks: returns fewer samples (possibly 0) if the decoder has not caught up yet,
+// or if location is not where the stream currently is (a seek is then started).
+// *pFinished is set once the last sample of the song has been returned.
+// Must only be called from one thread (the mixer).
+size_t MusicStream_read(sMusicStream_t *pStream, size_t location, short *dest, size_t numSamples, bool *pFinished);
+
+// Starts decoding from location in the background so a later read() does not underrun.
+void MusicStream_prefetch(sMusicStream_t *pStream, size_t location);
+
+// Stops decoding the stream and frees its PCM ring buffer. Compressed data is kept.
+void MusicStream_release(sMusicStream_t *pStream);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _PARALLEL_DECODE_H_
+#define _PARALLEL_DECODE_H_
+
+// Module decodes a single MP3 on several cores at once.
+// The song is split at frame boundaries and each segment is decoded on its own thread
+// into its slice of one preallocated PCM buffer. Segments start decoding a few frames
+// early to refill the bit reservoir; each seam is then compared with the previous
+// segment and re-decoded from the start of the song if it is not bit-exact.
+// Segments decode without gapless trimming so every frame lands at a fixed offset, and
+// the encoder delay and padding are trimmed from the whole song at the end. The result
+// is the same as a serial decode through the codec module.
+
+#include <stddef.h>
+
+#include "music_stream.h"
+
+// Decodes all of pStream into a newly malloc'd buffer using up to maxThreads threads
+// (0 uses one per online core). Returns NULL on failure, and for a song that is not
+// at the mixer's rate; those must be decoded serially.
+// *pNumSamples is set to the number of samples in the buffer.
+short* ParallelDecode_decodeMp3(sMusicStream_t *pStream, int maxThreads, size_t *pNumSamples);
+
+#endif
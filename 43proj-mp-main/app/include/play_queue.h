@@ -0,0 +1,137 @@
+#ifndef _PLAY_QUEUE_H_
+#define _PLAY_QUEUE_H_
+
+// The one play queue. Audio playback owns it and is the only module that adds or
+// removes songs; the mixer reads the current song from it and moves past a song
+// when it ends. Songs already played stay in the queue so previous() can go back
+// to them.
+//
+// Songs play in queue order, or shuffled: each song once in a random order, and under
+// repeat-all a new order once every song has played. The song after the current one
+// is always known ahead, so it can be decoded before it is needed.
+//
+// The queue has no size limit. It is kept as a balanced tree ordered by position,
+// so inserting, removing and moving an entry anywhere is O(log n). Every entry has
+// an id that stays the same while it is in the queue, whatever moves around it.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_datatypes.h"
+
+typedef struct sLoadedFile sLoadedFile;
+
+typedef uint64_t playQueueId_t;
+// Never the id of an entry
+#define PLAY_QUEUE_NO_ID 0
+
+typedef enum {
+    eREPEAT_OFF,
+    eREPEAT_ALL, // back to the start after the last song
+    eREPEAT_ONE, // the current song plays again when it ends; skipping still moves on
+    eNUM_REPEAT_MODES,
+} eRepeatMode_t;
+
+// Removes every entry. cleanup() also frees the queue's memory.
+void PlayQueue_clear(void);
+void PlayQueue_cleanup(void);
+
+// Adds a song at the end. Playback of it starts startFrame frames in. If every
+// song had played, it becomes the current song.
+playQueueId_t PlayQueue_append(sLoadedFile *pFile, size_t startFrame);
+
+// Adds a song straight after the current one, or at the end if nothing is playing.
+playQueueId_t PlayQueue_insertNext(sLoadedFile *pFile);
+
+// Removes an entry. If it was playing, the song after it becomes current.
+// Returns false if the id is not in the queue.
+bool PlayQueue_remove(playQueueId_t id);
+
+// Removes every entry for the song. Returns how many there were. O(n).
+int PlayQueue_removeFile(sLoadedFile *pFile);
+
+// Moves an entry to position (0 is the first entry; past the end means last).
+// Returns false if the id is not in the queue.
+bool PlayQueue_move(playQueueId_t id, int position);
+
+int PlayQueue_getLength(void);
+
+// Turning shuffle on keeps the current song and shuffles the rest after it.
+// Songs added while shuffling go at a random point among those not played yet,
+// or straight after the current one for insertNext().
+void PlayQueue_setShuffle(bool enabled);
+bool PlayQueue_getShuffle(void);
+void PlayQueue_setRepeat(eRepeatMode_t mode);
+eRepeatMode_t PlayQueue_getRepeat(void);
+
+// The current song, or NULL if every song has played. *pId is set to its entry.
+// *pStartFrame is set to where it should start; it is only nonzero the first time
+// the song is returned.
+sLoadedFile* PlayQueue_getCurrent(playQueueId_t *pId, size_t *pStartFrame);
+
+// The song that plays after entry id under the current modes, or NULL if there is none
+// queued yet or id is no longer the current entry.
+sLoadedFile* PlayQueue_getAfter(playQueueId_t id);
+
+// Moves past entry id if it is still the current one. Returns false if something
+// else already moved the queue on.
+bool PlayQueue_advance(playQueueId_t id);
+
+// Moves to the next song in play order, or back to the one played before the current
+// one. Returns false if there is none.
+bool PlayQueue_skip(void);
+bool PlayQueue_previous(void);
+
+// True if the song is anywhere in the queue, including already played entries. O(1).
+bool PlayQueue_contains(sLoadedFile *pFile);
+
+// Copies the current song's metadata. Returns false if nothing is playing.
+bool PlayQueue_getCurrentMetadata(musicMetadata_t *pMetadata);
+
+// Sets a song's length once it is known, and publishes a new snapshot if the
+// published one shows the song.
+void PlayQueue_fileChanged(sLoadedFile *pFile, double lengthSeconds);
+
+// Points a song at new copies of its tags, e.g. after the string arena starts a new
+// generation. Its length is left alone.
+void PlayQueue_setTags(sLoadedFile *pFile, const musicMetadata_t *pMetadata);
+
+// Rows of the queue a snapshot holds: up to BEFORE played songs, then the current
+// song and the ones after it
+#define PLAY_QUEUE_SNAPSHOT_BEFORE 7
+#define PLAY_QUEUE_SNAPSHOT_LEN 16
+
+typedef struct {
+    playQueueId_t id;
+    uint32_t title; // string arena offset
+    double lengthSeconds;
+} sQueueSnapshotEntry_t;
+
+// The queue around the current song as it was after one change, for display.
+// A published snapshot never changes.
+typedef struct {
+    uint64_t version;
+    bool shuffle;
+    eRepeatMode_t repeatMode;
+    int length; // entries in the whole queue
+    int numBefore; // played songs in entries; also the current song's index
+    int numEntries;
+    sQueueSnapshotEntry_t entries[PLAY_QUEUE_SNAPSHOT_LEN];
+} sQueueSnapshot_t;
+
+// Every change to the queue or its modes publishes a new snapshot with a higher
+// version. None of these take a lock, so the display never waits on playback.
+// A reader that saw a version can skip its work until the version changes.
+uint64_t PlayQueue_getSnapshotVersion(void);
+// The latest snapshot; never NULL. It stays valid until released. Hold it only
+// while copying from it.
+const sQueueSnapshot_t* PlayQueue_acquireSnapshot(void);
+void PlayQueue_releaseSnapshot(const sQueueSnapshot_t *pSnapshot);
+
+// Fills files with up to maxBefore already played songs, the current song and the
+// songs after it, in play order. Returns the number filled in; *pNumBefore is set to
+// the played count, which is also the current song's position in files.
+int PlayQueue_getWindow(int maxBefore, sLoadedFile **files, int maxFiles, int *pNumBefore);
+
+#endif
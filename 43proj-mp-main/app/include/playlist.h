@@ -0,0 +1,36 @@
+#ifndef _PLAYLIST_H_
+#define _PLAYLIST_H_
+
+// Module reads and writes playlist files: M3U, M3U8 and PLS.
+// A playlist is read one line at a time and each entry is handed over as soon as it
+// is read, so only one line is ever in memory however long the playlist is.
+// Entries are given as paths in the form the library uses: relative entries are taken
+// from the playlist's directory, and "." and ".." are resolved. Entries that are not
+// local files (http:// and the like) are skipped.
+
+#include <stdbool.h>
+
+typedef struct {
+    const char *path;
+    const char *title; // NULL if unknown
+    const char *artist; // NULL if unknown
+    double lengthSeconds; // 0 if unknown
+} sPlaylistEntry_t;
+
+// True if the file name ends in .m3u, .m3u8 or .pls (any case)
+bool Playlist_isPlaylistFile(const char *path);
+
+// Calls onEntry with the path of every entry in order. Returns the number of entries,
+// or -1 if the playlist could not be opened.
+int Playlist_read(const char *path, void (*onEntry)(const char *entryPath, void *pContext), void *pContext);
+
+// Writes a playlist, as PLS if path ends in .pls and as extended M3U otherwise.
+// Entries below the playlist's directory are written relative to it. The old file is
+// only replaced once the new one is complete. Returns false if it could not be written.
+bool Playlist_write(const char *path, const sPlaylistEntry_t *entries, int numEntries);
+
+// Fills paths with the playlists directly in dir, sorted by name. Returns the number
+// found; the caller frees them.
+int Playlist_find(const char *dir, char **paths, int maxPaths);
+
+#endif
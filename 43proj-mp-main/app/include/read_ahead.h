@@ -0,0 +1,22 @@
+#ifndef _READ_AHEAD_H_
+#define _READ_AHEAD_H_
+
+// Module tells the kernel which music files are about to be read and which are done with,
+// so songs come out of the page cache instead of the SD card.
+// It also counts how much of each decoded file was already cached.
+
+// Starts reading the whole file into the page cache in the background.
+void ReadAhead_prefetch(const char *path);
+
+// Opens a file to be read start to finish. Records how much of it is already cached.
+// Returns the fd, or -1 with errno set.
+int ReadAhead_openSequential(const char *path);
+
+// Drops the file's pages from the page cache; call once its contents are held elsewhere.
+// Does not close fd.
+void ReadAhead_release(int fd);
+
+// Prints how many of the pages opened so far were already cached
+void ReadAhead_printStats(void);
+
+#endif
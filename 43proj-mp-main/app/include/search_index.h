@@ -0,0 +1,42 @@
+#ifndef _SEARCH_INDEX_H_
+#define _SEARCH_INDEX_H_
+
+// Module finds songs by the words in their title, artist and album.
+// Every word is kept in a trie, and each word lists the songs it appears in, so a
+// query only looks at the words it matches and never scans the library. The library
+// adds and removes songs as the loader finds them, so the index is always up to date.
+//
+// Words are compared case-insensitively, and only letters and digits count:
+// anything else separates words.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_datatypes.h"
+
+// Longest query and longest word that is told apart from its prefix
+#define SEARCH_INDEX_MAX_QUERY_LEN 32
+
+void SearchIndex_init(void);
+void SearchIndex_cleanup(void);
+
+// Indexes the words of a song's tags under its library id
+void SearchIndex_addTrack(int id, const musicMetadata_t *pMetadata);
+
+// Takes a song out of the index. pMetadata must be the tags it was added with.
+void SearchIndex_removeTrack(int id, const musicMetadata_t *pMetadata);
+
+// Finds the songs that have, for every word of the query, a word starting with it.
+// With fuzzy, words a typo or two away match too (one for words under 6 letters,
+// none under 3).
+// Fills ids with up to maxIds matches in id order and returns the number of matches.
+int SearchIndex_query(const char *query, bool fuzzy, int *ids, int maxIds);
+
+// Changes whenever a song is added or removed, so old query results can be spotted
+uint64_t SearchIndex_getVersion(void);
+
+// Bytes used by the index
+size_t SearchIndex_getMemoryUsage(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+// Module saves what the user was doing so the next start picks up where this one left off:
+// the play queue, how far into the current song playback is, shuffle and repeat, the volume,
+// the page and the FILES page selection. Songs are saved by path, since library ids change between runs.
+// The snapshot is rewritten every few seconds while it changes, and at shutdown.
+
+// Reads the last snapshot and hands the queue to the file loader. Starts reading the
+// current song from storage right away. Must run before FileLoader_init().
+void Session_load(void);
+
+// Restores the volume, page, shuffle and repeat, then starts saving. Run once the app and volume are up.
+void Session_init(void);
+
+// Saves one last time. Must run before the file loader clears the queue.
+void Session_cleanup(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _STRING_ARENA_H_
+#define _STRING_ARENA_H_
+
+// Module stores many small strings (song paths, titles, ...) back to back in large
+// chunks instead of one malloc() each. Strings are referred to by a 32-bit offset and
+// are never moved, so a pointer returned by get() can be read without locking.
+// Strings are freed in bulk by generation (see startGeneration()).
+// Strings that repeat a lot (artists, albums, "Unknown") can be interned so each
+// distinct value is only stored once.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Offset of the empty string; valid without adding anything.
+#define STRING_ARENA_EMPTY 0
+
+void StringArena_init(void);
+void StringArena_cleanup(void);
+
+// Copies str into the arena and returns its offset.
+// Strings longer than a chunk are truncated.
+uint32_t StringArena_add(const char *str);
+
+// Same as add(), but returns the existing copy if an equal string was interned before.
+uint32_t StringArena_intern(const char *str);
+
+// Starts a new generation so strings nothing uses any more can be freed. Strings added
+// from now on go to new chunks and none of the old ones are interned any more. The
+// caller copies every string still in use with add() or intern() and switches its users
+// to the copies. The old generation stays readable until the next call, which frees it,
+// so a reader that looked up an old offset just before the switch is safe.
+void StringArena_startGeneration(void);
+
+const char* StringArena_get(uint32_t offset);
+
+// Bytes of string data stored in the current generation, including terminators
+size_t StringArena_getUsedBytes(void);
+
+// Bytes not stored because intern() found an existing copy
+size_t StringArena_getSavedBytes(void);
+
+#endif
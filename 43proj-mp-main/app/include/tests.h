@@ -12,4 +12,37 @@ void Tests_rotaryEncoder(int seconds);
 
 void Tests_audioPlayback(void);
 
+// Decodes an MP3 on 1..N threads, printing times and checking output matches the 1 thread decode.
+void Tests_parallelDecode(char* filename);
+
+// Compares strdup'd metadata with the interned string arena: memory used and list walk time.
+void Tests_metadataStrings(int numTracks);
+
+// Crawls rootDir on 1..N threads, printing times and checking every crawl finds the same files in the same order.
+void Tests_crawler(char *rootDir);
+
+// Decodes a music file of any supported format, printing its codec and how much faster than realtime it decoded.
+void Tests_decodeThroughput(char *filename);
+
+// Indexes numTracks made up songs, printing the time per prefix and fuzzy query and
+// checking the matches against a scan of every song.
+void Tests_searchIndex(int numTracks);
+
+// Adds numTracks made up songs to the library, printing the cost per song of keeping the
+// sorted views up to date as they grow, then scrolls the views and takes the songs out.
+void Tests_libraryViews(int numTracks);
+
+// Writes a playlist of numEntries made up songs and reads it back, printing the time
+// per entry to parse it and find each song in the library.
+void Tests_playlist(int numEntries);
+
+// Starts the file loader, so call it instead of FileLoader_init(). Queues a song while
+// the music directory is still being scanned, checking it is decoded next and before the
+// scan finishes.
+void Tests_queueDuringScan(void);
+
+// Loads a song decoded and compressed, checking the compressed stream plays back the
+// same samples, then plays the compressed copy for a few seconds.
+void Tests_compressedPlayback(char *filename);
+
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@ void Volume_init(void);
 void Volume_decreaseVolume(void);
 void Volume_increaseVolume(void);
 void Volume_setVolume(int);
+int Volume_getVolume(void);
 
 void Volume_cleanup(void);
 
@@ -3,9 +3,11 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdatomic.h>
+#include <time.h>
 
 #include "hal/btn_statemachine.h"
 
@@ -13,14 +15,31 @@
 #include "audio_playback.h"
 #include "effect_loader.h"
 #include "file_loader.h"
+#include "library.h"
+#include "search_index.h"
+#include "string_arena.h"
 #include "app.h"
 #include "volume.h"
+#include "timing.h"
 
 #define DEFAULT_VOLUME 80
 #define DEFAULT_PLAYBACK_STATE eMUSIC_PLAYING
 #define MAX_SONG_NAME_LEN 64
 // Make sure it matches the one in display.c
 #define MAX_SONGS_DISP 7
+// On the QUEUE page, up saves the queue here and left loads the playlists in turn
+#define SAVED_QUEUE_PLAYLIST "mp3-files/queue.m3u8"
+#define MAX_PLAYLISTS 64
+// Songs this many rows above and below the selected one are decoded before the rest
+#define NEAR_CURSOR_ROWS 8
+
+// The display only redraws when something it shows changed. Input redraws straight
+// away; the playtime on the MAIN page ticks at the progress rate while playing, and
+// changes made elsewhere (next song, queue, library scan) are looked for every poll.
+#define DEFAULT_MAX_FPS 30
+#define DEFAULT_PROGRESS_TICKS_PER_SECOND 2
+#define DISPLAY_POLL_MS 100
+#define DISPLAY_STATS_MS 10000
 
 
 // prototypes
@@ -33,10 +52,18 @@ static enum ePlaybackState currPlaybackState = DEFAULT_PLAYBACK_STATE;
 
 static bool runDisplayThread = false;
 static pthread_t displayThread;
+// Guards the display thread's wakeups and rates
+static pthread_mutex_t displayMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t displayCond = PTHREAD_COND_INITIALIZER;
+static bool redrawRequested = true;
+static int maxFps = DEFAULT_MAX_FPS;
+static int progressTicksPerSecond = DEFAULT_PROGRESS_TICKS_PER_SECOND;
 
-static musicMetadata_t *loadedSongsMetadata[MAX_NUM_LOADED_FILES];
-static int songMetaInd = 0;
 static int selectedSong = 0;
+static eLibraryView_t currView = eLIBRARY_VIEW_LOADED; // guarded by songListMutex
+static char viewTitle[24];
+// Songs are removed by the file loader while the list is being shown
+static pthread_mutex_t songListMutex = PTHREAD_MUTEX_INITIALIZER;
 // static int queueSelectedSong = 0;
 static atomic_int currPage = MAIN;
 
@@ -48,11 +75,28 @@ int dispWindowStart = 0;
 int dispWindowEnd = MAX_SONGS_DISP;
 int dispWindowSelected = 0; // value between 0 and MAX_SONGS_DISP
 
+// Type-to-filter on the FILES page: scrolling above the first song starts a filter.
+// While it is being edited, the joystick or the rotary encoder picks its last letter,
+// right adds a letter and left takes one off. Pressing keeps the filter and goes
+// back to picking songs; left then clears it.
+// Guarded by songListMutex
+static const char FILTER_LETTERS[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+static char filterText[SEARCH_INDEX_MAX_QUERY_LEN + 1];
+static int filterLen = 0;
+static bool filterEditing = false;
+static bool filterFuzzy = false; // nothing matched exactly, so typos are allowed
+static int *filterMatches = NULL; // library ids
+static int numFilterMatches = 0;
+static int filterMatchesCapacity = 0;
+static uint64_t filterIndexVersion = 0;
+static char filterTitle[24];
+// Search index version the songs around the cursor were last sent to the loader for
+static uint64_t nearCursorVersion = 0;
+
 char* queueStrs[MAX_SONGS_DISP];
 double queueLengths[MAX_SONGS_DISP];
-int queueWindowStart = 0;
-int queueWindowEnd = MAX_SONGS_DISP;
-int queueWindowSelected = 0; // value between 0 and MAX_SONGS_DISP
+// The playlist loaded last from the QUEUE page, counting from 0 in name order
+static int playlistInd = -1;
 
 void App_init(void)
 {
@@ -82,7 +126,10 @@ void App_cleanup(void)
 {
     assert(initialized);
 
+    pthread_mutex_lock(&displayMutex);
     runDisplayThread = false;
+    pthread_cond_signal(&displayCond);
+    pthread_mutex_unlock(&displayMutex);
     pthread_join(displayThread, NULL);
 
     for (int i=0;i<MAX_SONGS_DISP; i++)
@@ -90,6 +137,12 @@ void App_cleanup(void)
         free(dispStrs[i]);
         free(queueStrs[i]);
     }
+    free(filterMatches);
+    filterMatches = NULL;
+    filterMatchesCapacity = 0;
+    numFilterMatches = 0;
+    filterLen = 0;
+    filterEditing = false;
 
     BtnStateMachine_stopEventChecks(eROTARY_ENCODER_BUTTON_STATEMACHINE);
     BtnStateMachine_stopEventChecks(eJOYSTICK_BUTTON_STATEMACHINE);
@@ -102,6 +155,7 @@ void App_updateVolume(int newVolume)
     assert(initialized);
 
     volume = newVolume;
+    App_requestRedraw();
 }
 
 
@@ -117,6 +171,7 @@ void App_togglePlaybackStatus()
         AudioPlayback_resumeMusic();
         currPlaybackState = eMUSIC_PLAYING;
     }
+    App_requestRedraw();
 }
 
 void App_setPlaybackStatus(enum ePlaybackState state)
@@ -131,16 +186,231 @@ void App_setPlaybackStatus(enum ePlaybackState state)
         AudioPlayback_pauseMusic();
         currPlaybackState = eMUSIC_PAUSED;
     }
-    
+    App_requestRedraw();
 }
 
-void App_addMetadata(musicMetadata_t *metadata)
+// Keeps the selection on a song and inside the display window after the list changed.
+// Caller holds songListMutex
+static void clampSongWindow(int numSongs)
 {
-    loadedSongsMetadata[songMetaInd] = metadata;
-    songMetaInd++;
+    if (selectedSong >= numSongs) selectedSong = numSongs - 1;
+    if (selectedSong < 0) selectedSong = 0;
+
+    int maxWindowEnd = numSongs > MAX_SONGS_DISP ? numSongs : MAX_SONGS_DISP;
+    if (dispWindowEnd > maxWindowEnd)
+    {
+        dispWindowStart -= dispWindowEnd - maxWindowEnd;
+        dispWindowEnd = maxWindowEnd;
+    }
+    if (selectedSong < dispWindowStart)
+    {
+        dispWindowStart = selectedSong;
+        dispWindowEnd = dispWindowStart + MAX_SONGS_DISP;
+    }
+    if (selectedSong >= dispWindowEnd)
+    {
+        dispWindowEnd = selectedSong + 1;
+        dispWindowStart = dispWindowEnd - MAX_SONGS_DISP;
+    }
+    dispWindowSelected = selectedSong - dispWindowStart;
 }
 
-void App_joystickDown(void)
+// Songs on the FILES page: the filter's matches while there is a filter, else the listing.
+// Caller holds songListMutex
+static int getNumSongs(void)
+{
+    return filterLen > 0 ? numFilterMatches : Library_getNumTracks();
+}
+
+// Id of the song at position on the FILES page, or -1
+// Caller holds songListMutex
+static int getSongAt(int position)
+{
+    if (filterLen == 0) return Library_getTrackAt(currView, position);
+    return position >= 0 && position < numFilterMatches ? filterMatches[position] : -1;
+}
+
+// Sends the loader the songs around the cursor in the current view or filter, nearest
+// first, so they are decoded before the rest of the library.
+// Caller holds songListMutex
+static void sendNearCursor(void)
+{
+    int ids[2 * NEAR_CURSOR_ROWS + 1];
+    int numIds = 0;
+    int numSongs = getNumSongs();
+    for (int dist=0; dist<=NEAR_CURSOR_ROWS; dist++)
+    {
+        if (selectedSong + dist < numSongs) ids[numIds++] = getSongAt(selectedSong + dist);
+        if (dist > 0 && selectedSong - dist >= 0 && selectedSong - dist < numSongs)
+        {
+            ids[numIds++] = getSongAt(selectedSong - dist);
+        }
+    }
+    nearCursorVersion = SearchIndex_getVersion();
+    FileLoader_setNearCursor(ids, numIds);
+}
+
+// Selects the song at position and shows it at the top of the window.
+// Caller holds songListMutex
+static void selectPosition(int position)
+{
+    selectedSong = position;
+    dispWindowStart = position;
+    dispWindowEnd = position + MAX_SONGS_DISP;
+    clampSongWindow(getNumSongs());
+}
+
+// Looks up the filter's matches in the search index. If nothing matches exactly,
+// words a typo away are allowed.
+// Caller holds songListMutex
+static void runFilter(void)
+{
+    filterIndexVersion = SearchIndex_getVersion();
+    numFilterMatches = 0;
+    filterFuzzy = false;
+    if (filterLen == 0) return;
+
+    // Every id is below the id limit, so every match fits
+    int idLimit = Library_getIdLimit();
+    if (idLimit > filterMatchesCapacity)
+    {
+        int *pNew = realloc(filterMatches, idLimit * sizeof(int));
+        if (!pNew)
+        {
+            perror("ERROR: Unable to allocate filter matches");
+            exit(EXIT_FAILURE);
+        }
+        filterMatches = pNew;
+        filterMatchesCapacity = idLimit;
+    }
+
+    numFilterMatches = SearchIndex_query(filterText, false, filterMatches, filterMatchesCapacity);
+    if (numFilterMatches == 0)
+    {
+        numFilterMatches = SearchIndex_query(filterText, true, filterMatches, filterMatchesCapacity);
+        filterFuzzy = numFilterMatches > 0;
+    }
+    // Songs added since the id limit was read are picked up on the next refresh
+    if (numFilterMatches > filterMatchesCapacity) numFilterMatches = filterMatchesCapacity;
+}
+
+// Runs the filter again after the library changed, staying on the selected song.
+// Caller holds songListMutex
+static void refreshFilter(void)
+{
+    int selectedId = getSongAt(selectedSong);
+    runFilter();
+    for (int i=0; i<numFilterMatches; i++)
+    {
+        if (filterMatches[i] == selectedId)
+        {
+            selectedSong = i;
+            break;
+        }
+    }
+    clampSongWindow(numFilterMatches);
+}
+
+// Shows the first match of the filter after it was edited.
+// Caller holds songListMutex
+static void filterChanged(void)
+{
+    filterText[filterLen] = '\0';
+    runFilter();
+    selectPosition(0);
+    sendNearCursor();
+    EffectLoader_requestToBeQued(EFFECT_SOUND1);
+}
+
+// Moves the filter's last letter step letters along FILTER_LETTERS.
+// Caller holds songListMutex
+static void changeFilterLetter(int step)
+{
+    int numLetters = sizeof(FILTER_LETTERS) - 1;
+    const char *pLetter = strchr(FILTER_LETTERS, filterText[filterLen-1]);
+    int letter = pLetter ? pLetter - FILTER_LETTERS : 0;
+    filterText[filterLen-1] = FILTER_LETTERS[((letter + step) % numLetters + numLetters) % numLetters];
+    filterChanged();
+}
+
+// Names the view, or in the artist and album views, the selected song's group.
+// Caller holds songListMutex
+static void formatViewTitle(void)
+{
+    uint32_t group = Library_getGroup(currView, selectedSong);
+    if (currView == eLIBRARY_VIEW_ARTIST || currView == eLIBRARY_VIEW_ALBUM)
+    {
+        snprintf(viewTitle, sizeof(viewTitle), "%s", StringArena_get(group));
+    }
+    else
+    {
+        snprintf(viewTitle, sizeof(viewTitle), "%s", currView == eLIBRARY_VIEW_DURATION ? "By length" : "Songs");
+    }
+}
+
+// Caller holds songListMutex
+static void formatFilterTitle(void)
+{
+    // Only the end of a long filter fits
+    int first = filterLen > 12 ? filterLen - 12 : 0;
+    const char *prefix = filterFuzzy ? "~" : "/";
+    if (filterEditing)
+    {
+        // The letter being picked is in brackets
+        snprintf(filterTitle, sizeof(filterTitle), "%s%.*s[%c]", prefix, filterLen - 1 - first,
+            filterText + first, filterText[filterLen-1]);
+    }
+    else
+    {
+        snprintf(filterTitle, sizeof(filterTitle), "%s%s", prefix, filterText + first);
+    }
+}
+
+void App_songRemoved(const int *positions)
+{
+    pthread_mutex_lock(&songListMutex);
+    int position = positions[currView];
+    if (filterLen > 0)
+    {
+        refreshFilter();
+    }
+    else if (position >= 0)
+    {
+        // Stay on the same song if one above it was removed
+        if (position < selectedSong) selectedSong--;
+        clampSongWindow(Library_getNumTracks());
+    }
+    pthread_mutex_unlock(&songListMutex);
+    App_requestRedraw();
+}
+
+void App_selectTrack(int id)
+{
+    pthread_mutex_lock(&songListMutex);
+    int numSongs = getNumSongs();
+    int position = filterLen > 0 ? -1 : Library_getPosition(currView, id);
+    for (int i=0; i<numSongs && filterLen>0; i++)
+    {
+        if (filterMatches[i] == id) position = i;
+    }
+    // Show the song at the top of the window
+    if (position >= 0) selectPosition(position);
+    sendNearCursor();
+    pthread_mutex_unlock(&songListMutex);
+
+    App_requestRedraw();
+}
+
+// Returns -1 if the list is empty
+static int getSelectedFileInd(void)
+{
+    pthread_mutex_lock(&songListMutex);
+    int fileInd = getSongAt(selectedSong);
+    pthread_mutex_unlock(&songListMutex);
+    return fileInd;
+}
+
+static void joystickDown(void)
 {
 
     printf("playback status: %d\n", currPlaybackState);
@@ -149,8 +419,16 @@ void App_joystickDown(void)
     }
     else if (currPage == FILES)
     {
+        pthread_mutex_lock(&songListMutex);
+        if (filterEditing)
+        {
+            changeFilterLetter(1);
+            pthread_mutex_unlock(&songListMutex);
+            return;
+        }
+        int numSongs = getNumSongs();
         // Checks if last song
-        if (selectedSong+1 < songMetaInd)
+        if (selectedSong+1 < numSongs)
         {
             selectedSong++;
             EffectLoader_requestToBeQued(EFFECT_SOUND1);
@@ -162,21 +440,72 @@ void App_joystickDown(void)
             }
         }
 
-        if (dispWindowSelected < MAX_SONGS_DISP-1 && dispWindowSelected < songMetaInd-1)
+        if (dispWindowSelected < MAX_SONGS_DISP-1 && dispWindowSelected < numSongs-1)
         {dispWindowSelected++;}
+        sendNearCursor();
+        pthread_mutex_unlock(&songListMutex);
 
         printf("selected song: %d\n", selectedSong);
     }
     else if (currPage == QUEUE)
     {
-
+        // Cycles repeat off, all, one
+        AudioPlayback_setRepeat((AudioPlayback_getRepeat() + 1) % eNUM_REPEAT_MODES);
+        EffectLoader_requestToBeQued(EFFECT_SOUND1);
+        printf("Repeat mode: %d\n", AudioPlayback_getRepeat());
     }
     printf("Joystickick Down: selected song: %d\n", selectedSong);
 }
 
-void App_joystickUp(void)
+// Replaces the queue with the next playlist in the music directory
+static void loadNextPlaylist(void)
+{
+    char *paths[MAX_PLAYLISTS];
+    int numPlaylists = FileLoader_findPlaylists(paths, MAX_PLAYLISTS);
+    if (numPlaylists == 0)
+    {
+        printf("No playlists found\n");
+        return;
+    }
+
+    playlistInd = (playlistInd + 1) % numPlaylists;
+    if (FileLoader_loadPlaylist(paths[playlistInd]))
+    {
+        EffectLoader_requestToBeQued(EFFECT_SOUND2);
+        App_setPlaybackStatus(eMUSIC_PLAYING);
+    }
+
+    for (int i=0; i<numPlaylists; i++)
+    {
+        free(paths[i]);
+    }
+}
+
+static void joystickUp(void)
 {
     if (currPage == MAIN) return;
+    if (currPage == QUEUE)
+    {
+        if (FileLoader_savePlaylist(SAVED_QUEUE_PLAYLIST)) EffectLoader_requestToBeQued(EFFECT_SOUND2);
+        return;
+    }
+    pthread_mutex_lock(&songListMutex);
+    if (currPage == FILES && (filterEditing || selectedSong == 0))
+    {
+        // Going up past the first song edits the filter, starting one if there is none
+        if (!filterEditing)
+        {
+            filterEditing = true;
+            if (filterLen == 0) filterText[filterLen++] = FILTER_LETTERS[0];
+            filterChanged();
+        }
+        else
+        {
+            changeFilterLetter(-1);
+        }
+        pthread_mutex_unlock(&songListMutex);
+        return;
+    }
     if (selectedSong > 0)
     {
         selectedSong--;
@@ -188,11 +517,13 @@ void App_joystickUp(void)
         }
     }
     if (dispWindowSelected > 0) dispWindowSelected--;
+    sendNearCursor();
+    pthread_mutex_unlock(&songListMutex);
 
     printf("Joystickick Up: selected song: %d\n", selectedSong);
 }
 
-void App_joystickRight(void)
+static void joystickRight(void)
 {
     printf("Joystick Right\n");
     if (currPage == MAIN)
@@ -210,7 +541,19 @@ void App_joystickRight(void)
     }
     else if (currPage == FILES)
     {
-        if (selectedSong < songMetaInd) FileLoader_queueFile(selectedSong);
+        pthread_mutex_lock(&songListMutex);
+        if (filterEditing)
+        {
+            // Adds a letter to pick
+            if (filterLen < SEARCH_INDEX_MAX_QUERY_LEN) filterText[filterLen++] = FILTER_LETTERS[0];
+            filterChanged();
+            pthread_mutex_unlock(&songListMutex);
+            return;
+        }
+        pthread_mutex_unlock(&songListMutex);
+
+        int fileInd = getSelectedFileInd();
+        if (fileInd >= 0) FileLoader_queueFile(fileInd);
         EffectLoader_requestToBeQued(EFFECT_SOUND2);
 
         printf("Queuing file #%d\n", selectedSong);
@@ -219,7 +562,7 @@ void App_joystickRight(void)
     // printf("next page: %d\n", currPage);
 }
 
-void App_joystickLeft(void)
+static void joystickLeft(void)
 {
     printf("Joystick Left\n");
     if (currPage == MAIN)
@@ -232,11 +575,78 @@ void App_joystickLeft(void)
     }
     else if (currPage == FILES)
     {
+        pthread_mutex_lock(&songListMutex);
+        if (filterEditing)
+        {
+            // Takes off the last letter; with none left the whole listing is back
+            filterLen--;
+            filterEditing = filterLen > 0;
+            filterChanged();
+            pthread_mutex_unlock(&songListMutex);
+            return;
+        }
+        if (filterLen > 0)
+        {
+            // Clears the filter but stays on the song that was selected
+            int selectedId = getSongAt(selectedSong);
+            filterLen = 0;
+            runFilter();
+            int position = Library_getPosition(currView, selectedId);
+            selectPosition(position >= 0 ? position : 0);
+            sendNearCursor();
+            pthread_mutex_unlock(&songListMutex);
+            EffectLoader_requestToBeQued(EFFECT_SOUND1);
+            return;
+        }
+        pthread_mutex_unlock(&songListMutex);
+
         currPage--;
     }
+    else if (currPage == QUEUE)
+    {
+        loadNextPlaylist();
+    }
 }
 
-void App_joystickPressed(void)
+static void rotaryTurned(int step)
+{
+    pthread_mutex_lock(&songListMutex);
+    if (currPage == FILES && filterEditing)
+    {
+        changeFilterLetter(step);
+        pthread_mutex_unlock(&songListMutex);
+        return;
+    }
+    pthread_mutex_unlock(&songListMutex);
+
+    if (step > 0) Volume_increaseVolume();
+    else Volume_decreaseVolume();
+}
+
+static void rotaryPressed(void)
+{
+    if (currPage != FILES)
+    {
+        App_togglePlaybackStatus();
+        return;
+    }
+
+    pthread_mutex_lock(&songListMutex);
+    // The selected song stays selected in the new view
+    int selectedId = getSongAt(selectedSong);
+    currView = (currView + 1) % eNUM_LIBRARY_VIEWS;
+    if (filterLen == 0)
+    {
+        int position = Library_getPosition(currView, selectedId);
+        selectPosition(position >= 0 ? position : 0);
+    }
+    // The rows around the cursor are different songs in the new view
+    sendNearCursor();
+    pthread_mutex_unlock(&songListMutex);
+    EffectLoader_requestToBeQued(EFFECT_SOUND1);
+}
+
+static void joystickPressed(void)
 {
     // FileLoader_queueFile(selectedSong);
     // currently also clears queue
@@ -254,10 +664,89 @@ void App_joystickPressed(void)
     }
     else if (currPage == FILES) 
     {
+        pthread_mutex_lock(&songListMutex);
+        if (filterEditing)
+        {
+            // Keeps the filter and goes back to picking a song
+            filterEditing = false;
+            pthread_mutex_unlock(&songListMutex);
+            EffectLoader_requestToBeQued(EFFECT_SOUND2);
+            return;
+        }
+        pthread_mutex_unlock(&songListMutex);
+
         printf("Loading File at index %d\n", selectedSong);
-        FileLoader_replaceFile(selectedSong);
+        int fileInd = getSelectedFileInd();
+        if (fileInd >= 0) FileLoader_replaceFile(fileInd);
         App_setPlaybackStatus(eMUSIC_PLAYING);
     }
+    else if (currPage == QUEUE)
+    {
+        AudioPlayback_setShuffle(!AudioPlayback_getShuffle());
+        printf("Shuffle: %s\n", AudioPlayback_getShuffle() ? "on" : "off");
+    }
+}
+
+// Input changes what the current page shows, so each handler ends with a redraw
+void App_joystickDown(void)
+{
+    joystickDown();
+    App_requestRedraw();
+}
+
+void App_joystickUp(void)
+{
+    joystickUp();
+    App_requestRedraw();
+}
+
+void App_joystickRight(void)
+{
+    joystickRight();
+    App_requestRedraw();
+}
+
+void App_joystickLeft(void)
+{
+    joystickLeft();
+    App_requestRedraw();
+}
+
+void App_rotaryTurned(int step)
+{
+    rotaryTurned(step);
+    App_requestRedraw();
+}
+
+void App_rotaryPressed(void)
+{
+    rotaryPressed();
+    App_requestRedraw();
+}
+
+void App_joystickPressed(void)
+{
+    joystickPressed();
+    App_requestRedraw();
+}
+
+int App_getSelectedTrack(void)
+{
+    return getSelectedFileInd();
+}
+
+int App_getPage(void)
+{
+    return currPage;
+}
+
+void App_setPage(int page)
+{
+    if (page >= 0 && page < NUM_PAGES)
+    {
+        currPage = page;
+    }
+    App_requestRedraw();
 }
 
 void App_nextPage()
@@ -266,6 +755,7 @@ void App_nextPage()
     {
         currPage++;
     }
+    App_requestRedraw();
 }
 void App_prevPage(void)
 {
@@ -273,6 +763,7 @@ void App_prevPage(void)
     {
         currPage--;
     }
+    App_requestRedraw();
 }
 
 static void displayMainPage(void)
@@ -291,12 +782,12 @@ static void displayMainPage(void)
         mainSelected
     };
 
-    musicMetadata_t* metadata = AudioPlayback_getCurrentMetadata();
-    if (metadata != NULL)
+    musicMetadata_t metadata;
+    if (AudioPlayback_getCurrentMetadata(&metadata))
     {
-        req.songName = metadata->title;
-        req.author = metadata->artist;
-        req.totalPlaytime = metadata->lengthSeconds;
+        req.songName = (char*)StringArena_get(metadata.title);
+        req.author = (char*)StringArena_get(metadata.artist);
+        req.totalPlaytime = metadata.lengthSeconds;
         req.isPlaying = currPlaybackState == eMUSIC_PLAYING;
         req.elemSelected = mainSelected;
     }
@@ -310,66 +801,231 @@ static void displayMainPage(void)
 static void displaySongListPage()
 {
 
-    int numSongsToDisp = songMetaInd<(dispWindowEnd-dispWindowStart) ? songMetaInd : dispWindowEnd - dispWindowStart;
+    // Only the visible rows are read from the library
+    pthread_mutex_lock(&songListMutex);
+    char *title = viewTitle;
+    if (filterLen > 0)
+    {
+        // Songs added or removed since the filter last ran
+        if (SearchIndex_getVersion() != filterIndexVersion) refreshFilter();
 
-    for (int i=0; i<numSongsToDisp; i++)
+        int end = dispWindowEnd < numFilterMatches ? dispWindowEnd : numFilterMatches;
+        if (end > dispWindowStart)
+        {
+            Library_getTitles(&filterMatches[dispWindowStart], end - dispWindowStart, dispStrs,
+                MAX_SONG_NAME_LEN, dispLengths);
+        }
+        formatFilterTitle();
+        title = filterTitle;
+    }
+    else
     {
-        int j = dispWindowStart+i;
-        snprintf(dispStrs[i], MAX_SONG_NAME_LEN, "%s", loadedSongsMetadata[j]->title);
-        dispLengths[i] = loadedSongsMetadata[j]->lengthSeconds;
-        // printf("%s\n", loadedSongsMetadata[i]->title);
+        Library_getWindow(currView, dispWindowStart, dispWindowEnd - dispWindowStart, dispStrs, MAX_SONG_NAME_LEN,
+            dispLengths);
+        formatViewTitle();
     }
+    // Songs added or removed move other songs into or out of the rows around the cursor
+    if (SearchIndex_getVersion() != nearCursorVersion) sendNearCursor();
 
     File_List_Display_Request_t req = 
     {
-        "Songs",
+        title,
         dispStrs,
         dispLengths,
-        songMetaInd,
+        getNumSongs(),
         dispWindowSelected,
     };
+    pthread_mutex_unlock(&songListMutex);
 
     Display_updateSongSelectScreen(req);
 }
 
-static void displayQueuePage()
+// Queue page rows as last formatted, and the queue version they were formatted from
+static uint64_t queueShownVersion = 0;
+static bool queueFormatted = false;
+static char queueTitle[24];
+static int queueNumRows = 0;
+static int queuePlayingRow = 0;
+
+// Copies the rows around the current song out of a queue snapshot
+static void formatQueuePage(const sQueueSnapshot_t *pSnapshot)
 {
-    // Should play queue
-    int numSongsToDisp = songMetaInd<(queueWindowEnd-queueWindowStart) ? songMetaInd : queueWindowEnd - queueWindowStart;
+    // Keep the current song in the middle once there is history above it
+    int first = pSnapshot->numBefore - MAX_SONGS_DISP / 2;
+    if (first < 0) first = 0;
 
-    int playing = AudioPlayback_fillQueueInfo(queueStrs, queueLengths, MAX_SONG_NAME_LEN, numSongsToDisp);
+    queueNumRows = 0;
+    for (int i = first; i < pSnapshot->numEntries && queueNumRows < MAX_SONGS_DISP; i++)
+    {
+        snprintf(queueStrs[queueNumRows], MAX_SONG_NAME_LEN, "%s", StringArena_get(pSnapshot->entries[i].title));
+        queueLengths[queueNumRows] = pSnapshot->entries[i].lengthSeconds;
+        queueNumRows++;
+    }
+    for (int i = queueNumRows; i < MAX_SONGS_DISP; i++)
+    {
+        queueStrs[i][0] = '\0';
+    }
+    queuePlayingRow = pSnapshot->numBefore - first;
+
+    static const char *repeatLabels[eNUM_REPEAT_MODES] = { "", " RPT", " RPT1" };
+    snprintf(queueTitle, sizeof(queueTitle), "QUEUE%s%s", pSnapshot->shuffle ? " SHUF" : "",
+        repeatLabels[pSnapshot->repeatMode]);
+}
+
+static void displayQueuePage()
+{
+    // Nothing is formatted again until the queue changes
+    if (!queueFormatted || AudioPlayback_getQueueVersion() != queueShownVersion)
+    {
+        const sQueueSnapshot_t *pSnapshot = AudioPlayback_acquireQueueSnapshot();
+        formatQueuePage(pSnapshot);
+        queueShownVersion = pSnapshot->version;
+        queueFormatted = true;
+        AudioPlayback_releaseQueueSnapshot(pSnapshot);
+    }
 
-    // printf("playing: %d\n", playing);
     File_List_Display_Request_t req = 
     {
-        "QUEUE",
+        queueTitle,
         queueStrs,
         queueLengths,
-        songMetaInd,
-        playing,
+        queueNumRows,
+        queuePlayingRow,
     };
 
     Display_updateQueueScreen(req);
 }
 
+void App_requestRedraw(void)
+{
+    pthread_mutex_lock(&displayMutex);
+    redrawRequested = true;
+    pthread_cond_signal(&displayCond);
+    pthread_mutex_unlock(&displayMutex);
+}
+
+void App_setFrameRate(int maxFramesPerSecond, int progressTicks)
+{
+    assert(maxFramesPerSecond > 0 && progressTicks > 0);
+
+    pthread_mutex_lock(&displayMutex);
+    maxFps = maxFramesPerSecond;
+    progressTicksPerSecond = progressTicks;
+    pthread_cond_signal(&displayCond);
+    pthread_mutex_unlock(&displayMutex);
+}
+
+// Sleeps until deadlineMs unless a redraw is requested first. Caller holds displayMutex
+static void waitForRedraw(long long deadlineMs)
+{
+    struct timespec deadline = { deadlineMs / 1000, (deadlineMs % 1000) * 1000000L };
+    while (runDisplayThread && !redrawRequested && getTimeInMs() < deadlineMs)
+    {
+        pthread_cond_timedwait(&displayCond, &displayMutex, &deadline);
+    }
+}
+
+static double getThreadCpuMs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &spec);
+    return spec.tv_sec * 1000.0 + spec.tv_nsec / 1000000.0;
+}
+
+static void renderPage(int page)
+{
+    if (page == MAIN)
+    {
+        displayMainPage();
+    }
+    else if (page == FILES)
+    {
+        displaySongListPage();
+    }
+    else
+    {
+        displayQueuePage();
+    }
+}
+
 static void* displayThreadFunc()
 {
+    long long now = getTimeInMs();
+    long long lastFrameMs = 0;
+    long long nextTickMs = now;
+    long long nextPollMs = now;
+    uint64_t shownQueueVersion = 0;
+    uint64_t shownIndexVersion = 0;
+
+    // Reported every DISPLAY_STATS_MS
+    long long statsStartMs = now;
+    double statsStartCpuMs = getThreadCpuMs();
+    uint64_t statsStartBytes = Display_getBytesPushed();
+    uint64_t statsStartRenderNs = Display_getRenderNs();
+    int numFrames = 0;
+
+    pthread_mutex_lock(&displayMutex);
     while (runDisplayThread)
     {
-        if (currPage == MAIN)
+        int page = currPage;
+        bool isTicking = page == MAIN && currPlaybackState == eMUSIC_PLAYING;
+        long long deadlineMs = isTicking && nextTickMs < nextPollMs ? nextTickMs : nextPollMs;
+        waitForRedraw(deadlineMs);
+        if (!runDisplayThread) break;
+
+        now = getTimeInMs();
+        bool isDue = redrawRequested;
+        if (isTicking && now >= nextTickMs)
         {
-            displayMainPage();
+            isDue = true;
+            nextTickMs = now + 1000 / progressTicksPerSecond;
         }
-        else if (currPage == FILES)
+        if (now >= nextPollMs)
         {
-            displaySongListPage();
+            // The next song, queue edits and songs found by the scan don't come through input
+            uint64_t queueVersion = AudioPlayback_getQueueVersion();
+            uint64_t indexVersion = SearchIndex_getVersion();
+            isDue = isDue || queueVersion != shownQueueVersion || (page == FILES && indexVersion != shownIndexVersion);
+            shownQueueVersion = queueVersion;
+            shownIndexVersion = indexVersion;
+            nextPollMs = now + DISPLAY_POLL_MS;
         }
-        else 
+
+        if (isDue)
         {
-            displayQueuePage();
+            // Changes that come in faster than the frame rate are drawn together
+            long long frameMs = 1000 / maxFps;
+            pthread_mutex_unlock(&displayMutex);
+            if (now - lastFrameMs < frameMs) sleepForMs(frameMs - (now - lastFrameMs));
+            pthread_mutex_lock(&displayMutex);
+            redrawRequested = false;
+            pthread_mutex_unlock(&displayMutex);
+
+            renderPage(currPage);
+            numFrames++;
+            lastFrameMs = getTimeInMs();
+
+            pthread_mutex_lock(&displayMutex);
         }
-    }
 
+        now = getTimeInMs();
+        if (now - statsStartMs >= DISPLAY_STATS_MS)
+        {
+            double seconds = (now - statsStartMs) / 1000.0;
+            double cpuMs = getThreadCpuMs();
+            uint64_t bytes = Display_getBytesPushed();
+            uint64_t renderNs = Display_getRenderNs();
+            double renderMs = numFrames > 0 ? (renderNs - statsStartRenderNs) / (numFrames * 1e6) : 0;
+            printf("Display: %.1f frames/s, %.2f ms to draw a frame, %.1f%% of a core, %.0f bytes/s to the panel\n",
+                numFrames / seconds, renderMs, (cpuMs - statsStartCpuMs) / (seconds * 10.0), (bytes - statsStartBytes) / seconds);
+            statsStartMs = now;
+            statsStartCpuMs = cpuMs;
+            statsStartBytes = bytes;
+            statsStartRenderNs = renderNs;
+            numFrames = 0;
+        }
+    }
+    pthread_mutex_unlock(&displayMutex);
 
     return NULL;
 }
@@ -4,17 +4,32 @@
 #include <limits.h>
 #include <alloca.h> // needed for mixer
 #include <mpg123.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "audio_mixer.h"
+#include "audio_playback.h"
+#include "play_queue.h"
+#include "music_stream.h"
+#include "parallel_decode.h"
+#include "file_reader.h"
+#include "codec.h"
+#include "codec_mp3.h"
+#include "codec_wav.h"
+#include "string_arena.h"
 
 #include "visualizer.h"
+#include "boot.h"
 #include "audio_datatypes.h"
 
 
 #define DEFAULT_VOLUME 80
 
-#define SAMPLE_RATE 44100
-#define NUM_CHANNELS 2
+#define SAMPLE_RATE CODEC_SAMPLE_RATE
+#define NUM_CHANNELS CODEC_NUM_CHANNELS
 #define SAMPLE_SIZE (sizeof(short)) 			// bytes per sample
 #define INITIAL_BUFFER_SIZE 640000
 
@@ -30,16 +45,11 @@ typedef struct {
 	// (overlapping cymbal crashes, for example)
 	soundData_t *pSound;
 
-	// The offset into the pData of pSound. Indicates how much of the
+	// The frame offset into the pData of pSound. Indicates how much of the
 	// sound has already been played (and hence where to start playing next).
 	int location;
 } playbackSound_t;
 
-typedef struct {
-	musicData_t *pMusic;
-	int location;
-} playbackMusic_t;
-
 typedef struct
 {
     short* buffer; 
@@ -52,13 +62,19 @@ static bool isPaused = false;
 snd_pcm_t *pcmHandle;
 snd_pcm_hw_params_t *params;
 playbackBuffer_t playbackBuffer;
+// Decoded samples pulled from a compressed song's stream each period
+static short *streamBuffer;
 
 // Holds sound bites to be played. Can play multiple at once
 static playbackSound_t soundBites[MAX_SOUND_BITES];
-// Holds the songs to be played. 
-static int musicBitesHead = 0;
-static int musicBitesTail = 0;
-static playbackMusic_t musicBites[MAX_SOUND_BITES];
+// The song the mixer is playing from the play queue, and its entry there.
+// Compared with the queue's current song every period to notice a skip or a clear.
+static musicData_t *pCurrentMusic = NULL;
+static playQueueId_t currentId = PLAY_QUEUE_NO_ID;
+// The queue's current song when the mixer last looked, decoded or not
+static sLoadedFile *pCurrentFile = NULL;
+// Sample offset into the current song
+static size_t currentLocation = 0;
 
 // Playback threading
 void* playbackThread();
@@ -66,6 +82,78 @@ static _Bool stopping = false;
 static pthread_t playbackThreadId;
 static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Asked to decode a queued song once it is current or next and still has no samples
+static void (*decodeCallback)(sLoadedFile *pFile, bool isCurrent) = NULL;
+// The last song asked for and the entry playing then, so each is only asked for once.
+// Playback thread only
+static sLoadedFile *pRequestedFile = NULL;
+static playQueueId_t requestedId = PLAY_QUEUE_NO_ID;
+static bool requestedCurrent = false;
+
+
+// Stops a compressed song's decoder once the mixer has moved off it.
+// Must hold audioMutex.
+static void releaseMusic(void)
+{
+	if (pCurrentMusic == NULL) return;
+
+	pCurrentMusic->playingInMixer = false;
+	if (pCurrentMusic->storage == eMUSIC_STORAGE_COMPRESSED)
+	{
+		MusicStream_release(pCurrentMusic->pStream);
+	}
+	pCurrentMusic = NULL;
+	currentLocation = 0;
+}
+
+// Starts decoding the song that plays next (which shuffle or repeat may have chosen)
+// so the transition does not underrun.
+static void prefetchNextMusic(void)
+{
+	sLoadedFile *pNext = PlayQueue_getAfter(currentId);
+	if (pNext != NULL && pNext->musicData != pCurrentMusic && pNext->musicData->storage == eMUSIC_STORAGE_COMPRESSED)
+	{
+		MusicStream_prefetch(pNext->musicData->pStream, 0);
+	}
+}
+
+// The current or next song if it is still waiting to be decoded. Must hold audioMutex.
+static sLoadedFile* findUndecodedMusic(bool *pIsCurrent)
+{
+	sLoadedFile *pFile = pCurrentFile;
+	*pIsCurrent = true;
+	if (pFile != NULL && pFile->musicData->numSamples > 0)
+	{
+		pFile = PlayQueue_getAfter(currentId);
+		*pIsCurrent = false;
+	}
+	return pFile != NULL && pFile->musicData->numSamples == 0 ? pFile : NULL;
+}
+
+// Moves the mixer onto the play queue's current song if that is not the one it was
+// playing. Returns the song to play, or NULL. Must hold audioMutex.
+static musicData_t* syncWithQueue(void)
+{
+	playQueueId_t id;
+	size_t startFrame;
+	sLoadedFile *pFile = PlayQueue_getCurrent(&id, &startFrame);
+	pCurrentFile = pFile;
+	musicData_t *pMusic = pFile != NULL ? pFile->musicData : NULL;
+
+	if (pMusic != pCurrentMusic || id != currentId)
+	{
+		releaseMusic();
+		currentId = id;
+		if (pMusic != NULL && pMusic->numSamples > 0)
+		{
+			size_t startSample = startFrame * NUM_CHANNELS;
+			pCurrentMusic = pMusic;
+			pCurrentMusic->playingInMixer = true;
+			currentLocation = startSample < pMusic->numSamples ? startSample : 0;
+		}
+	}
+	return pCurrentMusic;
+}
 
 void AudioMixer_init(void)
 {
@@ -74,6 +162,7 @@ void AudioMixer_init(void)
 	isPaused = false;
 
     mpg123_init();
+	MusicStream_init();
 
 	pthread_mutex_lock(&audioMutex);
 
@@ -81,9 +170,6 @@ void AudioMixer_init(void)
 	{
 		soundBites[i].pSound = NULL;
 		soundBites[i].location = 0;
-
-		musicBites[i].pMusic = NULL;
-		musicBites[i].location = 0;
 	}
 
 	pthread_mutex_unlock(&audioMutex);
@@ -111,220 +197,297 @@ void AudioMixer_init(void)
 	snd_pcm_get_params(pcmHandle, &unusedBufferSize, &playbackBuffer.soundsBufferSize);
 	// ..allocate playback buffer:
 	playbackBuffer.buffer = malloc(playbackBuffer.soundsBufferSize * sizeof(short));
+	streamBuffer = malloc(playbackBuffer.soundsBufferSize * sizeof(short));
 
 	// Launch playback thread:
 	pthread_create(&playbackThreadId, NULL, playbackThread, NULL);
 }
 
 
+// Converts to 16-bit at the mixer's rate with linear interpolation. Only done once, at load.
+static short* convertWaveData(const unsigned char *pSrc, const sWavInfo_t *pInfo, size_t *pNumFrames)
+{
+	int numChannels = pInfo->numChannels;
+	size_t srcFrames = pInfo->dataSize / numChannels / (pInfo->bitsPerSample / 8);
+
+	short *src = malloc(srcFrames * numChannels * SAMPLE_SIZE + 1);
+	if (src == NULL) {
+		perror("ERROR: Unable to allocate wave data");
+		exit(EXIT_FAILURE);
+	}
+	CodecWav_convertSamples(pSrc, pInfo->bitsPerSample, src, srcFrames * numChannels);
+
+	if (pInfo->sampleRate == SAMPLE_RATE || srcFrames == 0)
+	{
+		*pNumFrames = srcFrames;
+		return src;
+	}
+
+	size_t numFrames = Codec_getResampledLength(srcFrames, pInfo->sampleRate);
+	short *dest = malloc(numFrames * numChannels * SAMPLE_SIZE + 1);
+	if (dest == NULL) {
+		perror("ERROR: Unable to allocate wave data");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t outFrame = 0;
+	Codec_resample(src, srcFrames, 0, numChannels, pInfo->sampleRate, true, &outFrame, dest, numFrames);
+	free(src);
+
+	*pNumFrames = numFrames;
+	return dest;
+}
+
 // Client code must call AudioMixer_freeWaveFileData to free dynamically allocated data.
 void AudioMixer_readWaveFileIntoMemory(char *fileName, soundData_t *pSound)
 {
 	assert(initialized);
 	assert(pSound);
 
-	// The PCM data in a wave file starts after the header:
-	const int PCM_DATA_OFFSET = 44;
-
-	// Open the wave file
-	FILE *file = fopen(fileName, "r");
-	if (file == NULL) {
+	int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
 		fprintf(stderr, "ERROR: Unable to open file %s.\n", fileName);
 		exit(EXIT_FAILURE);
 	}
 
-	// Get file size
-	fseek(file, 0, SEEK_END);
-	int sizeInBytes = ftell(file) - PCM_DATA_OFFSET;
+	// Populated up front so the mixer thread never takes a page fault on a sound
+	size_t fileSize = st.st_size;
+	unsigned char *pFile = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	sWavInfo_t info;
+	if (pFile == MAP_FAILED || !CodecWav_parse(pFile, fileSize, &info) || info.numChannels > NUM_CHANNELS) {
+		fprintf(stderr, "ERROR: Unsupported wave file %s.\n", fileName);
+		exit(EXIT_FAILURE);
+	}
 
-	soundData_t pMonoSound;
-	pMonoSound.numSamples = sizeInBytes / SAMPLE_SIZE;
+	pSound->numChannels = info.numChannels;
+	if (info.bitsPerSample == 16 && info.sampleRate == SAMPLE_RATE && info.dataOffset % SAMPLE_SIZE == 0)
+	{
+		// Already in the mixer's format: play straight out of the mapping
+		pSound->pData = (const short*)(pFile + info.dataOffset);
+		pSound->numSamples = info.dataSize / SAMPLE_SIZE;
+		pSound->pMapping = pFile;
+		pSound->mappingSize = fileSize;
+		return;
+	}
 
-	// Search to the start of the data in the file
-	fseek(file, PCM_DATA_OFFSET, SEEK_SET);
+	size_t numFrames;
+	pSound->pData = convertWaveData(pFile + info.dataOffset, &info, &numFrames);
+	pSound->numSamples = numFrames * info.numChannels;
+	pSound->pMapping = NULL;
+	pSound->mappingSize = 0;
+	munmap(pFile, fileSize);
+}
 
-	// Allocate space to hold all PCM data
-	pMonoSound.pData = malloc(sizeInBytes);
-	if (pMonoSound.pData == 0) {
-		fprintf(stderr, "ERROR: Unable to allocate %d bytes for file %s.\n",
-				sizeInBytes, fileName);
-		exit(EXIT_FAILURE);
+// Hands a decoded song over in one step. A song may already be in the play queue while
+// it decodes, and the mixer starts it as soon as it sees samples.
+static void publishMusic(musicData_t *pMusic, musicData_t decoded)
+{
+	pthread_mutex_lock(&audioMutex);
+	*pMusic = decoded;
+	pthread_mutex_unlock(&audioMutex);
+}
+
+// Extra room so the last few frames decode straight into the buffer
+#define DECODE_MARGIN_SAMPLES 4096
+
+// Decodes the whole song through its codec into a buffer sized from the codec's length.
+// The caller frees pBytes.
+static void decodeIntoMemory(char *filename, const unsigned char *pBytes, size_t numBytes, musicData_t *pMusic, musicMetadata_t *pMetadata)
+{
+	sCodecDecoder_t *pDecoder = Codec_open(pBytes, numBytes);
+	if (pDecoder == NULL)
+	{
+		fprintf(stderr, "ERROR: Unable to decode %s\n", filename);
+		return;
 	}
 
-	// Read PCM data from wave file into memory
-	int samplesRead = fread(pMonoSound.pData, SAMPLE_SIZE, pMonoSound.numSamples, file);
-	if (samplesRead != pMonoSound.numSamples) {
-		fprintf(stderr, "ERROR: Unable to read %d samples from file %s (read %d).\n",
-				pMonoSound.numSamples, fileName, samplesRead);
+	sCodecFormat_t format;
+	Codec_getFormat(pDecoder, &format);
+
+	size_t capacity = (format.numSamples > 0 ? format.numSamples : INITIAL_BUFFER_SIZE / SAMPLE_SIZE) + DECODE_MARGIN_SAMPLES;
+	short *pcm = malloc(capacity * SAMPLE_SIZE);
+	if (!pcm)
+	{
+		perror("ERROR: Unable to allocate bytes for file");
 		exit(EXIT_FAILURE);
 	}
+	size_t numSamples = 0;
+	size_t bytesCopied = 0;
 
-	pSound->pData = malloc(sizeInBytes*2);
-	pSound->numSamples = pMonoSound.numSamples;
-
-	for (int i=0; i<pMonoSound.numSamples; i++)
+	// Each read decodes straight into its place in pcm
+	bool finished = false;
+	while (!finished)
 	{
-		pSound->pData[2*i] = pMonoSound.pData[i];
-		pSound->pData[2*i+1] = pMonoSound.pData[i];
+		if (numSamples == capacity)
+		{
+			// Only if the codec's length was wrong
+			size_t newCapacity = capacity * 2;
+			short *temp = realloc(pcm, newCapacity * SAMPLE_SIZE);
+			if (!temp) {
+				perror("Failed to realloc memory");
+				exit(EXIT_FAILURE);
+			}
+			bytesCopied += numSamples * SAMPLE_SIZE;
+			pcm = temp;
+			capacity = newCapacity;
+		}
+
+		numSamples += Codec_read(pDecoder, pcm + numSamples, capacity - numSamples, &finished);
 	}
 
-	free(pMonoSound.pData);
-}
+	// Give the margin back; shrinking does not move the data
+	short *shrunk = realloc(pcm, numSamples > 0 ? numSamples * SAMPLE_SIZE : 1);
+	if (shrunk) pcm = shrunk;
 
-void AudioMixer_readMp3FileIntoMemory(char *filename, musicData_t *pMusic, musicMetadata_t *pMetadata)
-{
-    assert(initialized);
-    assert(pMusic);
+	if (pMetadata != NULL)
+	{
+		Codec_readMetadata(pBytes, numBytes, pMetadata);
+		pMetadata->lengthSeconds = (double)numSamples / format.numChannels / format.sampleRate;
+	}
 
-    printf("Starting to read file into memory\n");
+	publishMusic(pMusic, (musicData_t){ .numSamples = numSamples, .pData = pcm, .storage = eMUSIC_STORAGE_PCM });
 
-    mpg123_handle *mp3Handle = mpg123_new(NULL, NULL);
+	const char *codecName = Codec_getCodec(pDecoder)->name;
+	Codec_close(pDecoder);
 
-    // open MP3 file
-    if (mpg123_open(mp3Handle, filename) != MPG123_OK)
-    {
-        perror("Failed to open MP3 file");
-        return;
-    }
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("done reading %s (%s): %zu bytes PCM, %zu bytes copied, peak RSS %ld KB\n",
+		filename, codecName, numSamples * SAMPLE_SIZE, bytesCopied, usage.ru_maxrss);
+}
 
+void AudioMixer_readMusicFileIntoMemory(char *filename, musicData_t *pMusic, musicMetadata_t *pMetadata)
+{
+	assert(initialized);
+	assert(pMusic);
 
+	printf("Starting to read file into memory\n");
 
-    printf("creating buffer\n");
+	// The file may already have been read by the reader threads while the last song decoded
+	size_t numBytes;
+	unsigned char *pBytes = FileReader_take(filename, &numBytes);
+	if (pBytes == NULL) return;
 
-    size_t soundsBufferSize = mpg123_outblock(mp3Handle);
-    unsigned char* buffer = (unsigned char*)malloc(soundsBufferSize);
-    if (!buffer)
-    {
-        mpg123_close(mp3Handle);
-        mpg123_delete(mp3Handle);
-		perror("ERROR: Unable to allocate bytes for file");
-		exit(EXIT_FAILURE);
-    }
+	decodeIntoMemory(filename, pBytes, numBytes, pMusic, pMetadata);
+	// Compressed bytes are no longer needed
+	free(pBytes);
+}
 
-	// get length of song
-	double lengthSeconds;
+void AudioMixer_readMusicMetadata(char *filename, musicMetadata_t *pMetadata)
+{
+	assert(initialized);
 
-    long sampleRate;
-    int channels, encoding;
-	off_t totalFrames;
-    mpg123_getformat(mp3Handle, (long*)&sampleRate, &channels, &encoding);
-	totalFrames = mpg123_length(mp3Handle);
-	lengthSeconds = (double)totalFrames / sampleRate;
+	Codec_readFileMetadata(filename, pMetadata);
+}
 
-    size_t pcm_capacity = INITIAL_BUFFER_SIZE;
-    unsigned char *pcm_data = malloc(pcm_capacity);
-    size_t pcm_size = 0;
+double AudioMixer_getMusicLength(musicData_t *pMusic)
+{
+	return (double)pMusic->numSamples / NUM_CHANNELS / SAMPLE_RATE;
+}
 
-    size_t bytesRead = 0;
+// Decodes the whole song into PCM using every core. Meant for a song the user is waiting on.
+void AudioMixer_readMusicFileParallel(char *filename, musicData_t *pMusic, musicMetadata_t *pMetadata)
+{
+	assert(initialized);
+	assert(pMusic);
 
+	size_t numBytes;
+	unsigned char *pBytes = FileReader_take(filename, &numBytes);
+	if (pBytes == NULL) return;
 
-    while (mpg123_read(mp3Handle, buffer, soundsBufferSize, &bytesRead) == MPG123_OK) 
-    {        
-        if (pcm_size + bytesRead > pcm_capacity)
-        {
-            size_t new_capacity = pcm_capacity * 2;
-            if (new_capacity < pcm_size + bytesRead)
-            {
-                new_capacity = pcm_size + bytesRead;
-            }
+	// Only MP3 is split across cores; the other formats decode quickly enough on one
+	if (Codec_probe(pBytes, numBytes) != &CODEC_MP3)
+	{
+		decodeIntoMemory(filename, pBytes, numBytes, pMusic, pMetadata);
+		free(pBytes);
+		return;
+	}
 
-            unsigned char *temp = realloc(pcm_data, new_capacity);
-            if (!temp) {
-                perror("Failed to realloc memory");
-                free(pcm_data);
-                free(buffer);
-                mpg123_close(mp3Handle);
-                mpg123_delete(mp3Handle);
-                exit(EXIT_FAILURE);
-            }
-            pcm_data = temp;  // Only assign if realloc succeeds
-            pcm_capacity = new_capacity;
-        }
-
-        memcpy(pcm_data+pcm_size, buffer, bytesRead);
-        pcm_size += bytesRead;
-    }
-
-	free(buffer);
-
-	// Extract metadata
-	char* title;
-	char* artist;
-	char* album;
-	mpg123_id3v1* id3v1;
-	mpg123_id3v2* id3v2;
-	if (mpg123_id3(mp3Handle, &id3v1, &id3v2) == MPG123_OK)
+	sMusicStream_t *pStream = MusicStream_create(pBytes, numBytes);
+
+	size_t numSamples = 0;
+	short *pcm = ParallelDecode_decodeMp3(pStream, 0, &numSamples);
+	if (pcm == NULL)
 	{
-		if (id3v2)
-		{
-			title = id3v2->title && id3v2->title->p ? strdup(id3v2->title->p) : strdup("Unknown");
-			artist = id3v2->artist && id3v2->artist->p ? strdup(id3v2->artist->p) : strdup("Unknown");
-			album = id3v2->album && id3v2->album->p ? strdup(id3v2->album->p) : strdup("Unknown");
-		}
-		else if (id3v1)
-		{
-			title = strdup(id3v1->title);
-			artist = strdup(id3v1->artist);
-			album = strdup(id3v1->album);
-		}
-		else
-		{
-			title = strdup("Unknown");
-			artist = strdup("Unknown");
-			album = strdup("Unknown");
-		}
+		// Songs that must be resampled are decoded on one core
+		decodeIntoMemory(filename, pBytes, numBytes, pMusic, pMetadata);
+		MusicStream_destroy(pStream);
+		return;
 	}
-	else
+
+	if (pMetadata != NULL)
 	{
-		title = strdup("Unknown");
-		artist = strdup("Unknown");
-		album = strdup("Unknown");
+		Codec_readMetadata(pBytes, numBytes, pMetadata);
+		pMetadata->lengthSeconds = (double)numSamples / NUM_CHANNELS / SAMPLE_RATE;
 	}
 
-    pMusic->pData = pcm_data;
-    pMusic->numSamples = pcm_size / sizeof(short);
-	pMusic->playingInMixer = false;
+	publishMusic(pMusic, (musicData_t){ .numSamples = numSamples, .pData = pcm, .storage = eMUSIC_STORAGE_PCM });
 
-	pMetadata->title = title;
-	pMetadata->artist = artist;
-	pMetadata->album = album;
-	pMetadata->lengthSeconds = lengthSeconds;
+	// Compressed bytes are no longer needed
+	MusicStream_destroy(pStream);
+}
+
+// Keeps only the compressed bytes in memory; they are decoded just ahead of playback.
+void AudioMixer_readMusicFileCompressed(char *filename, musicData_t *pMusic, musicMetadata_t *pMetadata)
+{
+	assert(initialized);
+	assert(pMusic);
 
+	size_t numBytes;
+	unsigned char *pBytes = FileReader_take(filename, &numBytes);
+	if (pBytes == NULL) return;
 
-    mpg123_close(mp3Handle);
-    mpg123_delete(mp3Handle);
-    printf("done reading\n");
+	// Opening gives the exact length without decoding: MP3 scans its frame headers,
+	// FLAC and WAV store it in their headers
+	sCodecDecoder_t *pDecoder = Codec_open(pBytes, numBytes);
+	if (pDecoder == NULL)
+	{
+		free(pBytes);
+		return;
+	}
+	sCodecFormat_t format;
+	Codec_getFormat(pDecoder, &format);
+	Codec_close(pDecoder);
+
+	if (pMetadata != NULL)
+	{
+		Codec_readMetadata(pBytes, numBytes, pMetadata);
+		pMetadata->lengthSeconds = (double)format.numSamples / format.numChannels / format.sampleRate;
+	}
 
+	sMusicStream_t *pStream = MusicStream_create(pBytes, numBytes);
+	publishMusic(pMusic, (musicData_t){ .numSamples = format.numSamples, .storage = eMUSIC_STORAGE_COMPRESSED, .pStream = pStream });
 }
 
 void AudioMixer_freeWaveFileData(soundData_t *pSound)
 {
 	assert(initialized);
 	pSound->numSamples = 0;
-	free(pSound->pData);
+	if (pSound->pMapping != NULL)
+	{
+		munmap(pSound->pMapping, pSound->mappingSize);
+		pSound->pMapping = NULL;
+	}
+	else
+	{
+		free((void*)pSound->pData);
+	}
 	pSound->pData = NULL;
 }
 
-void AudioMixer_freeMp3FileData(musicData_t *pMusic)
+void AudioMixer_freeMusicFileData(musicData_t *pMusic)
 {
 	assert(initialized);
 	pMusic->numSamples = 0;
 	free(pMusic->pData);
 	pMusic->pData = NULL;
+	MusicStream_destroy(pMusic->pStream);
+	pMusic->pStream = NULL;
 	pMusic->playingInMixer = false;
 }
 
-void AudioMixer_freeMp3MetaData(musicMetadata_t *pMetadata)
-{
-	free(pMetadata->title);
-	pMetadata->title = NULL;
-	free(pMetadata->artist);
-	pMetadata->artist = NULL;
-	free(pMetadata->album);
-	pMetadata->album = NULL;
-	pMetadata->lengthSeconds = 0;
-}
-
 void AudioMixer_queueSound(soundData_t *pSound)
 {
 	assert(initialized);
@@ -367,102 +530,29 @@ void AudioMixer_clearSoundQueue(void)
 	}
 
 	pthread_mutex_unlock(&audioMutex);
-
-	
-	musicBitesHead = 0;
-	musicBitesTail = 0;
 }
 
-void AudioMixer_queueMusic(musicData_t *pMusic)
+void AudioMixer_setDecodeCallback(void (*callback)(sLoadedFile *pFile, bool isCurrent))
 {
-	assert(initialized);
-	// Ensure we are only being asked to play "good" sounds:
-	assert(pMusic->numSamples > 0);
-	assert(pMusic->pData);
-
 	pthread_mutex_lock(&audioMutex);
-
-	if (musicBites[musicBitesTail].pMusic != NULL)
-	{
-
-		printf("All music slots full\n");
-		pthread_mutex_unlock(&audioMutex);
-		return;
-	}
-
-	musicBites[musicBitesTail].pMusic = pMusic;
-	musicBites[musicBitesTail].pMusic->playingInMixer = false;
-	musicBites[musicBitesTail].location = 0;
-
-	musicBitesTail = (musicBitesTail + 1) % MAX_SOUND_BITES;
-
+	decodeCallback = callback;
 	pthread_mutex_unlock(&audioMutex);
 }
 
-void AudioMixer_nextMusic()
-{
-	if (musicBites[musicBitesHead].pMusic != NULL)
-	{
-		pthread_mutex_lock(&audioMutex);
-		musicBites[musicBitesHead].location = 0;
-		musicBites[musicBitesHead].pMusic->playingInMixer = false;
-		pthread_mutex_unlock(&audioMutex);
-		musicBitesHead = (musicBitesHead + 1) % MAX_SOUND_BITES;
-	}
-
-
-	printf("%d\n", musicBitesHead);
-}
-void AudioMixer_prevMusic()
-{
-
-	int prevI = (musicBitesHead - 1 + MAX_SOUND_BITES) % MAX_SOUND_BITES;
-
-	if (musicBites[musicBitesHead].pMusic != NULL)
-	{
-		if (musicBites[prevI].pMusic != NULL)
-		{
-			pthread_mutex_lock(&audioMutex);
-			musicBites[musicBitesHead].location = 0;
-			musicBites[musicBitesHead].pMusic->playingInMixer = false;
-			// Negative modulo remains negative
-			pthread_mutex_unlock(&audioMutex);
-			musicBitesHead = prevI;
-		}
-		else
-		{
-			printf("No songs before. No action\n");
-		}
-	}
-	else if (musicBites[prevI].pMusic != NULL)
-	{
-		musicBitesHead = prevI;
-	}
-	
-	printf("%d\n", musicBitesHead);
-}
-
 void AudioMixer_restartMusic()
 {
 	pthread_mutex_lock(&audioMutex);
-	musicBites[musicBitesHead].location = 0;
+	currentLocation = 0;
 	pthread_mutex_unlock(&audioMutex);
 }
 
-void AudioMixer_clearMusicQueue(void)
+void AudioMixer_stopMusic(void)
 {
 	assert(initialized);
 
 	pthread_mutex_lock(&audioMutex);
-
-	for (int i=0; i < MAX_SOUND_BITES; i++)
-	{
-		musicBites[i].pMusic = NULL;
-		musicBites[i].location = 0;
-	}
-
+	releaseMusic();
 	pthread_mutex_unlock(&audioMutex);
-
 }
 
 void AudioMixer_cleanup(void)
@@ -475,6 +565,7 @@ void AudioMixer_cleanup(void)
 	stopping = true;
 	pthread_join(playbackThreadId, NULL);
 
+	MusicStream_cleanup();
     mpg123_exit();
 
 	// Shutdown the PCM output, allowing any pending sound to play out (drain)
@@ -486,6 +577,8 @@ void AudioMixer_cleanup(void)
 	//  in addition to this by calling AudioMixer_freeWaveFileData() on that struct.)
 	free(playbackBuffer.buffer);
 	playbackBuffer.buffer = NULL;
+	free(streamBuffer);
+	streamBuffer = NULL;
 
 	printf("Done stopping audio...\n");
 	fflush(stdout);
@@ -514,22 +607,25 @@ static void fillPlaybackBufferSounds(playbackBuffer_t *buff)
 			continue;
 		}
 		int offset = soundBites[i].location;
-		short *data = soundBites[i].pSound->pData;
-		size_t numSamples = soundBites[i].pSound->numSamples;
+		const short *data = soundBites[i].pSound->pData;
+		int soundChannels = soundBites[i].pSound->numChannels;
+		size_t soundFrames = soundBites[i].pSound->numSamples / soundChannels;
 		for (size_t frame=0; frame<numFrames; frame++)
 		{
-			if ((offset + frame*NUM_CHANNELS) >= numSamples)
+			if ((offset + frame) >= soundFrames)
 			{
 				soundBites[i].pSound = NULL;
 				soundBites[i].location = 0;
 				break;
 			}
 
+			// Mono sounds are upmixed here rather than stored doubled
+			const short *pFrame = data + (offset + frame) * soundChannels;
             for (int ch=0; ch < NUM_CHANNELS; ch++)
             {
                 size_t sampleIndex = frame * NUM_CHANNELS + ch;
 
-                int mixedSample = buff->buffer[sampleIndex] + data[offset + frame*NUM_CHANNELS + ch];
+                int mixedSample = buff->buffer[sampleIndex] + pFrame[soundChannels == 1 ? 0 : ch];
 
                 if (mixedSample > SHRT_MAX) mixedSample = SHRT_MAX;
                 if (mixedSample < SHRT_MIN) mixedSample = SHRT_MIN;
@@ -539,67 +635,102 @@ static void fillPlaybackBufferSounds(playbackBuffer_t *buff)
 
 		}
 
-		soundBites[i].location += numFrames * NUM_CHANNELS;
+		soundBites[i].location += numFrames;
 	}
 	pthread_mutex_unlock(&audioMutex);
 
 }
 
-static void fillPlaybackBufferMusic(playbackBuffer_t *buff)
+// Points *pData at the next samples of the current song.
+// Returns how many samples are available this period; *pEnded is set if the song ends within them.
+static size_t getMusicSamples(musicData_t *pMusic, size_t numSamplesWanted, short **pData, bool *pEnded)
 {
-	if (musicBites[musicBitesHead].pMusic == NULL)
+	size_t offset = currentLocation;
+
+	if (pMusic->storage == eMUSIC_STORAGE_COMPRESSED)
 	{
-		return;
+		*pData = streamBuffer;
+		return MusicStream_read(pMusic->pStream, offset, streamBuffer, numSamplesWanted, pEnded);
 	}
 
+	*pData = (short*)pMusic->pData + offset;
+	size_t remaining = offset < pMusic->numSamples ? pMusic->numSamples - offset : 0;
+	*pEnded = remaining <= numSamplesWanted;
+	return *pEnded ? remaining : numSamplesWanted;
+}
+
+static void fillPlaybackBufferMusic(playbackBuffer_t *buff)
+{
 	pthread_mutex_lock(&audioMutex);
-    size_t numFrames = buff->soundsBufferSize / NUM_CHANNELS;
 
+	// Synced while paused too, so a skip shows up straight away
+	musicData_t *pMusic = syncWithQueue();
 
-	musicBites[musicBitesHead].pMusic->playingInMixer = true;
+	// Asked outside the lock: the loader holds its own lock while it touches playback
+	bool isCurrent = false;
+	sLoadedFile *pUndecoded = decodeCallback != NULL ? findUndecodedMusic(&isCurrent) : NULL;
+	bool isNewRequest = pUndecoded != NULL &&
+		(pUndecoded != pRequestedFile || currentId != requestedId || isCurrent != requestedCurrent);
+	if (isNewRequest)
+	{
+		pRequestedFile = pUndecoded;
+		requestedId = currentId;
+		requestedCurrent = isCurrent;
+	}
 
-	int offset = musicBites[musicBitesHead].location;
-	short *data = musicBites[musicBitesHead].pMusic->pData;
-	size_t numSamples = musicBites[musicBitesHead].pMusic->numSamples;
-	for (size_t frame=0; frame<numFrames; frame++)
+	if (pMusic == NULL || isPaused)
 	{
-		if ((offset + frame*NUM_CHANNELS) >= numSamples)
-		{
-			musicBites[musicBitesHead].pMusic->playingInMixer = false;
-			musicBites[musicBitesHead].pMusic = NULL;
-			musicBites[musicBitesHead].location = 0;
-			musicBitesHead = (musicBitesHead + 1) % MAX_SOUND_BITES;
-			break;
-		}
+		pthread_mutex_unlock(&audioMutex);
+		if (isNewRequest) decodeCallback(pUndecoded, isCurrent);
+		return;
+	}
 
-		for (int ch=0; ch < NUM_CHANNELS; ch++)
-		{
-			size_t sampleIndex = frame * NUM_CHANNELS + ch;
+    size_t numFrames = buff->soundsBufferSize / NUM_CHANNELS;
 
-			int mixedSample = buff->buffer[sampleIndex] + data[offset + sampleIndex];
+	short *data;
+	bool ended = false;
+	size_t numSamples = getMusicSamples(pMusic, numFrames * NUM_CHANNELS, &data, &ended);
 
-			if (mixedSample > SHRT_MAX) mixedSample = SHRT_MAX;
-			if (mixedSample < SHRT_MIN) mixedSample = SHRT_MIN;
+	for (size_t sampleIndex=0; sampleIndex<numSamples; sampleIndex++)
+	{
+		int mixedSample = buff->buffer[sampleIndex] + data[sampleIndex];
 
-			Visualizer_setLEDArray((short)mixedSample);
-			buff->buffer[sampleIndex] = (short)mixedSample;
-		}
+		if (mixedSample > SHRT_MAX) mixedSample = SHRT_MAX;
+		if (mixedSample < SHRT_MIN) mixedSample = SHRT_MIN;
+
+		Visualizer_setLEDArray((short)mixedSample);
+		buff->buffer[sampleIndex] = (short)mixedSample;
+	}
+	if (numSamples > 0) Boot_markFirstAudio();
+
+	if (ended)
+	{
+		// Does nothing if the user already skipped past it
+		PlayQueue_advance(currentId);
+		releaseMusic();
+	}
+	else
+	{
+		currentLocation += numSamples;
+		prefetchNextMusic();
 	}
-	musicBites[musicBitesHead].location += numFrames * NUM_CHANNELS;
 	pthread_mutex_unlock(&audioMutex);
+
+	if (isNewRequest) decodeCallback(pUndecoded, isCurrent);
 }
 
-double AudioMixer_getPlaytime(void) 
+size_t AudioMixer_getPosition(void)
 {
-	double playedFrames = 0;
 	pthread_mutex_lock(&audioMutex);
-	if (musicBites[musicBitesHead].pMusic != NULL)
-	{
-		playedFrames = (double)musicBites[musicBitesHead].location / NUM_CHANNELS;
-	}
+	size_t playedFrames = currentLocation / NUM_CHANNELS;
 	pthread_mutex_unlock(&audioMutex);
 
-	return playedFrames / SAMPLE_RATE;
+	return playedFrames;
+}
+
+double AudioMixer_getPlaytime(void) 
+{
+	return (double)AudioMixer_getPosition() / SAMPLE_RATE;
 }
 
 // Fill the buff array with new PCM values to output.
@@ -615,12 +746,7 @@ static void fillPlaybackBuffer(playbackBuffer_t *buff)
 
 	fillPlaybackBufferSounds(buff);
 
-	if (!isPaused)
-	{
-		fillPlaybackBufferMusic(buff);
-	}
-
-	pthread_mutex_unlock(&audioMutex);
+	fillPlaybackBufferMusic(buff);
 }
 
 
@@ -9,28 +9,22 @@
 #include "audio_datatypes.h"
 #include "audio_playback.h"
 #include "audio_mixer.h"
+#include "play_queue.h"
+#include "string_arena.h"
 
 #define DEFAULT_NUM_CHANNELS 2 // stereo
 #define DEFAULT_BITRATE 44100 // 44.1 kHz
-#define MAX_SONGS_QUEUED 30
+#define DEFAULT_STORAGE_MODE eMUSIC_STORAGE_PCM
 
 static bool initialized = false;
-static sLoadedFile *pMusicQ[MAX_SONGS_QUEUED]; // circular array
-static int pMusicHead = 0;
-static int pMusicTail = 0;
-
-// prototypes
-static void AudioPlayback_updatePMusicIndex();
+static eMusicStorage_t storageMode = DEFAULT_STORAGE_MODE;
 
 // Initializes Audio Playback module
 void AudioPlayback_init(void)
 {
     assert(!initialized);
 
-    for (int i=0; i<MAX_SONGS_QUEUED; i++)
-    {
-        pMusicQ[i] = NULL;
-    }
+    PlayQueue_clear();
 
     initialized = true;
 }
@@ -41,69 +35,111 @@ void AudioPlayback_cleanup(void)
     assert(initialized);
 
     AudioPlayback_clearQueue();
+    PlayQueue_cleanup();
 
     initialized = false;
 }
 
-void AudioPlayback_queueSong(sLoadedFile *pLoadedFile)
+playQueueId_t AudioPlayback_queueSong(sLoadedFile *pLoadedFile)
 {
-    pMusicQ[pMusicTail] = pLoadedFile;
-    AudioMixer_queueMusic(pMusicQ[pMusicTail]->musicData);
-    pMusicTail = (pMusicTail + 1) % MAX_SONGS_QUEUED;
+    return AudioPlayback_queueSongAt(pLoadedFile, 0);
 }
 
-int AudioPlayback_fillQueueInfo(char** strs, double* songlens, int bufLen, int numSongsToDisp)
+playQueueId_t AudioPlayback_queueSongAt(sLoadedFile *pLoadedFile, size_t startFrame)
 {
-    AudioPlayback_updatePMusicIndex();
+    // Ensure we are only being asked to play "good" songs:
+    assert(pLoadedFile->musicData->numSamples > 0);
+    assert(pLoadedFile->musicData->pData || pLoadedFile->musicData->pStream);
 
-    int selectedInd = 0;
-    int i = pMusicHead;
+    return PlayQueue_append(pLoadedFile, startFrame);
+}
 
-    for (int j=1;j<8;j++)
-    {
-        int prev = (i-1+MAX_SONGS_QUEUED) % MAX_SONGS_QUEUED;
-        if (pMusicQ[prev] != NULL && pMusicQ[prev]->musicData != NULL) i=prev;
-        else break;
-        selectedInd++;
-    }
+playQueueId_t AudioPlayback_queueSongNext(sLoadedFile *pLoadedFile)
+{
+    assert(pLoadedFile->musicData->numSamples > 0);
+    assert(pLoadedFile->musicData->pData || pLoadedFile->musicData->pStream);
 
-    // if (strs && songlens && bufLen) {} ;
-    int arrInd = 0;
+    return PlayQueue_insertNext(pLoadedFile);
+}
 
-    // printf("head: %d, tail: %d\n", pMusicHead, pMusicTail);
+playQueueId_t AudioPlayback_queueUndecodedSong(sLoadedFile *pLoadedFile)
+{
+    return PlayQueue_append(pLoadedFile, 0);
+}
 
-    while (i != pMusicTail && arrInd < numSongsToDisp)
-    {
-        // printf("i: %d, arrInd: %d\n", i, arrInd);
-        snprintf(strs[arrInd], bufLen, "%s", pMusicQ[i]->metadata->title);
-        songlens[arrInd] = pMusicQ[i]->metadata->lengthSeconds;
-        i = (i + 1) % MAX_SONGS_QUEUED;
-        arrInd++;
-    }
+void AudioPlayback_setDecodeCallback(void (*callback)(sLoadedFile *pLoadedFile, bool isCurrent))
+{
+    AudioMixer_setDecodeCallback(callback);
+}
 
-    // clear remaining strings
-    arrInd = (arrInd + 1) % MAX_SONGS_QUEUED;
-    while (arrInd < numSongsToDisp)
-    {
-        strs[arrInd][0] = '\0';
-        arrInd = (arrInd + 1) % MAX_SONGS_QUEUED;
-    }
+// The mixer picks up a change to the current song at its next period
+void AudioPlayback_unqueue(playQueueId_t id)
+{
+    PlayQueue_remove(id);
+}
+
+void AudioPlayback_unqueueFile(sLoadedFile *pLoadedFile)
+{
+    PlayQueue_removeFile(pLoadedFile);
+}
+
+void AudioPlayback_moveInQueue(playQueueId_t id, int position)
+{
+    PlayQueue_move(id, position);
+}
 
-    return selectedInd;
+int AudioPlayback_getQueue(sLoadedFile **files, int maxFiles)
+{
+    int numBefore;
+    return PlayQueue_getWindow(0, files, maxFiles, &numBefore);
+}
+
+int AudioPlayback_getQueueLength(void)
+{
+    return PlayQueue_getLength();
+}
+
+uint64_t AudioPlayback_getQueueVersion(void)
+{
+    return PlayQueue_getSnapshotVersion();
+}
+
+const sQueueSnapshot_t* AudioPlayback_acquireQueueSnapshot(void)
+{
+    return PlayQueue_acquireSnapshot();
+}
+
+void AudioPlayback_releaseQueueSnapshot(const sQueueSnapshot_t *pSnapshot)
+{
+    PlayQueue_releaseSnapshot(pSnapshot);
 }
 
 void AudioPlayback_clearQueue()
 {
     AudioMixer_clearSoundQueue();
-    AudioMixer_clearMusicQueue();
-    for (int i=0; i<MAX_SONGS_QUEUED; i++)
-    {
-        pMusicQ[i] = NULL;
-    }
+    PlayQueue_clear();
+    // The mixer may still be on a song that was just removed
+    AudioMixer_stopMusic();
+}
+
+// Metadata to fill in while decoding, or NULL if the song was already indexed
+static musicMetadata_t* getMetadataToRead(sLoadedFile *pLoadedFile)
+{
+    return pLoadedFile->metadata->title == STRING_ARENA_EMPTY ? pLoadedFile->metadata : NULL;
+}
 
-    pMusicHead = 0;
-    pMusicTail = 0;
+void AudioPlayback_readSongInfo(char* filePath, musicMetadata_t *pMetadata)
+{
+    assert(initialized);
+
+    AudioMixer_readMusicMetadata(filePath, pMetadata);
+}
+
+void AudioPlayback_unloadSong(sLoadedFile *pLoadedFile)
+{
+    assert(initialized);
 
+    AudioMixer_freeMusicFileData(pLoadedFile->musicData);
 }
 
 // Loads the song to be played. Should automatically start playing.
@@ -115,13 +151,59 @@ void AudioPlayback_loadSong(char* filePath, sLoadedFile *pLoadedFile)
 
     printf("Loading new song: %s\n", filePath);
 
-    if (pMusicQ[pMusicTail] != NULL)
+    musicMetadata_t *pMetadata = getMetadataToRead(pLoadedFile);
+    if (storageMode == eMUSIC_STORAGE_COMPRESSED)
+    {
+        AudioMixer_readMusicFileCompressed(filePath, pLoadedFile->musicData, pMetadata);
+    }
+    else
     {
-        printf("Too many songs in queue. Overwriting");
-        pMusicQ[pMusicTail] = NULL;
+        AudioMixer_readMusicFileIntoMemory(filePath, pLoadedFile->musicData, pMetadata);
     }
 
-    AudioMixer_readMp3FileIntoMemory(filePath, pLoadedFile->musicData, pLoadedFile->metadata);
+    // Replace the indexed estimate with the decoded length
+    if (pMetadata == NULL && pLoadedFile->musicData->numSamples > 0)
+    {
+        PlayQueue_fileChanged(pLoadedFile, AudioMixer_getMusicLength(pLoadedFile->musicData));
+    }
+}
+
+void AudioPlayback_loadSongUrgent(char* filePath, sLoadedFile *pLoadedFile)
+{
+    assert(initialized);
+
+    // Compressed songs are ready as soon as they are read; nothing to speed up
+    if (storageMode == eMUSIC_STORAGE_COMPRESSED)
+    {
+        AudioPlayback_loadSong(filePath, pLoadedFile);
+        return;
+    }
+
+    printf("Loading new song on all cores: %s\n", filePath);
+    musicMetadata_t *pMetadata = getMetadataToRead(pLoadedFile);
+    AudioMixer_readMusicFileParallel(filePath, pLoadedFile->musicData, pMetadata);
+
+    if (pMetadata == NULL && pLoadedFile->musicData->numSamples > 0)
+    {
+        PlayQueue_fileChanged(pLoadedFile, AudioMixer_getMusicLength(pLoadedFile->musicData));
+    }
+}
+
+bool AudioPlayback_isQueued(sLoadedFile *pLoadedFile)
+{
+    return pLoadedFile->musicData->playingInMixer || PlayQueue_contains(pLoadedFile);
+}
+
+void AudioPlayback_setSongTags(sLoadedFile *pLoadedFile, const musicMetadata_t *pMetadata)
+{
+    assert(initialized);
+
+    PlayQueue_setTags(pLoadedFile, pMetadata);
+}
+
+void AudioPlayback_setStorageMode(eMusicStorage_t mode)
+{
+    storageMode = mode;
 }
 
 
@@ -142,16 +224,17 @@ void AudioPlayback_resumeMusic(void)
 // Skips the current song being played.
 void AudioPlayback_skip(void)
 {
-    AudioMixer_nextMusic();
-    AudioPlayback_updatePMusicIndex();
+    PlayQueue_skip();
 }
 
 // Starts the song from the beginning. 
 // If already in the first 3 seconds of the song, goes to previous song.
 void AudioPlayback_previous(void)
 {
-    AudioMixer_prevMusic();
-    AudioPlayback_updatePMusicIndex();
+    if (!PlayQueue_previous())
+    {
+        printf("No songs before. No action\n");
+    }
 }
 
 void AudioPlayback_restart(void)
@@ -159,17 +242,29 @@ void AudioPlayback_restart(void)
     AudioMixer_restartMusic();
 }
 
-musicMetadata_t* AudioPlayback_getCurrentMetadata(void)
+void AudioPlayback_setShuffle(bool enabled)
 {
-    if (pMusicQ[pMusicHead] != NULL)
-    {
-        AudioPlayback_updatePMusicIndex();
-        return pMusicQ[pMusicHead]->metadata;
-    }
-    else 
-    {
-        return NULL;
-    }
+    PlayQueue_setShuffle(enabled);
+}
+
+bool AudioPlayback_getShuffle(void)
+{
+    return PlayQueue_getShuffle();
+}
+
+void AudioPlayback_setRepeat(eRepeatMode_t mode)
+{
+    PlayQueue_setRepeat(mode);
+}
+
+eRepeatMode_t AudioPlayback_getRepeat(void)
+{
+    return PlayQueue_getRepeat();
+}
+
+bool AudioPlayback_getCurrentMetadata(musicMetadata_t *pMetadata)
+{
+    return PlayQueue_getCurrentMetadata(pMetadata);
 }
 
 double AudioPlayback_getSongPlaytime(void)
@@ -177,17 +272,8 @@ double AudioPlayback_getSongPlaytime(void)
     return AudioMixer_getPlaytime();
 }
 
-
-// Sets pMusicIndex to the songs currently being played
-static void AudioPlayback_updatePMusicIndex()
+size_t AudioPlayback_getPosition(void)
 {
+    return AudioMixer_getPosition();
+}
 
-    for (int i=0; i < MAX_SONGS_QUEUED; i++)
-    {
-        if (pMusicQ[i] != NULL && pMusicQ[i]->musicData !=NULL && pMusicQ[i]->musicData->playingInMixer)
-        {
-            pMusicHead = i;
-            return;
-        }
-    }
-}
\ No newline at end of file
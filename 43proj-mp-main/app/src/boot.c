@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "boot.h"
+#include "timing.h"
+
+#define MAX_BOOT_STEPS 32
+
+typedef struct {
+    const sBootStep_t *pStep;
+    int deps[BOOT_MAX_DEPS];
+    int numDeps;
+    bool done;
+    long long startMs;
+    long long endMs;
+    pthread_t thread;
+} sBootNode_t;
+
+static sBootNode_t nodes[MAX_BOOT_STEPS];
+static int numNodes = 0;
+static pthread_mutex_t bootMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stepDoneCond = PTHREAD_COND_INITIALIZER;
+
+static long long bootStartMs = 0;
+static atomic_bool firstFrameSeen = false;
+static atomic_bool firstAudioSeen = false;
+
+
+static int findStep(const char *name)
+{
+    for (int i=0; i<numNodes; i++)
+    {
+        if (strcmp(nodes[i].pStep->name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Resolves dependency names and checks the graph can finish
+static void buildGraph(const sBootStep_t *steps, int numSteps)
+{
+    if (numSteps > MAX_BOOT_STEPS)
+    {
+        fprintf(stderr, "ERROR: Too many boot steps (%d)\n", numSteps);
+        exit(EXIT_FAILURE);
+    }
+
+    numNodes = numSteps;
+    for (int i=0; i<numSteps; i++)
+    {
+        nodes[i].pStep = &steps[i];
+        nodes[i].numDeps = 0;
+        nodes[i].done = false;
+    }
+
+    for (int i=0; i<numSteps; i++)
+    {
+        for (int d=0; d<BOOT_MAX_DEPS && steps[i].deps[d] != NULL; d++)
+        {
+            int dep = findStep(steps[i].deps[d]);
+            if (dep < 0)
+            {
+                fprintf(stderr, "ERROR: Boot step %s depends on unknown step %s\n", steps[i].name, steps[i].deps[d]);
+                exit(EXIT_FAILURE);
+            }
+            nodes[i].deps[nodes[i].numDeps++] = dep;
+        }
+    }
+
+    // Repeatedly retire steps whose dependencies are retired; anything left is in a cycle
+    bool retired[MAX_BOOT_STEPS] = {false};
+    int numRetired = 0;
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (int i=0; i<numNodes; i++)
+        {
+            if (retired[i]) continue;
+
+            bool ready = true;
+            for (int d=0; d<nodes[i].numDeps; d++) ready = ready && retired[nodes[i].deps[d]];
+            if (ready)
+            {
+                retired[i] = true;
+                numRetired++;
+                progress = true;
+            }
+        }
+    }
+    if (numRetired != numNodes)
+    {
+        fprintf(stderr, "ERROR: Boot steps have a dependency cycle\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool depsDone(const sBootNode_t *pNode)
+{
+    for (int d=0; d<pNode->numDeps; d++)
+    {
+        if (!nodes[pNode->deps[d]].done) return false;
+    }
+    return true;
+}
+
+static void* stepThreadFunc(void *arg)
+{
+    sBootNode_t *pNode = arg;
+
+    pthread_mutex_lock(&bootMutex);
+    while (!depsDone(pNode))
+    {
+        pthread_cond_wait(&stepDoneCond, &bootMutex);
+    }
+    pthread_mutex_unlock(&bootMutex);
+
+    long long startMs = getTimeInMs();
+    pNode->pStep->init();
+    long long endMs = getTimeInMs();
+
+    pthread_mutex_lock(&bootMutex);
+    pNode->startMs = startMs;
+    pNode->endMs = endMs;
+    pNode->done = true;
+    pthread_cond_broadcast(&stepDoneCond);
+    pthread_mutex_unlock(&bootMutex);
+
+    return NULL;
+}
+
+static int compareStart(const void *a, const void *b)
+{
+    const sBootNode_t *pA = *(const sBootNode_t* const*)a;
+    const sBootNode_t *pB = *(const sBootNode_t* const*)b;
+    return (pA->startMs > pB->startMs) - (pA->startMs < pB->startMs);
+}
+
+static void printReport(long long endMs)
+{
+    sBootNode_t *order[MAX_BOOT_STEPS];
+    long long serialMs = 0;
+    for (int i=0; i<numNodes; i++)
+    {
+        order[i] = &nodes[i];
+        serialMs += nodes[i].endMs - nodes[i].startMs;
+    }
+    qsort(order, numNodes, sizeof(order[0]), compareStart);
+
+    printf("Boot: %d modules in %lld ms (%lld ms if run one at a time)\n", numNodes, endMs - bootStartMs, serialMs);
+    for (int i=0; i<numNodes; i++)
+    {
+        printf("  %-14s started at %5lld ms, took %5lld ms\n", order[i]->pStep->name,
+            order[i]->startMs - bootStartMs, order[i]->endMs - order[i]->startMs);
+    }
+}
+
+void Boot_run(const sBootStep_t *steps, int numSteps)
+{
+    bootStartMs = getTimeInMs();
+    buildGraph(steps, numSteps);
+
+    // One thread per step; most of them only wait on hardware or a dependency
+    for (int i=0; i<numNodes; i++)
+    {
+        if (pthread_create(&nodes[i].thread, NULL, stepThreadFunc, &nodes[i]) != 0)
+        {
+            perror("Failed to create boot thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i=0; i<numNodes; i++)
+    {
+        pthread_join(nodes[i].thread, NULL);
+    }
+
+    printReport(getTimeInMs());
+}
+
+void Boot_markFirstFrame(void)
+{
+    if (bootStartMs == 0 || atomic_exchange(&firstFrameSeen, true)) return;
+    printf("Boot: first frame at %lld ms\n", getTimeInMs() - bootStartMs);
+}
+
+void Boot_markFirstAudio(void)
+{
+    if (bootStartMs == 0 || atomic_exchange(&firstAudioSeen, true)) return;
+    printf("Boot: first audio at %lld ms\n", getTimeInMs() - bootStartMs);
+}
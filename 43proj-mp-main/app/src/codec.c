@@ -0,0 +1,283 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "codec_mp3.h"
+#include "codec_flac.h"
+#include "codec_wav.h"
+#include "string_arena.h"
+
+// Source frames converted per plugin read
+#define CONVERT_BLOCK_FRAMES 4096
+
+// Turns a plugin's samples into the mixer's format
+typedef struct {
+    sCodecFormat_t srcFormat;
+    short *srcBlock; // CONVERT_BLOCK_FRAMES frames as the plugin decodes them
+    // Source frames in the mixer's channel layout; frame 0 is song frame baseFrame.
+    // The frame before the next output frame is kept across reads to interpolate from.
+    short *frames;
+    size_t numFrames;
+    uint64_t baseFrame;
+    uint64_t outFrame; // next frame to return, at the mixer's rate
+    bool srcFinished;
+} sConverter_t;
+
+struct sCodecDecoder {
+    const sCodec_t *pCodec;
+    void *pState;
+    sCodecFormat_t format;
+    sConverter_t *pConverter; // NULL if the plugin already decodes the mixer's format
+};
+
+// MP3 goes last: its frame sync check is the loosest
+static const sCodec_t *codecs[] = {
+    &CODEC_FLAC,
+    &CODEC_WAV,
+    &CODEC_MP3,
+};
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+
+const sCodec_t* Codec_probe(const unsigned char *pHeader, size_t numBytes)
+{
+    for (size_t i=0; i<NUM_CODECS; i++)
+    {
+        if (codecs[i]->probe(pHeader, numBytes)) return codecs[i];
+    }
+    return NULL;
+}
+
+sCodecDecoder_t* Codec_open(const unsigned char *pBytes, size_t numBytes)
+{
+    const sCodec_t *pCodec = Codec_probe(pBytes, numBytes);
+    if (pCodec == NULL)
+    {
+        fprintf(stderr, "ERROR: Unsupported music file format\n");
+        return NULL;
+    }
+
+    sCodecDecoder_t *pDecoder = malloc(sizeof(sCodecDecoder_t));
+    if (!pDecoder)
+    {
+        perror("ERROR: Unable to allocate decoder");
+        exit(EXIT_FAILURE);
+    }
+
+    pDecoder->pCodec = pCodec;
+    pDecoder->format.sampleRate = 0;
+    pDecoder->format.numChannels = 0;
+    pDecoder->format.numSamples = 0;
+    pDecoder->pState = pCodec->open(pBytes, numBytes, &pDecoder->format);
+    if (pDecoder->pState == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open %s file\n", pCodec->name);
+        free(pDecoder);
+        return NULL;
+    }
+
+    pDecoder->pConverter = NULL;
+    sCodecFormat_t *pFormat = &pDecoder->format;
+    if (pFormat->sampleRate != CODEC_SAMPLE_RATE || pFormat->numChannels != CODEC_NUM_CHANNELS)
+    {
+        sConverter_t *pConverter = malloc(sizeof(sConverter_t));
+        short *srcBlock = malloc(CONVERT_BLOCK_FRAMES * pFormat->numChannels * sizeof(short));
+        short *frames = malloc((CONVERT_BLOCK_FRAMES + 1) * CODEC_NUM_CHANNELS * sizeof(short));
+        if (!pConverter || !srcBlock || !frames)
+        {
+            perror("ERROR: Unable to allocate decoder");
+            exit(EXIT_FAILURE);
+        }
+        pConverter->srcFormat = *pFormat;
+        pConverter->srcBlock = srcBlock;
+        pConverter->frames = frames;
+        pConverter->numFrames = 0;
+        pConverter->baseFrame = 0;
+        pConverter->outFrame = 0;
+        pConverter->srcFinished = false;
+        pDecoder->pConverter = pConverter;
+
+        size_t numSrcFrames = pFormat->numSamples / pFormat->numChannels;
+        pFormat->numSamples = Codec_getResampledLength(numSrcFrames, pFormat->sampleRate) * CODEC_NUM_CHANNELS;
+        pFormat->sampleRate = CODEC_SAMPLE_RATE;
+        pFormat->numChannels = CODEC_NUM_CHANNELS;
+    }
+
+    return pDecoder;
+}
+
+void Codec_close(sCodecDecoder_t *pDecoder)
+{
+    if (pDecoder == NULL) return;
+
+    pDecoder->pCodec->close(pDecoder->pState);
+    if (pDecoder->pConverter != NULL)
+    {
+        free(pDecoder->pConverter->srcBlock);
+        free(pDecoder->pConverter->frames);
+        free(pDecoder->pConverter);
+    }
+    free(pDecoder);
+}
+
+const sCodec_t* Codec_getCodec(sCodecDecoder_t *pDecoder)
+{
+    return pDecoder->pCodec;
+}
+
+void Codec_getFormat(sCodecDecoder_t *pDecoder, sCodecFormat_t *pFormat)
+{
+    *pFormat = pDecoder->format;
+}
+
+size_t Codec_getResampledLength(size_t numSrcFrames, long srcRate)
+{
+    // Output frame k comes from source position k * srcRate / CODEC_SAMPLE_RATE
+    return ((uint64_t)numSrcFrames * CODEC_SAMPLE_RATE + srcRate - 1) / srcRate;
+}
+
+size_t Codec_resample(const short *src, size_t numSrcFrames, uint64_t srcStart, int numChannels, long srcRate,
+                      bool isEnd, uint64_t *pOutFrame, short *dest, size_t maxFrames)
+{
+    if (numSrcFrames == 0) return 0;
+
+    // Kept as a fraction so long songs don't drift
+    uint64_t srcEnd = srcStart + numSrcFrames;
+    size_t numWritten = 0;
+    while (numWritten < maxFrames)
+    {
+        uint64_t srcPos = *pOutFrame * (uint64_t)srcRate;
+        uint64_t i = srcPos / CODEC_SAMPLE_RATE;
+        if (i >= srcEnd || (i + 1 >= srcEnd && !isEnd)) break;
+
+        uint64_t next = i + 1 < srcEnd ? i + 1 : i;
+        double frac = (double)(srcPos % CODEC_SAMPLE_RATE) / CODEC_SAMPLE_RATE;
+        const short *a = src + (i - srcStart) * numChannels;
+        const short *b = src + (next - srcStart) * numChannels;
+        for (int ch=0; ch<numChannels; ch++)
+        {
+            dest[numWritten * numChannels + ch] = (short)(a[ch] + (b[ch] - a[ch]) * frac);
+        }
+        numWritten++;
+        (*pOutFrame)++;
+    }
+    return numWritten;
+}
+
+// Decodes the next block from the plugin and appends it in the mixer's channel layout.
+// Mono is copied to both sides; beyond stereo only the front pair is kept.
+static void refillConverter(sCodecDecoder_t *pDecoder)
+{
+    sConverter_t *pConverter = pDecoder->pConverter;
+    int srcChannels = pConverter->srcFormat.numChannels;
+
+    // Drop the frames every later output frame is past
+    uint64_t needed = pConverter->outFrame * (uint64_t)pConverter->srcFormat.sampleRate / CODEC_SAMPLE_RATE;
+    size_t numDropped = needed - pConverter->baseFrame;
+    if (numDropped > pConverter->numFrames) numDropped = pConverter->numFrames;
+    memmove(pConverter->frames, pConverter->frames + numDropped * CODEC_NUM_CHANNELS,
+            (pConverter->numFrames - numDropped) * CODEC_NUM_CHANNELS * sizeof(short));
+    pConverter->numFrames -= numDropped;
+    pConverter->baseFrame += numDropped;
+
+    size_t room = CONVERT_BLOCK_FRAMES + 1 - pConverter->numFrames;
+    if (room > CONVERT_BLOCK_FRAMES) room = CONVERT_BLOCK_FRAMES;
+    bool finished = false;
+    size_t numRead = pDecoder->pCodec->read(pDecoder->pState, pConverter->srcBlock, room * srcChannels, &finished) / srcChannels;
+    pConverter->srcFinished = finished || numRead == 0;
+
+    short *out = pConverter->frames + pConverter->numFrames * CODEC_NUM_CHANNELS;
+    for (size_t frame=0; frame<numRead; frame++)
+    {
+        const short *in = pConverter->srcBlock + frame * srcChannels;
+        out[frame * CODEC_NUM_CHANNELS] = in[0];
+        out[frame * CODEC_NUM_CHANNELS + 1] = srcChannels > 1 ? in[1] : in[0];
+    }
+    pConverter->numFrames += numRead;
+}
+
+size_t Codec_read(sCodecDecoder_t *pDecoder, short *dest, size_t numSamples, bool *pFinished)
+{
+    sConverter_t *pConverter = pDecoder->pConverter;
+    if (pConverter == NULL) return pDecoder->pCodec->read(pDecoder->pState, dest, numSamples, pFinished);
+
+    size_t maxFrames = numSamples / CODEC_NUM_CHANNELS;
+    size_t numWritten = 0;
+    *pFinished = false;
+    while (true)
+    {
+        numWritten += Codec_resample(pConverter->frames, pConverter->numFrames, pConverter->baseFrame,
+                                     CODEC_NUM_CHANNELS, pConverter->srcFormat.sampleRate, pConverter->srcFinished,
+                                     &pConverter->outFrame, dest + numWritten * CODEC_NUM_CHANNELS, maxFrames - numWritten);
+        if (numWritten == maxFrames) break;
+        if (pConverter->srcFinished)
+        {
+            *pFinished = true;
+            break;
+        }
+        refillConverter(pDecoder);
+    }
+    return numWritten * CODEC_NUM_CHANNELS;
+}
+
+bool Codec_seek(sCodecDecoder_t *pDecoder, size_t sample)
+{
+    sConverter_t *pConverter = pDecoder->pConverter;
+    if (pConverter == NULL) return pDecoder->pCodec->seek(pDecoder->pState, sample);
+
+    uint64_t outFrame = sample / CODEC_NUM_CHANNELS;
+    uint64_t srcFrame = outFrame * pConverter->srcFormat.sampleRate / CODEC_SAMPLE_RATE;
+    if (!pDecoder->pCodec->seek(pDecoder->pState, srcFrame * pConverter->srcFormat.numChannels)) return false;
+
+    pConverter->numFrames = 0;
+    pConverter->baseFrame = srcFrame;
+    pConverter->outFrame = outFrame;
+    pConverter->srcFinished = false;
+    return true;
+}
+
+void Codec_setUnknownMetadata(musicMetadata_t *pMetadata)
+{
+    uint32_t unknown = StringArena_intern("Unknown");
+    pMetadata->title = unknown;
+    pMetadata->artist = unknown;
+    pMetadata->album = unknown;
+    pMetadata->lengthSeconds = 0;
+}
+
+void Codec_readFileMetadata(const char *path, musicMetadata_t *pMetadata)
+{
+    unsigned char header[CODEC_PROBE_BYTES];
+    size_t numBytes = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        numBytes = fread(header, 1, sizeof(header), file);
+        fclose(file);
+    }
+
+    const sCodec_t *pCodec = Codec_probe(header, numBytes);
+    if (pCodec == NULL)
+    {
+        fprintf(stderr, "WARNING: Unsupported music file %s\n", path);
+        Codec_setUnknownMetadata(pMetadata);
+        return;
+    }
+
+    pCodec->readFileMetadata(path, pMetadata);
+}
+
+void Codec_readMetadata(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata)
+{
+    const sCodec_t *pCodec = Codec_probe(pBytes, numBytes);
+    if (pCodec == NULL)
+    {
+        Codec_setUnknownMetadata(pMetadata);
+        return;
+    }
+
+    pCodec->readMetadata(pBytes, numBytes, pMetadata);
+}
@@ -0,0 +1,324 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <FLAC/stream_decoder.h>
+#include <FLAC/metadata.h>
+
+#include "codec_flac.h"
+#include "string_arena.h"
+
+#define MAX_TAG_LEN 256
+
+typedef struct {
+    FLAC__StreamDecoder *pFlac;
+    const unsigned char *pBytes;
+    size_t numBytes;
+    size_t pos;
+
+    long sampleRate;
+    int numChannels;
+    FLAC__uint64 totalFrames; // samples per channel, 0 if unknown
+
+    // The last decoded block, interleaved, and how much of it was already returned
+    short *block;
+    size_t blockCapacity;
+    size_t blockSamples;
+    size_t blockPos;
+    bool ended;
+
+    // Gets the Vorbis comments when only the metadata is read; NULL when decoding
+    musicMetadata_t *pTags;
+} sFlacDecoder_t;
+
+static void readComments(const FLAC__StreamMetadata *pComments, musicMetadata_t *pMetadata);
+
+
+static bool probe(const unsigned char *pHeader, size_t numBytes)
+{
+    return numBytes >= 4 && memcmp(pHeader, "fLaC", 4) == 0;
+}
+
+static FLAC__StreamDecoderReadStatus readCallback(const FLAC__StreamDecoder *pFlac, FLAC__byte buffer[], size_t *pNumBytes, void *pClient)
+{
+    (void)pFlac;
+    sFlacDecoder_t *pDecoder = pClient;
+
+    size_t remaining = pDecoder->numBytes - pDecoder->pos;
+    if (remaining == 0)
+    {
+        *pNumBytes = 0;
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    }
+    if (*pNumBytes > remaining) *pNumBytes = remaining;
+
+    memcpy(buffer, pDecoder->pBytes + pDecoder->pos, *pNumBytes);
+    pDecoder->pos += *pNumBytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static FLAC__StreamDecoderSeekStatus seekCallback(const FLAC__StreamDecoder *pFlac, FLAC__uint64 offset, void *pClient)
+{
+    (void)pFlac;
+    sFlacDecoder_t *pDecoder = pClient;
+    if (offset > pDecoder->numBytes) return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+
+    pDecoder->pos = offset;
+    return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus tellCallback(const FLAC__StreamDecoder *pFlac, FLAC__uint64 *pOffset, void *pClient)
+{
+    (void)pFlac;
+    *pOffset = ((sFlacDecoder_t*)pClient)->pos;
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+static FLAC__StreamDecoderLengthStatus lengthCallback(const FLAC__StreamDecoder *pFlac, FLAC__uint64 *pLength, void *pClient)
+{
+    (void)pFlac;
+    *pLength = ((sFlacDecoder_t*)pClient)->numBytes;
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool eofCallback(const FLAC__StreamDecoder *pFlac, void *pClient)
+{
+    (void)pFlac;
+    sFlacDecoder_t *pDecoder = pClient;
+    return pDecoder->pos >= pDecoder->numBytes;
+}
+
+// Interleaves a decoded block into 16-bit samples
+static FLAC__StreamDecoderWriteStatus writeCallback(const FLAC__StreamDecoder *pFlac, const FLAC__Frame *pFrame,
+    const FLAC__int32 *const channels[], void *pClient)
+{
+    (void)pFlac;
+    sFlacDecoder_t *pDecoder = pClient;
+    unsigned blockSize = pFrame->header.blocksize;
+    unsigned numChannels = pFrame->header.channels;
+    unsigned bits = pFrame->header.bits_per_sample;
+
+    size_t numSamples = (size_t)blockSize * numChannels;
+    if (numSamples > pDecoder->blockCapacity)
+    {
+        short *block = realloc(pDecoder->block, numSamples * sizeof(short));
+        if (!block)
+        {
+            perror("ERROR: Unable to allocate FLAC block");
+            exit(EXIT_FAILURE);
+        }
+        pDecoder->block = block;
+        pDecoder->blockCapacity = numSamples;
+    }
+
+    short *out = pDecoder->block;
+    for (unsigned i=0; i<blockSize; i++)
+    {
+        for (unsigned ch=0; ch<numChannels; ch++)
+        {
+            FLAC__int32 sample = channels[ch][i];
+            *out++ = bits > 16 ? sample >> (bits - 16) : sample * (1 << (16 - bits));
+        }
+    }
+    pDecoder->blockSamples = numSamples;
+    pDecoder->blockPos = 0;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void metadataCallback(const FLAC__StreamDecoder *pFlac, const FLAC__StreamMetadata *pMetadata, void *pClient)
+{
+    (void)pFlac;
+    sFlacDecoder_t *pDecoder = pClient;
+    if (pMetadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT && pDecoder->pTags != NULL)
+    {
+        readComments(pMetadata, pDecoder->pTags);
+        return;
+    }
+    if (pMetadata->type != FLAC__METADATA_TYPE_STREAMINFO) return;
+
+    pDecoder->sampleRate = pMetadata->data.stream_info.sample_rate;
+    pDecoder->numChannels = pMetadata->data.stream_info.channels;
+    pDecoder->totalFrames = pMetadata->data.stream_info.total_samples;
+}
+
+static void errorCallback(const FLAC__StreamDecoder *pFlac, FLAC__StreamDecoderErrorStatus status, void *pClient)
+{
+    (void)pFlac;
+    (void)pClient;
+    // libFLAC resyncs on the next frame by itself
+    fprintf(stderr, "WARNING: FLAC decode error: %s\n", FLAC__StreamDecoderErrorStatusString[status]);
+}
+
+static void closeDecoder(void *pState)
+{
+    sFlacDecoder_t *pDecoder = pState;
+    FLAC__stream_decoder_finish(pDecoder->pFlac);
+    FLAC__stream_decoder_delete(pDecoder->pFlac);
+    free(pDecoder->block);
+    free(pDecoder);
+}
+
+// Opens a decoder and reads the metadata blocks; the comments go in pTags if it is not NULL
+static sFlacDecoder_t* openStream(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pTags)
+{
+    sFlacDecoder_t *pDecoder = calloc(1, sizeof(sFlacDecoder_t));
+    if (!pDecoder)
+    {
+        perror("ERROR: Unable to allocate FLAC decoder");
+        exit(EXIT_FAILURE);
+    }
+    pDecoder->pBytes = pBytes;
+    pDecoder->numBytes = numBytes;
+    pDecoder->pTags = pTags;
+
+    pDecoder->pFlac = FLAC__stream_decoder_new();
+    if (pDecoder->pFlac == NULL)
+    {
+        free(pDecoder);
+        return NULL;
+    }
+    if (pTags != NULL) FLAC__stream_decoder_set_metadata_respond(pDecoder->pFlac, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+
+    if (FLAC__stream_decoder_init_stream(pDecoder->pFlac, readCallback, seekCallback, tellCallback, lengthCallback,
+            eofCallback, writeCallback, metadataCallback, errorCallback, pDecoder) != FLAC__STREAM_DECODER_INIT_STATUS_OK ||
+        !FLAC__stream_decoder_process_until_end_of_metadata(pDecoder->pFlac) ||
+        pDecoder->sampleRate == 0)
+    {
+        closeDecoder(pDecoder);
+        return NULL;
+    }
+
+    return pDecoder;
+}
+
+static void* openDecoder(const unsigned char *pBytes, size_t numBytes, sCodecFormat_t *pFormat)
+{
+    sFlacDecoder_t *pDecoder = openStream(pBytes, numBytes, NULL);
+    if (pDecoder == NULL) return NULL;
+
+    pFormat->sampleRate = pDecoder->sampleRate;
+    pFormat->numChannels = pDecoder->numChannels;
+    pFormat->numSamples = pDecoder->totalFrames * pDecoder->numChannels;
+
+    return pDecoder;
+}
+
+static size_t readSamples(void *pState, short *dest, size_t numSamples, bool *pFinished)
+{
+    sFlacDecoder_t *pDecoder = pState;
+    size_t numWritten = 0;
+    *pFinished = false;
+
+    while (numWritten < numSamples)
+    {
+        if (pDecoder->blockPos == pDecoder->blockSamples)
+        {
+            // Decodes one block through writeCallback()
+            if (pDecoder->ended ||
+                FLAC__stream_decoder_get_state(pDecoder->pFlac) == FLAC__STREAM_DECODER_END_OF_STREAM ||
+                !FLAC__stream_decoder_process_single(pDecoder->pFlac))
+            {
+                pDecoder->ended = true;
+                *pFinished = true;
+                break;
+            }
+            continue;
+        }
+
+        size_t available = pDecoder->blockSamples - pDecoder->blockPos;
+        size_t numCopied = available < numSamples - numWritten ? available : numSamples - numWritten;
+        memcpy(dest + numWritten, pDecoder->block + pDecoder->blockPos, numCopied * sizeof(short));
+        pDecoder->blockPos += numCopied;
+        numWritten += numCopied;
+    }
+
+    return numWritten;
+}
+
+static bool seekSample(void *pState, size_t sample)
+{
+    sFlacDecoder_t *pDecoder = pState;
+    pDecoder->blockSamples = 0;
+    pDecoder->blockPos = 0;
+    pDecoder->ended = false;
+
+    // Leaves the block starting at the target sample in place through writeCallback()
+    if (!FLAC__stream_decoder_seek_absolute(pDecoder->pFlac, sample / pDecoder->numChannels))
+    {
+        // A failed seek leaves the decoder needing a flush before it can be used again
+        FLAC__stream_decoder_flush(pDecoder->pFlac);
+        return false;
+    }
+    return true;
+}
+
+// Copies the value of a "NAME=value" comment if its name matches
+static bool getComment(const FLAC__StreamMetadata_VorbisComment_Entry *pEntry, const char *name, char *value, size_t valueLen)
+{
+    size_t nameLen = strlen(name);
+    if (pEntry->length <= nameLen || pEntry->entry[nameLen] != '=' ||
+        strncasecmp((const char*)pEntry->entry, name, nameLen) != 0)
+    {
+        return false;
+    }
+
+    size_t len = pEntry->length - nameLen - 1;
+    if (len > valueLen - 1) len = valueLen - 1;
+    memcpy(value, pEntry->entry + nameLen + 1, len);
+    value[len] = '\0';
+    return len > 0;
+}
+
+static void readComments(const FLAC__StreamMetadata *pComments, musicMetadata_t *pMetadata)
+{
+    char value[MAX_TAG_LEN];
+    for (FLAC__uint32 i=0; i<pComments->data.vorbis_comment.num_comments; i++)
+    {
+        const FLAC__StreamMetadata_VorbisComment_Entry *pEntry = &pComments->data.vorbis_comment.comments[i];
+        if (getComment(pEntry, "TITLE", value, sizeof(value))) pMetadata->title = StringArena_add(value);
+        else if (getComment(pEntry, "ARTIST", value, sizeof(value))) pMetadata->artist = StringArena_intern(value);
+        else if (getComment(pEntry, "ALBUM", value, sizeof(value))) pMetadata->album = StringArena_intern(value);
+    }
+}
+
+// Reads STREAMINFO and the Vorbis comments; only the metadata blocks at the start of the file are read.
+static void readFileMetadata(const char *path, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    FLAC__StreamMetadata streamInfo;
+    if (FLAC__metadata_get_streaminfo(path, &streamInfo) && streamInfo.data.stream_info.sample_rate > 0)
+    {
+        pMetadata->lengthSeconds = (double)streamInfo.data.stream_info.total_samples / streamInfo.data.stream_info.sample_rate;
+    }
+
+    FLAC__StreamMetadata *pTags = NULL;
+    if (!FLAC__metadata_get_tags(path, &pTags)) return;
+
+    readComments(pTags, pMetadata);
+    FLAC__metadata_object_delete(pTags);
+}
+
+static void readMetadata(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    sFlacDecoder_t *pDecoder = openStream(pBytes, numBytes, pMetadata);
+    if (pDecoder == NULL) return;
+
+    pMetadata->lengthSeconds = (double)pDecoder->totalFrames / pDecoder->sampleRate;
+    closeDecoder(pDecoder);
+}
+
+const sCodec_t CODEC_FLAC = {
+    .name = "FLAC",
+    .probe = probe,
+    .open = openDecoder,
+    .read = readSamples,
+    .seek = seekSample,
+    .close = closeDecoder,
+    .readFileMetadata = readFileMetadata,
+    .readMetadata = readMetadata,
+};
@@ -0,0 +1,301 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpg123.h>
+
+#include "codec_mp3.h"
+#include "string_arena.h"
+
+// mpg123 reader over an in-memory buffer. One per open decoder handle.
+typedef struct {
+    const unsigned char *pBytes;
+    size_t numBytes;
+    size_t pos;
+} sMemReader_t;
+
+typedef struct {
+    mpg123_handle *mp3Handle;
+    // Frames that don't fit in the caller's buffer are decoded here instead
+    unsigned char *frameBuffer;
+    size_t frameBufferSize;
+    unsigned char *pLeftover; // rest of the last such frame, not yet returned
+    size_t numLeftoverBytes;
+    int numChannels;
+} sMp3Decoder_t;
+
+
+static ssize_t memReaderRead(void *handle, void *buf, size_t count)
+{
+    sMemReader_t *pReader = handle;
+    size_t remaining = pReader->numBytes - pReader->pos;
+    if (count > remaining) count = remaining;
+
+    memcpy(buf, pReader->pBytes + pReader->pos, count);
+    pReader->pos += count;
+    return count;
+}
+
+static off_t memReaderSeek(void *handle, off_t offset, int whence)
+{
+    sMemReader_t *pReader = handle;
+    off_t newPos;
+    if (whence == SEEK_SET) newPos = offset;
+    else if (whence == SEEK_CUR) newPos = pReader->pos + offset;
+    else if (whence == SEEK_END) newPos = pReader->numBytes + offset;
+    else return -1;
+
+    if (newPos < 0 || (size_t)newPos > pReader->numBytes) return -1;
+
+    pReader->pos = newPos;
+    return newPos;
+}
+
+static void memReaderCleanup(void *handle)
+{
+    free(handle);
+}
+
+bool CodecMp3_attach(mpg123_handle *mp3Handle, const unsigned char *pBytes, size_t numBytes)
+{
+    sMemReader_t *pReader = malloc(sizeof(sMemReader_t));
+    if (!pReader) return false;
+
+    pReader->pBytes = pBytes;
+    pReader->numBytes = numBytes;
+    pReader->pos = 0;
+
+    // mpg123 resamples and upmixes to the mixer's format itself
+    mpg123_format_none(mp3Handle);
+    mpg123_format(mp3Handle, CODEC_SAMPLE_RATE, MPG123_STEREO, MPG123_ENC_SIGNED_16);
+
+    if (mpg123_replace_reader_handle(mp3Handle, memReaderRead, memReaderSeek, memReaderCleanup) != MPG123_OK)
+    {
+        free(pReader);
+        return false;
+    }
+
+    // The reader is freed through memReaderCleanup() when the handle is closed
+    if (mpg123_open_handle(mp3Handle, pReader) != MPG123_OK)
+    {
+        fprintf(stderr, "ERROR: Unable to open MP3 data: %s\n", mpg123_strerror(mp3Handle));
+        return false;
+    }
+
+    return true;
+}
+
+// An ID3v2 tag or an MPEG audio frame sync
+static bool probe(const unsigned char *pHeader, size_t numBytes)
+{
+    if (numBytes < 3) return false;
+    if (memcmp(pHeader, "ID3", 3) == 0) return true;
+    return pHeader[0] == 0xFF && (pHeader[1] & 0xE0) == 0xE0;
+}
+
+static void* openDecoder(const unsigned char *pBytes, size_t numBytes, sCodecFormat_t *pFormat)
+{
+    mpg123_handle *mp3Handle = mpg123_new(NULL, NULL);
+    if (mp3Handle == NULL) return NULL;
+    if (!CodecMp3_attach(mp3Handle, pBytes, numBytes))
+    {
+        mpg123_delete(mp3Handle);
+        return NULL;
+    }
+
+    // Scanning parses every frame header (no decoding) so the length is exact, not estimated
+    long sampleRate;
+    int channels, encoding;
+    mpg123_scan(mp3Handle);
+    if (mpg123_getformat(mp3Handle, &sampleRate, &channels, &encoding) != MPG123_OK)
+    {
+        mpg123_close(mp3Handle);
+        mpg123_delete(mp3Handle);
+        return NULL;
+    }
+    off_t totalFrames = mpg123_length(mp3Handle);
+
+    sMp3Decoder_t *pDecoder = malloc(sizeof(sMp3Decoder_t));
+    size_t frameBufferSize = mpg123_outblock(mp3Handle);
+    unsigned char *frameBuffer = malloc(frameBufferSize);
+    if (!pDecoder || !frameBuffer)
+    {
+        perror("ERROR: Unable to allocate MP3 decoder");
+        exit(EXIT_FAILURE);
+    }
+
+    pDecoder->mp3Handle = mp3Handle;
+    pDecoder->frameBuffer = frameBuffer;
+    pDecoder->frameBufferSize = frameBufferSize;
+    pDecoder->pLeftover = NULL;
+    pDecoder->numLeftoverBytes = 0;
+    pDecoder->numChannels = channels;
+
+    pFormat->sampleRate = sampleRate;
+    pFormat->numChannels = channels;
+    pFormat->numSamples = totalFrames > 0 ? totalFrames * channels : 0;
+
+    return pDecoder;
+}
+
+static size_t readSamples(void *pState, short *dest, size_t numSamples, bool *pFinished)
+{
+    sMp3Decoder_t *pDecoder = pState;
+    unsigned char *out = (unsigned char*)dest;
+    size_t room = numSamples * sizeof(short);
+    size_t numWritten = 0;
+    *pFinished = false;
+
+    if (pDecoder->numLeftoverBytes > 0)
+    {
+        size_t numLeftover = pDecoder->numLeftoverBytes < room ? pDecoder->numLeftoverBytes : room;
+        memcpy(out, pDecoder->pLeftover, numLeftover);
+        pDecoder->pLeftover += numLeftover;
+        pDecoder->numLeftoverBytes -= numLeftover;
+        numWritten += numLeftover;
+    }
+
+    while (numWritten < room)
+    {
+        // Whole frames are decoded straight into dest; mpg123 needs a full output block of room
+        bool direct = room - numWritten >= pDecoder->frameBufferSize;
+        unsigned char *target = direct ? out + numWritten : pDecoder->frameBuffer;
+        mpg123_replace_buffer(pDecoder->mp3Handle, target, direct ? room - numWritten : pDecoder->frameBufferSize);
+
+        off_t frameNum;
+        unsigned char *audio;
+        size_t numBytes = 0;
+        int err = mpg123_decode_frame(pDecoder->mp3Handle, &frameNum, &audio, &numBytes);
+        if (err == MPG123_NEW_FORMAT) continue;
+        if (err != MPG123_OK)
+        {
+            if (err != MPG123_DONE)
+            {
+                fprintf(stderr, "ERROR: Decoding MP3 failed: %s\n", mpg123_strerror(pDecoder->mp3Handle));
+            }
+            *pFinished = true;
+            break;
+        }
+
+        if (direct)
+        {
+            // Gapless trimming of the first frame can leave the samples offset in the buffer
+            if (numBytes > 0 && audio != target) memmove(target, audio, numBytes);
+            numWritten += numBytes;
+        }
+        else
+        {
+            size_t numCopied = numBytes < room - numWritten ? numBytes : room - numWritten;
+            memcpy(out + numWritten, audio, numCopied);
+            numWritten += numCopied;
+            pDecoder->pLeftover = audio + numCopied;
+            pDecoder->numLeftoverBytes = numBytes - numCopied;
+        }
+    }
+
+    return numWritten / sizeof(short);
+}
+
+static bool seekSample(void *pState, size_t sample)
+{
+    sMp3Decoder_t *pDecoder = pState;
+    pDecoder->numLeftoverBytes = 0;
+
+    // Frames decoded while seeking must not land in a caller's old buffer
+    mpg123_replace_buffer(pDecoder->mp3Handle, pDecoder->frameBuffer, pDecoder->frameBufferSize);
+    return mpg123_seek(pDecoder->mp3Handle, sample / pDecoder->numChannels, SEEK_SET) >= 0;
+}
+
+static void closeDecoder(void *pState)
+{
+    sMp3Decoder_t *pDecoder = pState;
+    mpg123_close(pDecoder->mp3Handle);
+    mpg123_delete(pDecoder->mp3Handle);
+    free(pDecoder->frameBuffer);
+    free(pDecoder);
+}
+
+// id3v1 fields are fixed size and not always terminated
+#define ID3V1_FIELD(field) "%.*s", (int)sizeof(field), (field)
+
+// Reads title/artist/album tags from an opened handle into pMetadata.
+// Strings go in the string arena; artists and albums are interned since many songs share them.
+static void readTags(mpg123_handle *mp3Handle, musicMetadata_t *pMetadata)
+{
+    mpg123_id3v1* id3v1;
+    mpg123_id3v2* id3v2;
+    if (mpg123_id3(mp3Handle, &id3v1, &id3v2) != MPG123_OK) return;
+
+    if (id3v2)
+    {
+        if (id3v2->title && id3v2->title->p) pMetadata->title = StringArena_add(id3v2->title->p);
+        if (id3v2->artist && id3v2->artist->p) pMetadata->artist = StringArena_intern(id3v2->artist->p);
+        if (id3v2->album && id3v2->album->p) pMetadata->album = StringArena_intern(id3v2->album->p);
+    }
+    else if (id3v1)
+    {
+        char field[sizeof(id3v1->title) + 1];
+        snprintf(field, sizeof(field), ID3V1_FIELD(id3v1->title));
+        pMetadata->title = StringArena_add(field);
+        snprintf(field, sizeof(field), ID3V1_FIELD(id3v1->artist));
+        pMetadata->artist = StringArena_intern(field);
+        snprintf(field, sizeof(field), ID3V1_FIELD(id3v1->album));
+        pMetadata->album = StringArena_intern(field);
+    }
+}
+
+// Reads the tags and an estimated length from an opened handle, then closes it
+static void readHandleMetadata(mpg123_handle *mp3Handle, musicMetadata_t *pMetadata)
+{
+    // Parses the first frame (and any ID3v2 tag before it)
+    long sampleRate;
+    int channels, encoding;
+    if (mpg123_getformat(mp3Handle, &sampleRate, &channels, &encoding) == MPG123_OK)
+    {
+        pMetadata->lengthSeconds = (double)mpg123_length(mp3Handle) / sampleRate;
+    }
+    readTags(mp3Handle, pMetadata);
+
+    mpg123_close(mp3Handle);
+    mpg123_delete(mp3Handle);
+}
+
+// Reads only the tags and an estimated length; nothing is decoded.
+static void readFileMetadata(const char *path, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    mpg123_handle *mp3Handle = mpg123_new(NULL, NULL);
+    if (mpg123_open(mp3Handle, path) != MPG123_OK)
+    {
+        perror("Failed to open MP3 file");
+        mpg123_delete(mp3Handle);
+        return;
+    }
+    readHandleMetadata(mp3Handle, pMetadata);
+}
+
+static void readMetadata(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    mpg123_handle *mp3Handle = mpg123_new(NULL, NULL);
+    if (mp3Handle == NULL) return;
+    if (!CodecMp3_attach(mp3Handle, pBytes, numBytes))
+    {
+        mpg123_delete(mp3Handle);
+        return;
+    }
+    readHandleMetadata(mp3Handle, pMetadata);
+}
+
+const sCodec_t CODEC_MP3 = {
+    .name = "MP3",
+    .probe = probe,
+    .open = openDecoder,
+    .read = readSamples,
+    .seek = seekSample,
+    .close = closeDecoder,
+    .readFileMetadata = readFileMetadata,
+    .readMetadata = readMetadata,
+};
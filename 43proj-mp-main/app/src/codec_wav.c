@@ -0,0 +1,282 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec_wav.h"
+#include "string_arena.h"
+
+#define RIFF_HEADER_SIZE 12
+#define CHUNK_HEADER_SIZE 8
+#define FMT_MIN_SIZE 16
+#define FMT_EXTENSIBLE_SIZE 26
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+#define MAX_TAG_LEN 256
+
+typedef struct {
+    const unsigned char *pData;
+    int bytesPerSample;
+    size_t numSamples;
+    size_t position;
+} sWavDecoder_t;
+
+
+static uint32_t readLE32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t readLE16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static bool probe(const unsigned char *pHeader, size_t numBytes)
+{
+    return numBytes >= RIFF_HEADER_SIZE && memcmp(pHeader, "RIFF", 4) == 0 && memcmp(pHeader + 8, "WAVE", 4) == 0;
+}
+
+// Fills in pInfo from a fmt chunk. Returns false for anything but integer PCM.
+static bool parseFmt(const unsigned char *pChunk, size_t chunkSize, sWavInfo_t *pInfo)
+{
+    if (chunkSize < FMT_MIN_SIZE) return false;
+
+    // Extensible headers keep the real format in the first two bytes of the sub-format GUID
+    uint16_t formatTag = readLE16(pChunk);
+    if (formatTag == WAVE_FORMAT_EXTENSIBLE && chunkSize >= FMT_EXTENSIBLE_SIZE)
+    {
+        formatTag = readLE16(pChunk + 24);
+    }
+    if (formatTag != WAVE_FORMAT_PCM) return false;
+
+    pInfo->numChannels = readLE16(pChunk + 2);
+    pInfo->sampleRate = readLE32(pChunk + 4);
+    pInfo->bitsPerSample = readLE16(pChunk + 14);
+
+    int bits = pInfo->bitsPerSample;
+    return pInfo->numChannels > 0 && pInfo->sampleRate > 0 &&
+        (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+}
+
+bool CodecWav_parse(const unsigned char *pBytes, size_t numBytes, sWavInfo_t *pInfo)
+{
+    if (!probe(pBytes, numBytes)) return false;
+
+    bool haveFmt = false;
+    bool haveData = false;
+    size_t pos = RIFF_HEADER_SIZE;
+    while (pos + CHUNK_HEADER_SIZE <= numBytes && !(haveFmt && haveData))
+    {
+        const unsigned char *pChunk = pBytes + pos + CHUNK_HEADER_SIZE;
+        size_t chunkSize = readLE32(pBytes + pos + 4);
+        size_t available = numBytes - pos - CHUNK_HEADER_SIZE;
+
+        if (memcmp(pBytes + pos, "fmt ", 4) == 0)
+        {
+            if (chunkSize > available || !parseFmt(pChunk, chunkSize, pInfo)) return false;
+            haveFmt = true;
+        }
+        else if (memcmp(pBytes + pos, "data", 4) == 0)
+        {
+            // A recording that was cut short claims more data than there is
+            pInfo->dataOffset = pos + CHUNK_HEADER_SIZE;
+            pInfo->dataSize = chunkSize < available ? chunkSize : available;
+            haveData = true;
+        }
+        // LIST and any other chunks are skipped
+
+        // Chunks are padded to an even size
+        if (chunkSize > available) break;
+        pos += CHUNK_HEADER_SIZE + chunkSize + (chunkSize & 1);
+    }
+    if (!haveFmt || !haveData) return false;
+
+    // Drop a trailing partial frame
+    size_t frameSize = (size_t)pInfo->numChannels * (pInfo->bitsPerSample / 8);
+    pInfo->dataSize -= pInfo->dataSize % frameSize;
+    return true;
+}
+
+void CodecWav_convertSamples(const unsigned char *pSrc, int bitsPerSample, short *dest, size_t numSamples)
+{
+    switch (bitsPerSample)
+    {
+    case 8:
+        // 8-bit samples are unsigned
+        for (size_t i=0; i<numSamples; i++) dest[i] = (short)((pSrc[i] - 128) * 256);
+        break;
+    case 16:
+        // Little-endian like the CPU, so it is a straight copy
+        memcpy(dest, pSrc, numSamples * sizeof(short));
+        break;
+    case 24:
+        // Keep the top two bytes
+        for (size_t i=0; i<numSamples; i++) dest[i] = (short)readLE16(pSrc + 3*i + 1);
+        break;
+    case 32:
+        for (size_t i=0; i<numSamples; i++) dest[i] = (short)readLE16(pSrc + 4*i + 2);
+        break;
+    }
+}
+
+static void* openDecoder(const unsigned char *pBytes, size_t numBytes, sCodecFormat_t *pFormat)
+{
+    sWavInfo_t info;
+    if (!CodecWav_parse(pBytes, numBytes, &info)) return NULL;
+
+    sWavDecoder_t *pDecoder = malloc(sizeof(sWavDecoder_t));
+    if (!pDecoder)
+    {
+        perror("ERROR: Unable to allocate WAV decoder");
+        exit(EXIT_FAILURE);
+    }
+
+    pDecoder->pData = pBytes + info.dataOffset;
+    pDecoder->bytesPerSample = info.bitsPerSample / 8;
+    pDecoder->numSamples = info.dataSize / pDecoder->bytesPerSample;
+    pDecoder->position = 0;
+
+    pFormat->sampleRate = info.sampleRate;
+    pFormat->numChannels = info.numChannels;
+    pFormat->numSamples = pDecoder->numSamples;
+
+    return pDecoder;
+}
+
+static size_t readSamples(void *pState, short *dest, size_t numSamples, bool *pFinished)
+{
+    sWavDecoder_t *pDecoder = pState;
+
+    size_t remaining = pDecoder->numSamples - pDecoder->position;
+    size_t numCopied = numSamples < remaining ? numSamples : remaining;
+    CodecWav_convertSamples(pDecoder->pData + pDecoder->position * pDecoder->bytesPerSample,
+        pDecoder->bytesPerSample * 8, dest, numCopied);
+    pDecoder->position += numCopied;
+
+    *pFinished = pDecoder->position == pDecoder->numSamples;
+    return numCopied;
+}
+
+static bool seekSample(void *pState, size_t sample)
+{
+    sWavDecoder_t *pDecoder = pState;
+    if (sample > pDecoder->numSamples) return false;
+
+    pDecoder->position = sample;
+    return true;
+}
+
+static void closeDecoder(void *pState)
+{
+    free(pState);
+}
+
+// Reads the INAM/IART/IPRD entries of a LIST/INFO chunk
+static void readInfoTags(FILE *file, size_t listSize, musicMetadata_t *pMetadata)
+{
+    unsigned char header[CHUNK_HEADER_SIZE];
+    char value[MAX_TAG_LEN];
+
+    size_t pos = 4; // past "INFO"
+    while (pos + CHUNK_HEADER_SIZE <= listSize && fread(header, 1, CHUNK_HEADER_SIZE, file) == CHUNK_HEADER_SIZE)
+    {
+        size_t size = readLE32(header + 4);
+        size_t padded = size + (size & 1);
+        size_t len = size < sizeof(value) - 1 ? size : sizeof(value) - 1;
+
+        if (fread(value, 1, len, file) != len) return;
+        value[len] = '\0';
+        fseek(file, padded - len, SEEK_CUR);
+        pos += CHUNK_HEADER_SIZE + padded;
+
+        if (value[0] == '\0') continue;
+        if (memcmp(header, "INAM", 4) == 0) pMetadata->title = StringArena_add(value);
+        else if (memcmp(header, "IART", 4) == 0) pMetadata->artist = StringArena_intern(value);
+        else if (memcmp(header, "IPRD", 4) == 0) pMetadata->album = StringArena_intern(value);
+    }
+}
+
+// Walks the chunk headers in the file, reading only fmt and the tags. Closes file.
+static void readStreamMetadata(FILE *file, musicMetadata_t *pMetadata)
+{
+    unsigned char header[RIFF_HEADER_SIZE];
+    sWavInfo_t info = {0};
+    bool haveFmt = false;
+    size_t dataSize = 0;
+
+    if (fread(header, 1, RIFF_HEADER_SIZE, file) == RIFF_HEADER_SIZE && probe(header, RIFF_HEADER_SIZE))
+    {
+        unsigned char chunk[CHUNK_HEADER_SIZE];
+        while (fread(chunk, 1, CHUNK_HEADER_SIZE, file) == CHUNK_HEADER_SIZE)
+        {
+            size_t chunkSize = readLE32(chunk + 4);
+            long next = ftell(file) + chunkSize + (chunkSize & 1);
+            unsigned char fmt[FMT_EXTENSIBLE_SIZE];
+            unsigned char listType[4];
+
+            if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= FMT_MIN_SIZE)
+            {
+                size_t fmtSize = chunkSize < sizeof(fmt) ? chunkSize : sizeof(fmt);
+                haveFmt = fread(fmt, 1, fmtSize, file) == fmtSize && parseFmt(fmt, fmtSize, &info);
+            }
+            else if (memcmp(chunk, "data", 4) == 0)
+            {
+                dataSize = chunkSize;
+            }
+            else if (memcmp(chunk, "LIST", 4) == 0 && fread(listType, 1, 4, file) == 4 &&
+                memcmp(listType, "INFO", 4) == 0)
+            {
+                readInfoTags(file, chunkSize, pMetadata);
+            }
+
+            if (fseek(file, next, SEEK_SET) != 0) break;
+        }
+    }
+    fclose(file);
+
+    if (haveFmt && info.bitsPerSample > 0)
+    {
+        size_t bytesPerSecond = (size_t)info.sampleRate * info.numChannels * (info.bitsPerSample / 8);
+        pMetadata->lengthSeconds = bytesPerSecond > 0 ? (double)dataSize / bytesPerSecond : 0;
+    }
+}
+
+static void readFileMetadata(const char *path, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror("Failed to open WAV file");
+        return;
+    }
+    readStreamMetadata(file, pMetadata);
+}
+
+static void readMetadata(const unsigned char *pBytes, size_t numBytes, musicMetadata_t *pMetadata)
+{
+    Codec_setUnknownMetadata(pMetadata);
+
+    // Only read through the stream, so the cast never leads to a write
+    FILE *file = fmemopen((void*)pBytes, numBytes, "rb");
+    if (file == NULL)
+    {
+        perror("Failed to open WAV data");
+        return;
+    }
+    readStreamMetadata(file, pMetadata);
+}
+
+const sCodec_t CODEC_WAV = {
+    .name = "WAV",
+    .probe = probe,
+    .open = openDecoder,
+    .read = readSamples,
+    .seek = seekSample,
+    .close = closeDecoder,
+    .readFileMetadata = readFileMetadata,
+    .readMetadata = readMetadata,
+};
@@ -0,0 +1,288 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "crawler.h"
+#include "codec.h"
+
+// Directory reads mostly wait on storage, so a few threads are enough to keep it busy
+#define DEFAULT_NUM_THREADS 4
+#define MAX_CRAWL_THREADS 16
+#define MAX_PATH_LEN 1024
+#define INITIAL_CAPACITY 64
+
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} sPathList_t;
+
+typedef struct {
+    int rootFd;
+    const char *rootDir;
+    CrawlerDirectoryCallback onDirectory;
+
+    // Directories still to be read, relative to rootFd ("" is the root)
+    sPathList_t pendingDirs;
+    int numBusy; // threads currently reading a directory
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} sCrawl_t;
+
+typedef struct {
+    sCrawl_t *pCrawl;
+    sPathList_t files;
+} sCrawlWorker_t;
+
+
+// Takes ownership of path
+static void addPath(sPathList_t *pList, char *path)
+{
+    if (pList->count == pList->capacity)
+    {
+        pList->capacity = pList->capacity > 0 ? pList->capacity * 2 : INITIAL_CAPACITY;
+        pList->paths = realloc(pList->paths, pList->capacity * sizeof(char*));
+        if (!pList->paths)
+        {
+            perror("ERROR: Unable to allocate crawl results");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pList->paths[pList->count++] = path;
+}
+
+static char* joinPath(const char *dir, const char *name)
+{
+    char path[MAX_PATH_LEN];
+    if (dir[0] == '\0')
+    {
+        snprintf(path, sizeof(path), "%s", name);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+    }
+    return strdup(path);
+}
+
+static const char *musicExtensions[] = { ".mp3", ".flac", ".wav" };
+#define NUM_MUSIC_EXTENSIONS (sizeof(musicExtensions) / sizeof(musicExtensions[0]))
+
+static bool hasMusicExtension(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL) return false;
+
+    for (size_t i=0; i<NUM_MUSIC_EXTENSIONS; i++)
+    {
+        if (strcasecmp(ext, musicExtensions[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Checks that one of the codecs recognizes the start of the file
+static bool hasMusicHeader(int fd)
+{
+    unsigned char header[CODEC_PROBE_BYTES];
+    ssize_t numBytes = read(fd, header, CODEC_PROBE_BYTES);
+    if (numBytes <= 0) return false;
+
+    return Codec_probe(header, numBytes) != NULL;
+}
+
+static bool isMusicName(const char *name)
+{
+    return name[0] != '.' && hasMusicExtension(name);
+}
+
+// path is relative to dirFd
+static bool hasMusicHeaderAt(int dirFd, const char *path)
+{
+    int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool isMusic = hasMusicHeader(fd);
+    close(fd);
+    return isMusic;
+}
+
+bool Crawler_isMusicFile(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    return isMusicName(name) && hasMusicHeaderAt(AT_FDCWD, path);
+}
+
+// Reads one directory, adding music files to the worker's results and subdirectories to newDirs
+static void readDirectory(sCrawlWorker_t *pWorker, const char *relDir, sPathList_t *pNewDirs)
+{
+    sCrawl_t *pCrawl = pWorker->pCrawl;
+
+    int dirFd = openat(pCrawl->rootFd, relDir[0] ? relDir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) return;
+    DIR *d = fdopendir(dirFd);
+    if (!d)
+    {
+        close(dirFd);
+        return;
+    }
+
+    char *fullDir = relDir[0] ? joinPath(pCrawl->rootDir, relDir) : strdup(pCrawl->rootDir);
+    if (pCrawl->onDirectory) pCrawl->onDirectory(fullDir);
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (ent->d_name[0] == '.') continue;
+
+        bool isDir = ent->d_type == DT_DIR;
+        bool isFile = ent->d_type == DT_REG;
+        if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+        {
+            struct stat st;
+            if (fstatat(dirFd, ent->d_name, &st, 0) != 0) continue;
+            // Links to files are followed, links to directories are not so loops can't happen
+            isDir = S_ISDIR(st.st_mode) && ent->d_type != DT_LNK;
+            isFile = S_ISREG(st.st_mode);
+        }
+
+        if (isDir)
+        {
+            addPath(pNewDirs, joinPath(relDir, ent->d_name));
+        }
+        else if (isFile && isMusicName(ent->d_name) && hasMusicHeaderAt(dirFd, ent->d_name))
+        {
+            addPath(&pWorker->files, joinPath(fullDir, ent->d_name));
+        }
+    }
+
+    free(fullDir);
+    closedir(d);
+}
+
+static void* crawlThreadFunc(void *arg)
+{
+    sCrawlWorker_t *pWorker = arg;
+    sCrawl_t *pCrawl = pWorker->pCrawl;
+    sPathList_t newDirs = {NULL, 0, 0};
+
+    pthread_mutex_lock(&pCrawl->mutex);
+    while (true)
+    {
+        // Another thread may still find more directories
+        while (pCrawl->pendingDirs.count == 0 && pCrawl->numBusy > 0)
+        {
+            pthread_cond_wait(&pCrawl->cond, &pCrawl->mutex);
+        }
+        if (pCrawl->pendingDirs.count == 0) break;
+
+        char *relDir = pCrawl->pendingDirs.paths[--pCrawl->pendingDirs.count];
+        pCrawl->numBusy++;
+        pthread_mutex_unlock(&pCrawl->mutex);
+
+        readDirectory(pWorker, relDir, &newDirs);
+        free(relDir);
+
+        pthread_mutex_lock(&pCrawl->mutex);
+        for (int i=0; i<newDirs.count; i++)
+        {
+            addPath(&pCrawl->pendingDirs, newDirs.paths[i]);
+        }
+        newDirs.count = 0;
+        pCrawl->numBusy--;
+        pthread_cond_broadcast(&pCrawl->cond);
+    }
+    pthread_mutex_unlock(&pCrawl->mutex);
+
+    free(newDirs.paths);
+    return NULL;
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+char** Crawler_findMusicFiles(const char *rootDir, int numThreads, CrawlerDirectoryCallback onDirectory, int *pNumFiles)
+{
+    *pNumFiles = 0;
+
+    sCrawl_t crawl = {
+        .rootFd = open(rootDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+        .rootDir = rootDir,
+        .onDirectory = onDirectory,
+        .pendingDirs = {NULL, 0, 0},
+        .numBusy = 0,
+    };
+    if (crawl.rootFd < 0)
+    {
+        perror("WARNING: Unable to open music directory");
+        return NULL;
+    }
+    pthread_mutex_init(&crawl.mutex, NULL);
+    pthread_cond_init(&crawl.cond, NULL);
+    addPath(&crawl.pendingDirs, strdup(""));
+
+    if (numThreads <= 0) numThreads = DEFAULT_NUM_THREADS;
+    if (numThreads > MAX_CRAWL_THREADS) numThreads = MAX_CRAWL_THREADS;
+
+    sCrawlWorker_t workers[MAX_CRAWL_THREADS];
+    pthread_t threads[MAX_CRAWL_THREADS];
+    for (int i=0; i<numThreads; i++)
+    {
+        workers[i].pCrawl = &crawl;
+        workers[i].files = (sPathList_t){NULL, 0, 0};
+    }
+
+    // The calling thread is one of the workers
+    for (int i=1; i<numThreads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, crawlThreadFunc, &workers[i]) != 0)
+        {
+            perror("Failed to spawn thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    crawlThreadFunc(&workers[0]);
+    for (int i=1; i<numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Merge and sort so the result does not depend on which thread found what
+    sPathList_t files = {NULL, 0, 0};
+    for (int i=0; i<numThreads; i++)
+    {
+        for (int j=0; j<workers[i].files.count; j++)
+        {
+            addPath(&files, workers[i].files.paths[j]);
+        }
+        free(workers[i].files.paths);
+    }
+    qsort(files.paths, files.count, sizeof(char*), comparePaths);
+
+    free(crawl.pendingDirs.paths);
+    pthread_mutex_destroy(&crawl.mutex);
+    pthread_cond_destroy(&crawl.cond);
+    close(crawl.rootFd);
+
+    *pNumFiles = files.count;
+    return files.paths;
+}
+
+void Crawler_freeFiles(char **files, int numFiles)
+{
+    for (int i=0; i<numFiles; i++)
+    {
+        free(files[i]);
+    }
+    free(files);
+}
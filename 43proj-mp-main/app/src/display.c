@@ -5,7 +5,9 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <assert.h>
+#include <time.h>
 #include "audio_datatypes.h"
+#include "boot.h"
 
 #define HIGHLIGHT_COLOUR MAGENTA
 #define ACCENT_COLOUR BRRED
@@ -41,8 +43,18 @@
 #define SONG_BOX_HEIGHT 25 
 #define SONG_BOX_WIDTH 210
 
+// Damage tracking: the frame is compared with what the panel shows in tiles, and
+// runs of changed tiles are sent as windows shrunk to the pixels that changed.
+#define DIRTY_TILE_SIZE 16
+#define DIRTY_TILES_X ((LCD_1IN54_WIDTH + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE)
+#define DIRTY_TILES_Y ((LCD_1IN54_HEIGHT + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE)
+// More windows than this and the whole frame is sent instead
+#define MAX_DIRTY_RECTS 32
+
 // prototypes
 static void Display_drawString(char* str, sFONT* font, int line);
+static void pushFrame(void);
+static void pushRect(UWORD xStart, UWORD yStart, UWORD xEnd, UWORD yEnd);
 static UWORD Display_computeLineYStart(int line);
 static bool splitAndTruncate(char* input, char *out1, char *out2);
 static void getSongDispStr(char* orig, char* dest, int bufLen);
@@ -52,7 +64,11 @@ static void drawPlayIcon(UWORD xStart, UWORD yStart, UWORD xEnd, UWORD yEnd, boo
 static void drawCommands(bool isPlaying, eMainPageElem elemSelected);
 static void drawPlayback(double currPlaytime, double totalPlaytime);
 
+static void drawPlaybackTrack(void);
+static void drawVolumeFrame(void);
 static void drawVolumeVertical(int volume);
+static void drawListBoxes(UWORD startY);
+static void prerenderSprites(void);
 static void drawSongList(char** songNames, int numSongs, int selectedSong, UWORD);
 static void drawQueueList(char** songNames, int numSongs, int selectedSong, UWORD startY);
 
@@ -68,6 +84,29 @@ typedef enum eLines
   NUM_LINES
 } eLines;
 
+/** A region of the screen; the end coordinates are exclusive. */
+typedef struct {
+  UWORD xStart;
+  UWORD yStart;
+  UWORD xEnd;
+  UWORD yEnd;
+} Display_Rect_t;
+
+/** Icons on the home screen, each drawn once per variant and then copied in. */
+typedef enum {
+  SPRITE_PREV,
+  SPRITE_PLAY,
+  SPRITE_PAUSE,
+  SPRITE_NEXT,
+  NUM_SPRITES
+} eSprite;
+
+/** A pre-rendered block of RGB565 pixels and where it goes on the screen. */
+typedef struct {
+  Display_Rect_t rect;
+  UWORD *pixels;
+} Display_Sprite_t;
+
 /** Structure representing the layout of the display */
 typedef struct {
   struct Display_Layout_Line_t {
@@ -81,20 +120,57 @@ static bool s_initialized = false;
 static Display_Opts_t s_opts;
 static Display_Layout_t s_layout;
 static UWORD *s_imageBuffer;
+// What the panel shows, to find what a new frame changed
+static UWORD *s_shownBuffer;
+// One row of pixels in the byte order the panel reads
+static UBYTE s_rowBytes[LCD_1IN54_WIDTH * 2];
+static uint64_t s_bytesPushed = 0;
+static uint64_t s_renderNs = 0;
+
+// What never changes on a page is drawn once into these and copied in at the start
+// of every frame: white, the header line, the volume frame and progress track on the
+// home screen, the row boxes on the list screens.
+static UWORD *s_homeBackground;
+static UWORD *s_listBackground;
+// [sprite][selected]
+static Display_Sprite_t s_sprites[NUM_SPRITES][2];
+
+static long long getTimeInNs(void)
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+/** Starts a frame from a pre-drawn background. */
+static void startFrame(const UWORD *background)
+{
+  Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
+  memcpy(s_imageBuffer, background, IMAGE_SIZE);
+}
+
+/** Copies a sprite into the frame one row at a time. */
+static void blitSprite(const Display_Sprite_t *pSprite)
+{
+  const Display_Rect_t *pRect = &pSprite->rect;
+  UWORD width = pRect->xEnd - pRect->xStart;
+  for (UWORD y = pRect->yStart; y < pRect->yEnd; y++)
+  {
+    memcpy(s_imageBuffer + (UDOUBLE)y * LCD_1IN54_WIDTH + pRect->xStart,
+      pSprite->pixels + (UDOUBLE)(y - pRect->yStart) * width, width * sizeof(UWORD));
+  }
+}
 
 void Display_updateHomeScreen(Display_Request_t request)
 {
   assert(s_initialized);
 
-  // initialize the RAM frame buffer to be blank
-  Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
-  Paint_Clear(WHITE);
+  long long startNs = getTimeInNs();
+  startFrame(s_homeBackground);
 
   Display_drawString(request.title, s_opts.titleFont, TITLE_LINE); // title on line 0
 
   UWORD currY = Display_computeLineYStart(HEADER_SEP_LINE);
-  Paint_DrawLine(DISPLAY_X_MARGIN, currY, DISPLAY_X_MARGIN + HEADER_LINE_LEN, currY, HIGHLIGHT_COLOUR, 2, LINE_STYLE_SOLID);
-
   currY += s_layout.lines[HEADER_SEP_LINE].spacing;
 
   char songNameLine1[SONG_NAME_LEN_PER_LINE + 1];
@@ -118,36 +194,37 @@ void Display_updateHomeScreen(Display_Request_t request)
   drawPlayback(request.currPlaytime, request.totalPlaytime);
 
   drawCommands(request.isPlaying, request.elemSelected);
+  s_renderNs += getTimeInNs() - startNs;
 
-  LCD_1IN54_Display(s_imageBuffer);
+  pushFrame();
 }
 
 void Display_updateSongSelectScreen(File_List_Display_Request_t request)
 {
-  Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
-  Paint_Clear(WHITE);
+  long long startNs = getTimeInNs();
+  startFrame(s_listBackground);
 
   Display_drawString(request.title, s_opts.titleFont, TITLE_LINE); // title on line 0
 
   UWORD currY = Display_computeLineYStart(HEADER_SEP_LINE);
-  Paint_DrawLine(DISPLAY_X_MARGIN, currY, DISPLAY_X_MARGIN + HEADER_LINE_LEN, currY, HIGHLIGHT_COLOUR, 2, LINE_STYLE_SOLID);
   drawSongList(request.songNames, request.numSongs, request.selectedSong, currY);
+  s_renderNs += getTimeInNs() - startNs;
 
-  LCD_1IN54_Display(s_imageBuffer);
+  pushFrame();
 }
 
 void Display_updateQueueScreen(File_List_Display_Request_t request)
 {
-  Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
-  Paint_Clear(WHITE);
+  long long startNs = getTimeInNs();
+  startFrame(s_listBackground);
 
   Display_drawString(request.title, s_opts.titleFont, TITLE_LINE); // title on line 0
 
   UWORD currY = Display_computeLineYStart(HEADER_SEP_LINE);
-  Paint_DrawLine(DISPLAY_X_MARGIN, currY, DISPLAY_X_MARGIN + HEADER_LINE_LEN, currY, HIGHLIGHT_COLOUR, 2, LINE_STYLE_SOLID);
   drawQueueList(request.songNames, request.numSongs, request.selectedSong, currY);
+  s_renderNs += getTimeInNs() - startNs;
 
-  LCD_1IN54_Display(s_imageBuffer);
+  pushFrame();
 }
 
 
@@ -181,6 +258,174 @@ static UWORD Display_computeLineYStart(int line)
 }
 
 
+/** True if any pixel of the rows between yStart and yEnd differs from the panel between xStart and xEnd. */
+static bool isChanged(UWORD xStart, UWORD yStart, UWORD xEnd, UWORD yEnd)
+{
+  for (UWORD y = yStart; y < yEnd; y++)
+  {
+    UDOUBLE offset = (UDOUBLE)y * LCD_1IN54_WIDTH + xStart;
+    if (memcmp(s_imageBuffer + offset, s_shownBuffer + offset, (xEnd - xStart) * sizeof(UWORD)) != 0) return true;
+  }
+  return false;
+}
+
+/** Shrinks a rectangle to the pixels in it that differ from the panel. */
+static void shrinkToChanges(Display_Rect_t *pRect)
+{
+  UWORD xMin = pRect->xEnd;
+  UWORD xMax = pRect->xStart;
+  UWORD yMin = pRect->yEnd;
+  UWORD yMax = pRect->yStart;
+
+  for (UWORD y = pRect->yStart; y < pRect->yEnd; y++)
+  {
+    const UWORD *pNew = s_imageBuffer + (UDOUBLE)y * LCD_1IN54_WIDTH;
+    const UWORD *pShown = s_shownBuffer + (UDOUBLE)y * LCD_1IN54_WIDTH;
+    UWORD x = pRect->xStart;
+    while (x < pRect->xEnd && pNew[x] == pShown[x]) x++;
+    if (x == pRect->xEnd) continue;
+
+    UWORD xLast = pRect->xEnd - 1;
+    while (pNew[xLast] == pShown[xLast]) xLast--;
+
+    if (x < xMin) xMin = x;
+    if (xLast + 1 > xMax) xMax = xLast + 1;
+    if (y < yMin) yMin = y;
+    yMax = y + 1;
+  }
+
+  *pRect = (Display_Rect_t){ xMin, yMin, xMax, yMax };
+}
+
+/**
+ * Finds what changed since the last frame as runs of changed tiles. A run that covers
+ * the same columns as one in the tile row above extends it.
+ * Returns the number of rectangles, or -1 if there are more than maxRects.
+ */
+static int findDirtyRects(Display_Rect_t *rects, int maxRects)
+{
+  int numRects = 0;
+  // Index into rects of the run starting at each tile column in the tile row above, or -1
+  int above[DIRTY_TILES_X];
+  for (int tx = 0; tx < DIRTY_TILES_X; tx++) above[tx] = -1;
+
+  for (int ty = 0; ty < DIRTY_TILES_Y; ty++)
+  {
+    UWORD yStart = ty * DIRTY_TILE_SIZE;
+    UWORD yEnd = yStart + DIRTY_TILE_SIZE < LCD_1IN54_HEIGHT ? yStart + DIRTY_TILE_SIZE : LCD_1IN54_HEIGHT;
+    int current[DIRTY_TILES_X];
+
+    int tx = 0;
+    while (tx < DIRTY_TILES_X)
+    {
+      current[tx] = -1;
+      UWORD xStart = tx * DIRTY_TILE_SIZE;
+      UWORD xEnd = xStart + DIRTY_TILE_SIZE < LCD_1IN54_WIDTH ? xStart + DIRTY_TILE_SIZE : LCD_1IN54_WIDTH;
+      if (!isChanged(xStart, yStart, xEnd, yEnd))
+      {
+        tx++;
+        continue;
+      }
+
+      // Extend the run right over the changed tiles next to it
+      int txStart = tx;
+      while (tx + 1 < DIRTY_TILES_X)
+      {
+        UWORD xNext = (tx + 1) * DIRTY_TILE_SIZE;
+        UWORD xNextEnd = xNext + DIRTY_TILE_SIZE < LCD_1IN54_WIDTH ? xNext + DIRTY_TILE_SIZE : LCD_1IN54_WIDTH;
+        if (!isChanged(xNext, yStart, xNextEnd, yEnd)) break;
+        tx++;
+        current[tx] = -1;
+        xEnd = xNextEnd;
+      }
+
+      int index = above[txStart];
+      if (index >= 0 && rects[index].xEnd == xEnd && rects[index].yEnd == yStart)
+      {
+        rects[index].yEnd = yEnd;
+      }
+      else
+      {
+        if (numRects == maxRects) return -1;
+        index = numRects++;
+        rects[index] = (Display_Rect_t){ xStart, yStart, xEnd, yEnd };
+      }
+      current[txStart] = index;
+      tx++;
+    }
+
+    memcpy(above, current, sizeof(above));
+  }
+
+  for (int i = 0; i < numRects; i++)
+  {
+    shrinkToChanges(&rects[i]);
+  }
+  return numRects;
+}
+
+/** Sends one region of the frame through the panel's address window. */
+static void pushRect(UWORD xStart, UWORD yStart, UWORD xEnd, UWORD yEnd)
+{
+  // Column and row address set, then memory write; the panel fills the window row by row
+  LCD_1IN54_SetWindows(xStart, yStart, xEnd, yEnd);
+  DEV_Digital_Write(LCD_DC, 1);
+
+  UDOUBLE rowLen = (xEnd - xStart) * 2;
+  for (UWORD y = yStart; y < yEnd; y++)
+  {
+    UDOUBLE offset = (UDOUBLE)y * LCD_1IN54_WIDTH + xStart;
+    const UWORD *pRow = s_imageBuffer + offset;
+    for (UWORD x = 0; x < xEnd - xStart; x++)
+    {
+      s_rowBytes[2*x] = pRow[x] >> 8;
+      s_rowBytes[2*x + 1] = pRow[x] & 0xFF;
+    }
+    DEV_SPI_Write_nByte(s_rowBytes, rowLen);
+    memcpy(s_shownBuffer + offset, pRow, (xEnd - xStart) * sizeof(UWORD));
+  }
+  s_bytesPushed += rowLen * (yEnd - yStart);
+}
+
+/** Sends only what changed since the last frame, or the whole frame if most of it did. */
+static void pushFrame(void)
+{
+  Display_Rect_t rects[MAX_DIRTY_RECTS];
+  int numRects = findDirtyRects(rects, MAX_DIRTY_RECTS);
+
+  UDOUBLE numBytes = 0;
+  for (int i = 0; i < numRects; i++)
+  {
+    numBytes += (UDOUBLE)(rects[i].xEnd - rects[i].xStart) * (rects[i].yEnd - rects[i].yStart) * 2;
+  }
+
+  // Windows cost a few commands each, so past half the screen one transfer is cheaper
+  if (numRects < 0 || numBytes > IMAGE_SIZE / 2)
+  {
+    LCD_1IN54_Display(s_imageBuffer);
+    memcpy(s_shownBuffer, s_imageBuffer, IMAGE_SIZE);
+    s_bytesPushed += IMAGE_SIZE;
+  }
+  else
+  {
+    for (int i = 0; i < numRects; i++)
+    {
+      pushRect(rects[i].xStart, rects[i].yStart, rects[i].xEnd, rects[i].yEnd);
+    }
+  }
+  Boot_markFirstFrame();
+}
+
+uint64_t Display_getBytesPushed(void)
+{
+  return s_bytesPushed;
+}
+
+uint64_t Display_getRenderNs(void)
+{
+  return s_renderNs;
+}
+
 /**
  * Displays a string.
  * WARNING: Don't print strings with `\n`; will crash!
@@ -216,6 +461,35 @@ static void Display_layoutInit(Display_Opts_t opts)
   s_layout = layout;
 }
 
+/** Draws a background with the primitives into the frame buffer and keeps a copy. */
+static UWORD* saveBackground(void)
+{
+  UWORD *background;
+  if((background = (UWORD*) malloc(IMAGE_SIZE)) == NULL) {
+    perror("Failed to allocate background");
+    exit(0);
+  }
+  memcpy(background, s_imageBuffer, IMAGE_SIZE);
+  return background;
+}
+
+static void prerenderBackgrounds(void)
+{
+  UWORD headerY = Display_computeLineYStart(HEADER_SEP_LINE);
+
+  Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
+  Paint_Clear(WHITE);
+  Paint_DrawLine(DISPLAY_X_MARGIN, headerY, DISPLAY_X_MARGIN + HEADER_LINE_LEN, headerY, HIGHLIGHT_COLOUR, 2, LINE_STYLE_SOLID);
+  drawVolumeFrame();
+  drawPlaybackTrack();
+  s_homeBackground = saveBackground();
+
+  Paint_Clear(WHITE);
+  Paint_DrawLine(DISPLAY_X_MARGIN, headerY, DISPLAY_X_MARGIN + HEADER_LINE_LEN, headerY, HIGHLIGHT_COLOUR, 2, LINE_STYLE_SOLID);
+  drawListBoxes(headerY);
+  s_listBackground = saveBackground();
+}
+
 // static void Display_songListInit(Display_Opts_t opts)
 
 void Display_init(Display_Opts_t opts)
@@ -241,12 +515,42 @@ void Display_init(Display_Opts_t opts)
     perror("Failed to apply for black memory");
     exit(0);
   }
+  // The panel was just cleared to white
+  if((s_shownBuffer = (UWORD*) malloc(IMAGE_SIZE)) == NULL) {
+    perror("Failed to apply for black memory");
+    exit(0);
+  }
+  for (UDOUBLE i = 0; i < IMAGE_SIZE / 2; i++) s_shownBuffer[i] = WHITE;
 
   Display_layoutInit(opts);
+  prerenderBackgrounds();
+  prerenderSprites();
 
   s_initialized = true;
 }
 
+/** Where the progress bar's track runs, between the two playtimes. */
+static void getProgressTrack(UWORD *pXStart, UWORD *pXEnd, UWORD *pY)
+{
+  UWORD yStart = LCD_1IN54_HEIGHT - DISPLAY_Y_MARGIN - PROGESS_HEIGHT ;
+  UWORD timeStrWidth = s_opts.timeFont->Width * 4;
+  UWORD barPadding = 8;
+  UWORD xTotStart = LCD_1IN54_WIDTH - DISPLAY_X_MARGIN - timeStrWidth;
+
+  *pXStart = DISPLAY_X_MARGIN + timeStrWidth + barPadding;
+  *pXEnd = xTotStart - barPadding;
+  *pY = yStart + s_opts.timeFont->Height/2;
+}
+
+static void drawPlaybackTrack(void)
+{
+  UWORD xBarStart, xBarEnd, yBarBase;
+  getProgressTrack(&xBarStart, &xBarEnd, &yBarBase);
+
+  UWORD barHeight = 2;
+  Paint_DrawLine(xBarStart, yBarBase, xBarEnd, yBarBase, BLACK, barHeight, LINE_STYLE_SOLID);
+}
+
 static void drawPlayback(double currPlaytime, double totalPlaytime)
 {
   UWORD yStart = LCD_1IN54_HEIGHT - DISPLAY_Y_MARGIN - PROGESS_HEIGHT ;
@@ -269,15 +573,9 @@ static void drawPlayback(double currPlaytime, double totalPlaytime)
   UWORD xTotStart = LCD_1IN54_WIDTH - DISPLAY_X_MARGIN - timeStrWidth;
   Paint_DrawString_EN(xTotStart, yStart, totalPlaytimeStr, s_opts.timeFont, WHITE, BLACK);
 
-  // bar
-  UWORD barPadding = 8;
-  UWORD xBarStart = DISPLAY_X_MARGIN + timeStrWidth + barPadding;
-
-  UWORD barHeight = 2;
-  UWORD xBarEnd = xTotStart - barPadding;
-  UWORD yBarBase = yStart + s_opts.timeFont->Height/2;
-  Paint_DrawLine(xBarStart, yBarBase, xBarEnd, yBarBase, BLACK, barHeight, LINE_STYLE_SOLID);
-
+  // bar; its track is in the background
+  UWORD xBarStart, xBarEnd, yBarBase;
+  getProgressTrack(&xBarStart, &xBarEnd, &yBarBase);
 
   UWORD barHeightFill = 3;
   if (totalPlaytime > 0)
@@ -373,7 +671,8 @@ static void drawPrev(UWORD xStart, UWORD yStart, UWORD xEnd, UWORD yEnd, bool is
 
 }
 
-static void drawCommands(bool isPlaying, eMainPageElem elemSelected)
+/** Where each icon goes, without the sprite margin. Play and pause share a place. */
+static void getCommandLayout(Display_Rect_t icons[NUM_SPRITES])
 {
   UWORD yEnd = LCD_1IN54_HEIGHT - PROGESS_HEIGHT - DISPLAY_Y_MARGIN - 30;
   UWORD yStart = yEnd - PLAYBACK_STATE_HEIGHT;
@@ -388,30 +687,97 @@ static void drawCommands(bool isPlaying, eMainPageElem elemSelected)
   UWORD yStartPlayIcon = yCenter - PLAY_ICON_SIZE/2;
   UWORD yEndPlayIcon = yCenter + PLAY_ICON_SIZE/2;
 
-  // pause/play
-  if (isPlaying)
-  {
-    drawPauseIcon(xStartPlayIcon, yStartPlayIcon, xEndPlayIcon, yEndPlayIcon, elemSelected==PLAY);
-  }
-  else
-  {
-    drawPlayIcon(xStartPlayIcon, yStartPlayIcon, xEndPlayIcon, yEndPlayIcon, elemSelected==PLAY);
-  }
+  icons[SPRITE_PLAY] = (Display_Rect_t){ xStartPlayIcon, yStartPlayIcon, xEndPlayIcon, yEndPlayIcon };
+  icons[SPRITE_PAUSE] = icons[SPRITE_PLAY];
 
   // prev
   UWORD xCenterPrev = DISPLAY_X_MARGIN + (xStartPlayIcon - DISPLAY_X_MARGIN)/2;
-  UWORD xStartPrev = xCenterPrev - PREV_ICON_WIDTH/2;
-  UWORD xEndPrev = xCenterPrev + PREV_ICON_WIDTH/2;
   UWORD yStartPrev = yCenter - PREV_ICON_HEIGHT/2;
   UWORD yEndPrev = yCenter + PREV_ICON_HEIGHT/2;
-
-  drawPrev(xStartPrev, yStartPrev, xEndPrev, yEndPrev, false, elemSelected==PREV);
+  icons[SPRITE_PREV] = (Display_Rect_t){ xCenterPrev - PREV_ICON_WIDTH/2, yStartPrev, xCenterPrev + PREV_ICON_WIDTH/2, yEndPrev };
 
   UWORD xCenterNext = xEndPlayIcon + (LCD_1IN54_WIDTH - DISPLAY_X_MARGIN - xEndPlayIcon) / 2;
-  UWORD xStartNext = xCenterNext - PREV_ICON_WIDTH/2;
-  UWORD xEndNext = xCenterNext + PREV_ICON_WIDTH/2;
+  icons[SPRITE_NEXT] = (Display_Rect_t){ xCenterNext - PREV_ICON_WIDTH/2, yStartPrev, xCenterNext + PREV_ICON_WIDTH/2, yEndPrev };
+}
 
-  drawPrev(xStartNext, yStartPrev, xEndNext, yEndPrev, true, elemSelected==NEXT);
+static void drawIcon(eSprite sprite, const Display_Rect_t *pIcon, bool isSelected)
+{
+  switch (sprite)
+  {
+    case SPRITE_PREV:
+      drawPrev(pIcon->xStart, pIcon->yStart, pIcon->xEnd, pIcon->yEnd, false, isSelected);
+      break;
+    case SPRITE_PLAY:
+      drawPlayIcon(pIcon->xStart, pIcon->yStart, pIcon->xEnd, pIcon->yEnd, isSelected);
+      break;
+    case SPRITE_PAUSE:
+      drawPauseIcon(pIcon->xStart, pIcon->yStart, pIcon->xEnd, pIcon->yEnd, isSelected);
+      break;
+    case SPRITE_NEXT:
+      drawPrev(pIcon->xStart, pIcon->yStart, pIcon->xEnd, pIcon->yEnd, true, isSelected);
+      break;
+    default:
+      break;
+  }
+}
+
+/** The icon's place grown to cover every pixel drawn; thick strokes reach past it. */
+static Display_Rect_t getDrawnRect(Display_Rect_t rect)
+{
+  for (UWORD y = 0; y < LCD_1IN54_HEIGHT; y++)
+  {
+    for (UWORD x = 0; x < LCD_1IN54_WIDTH; x++)
+    {
+      if (s_imageBuffer[(UDOUBLE)y * LCD_1IN54_WIDTH + x] == WHITE) continue;
+
+      if (x < rect.xStart) rect.xStart = x;
+      if (x >= rect.xEnd) rect.xEnd = x + 1;
+      if (y < rect.yStart) rect.yStart = y;
+      if (y >= rect.yEnd) rect.yEnd = y + 1;
+    }
+  }
+  return rect;
+}
+
+/**
+ * Draws every icon, normal and selected, with the primitives and keeps the pixels.
+ * Uses the frame buffer as scratch space, so it runs before the first frame.
+ */
+static void prerenderSprites(void)
+{
+  Display_Rect_t icons[NUM_SPRITES];
+  getCommandLayout(icons);
+
+  for (int sprite = 0; sprite < NUM_SPRITES; sprite++)
+  {
+    for (int isSelected = 0; isSelected < 2; isSelected++)
+    {
+      Paint_NewImage(s_imageBuffer, LCD_1IN54_WIDTH, LCD_1IN54_HEIGHT, 0, WHITE, 16);
+      Paint_Clear(WHITE);
+      drawIcon(sprite, &icons[sprite], isSelected);
+
+      Display_Rect_t rect = getDrawnRect(icons[sprite]);
+      UWORD width = rect.xEnd - rect.xStart;
+      UWORD *pixels;
+      if((pixels = (UWORD*) malloc((UDOUBLE)width * (rect.yEnd - rect.yStart) * sizeof(UWORD))) == NULL) {
+        perror("Failed to allocate sprite");
+        exit(0);
+      }
+      for (UWORD y = rect.yStart; y < rect.yEnd; y++)
+      {
+        memcpy(pixels + (UDOUBLE)(y - rect.yStart) * width, s_imageBuffer + (UDOUBLE)y * LCD_1IN54_WIDTH + rect.xStart,
+          width * sizeof(UWORD));
+      }
+      s_sprites[sprite][isSelected] = (Display_Sprite_t){ rect, pixels };
+    }
+  }
+}
+
+static void drawCommands(bool isPlaying, eMainPageElem elemSelected)
+{
+  blitSprite(&s_sprites[isPlaying ? SPRITE_PAUSE : SPRITE_PLAY][elemSelected == PLAY]);
+  blitSprite(&s_sprites[SPRITE_PREV][elemSelected == PREV]);
+  blitSprite(&s_sprites[SPRITE_NEXT][elemSelected == NEXT]);
 }
 
 static bool splitAndTruncate(char* input, char *out1, char *out2)
@@ -439,7 +805,8 @@ static bool splitAndTruncate(char* input, char *out1, char *out2)
 }
 
 
-static void drawSongList(char** songNames, int numSongs, int selectedSong, UWORD startY)
+/** The row boxes both list screens share. */
+static void drawListBoxes(UWORD startY)
 {
   UWORD currY = startY+SONG_BOX_HEIGHT;
   for (int i=0; i<MAX_SONGS_DISP; i++)
@@ -449,8 +816,19 @@ static void drawSongList(char** songNames, int numSongs, int selectedSong, UWORD
     UWORD xStart = DISPLAY_X_MARGIN;
     UWORD xEnd = xStart + SONG_BOX_WIDTH;
 
-    // draw border
     Paint_DrawRectangle(xStart, yStart, xEnd, yEnd, BLACK, DOT_PIXEL_2X2, DRAW_FILL_EMPTY);
+  }
+}
+
+static void drawSongList(char** songNames, int numSongs, int selectedSong, UWORD startY)
+{
+  UWORD currY = startY+SONG_BOX_HEIGHT;
+  for (int i=0; i<MAX_SONGS_DISP; i++)
+  {
+    UWORD yStart = currY+(SONG_BOX_HEIGHT*i);
+    UWORD xStart = DISPLAY_X_MARGIN;
+
+    // border is in the background
 
     if (i < numSongs)
     {
@@ -469,12 +847,9 @@ static void drawQueueList(char** songNames, int numSongs, int selectedSong, UWOR
   for (int i=0; i<MAX_SONGS_DISP; i++)
   {
     UWORD yStart = currY+(SONG_BOX_HEIGHT*i);
-    UWORD yEnd = yStart+SONG_BOX_HEIGHT;
     UWORD xStart = DISPLAY_X_MARGIN;
-    UWORD xEnd = xStart + SONG_BOX_WIDTH;
 
-    // draw border
-    Paint_DrawRectangle(xStart, yStart, xEnd, yEnd, BLACK, DOT_PIXEL_2X2, DRAW_FILL_EMPTY);
+    // border is in the background
 
     if (i < numSongs)
     {
@@ -491,6 +866,15 @@ static void drawQueueList(char** songNames, int numSongs, int selectedSong, UWOR
   }
 }
 
+static void drawVolumeFrame(void)
+{
+  UWORD xEnd = LCD_1IN54_WIDTH - DISPLAY_X_MARGIN;
+  UWORD volumeTop = VOLUME_TOP_PADDING;
+  UWORD volumeBot = volumeTop+VOLUME_MAX_HEIGHT;
+
+  Paint_DrawRectangle(xEnd-VOLUME_BAR_WIDTH, volumeTop, xEnd, volumeBot, ACCENT_COLOUR2, DOT_PIXEL_3X3, DRAW_FILL_EMPTY);
+}
+
 static void drawVolumeVertical(int volume)
 {
   float volumeFilledRatio = ((float)volume / (float)MAX_VOLUME);
@@ -502,8 +886,7 @@ static void drawVolumeVertical(int volume)
   UWORD volumeBot = volumeTop+VOLUME_MAX_HEIGHT;
 
 
-  // draw outer rectangle
-  Paint_DrawRectangle(xEnd-VOLUME_BAR_WIDTH, volumeTop, xEnd, volumeBot, ACCENT_COLOUR2, DOT_PIXEL_3X3, DRAW_FILL_EMPTY);
+  // outer rectangle is in the background
 
   // draw inner rectangle
   Paint_DrawRectangle(
@@ -566,6 +949,19 @@ void Display_cleanup(void)
 
   free(s_imageBuffer);
   s_imageBuffer = NULL;
+  free(s_shownBuffer);
+  s_shownBuffer = NULL;
+  free(s_homeBackground);
+  s_homeBackground = NULL;
+  free(s_listBackground);
+  s_listBackground = NULL;
+  for (int sprite = 0; sprite < NUM_SPRITES; sprite++)
+  {
+    free(s_sprites[sprite][0].pixels);
+    free(s_sprites[sprite][1].pixels);
+    s_sprites[sprite][0].pixels = NULL;
+    s_sprites[sprite][1].pixels = NULL;
+  }
   DEV_ModuleExit();
 
   s_initialized = false;
@@ -0,0 +1,232 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "effect_bank.h"
+#include "audio_mixer.h"
+
+#define BANK_MAGIC "FXBK"
+#define BANK_VERSION 2
+// Each effect starts on its own page so playing one never pages in its neighbours
+#define BANK_ALIGN 4096
+#define MAX_PATH_LEN 1024
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t numEffects;
+    uint32_t reserved;
+} sBankHeader_t;
+
+typedef struct {
+    char name[EFFECT_BANK_MAX_NAME_LEN];
+    uint32_t numChannels;
+    uint32_t numSamples;
+    uint64_t offset; // from the start of the file
+    // The wave file it was built from, to notice when that changes
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+} sBankEntry_t;
+
+struct sEffectBank {
+    unsigned char *pMap;
+    size_t mapSize;
+    const sBankEntry_t *entries;
+    uint32_t numEffects;
+};
+
+
+static size_t alignUp(size_t value)
+{
+    return (value + BANK_ALIGN - 1) / BANK_ALIGN * BANK_ALIGN;
+}
+
+static bool writeAt(FILE *file, size_t offset, const void *pData, size_t numBytes)
+{
+    return fseek(file, offset, SEEK_SET) == 0 && fwrite(pData, 1, numBytes, file) == numBytes;
+}
+
+// Size and modification time of a wave file; both 0 if it can't be read
+static void statSource(const char *wavFile, uint64_t *pSize, int64_t *pMtimeNs)
+{
+    struct stat st;
+    if (stat(wavFile, &st) != 0)
+    {
+        *pSize = 0;
+        *pMtimeNs = 0;
+        return;
+    }
+    *pSize = st.st_size;
+    *pMtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool EffectBank_build(const char *path, const char **names, const char **wavFiles, int numEffects)
+{
+    char tempPath[MAX_PATH_LEN];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    FILE *file = fopen(tempPath, "wb");
+    if (file == NULL)
+    {
+        perror("WARNING: Unable to create effect bank");
+        return false;
+    }
+
+    sBankEntry_t *entries = calloc(numEffects, sizeof(sBankEntry_t));
+    if (entries == NULL)
+    {
+        perror("ERROR: Unable to allocate effect bank index");
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok = true;
+    size_t offset = alignUp(sizeof(sBankHeader_t) + numEffects * sizeof(sBankEntry_t));
+    for (int i=0; i<numEffects && ok; i++)
+    {
+        statSource(wavFiles[i], &entries[i].sourceSize, &entries[i].sourceMtimeNs);
+
+        // The mixer's loader does the parsing and conversion
+        soundData_t sound;
+        AudioMixer_readWaveFileIntoMemory((char*)wavFiles[i], &sound);
+
+        snprintf(entries[i].name, EFFECT_BANK_MAX_NAME_LEN, "%s", names[i]);
+        entries[i].numChannels = sound.numChannels;
+        entries[i].numSamples = sound.numSamples;
+        entries[i].offset = offset;
+
+        size_t numBytes = sound.numSamples * sizeof(short);
+        ok = writeAt(file, offset, sound.pData, numBytes);
+        offset = alignUp(offset + numBytes);
+
+        AudioMixer_freeWaveFileData(&sound);
+    }
+
+    sBankHeader_t header = { .version = BANK_VERSION, .numEffects = numEffects };
+    memcpy(header.magic, BANK_MAGIC, sizeof(header.magic));
+    ok = ok && writeAt(file, 0, &header, sizeof(header)) &&
+        writeAt(file, sizeof(header), entries, numEffects * sizeof(sBankEntry_t));
+    free(entries);
+
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(tempPath, path) != 0)
+    {
+        perror("WARNING: Unable to write effect bank");
+        unlink(tempPath);
+        return false;
+    }
+
+    printf("Built effect bank %s with %d effects\n", path, numEffects);
+    return true;
+}
+
+// Checks the header and that every entry lies inside the file
+static bool isValidBank(const unsigned char *pMap, size_t mapSize)
+{
+    if (mapSize < sizeof(sBankHeader_t)) return false;
+
+    const sBankHeader_t *pHeader = (const sBankHeader_t*)pMap;
+    if (memcmp(pHeader->magic, BANK_MAGIC, sizeof(pHeader->magic)) != 0 || pHeader->version != BANK_VERSION) return false;
+    if (pHeader->numEffects > (mapSize - sizeof(sBankHeader_t)) / sizeof(sBankEntry_t)) return false;
+
+    const sBankEntry_t *entries = (const sBankEntry_t*)(pMap + sizeof(sBankHeader_t));
+    for (uint32_t i=0; i<pHeader->numEffects; i++)
+    {
+        const sBankEntry_t *pEntry = &entries[i];
+        if (pEntry->numChannels < 1 || pEntry->numChannels > 2 || pEntry->offset % sizeof(short) != 0) return false;
+        if (pEntry->offset > mapSize || pEntry->numSamples > (mapSize - pEntry->offset) / sizeof(short)) return false;
+    }
+    return true;
+}
+
+sEffectBank_t* EffectBank_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    unsigned char *pMap = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        // No MAP_POPULATE: effects page in on first use
+        pMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (pMap == MAP_FAILED) return NULL;
+
+    if (!isValidBank(pMap, st.st_size))
+    {
+        fprintf(stderr, "WARNING: %s is not a valid effect bank\n", path);
+        munmap(pMap, st.st_size);
+        return NULL;
+    }
+
+    sEffectBank_t *pBank = malloc(sizeof(sEffectBank_t));
+    if (pBank == NULL)
+    {
+        perror("ERROR: Unable to allocate effect bank");
+        exit(EXIT_FAILURE);
+    }
+    pBank->pMap = pMap;
+    pBank->mapSize = st.st_size;
+    pBank->entries = (const sBankEntry_t*)(pMap + sizeof(sBankHeader_t));
+    pBank->numEffects = ((const sBankHeader_t*)pMap)->numEffects;
+    return pBank;
+}
+
+void EffectBank_close(sEffectBank_t *pBank)
+{
+    if (pBank == NULL) return;
+
+    munmap(pBank->pMap, pBank->mapSize);
+    free(pBank);
+}
+
+static const sBankEntry_t* findEntry(sEffectBank_t *pBank, const char *name)
+{
+    for (uint32_t i=0; i<pBank->numEffects; i++)
+    {
+        if (strncmp(pBank->entries[i].name, name, EFFECT_BANK_MAX_NAME_LEN) == 0) return &pBank->entries[i];
+    }
+    return NULL;
+}
+
+bool EffectBank_find(sEffectBank_t *pBank, const char *name, soundData_t *pSound)
+{
+    const sBankEntry_t *pEntry = findEntry(pBank, name);
+    if (pEntry == NULL) return false;
+
+    pSound->numSamples = pEntry->numSamples;
+    pSound->numChannels = pEntry->numChannels;
+    pSound->pData = (const short*)(pBank->pMap + pEntry->offset);
+    // The bank owns the mapping
+    pSound->pMapping = NULL;
+    pSound->mappingSize = 0;
+    return true;
+}
+
+bool EffectBank_isCurrent(sEffectBank_t *pBank, const char *name, const char *wavFile)
+{
+    const sBankEntry_t *pEntry = findEntry(pBank, name);
+    if (pEntry == NULL) return false;
+
+    uint64_t size;
+    int64_t mtimeNs;
+    statSource(wavFile, &size, &mtimeNs);
+    return size == pEntry->sourceSize && mtimeNs == pEntry->sourceMtimeNs;
+}
+
+void EffectBank_prefetch(sEffectBank_t *pBank, const soundData_t *pSound)
+{
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)pSound->pData & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t)(pSound->pData + pSound->numSamples);
+    if (start < (uintptr_t)pBank->pMap || end > (uintptr_t)(pBank->pMap + pBank->mapSize)) return;
+
+    madvise((void*)start, end - start, MADV_WILLNEED);
+}
@@ -1,66 +1,175 @@
 #include "effect_loader.h"
+#include "effect_bank.h"
 #include "audio_mixer.h"
+#include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#define KICK_FILE "wave-files/100051__menegass__gui-drum-bd-hard.wav"
-#define HIHAT_FILE "wave-files/100053__menegass__gui-drum-cc.wav"
-#define SNARE_FILE "wave-files/100059__menegass__gui-drum-snare-soft.wav"
-#define SNARE_HARD_FILE "wave-files/100058__menegass__gui-drum-snare-hard.wav"
-#define CYMBAL_FILE "wave-files/100057__menegass__gui-drum-cyn-soft.wav"
-#define TOMLOW_FILE "wave-files/100064__menegass__gui-drum-tom-lo-hard.wav"
-#define TOMMID_FILE "wave-files/100066__menegass__gui-drum-tom-mid-hard.wav"
 
 #define CLICK_FILE "wave-files/click.wav"
 #define QUEUE_FILE "wave-files/queue.wav"
-soundData_t theKick;
-soundData_t theHihat;
-soundData_t theSnare;
-soundData_t theSnareHard;
-soundData_t theCymbal;
-soundData_t theTomLow;
-soundData_t theTomMid;
-soundData_t click;
-soundData_t queue;
+#define SNARE_HARD_FILE "wave-files/100058__menegass__gui-drum-snare-hard.wav"
 
-void EffectLoader_requestToBeQued(EffectCollection desiredSound) {
-  if (desiredSound == EFFECT_SOUND1) {
-    AudioMixer_queueSound(&click);
+// Rebuilt from the registered wave files whenever one is missing from it or has changed
+#define BANK_FILE "wave-files/effects.bank"
+#define MAX_EFFECTS 32
+
+typedef struct {
+  char name[EFFECT_BANK_MAX_NAME_LEN];
+  const char *wavFile;
+  soundData_t sound;
+  bool loaded;
+  // Loaded from its own file rather than pointing into the bank
+  bool ownsData;
+} sEffect_t;
+
+static sEffect_t effects[MAX_EFFECTS];
+static int numEffects = 0;
+static sEffectBank_t *pBank = NULL;
+static pthread_mutex_t effectMutex = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
+
+// Names of the effects behind the EffectCollection values
+static const char *collectionNames[EFFECT_SOUND_COLLECTION_SIZE] = {
+  [EFFECT_SOUND1] = "click",
+  [EFFECT_SOUND2] = "queue",
+  [EFFECT_SOUND3] = "snare-hard",
+};
+
+static sEffect_t* findEffect(const char *name) {
+  for (int i = 0; i < numEffects; i++) {
+    if (strncmp(effects[i].name, name, EFFECT_BANK_MAX_NAME_LEN) == 0) {
+      return &effects[i];
+    }
   }
-  if (desiredSound == EFFECT_SOUND2) {
-    AudioMixer_queueSound(&queue);
+  return NULL;
+}
+
+// Points the effect at its samples in the bank, or reads its wave file if the bank doesn't have it
+static void loadEffect(sEffect_t *pEffect) {
+  if (pBank != NULL && EffectBank_find(pBank, pEffect->name, &pEffect->sound)) {
+    pEffect->ownsData = false;
+  } else {
+    AudioMixer_readWaveFileIntoMemory((char*)pEffect->wavFile, &pEffect->sound);
+    pEffect->ownsData = true;
   }
-  if (desiredSound == EFFECT_SOUND3) {
-    AudioMixer_queueSound(&theSnareHard);
+  pEffect->loaded = true;
+}
+
+static bool bankIsCurrent(void) {
+  for (int i = 0; i < numEffects; i++) {
+    if (!EffectBank_isCurrent(pBank, effects[i].name, effects[i].wavFile)) {
+      return false;
+    }
   }
+  return true;
 }
 
-static void EffectLoader_feedToMemory(void) {
-  AudioMixer_readWaveFileIntoMemory(KICK_FILE, &theKick);
-  AudioMixer_readWaveFileIntoMemory(HIHAT_FILE, &theHihat);
-  AudioMixer_readWaveFileIntoMemory(SNARE_FILE, &theSnare);
-  AudioMixer_readWaveFileIntoMemory(SNARE_HARD_FILE, &theSnareHard);
-  AudioMixer_readWaveFileIntoMemory(CYMBAL_FILE, &theCymbal);
-  AudioMixer_readWaveFileIntoMemory(TOMLOW_FILE, &theTomLow);
-  AudioMixer_readWaveFileIntoMemory(TOMMID_FILE, &theTomMid);
-  AudioMixer_readWaveFileIntoMemory(CLICK_FILE, &click);
-  AudioMixer_readWaveFileIntoMemory(QUEUE_FILE, &queue);
+static void openBank(void) {
+  pBank = EffectBank_open(BANK_FILE);
+  if (pBank != NULL && bankIsCurrent()) {
+    return;
+  }
+
+  EffectBank_close(pBank);
+  pBank = NULL;
+
+  const char *names[MAX_EFFECTS];
+  const char *wavFiles[MAX_EFFECTS];
+  for (int i = 0; i < numEffects; i++) {
+    names[i] = effects[i].name;
+    wavFiles[i] = effects[i].wavFile;
+  }
+  // If the bank can't be written the effects are read one by one instead
+  if (EffectBank_build(BANK_FILE, names, wavFiles, numEffects)) {
+    pBank = EffectBank_open(BANK_FILE);
+  }
+}
+
+bool EffectLoader_registerEffect(const char *name, const char *wavFile) {
+  assert(strlen(name) < EFFECT_BANK_MAX_NAME_LEN);
+
+  pthread_mutex_lock(&effectMutex);
+  if (findEffect(name) != NULL || numEffects == MAX_EFFECTS) {
+    pthread_mutex_unlock(&effectMutex);
+    fprintf(stderr, "WARNING: Unable to register effect %s\n", name);
+    return false;
+  }
+
+  sEffect_t *pEffect = &effects[numEffects];
+  snprintf(pEffect->name, sizeof(pEffect->name), "%s", name);
+  pEffect->wavFile = wavFile;
+  pEffect->loaded = false;
+
+  // Before init it is packed into the bank; after, it is read on its own until the next start
+  if (initialized) {
+    loadEffect(pEffect);
+  }
+  numEffects++;
+  pthread_mutex_unlock(&effectMutex);
+  return true;
+}
+
+bool EffectLoader_play(const char *name) {
+  assert(initialized);
+
+  pthread_mutex_lock(&effectMutex);
+  sEffect_t *pEffect = findEffect(name);
+  if (pEffect == NULL || !pEffect->loaded) {
+    pthread_mutex_unlock(&effectMutex);
+    fprintf(stderr, "WARNING: No effect named %s\n", name);
+    return false;
+  }
+
+  // The mixer reads the samples one period later; start paging them in now
+  if (!pEffect->ownsData) {
+    EffectBank_prefetch(pBank, &pEffect->sound);
+  }
+  AudioMixer_queueSound(&pEffect->sound);
+  pthread_mutex_unlock(&effectMutex);
+  return true;
+}
+
+void EffectLoader_requestToBeQued(EffectCollection desiredSound) {
+  if (desiredSound < EFFECT_SOUND_COLLECTION_SIZE) {
+    EffectLoader_play(collectionNames[desiredSound]);
+  }
 }
 
 void EffectLoader_init(void) {
-  EffectLoader_feedToMemory();
+  EffectLoader_registerEffect(collectionNames[EFFECT_SOUND1], CLICK_FILE);
+  EffectLoader_registerEffect(collectionNames[EFFECT_SOUND2], QUEUE_FILE);
+  EffectLoader_registerEffect(collectionNames[EFFECT_SOUND3], SNARE_HARD_FILE);
+
+  pthread_mutex_lock(&effectMutex);
+  openBank();
+  for (int i = 0; i < numEffects; i++) {
+    loadEffect(&effects[i]);
+  }
+  initialized = true;
+  pthread_mutex_unlock(&effectMutex);
 }
 
 void EffectLoader_cleanup(void) {
-  AudioMixer_freeWaveFileData(&theTomMid);
-  AudioMixer_freeWaveFileData(&theTomLow);
-  AudioMixer_freeWaveFileData(&theCymbal);
-  AudioMixer_freeWaveFileData(&theSnareHard);
-  AudioMixer_freeWaveFileData(&theSnare);
-  AudioMixer_freeWaveFileData(&theHihat);
-  AudioMixer_freeWaveFileData(&theKick);
-
-  AudioMixer_freeWaveFileData(&click);
-  AudioMixer_freeWaveFileData(&queue);
+  assert(initialized);
+
+  // Queued sounds may point into the bank
+  AudioMixer_clearSoundQueue();
+
+  pthread_mutex_lock(&effectMutex);
+  for (int i = 0; i < numEffects; i++) {
+    if (effects[i].ownsData) {
+      AudioMixer_freeWaveFileData(&effects[i].sound);
+    }
+    effects[i].loaded = false;
+  }
+  numEffects = 0;
+
+  EffectBank_close(pBank);
+  pBank = NULL;
+  initialized = false;
+  pthread_mutex_unlock(&effectMutex);
 }
@@ -1,27 +1,95 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <dirent.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "app.h"
+#include "crawler.h"
 #include "file_loader.h"
+#include "file_reader.h"
+#include "library.h"
+#include "load_scheduler.h"
+#include "read_ahead.h"
+#include "library_watcher.h"
+#include "playlist.h"
+#include "string_arena.h"
+#include "timing.h"
 
 #define MUSIC_DIRECTORY "mp3-files"
-#define MAX_FILE_STR_LEN 1024 
-
+// Songs are decoded ahead of time until this many are in memory.
+// After that only songs the user queued are decoded, and the least recently
+// used songs that are not queued are freed to make room for them.
+#define MAX_PRELOADED_FILES 256
+// Files read into memory ahead of the one being decoded
+#define READ_AHEAD_FILES 4
+#define INITIAL_CAPACITY 256
+// Songs are kept fully decoded while the system has this much memory available.
+// Below it they are kept compressed, about a tenth of the size, and decoded just ahead of playback.
+#define MIN_AVAILABLE_BYTES_FOR_PCM (128 * 1024 * 1024)
+// Strings of removed and rewritten songs are freed once the arena holds twice what is
+// in use plus this much
+#define RECLAIM_MIN_STRING_BYTES (1024 * 1024)
+// Files whose tags are read before the library lock is taken to list them
+#define INDEX_BATCH_FILES 32
+
+
+enum eFileState
+{
+    eFILE_FREE,    // id not in use
+    eFILE_INDEXED, // tags read, waiting to be decoded
+    eFILE_LOADED,
+    eFILE_FAILED,
+    eFILE_REMOVED, // gone from the library, freed once playback no longer holds it
+};
 
 static void* loadThreadFunc();
+static void* indexThreadFunc();
+static void decodeQueuedFile(sLoadedFile *pFile, bool isCurrent);
+static sLoadedFile* getLoadedFile(int i);
 
 static bool initialized = false;
 
-static sLoadedFile* loadedFiles[MAX_NUM_LOADED_FILES];
-static int nextFileInd = 0;
+// Indexed by library id
+static uint8_t *fileStates = NULL;
+static sLoadedFile **loadedFiles = NULL; // NULL until the song is decoded or queued
+static uint64_t *lastUsed = NULL; // useClock when the song was last decoded or queued
+static uint64_t useClock = 0;
+static int filesCapacity = 0;
+static int numLoaded = 0;
+static int numRemoved = 0;
+static int decodingInd = -1;
+
+// Queue saved by the last run (see session.h). The first song is decoded before the
+// library scan; the rest are queued once the scan has listed them.
+static char **restoredPaths = NULL;
+static int numRestored = 0;
+static size_t restoredStartFrame = 0;
+static char *restoredCursor = NULL;
+// The first restored song, decoded before the library listed it.
+// Taken over by the library id the scan gives its path.
+static sLoadedFile *pResumedFile = NULL;
+// Set once the first scan is done. Only the watcher reads tags after that, so it can reclaim strings.
+static bool isScanned = false;
+// String arena bytes in use after the scan or the last reclaim
+static size_t liveStringBytes = 0;
+// Protects everything above
+static pthread_mutex_t loaderMutex = PTHREAD_MUTEX_INITIALIZER;
+// Held while files are added to or removed from the library
+static pthread_mutex_t libraryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// How the load thread keeps the songs it decodes, chosen by how much memory is left
+static eMusicStorage_t storageMode = eMUSIC_STORAGE_PCM;
 
 static bool runLoadThread = false;
 static pthread_t loadThread;
+// Scans the library on its own so songs the user queues are decoded during a long scan
+static pthread_t indexThread;
 
 
 void FileLoader_init(void)
@@ -29,14 +97,19 @@ void FileLoader_init(void)
     assert(!initialized);
     initialized = true;
 
-    for (int i=0; i<MAX_NUM_LOADED_FILES; i++)
-    {
-        loadedFiles[i] = malloc(sizeof(sLoadedFile));
-        FileLoader_initFileType(loadedFiles[i]);
-    }
+    numLoaded = 0;
+    numRemoved = 0;
+    isScanned = false;
+    storageMode = eMUSIC_STORAGE_PCM;
+    AudioPlayback_setStorageMode(storageMode);
+
+    LoadScheduler_init();
+    LibraryWatcher_init(MUSIC_DIRECTORY);
+    AudioPlayback_setDecodeCallback(decodeQueuedFile);
 
     runLoadThread = true;
-    if (pthread_create(&loadThread, NULL, loadThreadFunc, NULL) != 0)
+    if (pthread_create(&loadThread, NULL, loadThreadFunc, NULL) != 0 ||
+        pthread_create(&indexThread, NULL, indexThreadFunc, NULL) != 0)
     {
         perror("Failed to spawn thread");
         exit(EXIT_FAILURE);
@@ -47,42 +120,361 @@ void FileLoader_cleanup(void)
 {
     assert(initialized);
 
+    LibraryWatcher_cleanup();
+    AudioPlayback_setDecodeCallback(NULL);
+
     runLoadThread = false;
+    LoadScheduler_stop();
+    pthread_join(indexThread, NULL);
     pthread_join(loadThread, NULL);
+    LoadScheduler_cleanup();
 
     AudioPlayback_clearQueue();
 
-    for (int i=0; i<MAX_NUM_LOADED_FILES; i++)
+    for (int i=0; i<filesCapacity; i++)
     {
+        if (loadedFiles[i] == NULL) continue;
+        AudioPlayback_unloadSong(loadedFiles[i]);
         FileLoader_freeFileType(loadedFiles[i]);
         free(loadedFiles[i]);
     }
+    free(loadedFiles);
+    loadedFiles = NULL;
+    free(fileStates);
+    fileStates = NULL;
+    free(lastUsed);
+    lastUsed = NULL;
+    filesCapacity = 0;
+
+    // Only set if the song vanished before the scan reached it
+    if (pResumedFile != NULL)
+    {
+        AudioPlayback_unloadSong(pResumedFile);
+        FileLoader_freeFileType(pResumedFile);
+        free(pResumedFile->filename);
+        free(pResumedFile);
+        pResumedFile = NULL;
+    }
+    for (int i=0; i<numRestored; i++)
+    {
+        free(restoredPaths[i]);
+    }
+    free(restoredPaths);
+    restoredPaths = NULL;
+    numRestored = 0;
+    free(restoredCursor);
+    restoredCursor = NULL;
 
     initialized = false;
 }
 
+// Makes room for ids up to id. Caller holds loaderMutex
+static void ensureCapacity(int id)
+{
+    if (id < filesCapacity) return;
+
+    int newCapacity = filesCapacity > 0 ? filesCapacity : INITIAL_CAPACITY;
+    while (newCapacity <= id) newCapacity *= 2;
+
+    fileStates = realloc(fileStates, newCapacity * sizeof(uint8_t));
+    loadedFiles = realloc(loadedFiles, newCapacity * sizeof(sLoadedFile*));
+    lastUsed = realloc(lastUsed, newCapacity * sizeof(uint64_t));
+    if (!fileStates || !loadedFiles || !lastUsed)
+    {
+        perror("ERROR: Unable to grow file loader");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=filesCapacity; i<newCapacity; i++)
+    {
+        fileStates[i] = eFILE_FREE;
+        loadedFiles[i] = NULL;
+        lastUsed[i] = 0;
+    }
+    filesCapacity = newCapacity;
+}
+
+static bool isInLibrary(int i)
+{
+    return fileStates[i] == eFILE_INDEXED || fileStates[i] == eFILE_LOADED || fileStates[i] == eFILE_FAILED;
+}
+
+static bool isValidFile(int i)
+{
+    return i >= 0 && i < filesCapacity && isInLibrary(i);
+}
+
+// Only songs the user asked for are decoded once enough are in memory.
+// Caller holds loaderMutex
+static void updateMinPriority(void)
+{
+    LoadScheduler_setMinPriority(numLoaded >= MAX_PRELOADED_FILES ? eLOAD_QUEUED : eLOAD_BACKGROUND);
+}
+
+// Queues the file, before it is decoded if need be. An undecoded song is decoded ahead
+// of the library and the mixer waits for it if playback reaches it first.
+// Caller holds loaderMutex
+static void queueFile(int i, enum eLoadPriority priority)
+{
+    lastUsed[i] = ++useClock;
+    if (fileStates[i] == eFILE_LOADED)
+    {
+        AudioPlayback_queueSong(loadedFiles[i]);
+    }
+    else if (fileStates[i] == eFILE_INDEXED)
+    {
+        AudioPlayback_queueUndecodedSong(getLoadedFile(i));
+        LoadScheduler_raise(i, priority);
+    }
+    else
+    {
+        printf("WARNING: Skipping %s, it could not be loaded\n", Library_getPath(i));
+    }
+}
+
+// Empties the play queue. Caller holds loaderMutex
+static void clearQueue(void)
+{
+    // Songs still waiting to be decoded for the queue are no longer wanted soon
+    int maxFiles = AudioPlayback_getQueueLength();
+    sLoadedFile **files = malloc((maxFiles > 0 ? maxFiles : 1) * sizeof(sLoadedFile*));
+    if (!files)
+    {
+        perror("ERROR: Unable to allocate queue copy");
+        exit(EXIT_FAILURE);
+    }
+    int numFiles = AudioPlayback_getQueue(files, maxFiles);
+    for (int j=0; j<numFiles; j++)
+    {
+        int i = Library_findTrack(files[j]->filename);
+        if (i >= 0 && fileStates[i] == eFILE_INDEXED) LoadScheduler_reset(i);
+    }
+    free(files);
+
+    AudioPlayback_clearQueue();
+}
+
 void FileLoader_queueFile(int i)
 {
-    if (loadedFiles[i] != NULL) AudioPlayback_queueSong(loadedFiles[i]);
+    bool isUndecoded = false;
+    pthread_mutex_lock(&loaderMutex);
+    if (isValidFile(i))
+    {
+        queueFile(i, eLOAD_QUEUED);
+        isUndecoded = fileStates[i] == eFILE_INDEXED;
+    }
+    pthread_mutex_unlock(&loaderMutex);
+
+    // Start reading it from storage while the decoder finishes what's ahead of it
+    if (isUndecoded) ReadAhead_prefetch(Library_getPath(i));
 }
 
 void FileLoader_replaceFile(int i)
 {
-    if (loadedFiles[i] != NULL)
+    bool isUndecoded = false;
+    pthread_mutex_lock(&loaderMutex);
+    if (isValidFile(i))
     {
-        AudioPlayback_clearQueue();
+        clearQueue();
+        queueFile(i, eLOAD_SELECTED);
+        isUndecoded = fileStates[i] == eFILE_INDEXED;
     }
-    AudioPlayback_queueSong(loadedFiles[i]);
+    pthread_mutex_unlock(&loaderMutex);
+
+    if (isUndecoded) ReadAhead_prefetch(Library_getPath(i));
+}
+
+typedef struct {
+    const char *cwd; // absolute entries below it are looked up relative to it
+    size_t cwdLen;
+    int numQueued;
+    int numMissing;
+    int firstId;
+} sPlaylistLoad_t;
+
+// Queues one playlist entry without decoding it; the mixer asks for it once it is next.
+static void queuePlaylistEntry(const char *path, void *pContext)
+{
+    sPlaylistLoad_t *pLoad = pContext;
+
+    // The library lists paths relative to the working directory
+    int i = Library_findTrack(path);
+    if (i < 0 && pLoad->cwdLen > 0 && strncmp(path, pLoad->cwd, pLoad->cwdLen) == 0 && path[pLoad->cwdLen] == '/')
+    {
+        i = Library_findTrack(path + pLoad->cwdLen + 1);
+    }
+
+    pthread_mutex_lock(&loaderMutex);
+    bool isQueued = i >= 0 && (fileStates[i] == eFILE_INDEXED || fileStates[i] == eFILE_LOADED);
+    if (isQueued && fileStates[i] == eFILE_LOADED)
+    {
+        AudioPlayback_queueSong(loadedFiles[i]);
+    }
+    else if (isQueued)
+    {
+        // Not raised: the mixer asks for it once it is next
+        AudioPlayback_queueUndecodedSong(getLoadedFile(i));
+    }
+    pthread_mutex_unlock(&loaderMutex);
+
+    if (!isQueued)
+    {
+        pLoad->numMissing++;
+        return;
+    }
+    if (pLoad->numQueued++ == 0) pLoad->firstId = i;
+}
+
+bool FileLoader_loadPlaylist(const char *path)
+{
+    assert(initialized);
+
+    long long startMs = getTimeInMs();
+    char cwd[PATH_MAX];
+    sPlaylistLoad_t load = {0};
+    load.cwd = getcwd(cwd, sizeof(cwd));
+    load.cwdLen = load.cwd != NULL ? strlen(load.cwd) : 0;
+    load.firstId = -1;
+
+    pthread_mutex_lock(&loaderMutex);
+    clearQueue();
+    pthread_mutex_unlock(&loaderMutex);
+
+    int numEntries = Playlist_read(path, queuePlaylistEntry, &load);
+    if (numEntries < 0) return false;
+
+    // Only the first song is decoded now, on every core
+    if (load.firstId >= 0 && LoadScheduler_raise(load.firstId, eLOAD_SELECTED))
+    {
+        ReadAhead_prefetch(Library_getPath(load.firstId));
+    }
+
+    printf("Loaded playlist %s in %lld ms: %d songs queued, %d not in the library\n",
+            path, getTimeInMs() - startMs, load.numQueued, load.numMissing);
+    return load.numQueued > 0;
+}
+
+bool FileLoader_savePlaylist(const char *path)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&loaderMutex);
+    int maxEntries = AudioPlayback_getQueueLength();
+    sLoadedFile **files = malloc((maxEntries > 0 ? maxEntries : 1) * sizeof(sLoadedFile*));
+    sPlaylistEntry_t *entries = malloc((maxEntries > 0 ? maxEntries : 1) * sizeof(sPlaylistEntry_t));
+    if (!files || !entries)
+    {
+        perror("ERROR: Unable to allocate playlist");
+        exit(EXIT_FAILURE);
+    }
+
+    int numFiles = AudioPlayback_getQueue(files, maxEntries);
+    int numEntries = 0;
+    for (int i=0; i<numFiles; i++)
+    {
+        const musicMetadata_t *pMetadata = files[i]->metadata;
+        entries[numEntries++] = (sPlaylistEntry_t){
+            .path = files[i]->filename,
+            .title = StringArena_get(pMetadata->title),
+            .artist = StringArena_get(pMetadata->artist),
+            .lengthSeconds = pMetadata->lengthSeconds,
+        };
+    }
+    pthread_mutex_unlock(&loaderMutex);
+
+    // Paths and tags stay readable until the string arena's next reclaim but one, long
+    // after this write, so the lock isn't needed to write them
+    bool saved = Playlist_write(path, entries, numEntries);
+    if (saved) printf("Saved %d songs to %s\n", numEntries, path);
+
+    free(entries);
+    free(files);
+    return saved;
+}
+
+int FileLoader_findPlaylists(char **paths, int maxPaths)
+{
+    return Playlist_find(MUSIC_DIRECTORY, paths, maxPaths);
+}
+
+void FileLoader_restoreSession(char **queuePaths, int numPaths, size_t startFrame, const char *cursorPath)
+{
+    assert(!initialized);
+
+    restoredPaths = malloc(numPaths * sizeof(char*));
+    if (numPaths > 0 && !restoredPaths)
+    {
+        perror("ERROR: Unable to allocate restored queue");
+        exit(EXIT_FAILURE);
+    }
+    numRestored = numPaths;
+    for (int i=0; i<numRestored; i++)
+    {
+        restoredPaths[i] = strdup(queuePaths[i]);
+    }
+    restoredStartFrame = startFrame;
+    restoredCursor = cursorPath != NULL ? strdup(cursorPath) : NULL;
+}
+
+char** FileLoader_getQueue(int *pNumPaths, size_t *pStartFrame)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&loaderMutex);
+    // A song queued between the two calls is left for the next snapshot
+    int maxFiles = AudioPlayback_getQueueLength();
+    sLoadedFile **files = malloc((maxFiles + 1) * sizeof(sLoadedFile*));
+    char **paths = malloc((maxFiles + numRestored + 1) * sizeof(char*));
+    if (!files || !paths)
+    {
+        perror("ERROR: Unable to allocate queue copy");
+        exit(EXIT_FAILURE);
+    }
+
+    int numFiles = AudioPlayback_getQueue(files, maxFiles);
+    int numPaths = 0;
+    for (int i=0; i<numFiles; i++)
+    {
+        paths[numPaths++] = strdup(files[i]->filename);
+    }
+    *pStartFrame = AudioPlayback_getPosition();
+
+    // Songs the last run queued that have not been handed to playback yet
+    if (numRestored > 0 && restoredPaths[0] != NULL) *pStartFrame = restoredStartFrame;
+    for (int i=0; i<numRestored; i++)
+    {
+        if (restoredPaths[i] != NULL) paths[numPaths++] = strdup(restoredPaths[i]);
+    }
+    pthread_mutex_unlock(&loaderMutex);
+
+    free(files);
+    *pNumPaths = numPaths;
+    return paths;
+}
+
+void FileLoader_setNearCursor(const int *ids, int numIds)
+{
+    assert(initialized);
+
+    LoadScheduler_setWindow(ids, numIds);
 }
 
 void FileLoader_initFileType(sLoadedFile* pLoadedFile)
 {
     assert(initialized);
     // pLoadedFile = malloc(sizeof(sLoadedFile));
-    pLoadedFile->filename = "";
+    pLoadedFile->filename = NULL;
+    pLoadedFile->queueRefs = 0;
     pLoadedFile->musicData = malloc(sizeof(musicData_t));
+    pLoadedFile->musicData->numSamples = 0;
+    pLoadedFile->musicData->pData = NULL;
     pLoadedFile->musicData->playingInMixer = false;
+    pLoadedFile->musicData->storage = eMUSIC_STORAGE_PCM;
+    pLoadedFile->musicData->pStream = NULL;
     pLoadedFile->metadata = malloc(sizeof(musicMetadata_t));
+    pLoadedFile->metadata->title = STRING_ARENA_EMPTY;
+    pLoadedFile->metadata->artist = STRING_ARENA_EMPTY;
+    pLoadedFile->metadata->album = STRING_ARENA_EMPTY;
+    pLoadedFile->metadata->lengthSeconds = 0;
 }
 
 void FileLoader_freeFileType(sLoadedFile* pLoadedFile)
@@ -93,34 +485,467 @@ void FileLoader_freeFileType(sLoadedFile* pLoadedFile)
 }
 
 
-static void* loadThreadFunc()
+// Frees removed files that playback is done with and lets the library reuse their ids.
+// Caller holds loaderMutex
+static void freeRemovedFiles(void)
 {
-    // loop through all files and load them
-    DIR *d;
+    for (int i=0; i<filesCapacity && numRemoved>0; i++)
+    {
+        if (fileStates[i] != eFILE_REMOVED || i == decodingInd) continue;
+        if (loadedFiles[i] != NULL)
+        {
+            if (AudioPlayback_isQueued(loadedFiles[i])) continue;
+
+            AudioPlayback_unloadSong(loadedFiles[i]);
+            FileLoader_freeFileType(loadedFiles[i]);
+            free(loadedFiles[i]);
+            loadedFiles[i] = NULL;
+        }
+
+        fileStates[i] = eFILE_FREE;
+        numRemoved--;
+        Library_releaseTrack(i);
+    }
+}
+
+// Frees the least recently used decoded songs that playback doesn't hold until no more
+// than MAX_PRELOADED_FILES are in memory. They are decoded again if queued later.
+// Caller holds loaderMutex
+static void evictUnusedFiles(void)
+{
+    while (numLoaded > MAX_PRELOADED_FILES)
+    {
+        int oldest = -1;
+        for (int i=0; i<filesCapacity; i++)
+        {
+            if (fileStates[i] != eFILE_LOADED || AudioPlayback_isQueued(loadedFiles[i])) continue;
+            if (oldest < 0 || lastUsed[i] < lastUsed[oldest]) oldest = i;
+        }
+        if (oldest < 0) break;
+
+        AudioPlayback_unloadSong(loadedFiles[oldest]);
+        fileStates[oldest] = eFILE_INDEXED;
+        numLoaded--;
+        LoadScheduler_add(oldest);
+    }
+    updateMinPriority();
+}
+
+static bool isUnder(const char *path, const char *dir)
+{
+    size_t dirLen = strlen(dir);
+    return strncmp(path, dir, dirLen) == 0 && (path[dirLen] == '\0' || path[dirLen] == '/');
+}
+
+// Lists a file whose tags have been read. It is decoded later by the load thread.
+// Caller holds libraryMutex
+static void addFile(const char *path, const musicMetadata_t *pMetadata)
+{
+    printf("%s\n", path);
+
+    int i = Library_addTrack(path, pMetadata);
 
-    struct dirent *dir;
+    pthread_mutex_lock(&loaderMutex);
+    ensureCapacity(i);
+    fileStates[i] = eFILE_INDEXED;
+
+    bool isResumed = pResumedFile != NULL && strcmp(pResumedFile->filename, path) == 0;
+    if (isResumed)
+    {
+        // Already decoded and playing; the library's copy of the path outlives the file
+        free(pResumedFile->filename);
+        pResumedFile->filename = (char*)Library_getPath(i);
+        loadedFiles[i] = pResumedFile;
+        pResumedFile = NULL;
+        fileStates[i] = eFILE_LOADED;
+        numLoaded++;
+        updateMinPriority();
+        Library_setLength(i, loadedFiles[i]->metadata->lengthSeconds);
+    }
+    pthread_mutex_unlock(&loaderMutex);
 
-    d = opendir(MUSIC_DIRECTORY);
+    if (!isResumed) LoadScheduler_add(i);
+}
 
-    if (d) {
-        char fullPath[MAX_FILE_STR_LEN];
-        while ((dir = readdir(d)) != NULL) {
-            if (!runLoadThread) return NULL;
-            if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+// Unlists the file. Anything already queued keeps playing from the old data.
+// Caller holds libraryMutex
+static void removeFile(int i)
+{
+    printf("Removing %s\n", Library_getPath(i));
 
+    int positions[eNUM_LIBRARY_VIEWS];
+    Library_removeTrack(i, positions);
+    App_songRemoved(positions);
+    LoadScheduler_cancel(i);
 
-            snprintf(fullPath, sizeof(fullPath), "%s/%s", MUSIC_DIRECTORY, dir->d_name);
+    pthread_mutex_lock(&loaderMutex);
+    if (fileStates[i] == eFILE_LOADED)
+    {
+        numLoaded--;
+        updateMinPriority();
+    }
+    // Queued without data, and now it will never be decoded
+    if (fileStates[i] == eFILE_INDEXED && loadedFiles[i] != NULL && i != decodingInd)
+    {
+        AudioPlayback_unqueueFile(loadedFiles[i]);
+    }
+    fileStates[i] = eFILE_REMOVED;
+    numRemoved++;
+    freeRemovedFiles();
+    pthread_mutex_unlock(&loaderMutex);
+}
 
-            printf("%s\n", fullPath);
+// Removes files below dir, or only the ones that no longer exist.
+// Caller holds libraryMutex
+static void removeFilesUnder(const char *dir, bool onlyMissing)
+{
+    struct stat st;
+    int idLimit = Library_getIdLimit();
+    for (int i=0; i<idLimit; i++)
+    {
+        if (!Library_isTrack(i)) continue;
 
-            AudioPlayback_loadSong(fullPath, loadedFiles[nextFileInd]);
-            App_addMetadata(loadedFiles[nextFileInd]->metadata);
+        const char *path = Library_getPath(i);
+        if (!isUnder(path, dir)) continue;
+        if (onlyMissing && stat(path, &st) == 0) continue;
+        removeFile(i);
+    }
+}
 
-            nextFileInd++;
+// Adds the music files below path that are not listed yet and watches each directory.
+// Tags are read a batch at a time without libraryMutex, which is only held to list them.
+static void indexDirectory(const char *path)
+{
+    int numFiles;
+    char **files = Crawler_findMusicFiles(path, 0, LibraryWatcher_watchDirectory, &numFiles);
+
+    musicMetadata_t metadata[INDEX_BATCH_FILES];
+    bool isNew[INDEX_BATCH_FILES];
+    for (int start=0; start<numFiles && runLoadThread; start+=INDEX_BATCH_FILES)
+    {
+        int numBatch = numFiles - start < INDEX_BATCH_FILES ? numFiles - start : INDEX_BATCH_FILES;
+        for (int j=0; j<numBatch; j++)
+        {
+            isNew[j] = Library_findTrack(files[start + j]) < 0;
+            if (isNew[j]) AudioPlayback_readSongInfo(files[start + j], &metadata[j]);
+        }
+
+        pthread_mutex_lock(&libraryMutex);
+        for (int j=0; j<numBatch; j++)
+        {
+            // The watcher may have listed or removed it while its tags were read
+            struct stat st;
+            const char *file = files[start + j];
+            if (!isNew[j] || Library_findTrack(file) >= 0 || stat(file, &st) != 0) continue;
+            addFile(file, &metadata[j]);
         }
+        pthread_mutex_unlock(&libraryMutex);
+    }
+
+    Crawler_freeFiles(files, numFiles);
+}
 
-        closedir(d);
+// Copies every string still in use to a new arena generation once strings of removed and
+// rewritten songs take up most of the arena. They are freed at the reclaim after, once
+// no reader can still be holding one.
+// Caller holds libraryMutex; called by the watcher, the only thread reading tags after the scan.
+static void reclaimStrings(void)
+{
+    size_t usedBytes = StringArena_getUsedBytes();
+    pthread_mutex_lock(&loaderMutex);
+    if (!isScanned || usedBytes < 2 * liveStringBytes + RECLAIM_MIN_STRING_BYTES)
+    {
+        pthread_mutex_unlock(&loaderMutex);
+        return;
+    }
+
+    long long startMs = getTimeInMs();
+    StringArena_startGeneration();
+    Library_copyStrings();
+    for (int i=0; i<filesCapacity; i++)
+    {
+        if (loadedFiles[i] == NULL) continue;
+
+        musicMetadata_t metadata;
+        Library_getMetadata(i, &metadata);
+        loadedFiles[i]->filename = (char*)Library_getPath(i);
+        AudioPlayback_setSongTags(loadedFiles[i], &metadata);
+    }
+    if (pResumedFile != NULL)
+    {
+        // Its path is its own copy
+        musicMetadata_t *pOld = pResumedFile->metadata;
+        musicMetadata_t metadata = {
+            .title = StringArena_intern(StringArena_get(pOld->title)),
+            .artist = StringArena_intern(StringArena_get(pOld->artist)),
+            .album = StringArena_intern(StringArena_get(pOld->album)),
+        };
+        AudioPlayback_setSongTags(pResumedFile, &metadata);
     }
+    liveStringBytes = StringArena_getUsedBytes();
+    pthread_mutex_unlock(&loaderMutex);
+
+    printf("Reclaimed strings in %lld ms: %zu bytes before, %zu in use\n",
+            getTimeInMs() - startMs, usedBytes, liveStringBytes);
+}
+
+void FileLoader_libraryChanged(const char *path)
+{
+    assert(initialized);
+
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        // Deleted or moved out of the library
+        pthread_mutex_lock(&libraryMutex);
+        removeFilesUnder(path, false);
+        pthread_mutex_unlock(&libraryMutex);
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        pthread_mutex_lock(&libraryMutex);
+        removeFilesUnder(path, true);
+        pthread_mutex_unlock(&libraryMutex);
+        indexDirectory(path);
+    }
+    else if (S_ISREG(st.st_mode) && Crawler_isMusicFile(path))
+    {
+        // Rewritten; its tags and audio may have changed
+        musicMetadata_t metadata;
+        AudioPlayback_readSongInfo((char*)path, &metadata);
+
+        pthread_mutex_lock(&libraryMutex);
+        int i = Library_findTrack(path);
+        if (i >= 0) removeFile(i);
+        if (stat(path, &st) == 0) addFile(path, &metadata);
+        pthread_mutex_unlock(&libraryMutex);
+    }
+
+    pthread_mutex_lock(&libraryMutex);
+    reclaimStrings();
+    pthread_mutex_unlock(&libraryMutex);
+}
+
+// Memory the kernel could hand out without swapping, or -1 if it can't be read
+static long long getAvailableBytes(void)
+{
+    FILE *pFile = fopen("/proc/meminfo", "r");
+    if (pFile == NULL) return -1;
+
+    long long availableKb = -1;
+    char line[128];
+    while (fgets(line, sizeof(line), pFile) != NULL)
+    {
+        if (sscanf(line, "MemAvailable: %lld kB", &availableKb) == 1) break;
+    }
+    fclose(pFile);
+    return availableKb >= 0 ? availableKb * 1024 : -1;
+}
+
+// Keeps the next songs compressed while memory is short, and decoded again once it isn't.
+// Only called by the load thread
+static void updateStorageMode(void)
+{
+    long long availableBytes = getAvailableBytes();
+    eMusicStorage_t mode = availableBytes >= 0 && availableBytes < MIN_AVAILABLE_BYTES_FOR_PCM
+        ? eMUSIC_STORAGE_COMPRESSED : eMUSIC_STORAGE_PCM;
+    if (mode == storageMode) return;
+
+    storageMode = mode;
+    AudioPlayback_setStorageMode(mode);
+    printf("%lld MB available, keeping songs %s\n", availableBytes / (1024 * 1024),
+            mode == eMUSIC_STORAGE_COMPRESSED ? "compressed" : "decoded");
+}
+
+// Called by the mixer for a queued song it will need that is not decoded yet
+static void decodeQueuedFile(sLoadedFile *pFile, bool isCurrent)
+{
+    int i = Library_findTrack(pFile->filename);
+    if (i >= 0) LoadScheduler_raise(i, isCurrent ? eLOAD_SELECTED : eLOAD_QUEUED);
+}
+
+// Returns the file's decode target, creating it the first time. Caller holds loaderMutex
+static sLoadedFile* getLoadedFile(int i)
+{
+    if (loadedFiles[i] == NULL)
+    {
+        sLoadedFile *pFile = malloc(sizeof(sLoadedFile));
+        if (!pFile)
+        {
+            perror("ERROR: Unable to allocate loaded file");
+            exit(EXIT_FAILURE);
+        }
+        FileLoader_initFileType(pFile);
+
+        // Path and tags point into the library, which keeps them until shutdown
+        pFile->filename = (char*)Library_getPath(i);
+        Library_getMetadata(i, pFile->metadata);
+        loadedFiles[i] = pFile;
+    }
+    return loadedFiles[i];
+}
+
+// Decodes the song that was playing at shutdown and starts it where it left off,
+// without waiting for the library scan.
+static void resumePlayback(void)
+{
+    pthread_mutex_lock(&loaderMutex);
+    char *path = numRestored > 0 ? restoredPaths[0] : NULL;
+    pthread_mutex_unlock(&loaderMutex);
+    if (path == NULL) return;
+
+    long long startMs = getTimeInMs();
+    sLoadedFile *pFile = malloc(sizeof(sLoadedFile));
+    if (!pFile)
+    {
+        perror("ERROR: Unable to allocate loaded file");
+        exit(EXIT_FAILURE);
+    }
+    FileLoader_initFileType(pFile);
+    pFile->filename = strdup(path);
+    AudioPlayback_loadSongUrgent(pFile->filename, pFile);
+
+    pthread_mutex_lock(&loaderMutex);
+    restoredPaths[0] = NULL;
+    free(path);
+    bool resumed = pFile->musicData->numSamples > 0;
+    if (resumed)
+    {
+        AudioPlayback_queueSongAt(pFile, restoredStartFrame);
+        printf("Resumed %s at frame %zu in %lld ms\n", pFile->filename, restoredStartFrame, getTimeInMs() - startMs);
+        pResumedFile = pFile;
+    }
+    pthread_mutex_unlock(&loaderMutex);
+
+    if (!resumed)
+    {
+        printf("WARNING: Unable to resume %s\n", pFile->filename);
+        FileLoader_freeFileType(pFile);
+        free(pFile->filename);
+        free(pFile);
+    }
+}
+
+// Queues the rest of the restored queue and selects the restored cursor, now that the library lists them.
+static void restoreQueue(void)
+{
+    for (int i=1; i<numRestored; i++)
+    {
+        int id = Library_findTrack(restoredPaths[i]);
+
+        pthread_mutex_lock(&loaderMutex);
+        free(restoredPaths[i]);
+        restoredPaths[i] = NULL;
+        pthread_mutex_unlock(&loaderMutex);
+
+        if (id >= 0) FileLoader_queueFile(id);
+    }
+    pthread_mutex_lock(&loaderMutex);
+    numRestored = 0;
+    free(restoredPaths);
+    restoredPaths = NULL;
+    pthread_mutex_unlock(&loaderMutex);
+
+    if (restoredCursor != NULL)
+    {
+        int id = Library_findTrack(restoredCursor);
+        if (id >= 0) App_selectTrack(id);
+        free(restoredCursor);
+        restoredCursor = NULL;
+    }
+}
+
+static void* indexThreadFunc()
+{
+    resumePlayback();
+
+    // Files are decoded as soon as their tags are read, not once the whole scan is done
+    long long startMs = getTimeInMs();
+    indexDirectory(MUSIC_DIRECTORY);
+    if (!runLoadThread) return NULL;
+
+    pthread_mutex_lock(&loaderMutex);
+    isScanned = true;
+    liveStringBytes = StringArena_getUsedBytes();
+    pthread_mutex_unlock(&loaderMutex);
+
+    restoreQueue();
+
+    int numTracks = Library_getNumTracks();
+    pthread_mutex_lock(&loaderMutex);
+    size_t metadataBytes = Library_getMemoryUsage() + filesCapacity * (sizeof(uint8_t) + sizeof(sLoadedFile*));
+    pthread_mutex_unlock(&loaderMutex);
+    printf("Indexed %d songs in %lld ms: %zu bytes of metadata (%zu per song), %zu bytes of strings (%zu saved by interning)\n",
+            numTracks, getTimeInMs() - startMs, metadataBytes,
+            numTracks > 0 ? metadataBytes / numTracks : 0, StringArena_getUsedBytes(), StringArena_getSavedBytes());
 
     return NULL;
-}
\ No newline at end of file
+}
+
+static void* loadThreadFunc()
+{
+    // Decode in order of what the user is waiting on
+    enum eLoadPriority priority;
+    int i;
+    while (runLoadThread && (i = LoadScheduler_waitForNext(&priority)) >= 0)
+    {
+        pthread_mutex_lock(&loaderMutex);
+        sLoadedFile *pFile = NULL;
+        if (fileStates[i] == eFILE_INDEXED)
+        {
+            decodingInd = i;
+            pFile = getLoadedFile(i);
+        }
+        pthread_mutex_unlock(&loaderMutex);
+        if (pFile == NULL) continue;
+
+        // Storage reads the next few files while this one decodes
+        int upcoming[READ_AHEAD_FILES];
+        int numUpcoming = LoadScheduler_peek(upcoming, READ_AHEAD_FILES);
+        for (int j=0; j<numUpcoming; j++)
+        {
+            FileReader_request(Library_getPath(upcoming[j]));
+        }
+
+        updateStorageMode();
+        if (priority == eLOAD_SELECTED)
+        {
+            AudioPlayback_loadSongUrgent(pFile->filename, pFile);
+        }
+        else
+        {
+            AudioPlayback_loadSong(pFile->filename, pFile);
+        }
+
+        pthread_mutex_lock(&loaderMutex);
+        decodingInd = -1;
+        if (fileStates[i] == eFILE_INDEXED)
+        {
+            if (pFile->musicData->numSamples > 0)
+            {
+                fileStates[i] = eFILE_LOADED;
+                lastUsed[i] = ++useClock;
+                numLoaded++;
+                evictUnusedFiles();
+                Library_setLength(i, pFile->metadata->lengthSeconds);
+            }
+            else
+            {
+                fileStates[i] = eFILE_FAILED;
+                // Queued from a playlist before it was decoded; it would never play
+                AudioPlayback_unqueueFile(pFile);
+            }
+        }
+        freeRemovedFiles();
+        pthread_mutex_unlock(&loaderMutex);
+
+        // Songs the user is waiting on should never have come from cold storage
+        if (priority >= eLOAD_QUEUED)
+        {
+            ReadAhead_printStats();
+            FileReader_printStats();
+        }
+    }
+
+    return NULL;
+}
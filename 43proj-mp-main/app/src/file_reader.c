@@ -0,0 +1,309 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file_reader.h"
+#include "read_ahead.h"
+
+// Storage copes best with a few requests queued at once; more threads only add seeking
+#define NUM_READER_THREADS 4
+// Bounds the memory held by finished reads waiting for the decoder
+#define MAX_READS 8
+
+enum eReadState
+{
+    eREAD_FREE,
+    eREAD_QUEUED,
+    eREAD_READING,
+    eREAD_DONE,
+};
+
+typedef struct {
+    enum eReadState state;
+    char *path;
+    unsigned char *pBytes; // NULL if the read failed
+    size_t numBytes;
+    unsigned long order; // queued reads start oldest first; finished ones are dropped oldest first
+    int numWaiting; // takers blocked on this read
+} sRead_t;
+
+static bool initialized = false;
+
+static sRead_t reads[MAX_READS];
+static unsigned long nextOrder = 0;
+
+static long numRequested = 0;
+static long numTakenReady = 0;
+static long numTakenWaited = 0;
+static long numTakenUnrequested = 0;
+
+static pthread_mutex_t readerMutex = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a read is queued
+static pthread_cond_t queuedCond = PTHREAD_COND_INITIALIZER;
+// Signalled when a read finishes
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+
+static bool runReaderThreads = false;
+static pthread_t readerThreads[NUM_READER_THREADS];
+
+static void* readerThreadFunc();
+
+
+void FileReader_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    for (int i=0; i<MAX_READS; i++)
+    {
+        reads[i].state = eREAD_FREE;
+    }
+
+    runReaderThreads = true;
+    for (int i=0; i<NUM_READER_THREADS; i++)
+    {
+        if (pthread_create(&readerThreads[i], NULL, readerThreadFunc, NULL) != 0)
+        {
+            perror("Failed to spawn thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void FileReader_cleanup(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&readerMutex);
+    runReaderThreads = false;
+    pthread_cond_broadcast(&queuedCond);
+    pthread_mutex_unlock(&readerMutex);
+
+    for (int i=0; i<NUM_READER_THREADS; i++)
+    {
+        pthread_join(readerThreads[i], NULL);
+    }
+
+    for (int i=0; i<MAX_READS; i++)
+    {
+        if (reads[i].state == eREAD_FREE) continue;
+        free(reads[i].path);
+        free(reads[i].pBytes);
+        reads[i].state = eREAD_FREE;
+    }
+
+    initialized = false;
+}
+
+// Reads a whole file into a malloc'd buffer. Returns NULL on failure.
+static unsigned char* readWholeFile(const char *path, size_t *pNumBytes)
+{
+    int fd = ReadAhead_openSequential(path);
+    if (fd < 0)
+    {
+        perror("Failed to open MP3 file");
+        return NULL;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        perror("Failed to stat MP3 file");
+        close(fd);
+        return NULL;
+    }
+
+    size_t numBytes = fileStat.st_size;
+    unsigned char *pBytes = malloc(numBytes);
+    if (!pBytes)
+    {
+        close(fd);
+        perror("ERROR: Unable to allocate bytes for file");
+        exit(EXIT_FAILURE);
+    }
+
+    // One large read; the loop only covers short reads
+    size_t bytesRead = 0;
+    while (bytesRead < numBytes)
+    {
+        ssize_t got = read(fd, pBytes + bytesRead, numBytes - bytesRead);
+        if (got <= 0) break;
+        bytesRead += got;
+    }
+    // The bytes are in memory now, so the file no longer needs to be cached
+    ReadAhead_release(fd);
+    close(fd);
+
+    if (bytesRead != numBytes)
+    {
+        perror("Failed to read MP3 file");
+        free(pBytes);
+        return NULL;
+    }
+
+    *pNumBytes = numBytes;
+    return pBytes;
+}
+
+// Caller holds readerMutex
+static sRead_t* findRead(const char *path)
+{
+    for (int i=0; i<MAX_READS; i++)
+    {
+        if (reads[i].state != eREAD_FREE && strcmp(reads[i].path, path) == 0) return &reads[i];
+    }
+    return NULL;
+}
+
+// Caller holds readerMutex
+static void freeRead(sRead_t *pRead)
+{
+    free(pRead->path);
+    pRead->path = NULL;
+    pRead->pBytes = NULL;
+    pRead->state = eREAD_FREE;
+}
+
+// A free slot, dropping the oldest finished read nobody has taken if needed.
+// Caller holds readerMutex
+static sRead_t* getFreeRead(void)
+{
+    sRead_t *pOldest = NULL;
+    for (int i=0; i<MAX_READS; i++)
+    {
+        if (reads[i].state == eREAD_FREE) return &reads[i];
+        if (reads[i].state == eREAD_DONE && reads[i].numWaiting == 0 &&
+            (pOldest == NULL || reads[i].order < pOldest->order))
+        {
+            pOldest = &reads[i];
+        }
+    }
+
+    if (pOldest != NULL)
+    {
+        free(pOldest->pBytes);
+        freeRead(pOldest);
+    }
+    return pOldest;
+}
+
+void FileReader_request(const char *path)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&readerMutex);
+    sRead_t *pRead = findRead(path) == NULL ? getFreeRead() : NULL;
+    if (pRead != NULL)
+    {
+        pRead->path = strdup(path);
+        pRead->pBytes = NULL;
+        pRead->numBytes = 0;
+        pRead->order = nextOrder++;
+        pRead->numWaiting = 0;
+        pRead->state = eREAD_QUEUED;
+        numRequested++;
+        pthread_cond_signal(&queuedCond);
+    }
+    pthread_mutex_unlock(&readerMutex);
+}
+
+unsigned char* FileReader_take(const char *path, size_t *pNumBytes)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&readerMutex);
+    sRead_t *pRead = findRead(path);
+
+    // Not started yet; reading it here beats waiting behind the reads ahead of it
+    if (pRead != NULL && pRead->state == eREAD_QUEUED)
+    {
+        freeRead(pRead);
+        pRead = NULL;
+    }
+
+    if (pRead != NULL)
+    {
+        if (pRead->state == eREAD_READING)
+        {
+            numTakenWaited++;
+            pRead->numWaiting++;
+            while (pRead->state == eREAD_READING)
+            {
+                pthread_cond_wait(&doneCond, &readerMutex);
+            }
+            pRead->numWaiting--;
+        }
+        else
+        {
+            numTakenReady++;
+        }
+
+        unsigned char *pBytes = pRead->pBytes;
+        *pNumBytes = pRead->numBytes;
+        freeRead(pRead);
+        pthread_mutex_unlock(&readerMutex);
+        return pBytes;
+    }
+
+    numTakenUnrequested++;
+    pthread_mutex_unlock(&readerMutex);
+
+    return readWholeFile(path, pNumBytes);
+}
+
+void FileReader_printStats(void)
+{
+    pthread_mutex_lock(&readerMutex);
+    printf("File reader: %ld requested, %ld read ahead, %ld waited on, %ld read on demand\n",
+        numRequested, numTakenReady, numTakenWaited, numTakenUnrequested);
+    pthread_mutex_unlock(&readerMutex);
+}
+
+// Caller holds readerMutex
+static sRead_t* getOldestQueued(void)
+{
+    sRead_t *pOldest = NULL;
+    for (int i=0; i<MAX_READS; i++)
+    {
+        if (reads[i].state == eREAD_QUEUED && (pOldest == NULL || reads[i].order < pOldest->order))
+        {
+            pOldest = &reads[i];
+        }
+    }
+    return pOldest;
+}
+
+static void* readerThreadFunc()
+{
+    pthread_mutex_lock(&readerMutex);
+    while (runReaderThreads)
+    {
+        sRead_t *pRead = getOldestQueued();
+        if (pRead == NULL)
+        {
+            pthread_cond_wait(&queuedCond, &readerMutex);
+            continue;
+        }
+
+        // The slot stays ours while READING; nothing else frees it
+        pRead->state = eREAD_READING;
+        pthread_mutex_unlock(&readerMutex);
+
+        size_t numBytes = 0;
+        unsigned char *pBytes = readWholeFile(pRead->path, &numBytes);
+
+        pthread_mutex_lock(&readerMutex);
+        pRead->pBytes = pBytes;
+        pRead->numBytes = numBytes;
+        pRead->state = eREAD_DONE;
+        pthread_cond_broadcast(&doneCond);
+    }
+    pthread_mutex_unlock(&readerMutex);
+
+    return NULL;
+}
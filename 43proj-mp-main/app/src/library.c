@@ -0,0 +1,741 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <strings.h>
+
+#include "library.h"
+#include "string_arena.h"
+#include "search_index.h"
+
+#define PAGE_BITS 10
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define INITIAL_CAPACITY 256
+// Ids per block of a sorted view. Adding a song moves at most this many ids.
+#define VIEW_BLOCK_SIZE 512
+
+enum eTrackState
+{
+    eTRACK_FREE,
+    eTRACK_LISTED,
+    eTRACK_REMOVED, // off the listing, id not yet released
+};
+
+// One page of songs, one array per field
+typedef struct {
+    uint32_t path[PAGE_SIZE];
+    uint32_t title[PAGE_SIZE];
+    uint32_t artist[PAGE_SIZE];
+    uint32_t album[PAGE_SIZE];
+    float lengthSeconds[PAGE_SIZE];
+    uint8_t state[PAGE_SIZE];
+} sLibraryPage_t;
+
+static bool initialized = false;
+
+static sLibraryPage_t **pages = NULL;
+static int numPages = 0;
+static int pagesCapacity = 0;
+static int idLimit = 0;
+
+static int *freeIds = NULL;
+static int numFreeIds = 0;
+static int freeIdsCapacity = 0;
+
+static int *listing = NULL; // ids in the order they were added
+static int numListed = 0;
+static int listingCapacity = 0;
+
+// Listed ids in a view's order, split into blocks so a song is added or removed by
+// moving the ids of one block, and found by a binary search over the blocks
+typedef struct {
+    int **blocks; // VIEW_BLOCK_SIZE ids each
+    int *blockLens;
+    int *blockStarts; // position of each block's first id in the view
+    int numBlocks;
+    int blocksCapacity;
+} sSortedView_t;
+
+// Views other than eLIBRARY_VIEW_LOADED, which is the listing
+static sSortedView_t sortedViews[eNUM_LIBRARY_VIEWS];
+
+// Listed songs by path, open addressing with linear probing. The hash is kept so
+// most probes that miss never compare strings.
+#define PATH_EMPTY (-1)
+#define PATH_DELETED (-2)
+typedef struct {
+    uint32_t hash;
+    int id; // or PATH_EMPTY / PATH_DELETED
+} sPathSlot_t;
+static sPathSlot_t *pathTable = NULL;
+static int pathTableSize = 0; // a power of two
+static int numPathSlotsUsed = 0; // songs and deleted slots
+
+static pthread_mutex_t libraryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void Library_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    numPages = 0;
+    idLimit = 0;
+    numFreeIds = 0;
+    numListed = 0;
+}
+
+void Library_cleanup(void)
+{
+    assert(initialized);
+
+    for (int i=0; i<numPages; i++)
+    {
+        free(pages[i]);
+    }
+    free(pages);
+    pages = NULL;
+    numPages = 0;
+    pagesCapacity = 0;
+    idLimit = 0;
+
+    free(freeIds);
+    freeIds = NULL;
+    numFreeIds = 0;
+    freeIdsCapacity = 0;
+
+    free(listing);
+    listing = NULL;
+    numListed = 0;
+    listingCapacity = 0;
+
+    free(pathTable);
+    pathTable = NULL;
+    pathTableSize = 0;
+    numPathSlotsUsed = 0;
+
+    for (int v=0; v<eNUM_LIBRARY_VIEWS; v++)
+    {
+        sSortedView_t *pView = &sortedViews[v];
+        for (int b=0; b<pView->numBlocks; b++)
+        {
+            free(pView->blocks[b]);
+        }
+        free(pView->blocks);
+        free(pView->blockLens);
+        free(pView->blockStarts);
+        *pView = (sSortedView_t){ 0 };
+    }
+
+    initialized = false;
+}
+
+// Grows *pArray (of elemSize elements) so it holds at least needed elements
+static void ensureCapacity(void **pArray, int *pCapacity, int needed, size_t elemSize)
+{
+    if (needed <= *pCapacity) return;
+
+    int newCapacity = *pCapacity > 0 ? *pCapacity : INITIAL_CAPACITY;
+    while (newCapacity < needed) newCapacity *= 2;
+
+    void *pNew = realloc(*pArray, newCapacity * elemSize);
+    if (!pNew)
+    {
+        perror("ERROR: Unable to grow library");
+        exit(EXIT_FAILURE);
+    }
+    *pArray = pNew;
+    *pCapacity = newCapacity;
+}
+
+static sLibraryPage_t* getPage(int id)
+{
+    return pages[id >> PAGE_BITS];
+}
+
+static int getSlot(int id)
+{
+    return id & (PAGE_SIZE - 1);
+}
+
+// Caller holds libraryMutex
+static int allocateId(void)
+{
+    if (numFreeIds > 0) return freeIds[--numFreeIds];
+
+    if (idLimit == numPages * PAGE_SIZE)
+    {
+        ensureCapacity((void**)&pages, &pagesCapacity, numPages + 1, sizeof(sLibraryPage_t*));
+        pages[numPages] = calloc(1, sizeof(sLibraryPage_t));
+        if (!pages[numPages])
+        {
+            perror("ERROR: Unable to allocate library page");
+            exit(EXIT_FAILURE);
+        }
+        numPages++;
+    }
+    return idLimit++;
+}
+
+// FNV-1a
+static uint32_t hashPath(const char *path)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)path; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding path, or the empty slot where it would go.
+// Caller holds libraryMutex
+static int findPathSlot(const char *path, uint32_t hash)
+{
+    int mask = pathTableSize - 1;
+    int firstDeleted = -1;
+    for (int slot = hash & mask; ; slot = (slot + 1) & mask)
+    {
+        sPathSlot_t *pSlot = &pathTable[slot];
+        if (pSlot->id == PATH_EMPTY) return firstDeleted >= 0 ? firstDeleted : slot;
+        if (pSlot->id == PATH_DELETED)
+        {
+            if (firstDeleted < 0) firstDeleted = slot;
+        }
+        else if (pSlot->hash == hash && strcmp(StringArena_get(getPage(pSlot->id)->path[getSlot(pSlot->id)]), path) == 0)
+        {
+            return slot;
+        }
+    }
+}
+
+// Caller holds libraryMutex
+static void addPath(int id)
+{
+    // Kept under half full, counting deleted slots, so probes stay short
+    if ((numPathSlotsUsed + 1) * 2 > pathTableSize)
+    {
+        sPathSlot_t *oldTable = pathTable;
+        int oldSize = pathTableSize;
+        pathTableSize = oldSize > 0 ? oldSize : INITIAL_CAPACITY;
+        // Only grow if the songs themselves fill it; else dropping deleted slots is enough
+        int numIds = 0;
+        for (int i=0; i<oldSize; i++)
+        {
+            if (oldTable[i].id >= 0) numIds++;
+        }
+        while ((numIds + 1) * 4 > pathTableSize) pathTableSize *= 2;
+
+        pathTable = malloc(pathTableSize * sizeof(sPathSlot_t));
+        if (!pathTable)
+        {
+            perror("ERROR: Unable to grow library path table");
+            exit(EXIT_FAILURE);
+        }
+        for (int i=0; i<pathTableSize; i++)
+        {
+            pathTable[i].id = PATH_EMPTY;
+        }
+        numPathSlotsUsed = 0;
+        for (int i=0; i<oldSize; i++)
+        {
+            if (oldTable[i].id < 0) continue;
+            int slot = oldTable[i].hash & (pathTableSize - 1);
+            while (pathTable[slot].id != PATH_EMPTY) slot = (slot + 1) & (pathTableSize - 1);
+            pathTable[slot] = oldTable[i];
+            numPathSlotsUsed++;
+        }
+        free(oldTable);
+    }
+
+    const char *path = StringArena_get(getPage(id)->path[getSlot(id)]);
+    uint32_t hash = hashPath(path);
+    int slot = findPathSlot(path, hash);
+    if (pathTable[slot].id == PATH_EMPTY) numPathSlotsUsed++;
+    // The loader removes a song before listing its path again, so paths are unique
+    if (pathTable[slot].id < 0) pathTable[slot] = (sPathSlot_t){ hash, id };
+}
+
+// Caller holds libraryMutex
+static void removePath(int id)
+{
+    if (pathTableSize == 0) return;
+    const char *path = StringArena_get(getPage(id)->path[getSlot(id)]);
+    int slot = findPathSlot(path, hashPath(path));
+    if (pathTable[slot].id == id) pathTable[slot].id = PATH_DELETED;
+}
+
+// Orders two tags, ignoring case. Interned tags are often the same string.
+static int compareTags(uint32_t a, uint32_t b)
+{
+    if (a == b) return 0;
+    return strcasecmp(StringArena_get(a), StringArena_get(b));
+}
+
+// Orders two songs for a view; no two songs are equal, so each has one place.
+// Caller holds libraryMutex
+static int compareTracks(eLibraryView_t view, int a, int b)
+{
+    sLibraryPage_t *pPageA = getPage(a);
+    sLibraryPage_t *pPageB = getPage(b);
+    int slotA = getSlot(a);
+    int slotB = getSlot(b);
+
+    int order = 0;
+    switch (view)
+    {
+    case eLIBRARY_VIEW_ARTIST:
+        order = compareTags(pPageA->artist[slotA], pPageB->artist[slotB]);
+        if (order == 0) order = compareTags(pPageA->album[slotA], pPageB->album[slotB]);
+        if (order == 0) order = compareTags(pPageA->title[slotA], pPageB->title[slotB]);
+        break;
+    case eLIBRARY_VIEW_ALBUM:
+        order = compareTags(pPageA->album[slotA], pPageB->album[slotB]);
+        if (order == 0) order = compareTags(pPageA->title[slotA], pPageB->title[slotB]);
+        break;
+    case eLIBRARY_VIEW_DURATION:
+        if (pPageA->lengthSeconds[slotA] != pPageB->lengthSeconds[slotB])
+        {
+            order = pPageA->lengthSeconds[slotA] < pPageB->lengthSeconds[slotB] ? -1 : 1;
+        }
+        break;
+    default:
+        break;
+    }
+    return order != 0 ? order : a - b;
+}
+
+// Finds where id is, or would go, in a sorted view: the block, and the index in the block.
+// Caller holds libraryMutex
+static void findInView(eLibraryView_t view, int id, int *pBlock, int *pIndex)
+{
+    sSortedView_t *pView = &sortedViews[view];
+
+    // The first block whose last id does not come before id
+    int low = 0;
+    int high = pView->numBlocks - 1;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        const int *block = pView->blocks[mid];
+        if (compareTracks(view, block[pView->blockLens[mid] - 1], id) < 0) low = mid + 1;
+        else high = mid;
+    }
+
+    int lowIndex = 0;
+    int highIndex = pView->numBlocks > 0 ? pView->blockLens[low] : 0;
+    while (lowIndex < highIndex)
+    {
+        int mid = (lowIndex + highIndex) / 2;
+        if (compareTracks(view, pView->blocks[low][mid], id) < 0) lowIndex = mid + 1;
+        else highIndex = mid;
+    }
+    *pBlock = low;
+    *pIndex = lowIndex;
+}
+
+// Caller holds libraryMutex
+static void updateBlockStarts(sSortedView_t *pView, int firstBlock)
+{
+    for (int b=firstBlock; b<pView->numBlocks; b++)
+    {
+        pView->blockStarts[b] = b > 0 ? pView->blockStarts[b-1] + pView->blockLens[b-1] : 0;
+    }
+}
+
+// Caller holds libraryMutex
+static void insertBlock(sSortedView_t *pView, int position)
+{
+    int capacity = pView->blocksCapacity;
+    ensureCapacity((void**)&pView->blocks, &capacity, pView->numBlocks + 1, sizeof(int*));
+    capacity = pView->blocksCapacity;
+    ensureCapacity((void**)&pView->blockLens, &capacity, pView->numBlocks + 1, sizeof(int));
+    capacity = pView->blocksCapacity;
+    ensureCapacity((void**)&pView->blockStarts, &capacity, pView->numBlocks + 1, sizeof(int));
+    pView->blocksCapacity = capacity;
+
+    int numAfter = pView->numBlocks - position;
+    memmove(&pView->blocks[position+1], &pView->blocks[position], numAfter * sizeof(int*));
+    memmove(&pView->blockLens[position+1], &pView->blockLens[position], numAfter * sizeof(int));
+    memmove(&pView->blockStarts[position+1], &pView->blockStarts[position], numAfter * sizeof(int));
+    pView->numBlocks++;
+
+    pView->blocks[position] = malloc(VIEW_BLOCK_SIZE * sizeof(int));
+    if (!pView->blocks[position])
+    {
+        perror("ERROR: Unable to allocate library view");
+        exit(EXIT_FAILURE);
+    }
+    pView->blockLens[position] = 0;
+}
+
+// Caller holds libraryMutex
+static void addToView(eLibraryView_t view, int id)
+{
+    sSortedView_t *pView = &sortedViews[view];
+    if (pView->numBlocks == 0) insertBlock(pView, 0);
+
+    int block, index;
+    findInView(view, id, &block, &index);
+
+    if (pView->blockLens[block] == VIEW_BLOCK_SIZE)
+    {
+        // Split the full block in two
+        insertBlock(pView, block + 1);
+        int half = VIEW_BLOCK_SIZE / 2;
+        memcpy(pView->blocks[block+1], &pView->blocks[block][half], (VIEW_BLOCK_SIZE - half) * sizeof(int));
+        pView->blockLens[block+1] = VIEW_BLOCK_SIZE - half;
+        pView->blockLens[block] = half;
+        if (index > half)
+        {
+            block++;
+            index -= half;
+        }
+    }
+
+    int *ids = pView->blocks[block];
+    memmove(&ids[index+1], &ids[index], (pView->blockLens[block] - index) * sizeof(int));
+    ids[index] = id;
+    pView->blockLens[block]++;
+    updateBlockStarts(pView, block);
+}
+
+// Caller holds libraryMutex. Returns the position id was at.
+static int removeFromView(eLibraryView_t view, int id)
+{
+    sSortedView_t *pView = &sortedViews[view];
+    if (pView->numBlocks == 0) return -1;
+
+    int block, index;
+    findInView(view, id, &block, &index);
+    if (index >= pView->blockLens[block] || pView->blocks[block][index] != id) return -1;
+
+    int position = pView->blockStarts[block] + index;
+    int *ids = pView->blocks[block];
+    pView->blockLens[block]--;
+    memmove(&ids[index], &ids[index+1], (pView->blockLens[block] - index) * sizeof(int));
+
+    if (pView->blockLens[block] == 0 && pView->numBlocks > 1)
+    {
+        free(ids);
+        pView->numBlocks--;
+        int numAfter = pView->numBlocks - block;
+        memmove(&pView->blocks[block], &pView->blocks[block+1], numAfter * sizeof(int*));
+        memmove(&pView->blockLens[block], &pView->blockLens[block+1], numAfter * sizeof(int));
+        memmove(&pView->blockStarts[block], &pView->blockStarts[block+1], numAfter * sizeof(int));
+    }
+    updateBlockStarts(pView, block);
+    return position;
+}
+
+// Id at position in a view, or -1
+// Caller holds libraryMutex
+static int getViewTrack(eLibraryView_t view, int position)
+{
+    if (position < 0 || position >= numListed) return -1;
+    if (view == eLIBRARY_VIEW_LOADED) return listing[position];
+
+    sSortedView_t *pView = &sortedViews[view];
+    // The last block starting at or before position
+    int low = 0;
+    int high = pView->numBlocks - 1;
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (pView->blockStarts[mid] <= position) low = mid;
+        else high = mid - 1;
+    }
+    return pView->blocks[low][position - pView->blockStarts[low]];
+}
+
+int Library_addTrack(const char *path, const musicMetadata_t *pMetadata)
+{
+    assert(initialized);
+
+    // Copy the path before taking the lock; the arena has its own. Interned so a file
+    // the watcher sees rewritten again and again reuses its first copy.
+    uint32_t pathOffset = StringArena_intern(path);
+
+    pthread_mutex_lock(&libraryMutex);
+
+    int id = allocateId();
+    sLibraryPage_t *pPage = getPage(id);
+    int slot = getSlot(id);
+    pPage->path[slot] = pathOffset;
+    pPage->title[slot] = pMetadata->title;
+    pPage->artist[slot] = pMetadata->artist;
+    pPage->album[slot] = pMetadata->album;
+    pPage->lengthSeconds[slot] = pMetadata->lengthSeconds;
+    pPage->state[slot] = eTRACK_LISTED;
+
+    ensureCapacity((void**)&listing, &listingCapacity, numListed + 1, sizeof(int));
+    listing[numListed++] = id;
+    addPath(id);
+    for (int v=eLIBRARY_VIEW_LOADED+1; v<eNUM_LIBRARY_VIEWS; v++)
+    {
+        addToView(v, id);
+    }
+
+    pthread_mutex_unlock(&libraryMutex);
+
+    SearchIndex_addTrack(id, pMetadata);
+
+    return id;
+}
+
+void Library_copyStrings(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&libraryMutex);
+    for (int id=0; id<idLimit; id++)
+    {
+        sLibraryPage_t *pPage = getPage(id);
+        int slot = getSlot(id);
+        if (pPage->state[slot] == eTRACK_FREE) continue;
+
+        // Titles are interned too; the copies are all made at once, and songs without one share "Unknown"
+        pPage->path[slot] = StringArena_intern(StringArena_get(pPage->path[slot]));
+        pPage->title[slot] = StringArena_intern(StringArena_get(pPage->title[slot]));
+        pPage->artist[slot] = StringArena_intern(StringArena_get(pPage->artist[slot]));
+        pPage->album[slot] = StringArena_intern(StringArena_get(pPage->album[slot]));
+    }
+    pthread_mutex_unlock(&libraryMutex);
+}
+
+void Library_removeTrack(int id, int *positions)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&libraryMutex);
+
+    int position = -1;
+    int viewPositions[eNUM_LIBRARY_VIEWS];
+    bool wasListed = id >= 0 && id < idLimit && getPage(id)->state[getSlot(id)] == eTRACK_LISTED;
+    musicMetadata_t metadata = {0};
+    if (wasListed)
+    {
+        sLibraryPage_t *pPage = getPage(id);
+        int slot = getSlot(id);
+        pPage->state[slot] = eTRACK_REMOVED;
+        metadata.title = pPage->title[slot];
+        metadata.artist = pPage->artist[slot];
+        metadata.album = pPage->album[slot];
+        removePath(id);
+        for (int i=0; i<numListed; i++)
+        {
+            if (listing[i] == id)
+            {
+                position = i;
+                break;
+            }
+        }
+        for (int v=eLIBRARY_VIEW_LOADED+1; v<eNUM_LIBRARY_VIEWS; v++)
+        {
+            viewPositions[v] = removeFromView(v, id);
+        }
+        if (position >= 0)
+        {
+            numListed--;
+            memmove(&listing[position], &listing[position+1], (numListed - position) * sizeof(int));
+        }
+    }
+    viewPositions[eLIBRARY_VIEW_LOADED] = position;
+
+    pthread_mutex_unlock(&libraryMutex);
+
+    // The tags stay in the arena, so the index can still find the song's words
+    if (wasListed) SearchIndex_removeTrack(id, &metadata);
+
+    if (positions)
+    {
+        for (int v=0; v<eNUM_LIBRARY_VIEWS; v++)
+        {
+            positions[v] = wasListed ? viewPositions[v] : -1;
+        }
+    }
+}
+
+void Library_releaseTrack(int id)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&libraryMutex);
+    if (id >= 0 && id < idLimit && getPage(id)->state[getSlot(id)] == eTRACK_REMOVED)
+    {
+        getPage(id)->state[getSlot(id)] = eTRACK_FREE;
+        ensureCapacity((void**)&freeIds, &freeIdsCapacity, numFreeIds + 1, sizeof(int));
+        freeIds[numFreeIds++] = id;
+    }
+    pthread_mutex_unlock(&libraryMutex);
+}
+
+int Library_getNumTracks(void)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int num = numListed;
+    pthread_mutex_unlock(&libraryMutex);
+    return num;
+}
+
+int Library_getTrackAt(eLibraryView_t view, int position)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int id = getViewTrack(view, position);
+    pthread_mutex_unlock(&libraryMutex);
+    return id;
+}
+
+int Library_getPosition(eLibraryView_t view, int id)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int position = -1;
+    if (id >= 0 && id < idLimit && getPage(id)->state[getSlot(id)] == eTRACK_LISTED)
+    {
+        if (view == eLIBRARY_VIEW_LOADED)
+        {
+            for (int i=0; i<numListed && position<0; i++)
+            {
+                if (listing[i] == id) position = i;
+            }
+        }
+        else
+        {
+            int block, index;
+            findInView(view, id, &block, &index);
+            position = sortedViews[view].blockStarts[block] + index;
+        }
+    }
+    pthread_mutex_unlock(&libraryMutex);
+    return position;
+}
+
+uint32_t Library_getGroup(eLibraryView_t view, int position)
+{
+    pthread_mutex_lock(&libraryMutex);
+    uint32_t group = STRING_ARENA_EMPTY;
+    int id = getViewTrack(view, position);
+    if (id >= 0 && view == eLIBRARY_VIEW_ARTIST) group = getPage(id)->artist[getSlot(id)];
+    if (id >= 0 && view == eLIBRARY_VIEW_ALBUM) group = getPage(id)->album[getSlot(id)];
+    pthread_mutex_unlock(&libraryMutex);
+    return group;
+}
+
+int Library_getIdLimit(void)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int limit = idLimit;
+    pthread_mutex_unlock(&libraryMutex);
+    return limit;
+}
+
+bool Library_isTrack(int id)
+{
+    pthread_mutex_lock(&libraryMutex);
+    bool isTrack = id >= 0 && id < idLimit && getPage(id)->state[getSlot(id)] == eTRACK_LISTED;
+    pthread_mutex_unlock(&libraryMutex);
+    return isTrack;
+}
+
+int Library_findTrack(const char *path)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int found = -1;
+    if (pathTableSize > 0)
+    {
+        int slot = findPathSlot(path, hashPath(path));
+        if (pathTable[slot].id >= 0) found = pathTable[slot].id;
+    }
+    pthread_mutex_unlock(&libraryMutex);
+    return found;
+}
+
+const char* Library_getPath(int id)
+{
+    pthread_mutex_lock(&libraryMutex);
+    assert(id >= 0 && id < idLimit);
+    uint32_t offset = getPage(id)->path[getSlot(id)];
+    pthread_mutex_unlock(&libraryMutex);
+    return StringArena_get(offset);
+}
+
+void Library_getMetadata(int id, musicMetadata_t *pMetadata)
+{
+    pthread_mutex_lock(&libraryMutex);
+    assert(id >= 0 && id < idLimit);
+    sLibraryPage_t *pPage = getPage(id);
+    int slot = getSlot(id);
+    pMetadata->title = pPage->title[slot];
+    pMetadata->artist = pPage->artist[slot];
+    pMetadata->album = pPage->album[slot];
+    pMetadata->lengthSeconds = pPage->lengthSeconds[slot];
+    pthread_mutex_unlock(&libraryMutex);
+}
+
+void Library_setLength(int id, double lengthSeconds)
+{
+    pthread_mutex_lock(&libraryMutex);
+    assert(id >= 0 && id < idLimit);
+    // The duration view is kept sorted by moving the song to its new place
+    bool isListed = getPage(id)->state[getSlot(id)] == eTRACK_LISTED;
+    if (isListed) removeFromView(eLIBRARY_VIEW_DURATION, id);
+    getPage(id)->lengthSeconds[getSlot(id)] = lengthSeconds;
+    if (isListed) addToView(eLIBRARY_VIEW_DURATION, id);
+    pthread_mutex_unlock(&libraryMutex);
+}
+
+int Library_getWindow(eLibraryView_t view, int position, int count, char **titles, int titleLen, double *lengths)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int numCopied = 0;
+    for (int i=position; i<numListed && numCopied<count; i++)
+    {
+        if (i < 0) continue;
+        int id = getViewTrack(view, i);
+        sLibraryPage_t *pPage = getPage(id);
+        int slot = getSlot(id);
+        snprintf(titles[numCopied], titleLen, "%s", StringArena_get(pPage->title[slot]));
+        lengths[numCopied] = pPage->lengthSeconds[slot];
+        numCopied++;
+    }
+    pthread_mutex_unlock(&libraryMutex);
+    return numCopied;
+}
+
+int Library_getTitles(const int *ids, int count, char **titles, int titleLen, double *lengths)
+{
+    pthread_mutex_lock(&libraryMutex);
+    int numCopied = 0;
+    for (int i=0; i<count; i++)
+    {
+        if (ids[i] < 0 || ids[i] >= idLimit || getPage(ids[i])->state[getSlot(ids[i])] != eTRACK_LISTED) continue;
+        sLibraryPage_t *pPage = getPage(ids[i]);
+        int slot = getSlot(ids[i]);
+        snprintf(titles[numCopied], titleLen, "%s", StringArena_get(pPage->title[slot]));
+        lengths[numCopied] = pPage->lengthSeconds[slot];
+        numCopied++;
+    }
+    pthread_mutex_unlock(&libraryMutex);
+    return numCopied;
+}
+
+size_t Library_getMemoryUsage(void)
+{
+    pthread_mutex_lock(&libraryMutex);
+    size_t bytes = numPages * sizeof(sLibraryPage_t) +
+        pagesCapacity * sizeof(sLibraryPage_t*) +
+        freeIdsCapacity * sizeof(int) +
+        listingCapacity * sizeof(int) +
+        pathTableSize * sizeof(sPathSlot_t);
+    for (int v=0; v<eNUM_LIBRARY_VIEWS; v++)
+    {
+        const sSortedView_t *pView = &sortedViews[v];
+        bytes += pView->numBlocks * VIEW_BLOCK_SIZE * sizeof(int) +
+            pView->blocksCapacity * (sizeof(int*) + 2 * sizeof(int));
+    }
+    pthread_mutex_unlock(&libraryMutex);
+    return bytes;
+}
@@ -0,0 +1,323 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "library_watcher.h"
+#include "file_loader.h"
+#include "timing.h"
+
+// Changes are reported once the tree has been quiet for this long...
+#define QUIET_TIME_MS 500
+// ...or once the oldest change has waited this long, so a long copy still shows up
+#define MAX_DELAY_MS 3000
+// How often the thread checks whether it should stop
+#define POLL_INTERVAL_MS 100
+// Files are only reported once they have been written (IN_CLOSE_WRITE), not when created
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define EVENT_BUF_SIZE 4096
+#define MAX_PATH_LEN 1024
+
+typedef struct {
+    int wd;
+    char *path;
+} sWatch_t;
+
+static void* watchThreadFunc();
+
+static bool initialized = false;
+static const char *root = NULL;
+static int inotifyFd = -1;
+
+// Watched directories. Added to by the file loader's scan and by this thread.
+static sWatch_t *watches = NULL;
+static int numWatches = 0;
+static int watchesCapacity = 0;
+static pthread_mutex_t watchesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Paths changed since the last report, each listed once. Only used by the watch thread.
+static char **changedPaths = NULL;
+static int numChanged = 0;
+static int changedCapacity = 0;
+static long long firstChangeMs = 0;
+static long long lastChangeMs = 0;
+
+static bool runWatchThread = false;
+static pthread_t watchThread;
+
+
+void LibraryWatcher_init(const char *rootDir)
+{
+    assert(!initialized);
+    initialized = true;
+
+    root = rootDir;
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        // Not fatal, the library just won't update until restart
+        perror("WARNING: Unable to watch music directory");
+        return;
+    }
+
+    runWatchThread = true;
+    if (pthread_create(&watchThread, NULL, watchThreadFunc, NULL) != 0)
+    {
+        perror("Failed to spawn thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void LibraryWatcher_cleanup(void)
+{
+    assert(initialized);
+
+    if (runWatchThread)
+    {
+        runWatchThread = false;
+        pthread_join(watchThread, NULL);
+    }
+
+    if (inotifyFd >= 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+
+    for (int i=0; i<numWatches; i++)
+    {
+        free(watches[i].path);
+    }
+    free(watches);
+    watches = NULL;
+    numWatches = 0;
+    watchesCapacity = 0;
+
+    for (int i=0; i<numChanged; i++)
+    {
+        free(changedPaths[i]);
+    }
+    free(changedPaths);
+    changedPaths = NULL;
+    numChanged = 0;
+    changedCapacity = 0;
+
+    initialized = false;
+}
+
+void LibraryWatcher_watchDirectory(const char *path)
+{
+    assert(initialized);
+    if (inotifyFd < 0) return;
+
+    int wd = inotify_add_watch(inotifyFd, path, WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        perror("WARNING: Unable to watch directory");
+        return;
+    }
+
+    pthread_mutex_lock(&watchesMutex);
+
+    // Watching a directory twice returns the same descriptor; keep the newest path
+    int i = 0;
+    while (i < numWatches && watches[i].wd != wd) i++;
+    if (i == numWatches)
+    {
+        if (numWatches == watchesCapacity)
+        {
+            watchesCapacity = watchesCapacity == 0 ? 16 : watchesCapacity * 2;
+            watches = realloc(watches, watchesCapacity * sizeof(sWatch_t));
+            if (!watches)
+            {
+                perror("ERROR: Unable to allocate directory watches");
+                exit(EXIT_FAILURE);
+            }
+        }
+        numWatches++;
+    }
+    else
+    {
+        free(watches[i].path);
+    }
+    watches[i].wd = wd;
+    watches[i].path = strdup(path);
+
+    pthread_mutex_unlock(&watchesMutex);
+}
+
+static bool isUnder(const char *path, const char *dir)
+{
+    size_t dirLen = strlen(dir);
+    return strncmp(path, dir, dirLen) == 0 && (path[dirLen] == '\0' || path[dirLen] == '/');
+}
+
+// Stops watching dir and everything below it, e.g. because it was moved away.
+// Its descriptors would otherwise keep reporting events under the old path.
+static void unwatchDirectory(const char *dir)
+{
+    pthread_mutex_lock(&watchesMutex);
+    int i = 0;
+    while (i < numWatches)
+    {
+        if (isUnder(watches[i].path, dir))
+        {
+            inotify_rm_watch(inotifyFd, watches[i].wd);
+            free(watches[i].path);
+            watches[i] = watches[--numWatches];
+        }
+        else
+        {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&watchesMutex);
+}
+
+static void forgetWatch(int wd)
+{
+    pthread_mutex_lock(&watchesMutex);
+    for (int i=0; i<numWatches; i++)
+    {
+        if (watches[i].wd == wd)
+        {
+            free(watches[i].path);
+            watches[i] = watches[--numWatches];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watchesMutex);
+}
+
+// Returns false if wd is not (or no longer) watched
+static bool getEventPath(struct inotify_event *pEvent, char *buf, size_t bufLen)
+{
+    bool found = false;
+    pthread_mutex_lock(&watchesMutex);
+    for (int i=0; i<numWatches; i++)
+    {
+        if (watches[i].wd == pEvent->wd)
+        {
+            snprintf(buf, bufLen, "%s/%s", watches[i].path, pEvent->name);
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watchesMutex);
+    return found;
+}
+
+static void addChangedPath(const char *path)
+{
+    long long now = getTimeInMs();
+    if (numChanged == 0) firstChangeMs = now;
+    lastChangeMs = now;
+
+    // Repeats are dropped once, when the batch is reported
+    if (numChanged == changedCapacity)
+    {
+        changedCapacity = changedCapacity == 0 ? 16 : changedCapacity * 2;
+        changedPaths = realloc(changedPaths, changedCapacity * sizeof(char*));
+        if (!changedPaths)
+        {
+            perror("ERROR: Unable to allocate changed paths");
+            exit(EXIT_FAILURE);
+        }
+    }
+    changedPaths[numChanged++] = strdup(path);
+}
+
+static void handleEvent(struct inotify_event *pEvent)
+{
+    // Events were dropped; resync the whole tree
+    if (pEvent->mask & IN_Q_OVERFLOW)
+    {
+        printf("WARNING: Music directory watch overflowed, rescanning\n");
+        addChangedPath(root);
+        return;
+    }
+    if (pEvent->mask & IN_IGNORED)
+    {
+        forgetWatch(pEvent->wd);
+        return;
+    }
+    if (pEvent->len == 0) return;
+
+    char path[MAX_PATH_LEN];
+    if (!getEventPath(pEvent, path, sizeof(path))) return;
+
+    if (pEvent->mask & IN_ISDIR)
+    {
+        // Watch new directories straight away so nothing written into them is missed.
+        // Files already inside are picked up when the directory itself is reported.
+        if (pEvent->mask & (IN_CREATE | IN_MOVED_TO)) LibraryWatcher_watchDirectory(path);
+        if (pEvent->mask & IN_MOVED_FROM) unwatchDirectory(path);
+    }
+    else if (pEvent->mask & IN_CREATE)
+    {
+        // Wait for IN_CLOSE_WRITE
+        return;
+    }
+
+    addChangedPath(path);
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void reportChanges(void)
+{
+    // A file written in many steps shows up many times; sorting puts the copies side by side
+    qsort(changedPaths, numChanged, sizeof(char*), comparePaths);
+    for (int i=0; i<numChanged; i++)
+    {
+        if (i == 0 || strcmp(changedPaths[i], changedPaths[i - 1]) != 0)
+        {
+            FileLoader_libraryChanged(changedPaths[i]);
+        }
+    }
+    for (int i=0; i<numChanged; i++)
+    {
+        free(changedPaths[i]);
+    }
+    numChanged = 0;
+}
+
+static void* watchThreadFunc()
+{
+    char buf[EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pollFd = { inotifyFd, POLLIN, 0 };
+
+    while (runWatchThread)
+    {
+        if (poll(&pollFd, 1, POLL_INTERVAL_MS) > 0)
+        {
+            ssize_t len;
+            while ((len = read(inotifyFd, buf, sizeof(buf))) > 0)
+            {
+                char *p = buf;
+                while (p < buf + len)
+                {
+                    struct inotify_event *pEvent = (struct inotify_event*)p;
+                    handleEvent(pEvent);
+                    p += sizeof(struct inotify_event) + pEvent->len;
+                }
+            }
+        }
+
+        long long now = getTimeInMs();
+        if (numChanged > 0 && (now - lastChangeMs >= QUIET_TIME_MS || now - firstChangeMs >= MAX_DELAY_MS))
+        {
+            reportChanges();
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,367 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "load_scheduler.h"
+
+#define INITIAL_CAPACITY 256
+#define NOT_PENDING -1
+#define MAX_PEEK 16
+
+typedef struct {
+    int fileInd;
+    enum eLoadPriority priority;
+    unsigned long order; // lower goes first within a priority
+} sLoadJob_t;
+
+static bool initialized = false;
+
+// Binary max-heap of pending jobs, plus the heap position of every file so
+// jobs can be re-prioritized or cancelled in O(log n).
+static sLoadJob_t *heap = NULL;
+static int heapSize = 0;
+static int heapCapacity = 0;
+static int *heapPos = NULL; // indexed by fileInd; NOT_PENDING if not in the heap
+static int heapPosCapacity = 0;
+static unsigned long nextOrder = 0;
+
+// Files around the cursor, nearest first
+static int windowInds[LOAD_SCHEDULER_MAX_WINDOW];
+static int windowSize = 0;
+
+// Jobs below this priority wait in the heap
+static enum eLoadPriority minPriority = eLOAD_BACKGROUND;
+
+static bool stopping = false;
+static pthread_mutex_t schedulerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t schedulerCond = PTHREAD_COND_INITIALIZER;
+
+
+void LoadScheduler_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    heapCapacity = INITIAL_CAPACITY;
+    heap = malloc(heapCapacity * sizeof(sLoadJob_t));
+    heapPosCapacity = INITIAL_CAPACITY;
+    heapPos = malloc(heapPosCapacity * sizeof(int));
+    if (!heap || !heapPos)
+    {
+        perror("ERROR: Unable to allocate load scheduler");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=0; i<heapPosCapacity; i++)
+    {
+        heapPos[i] = NOT_PENDING;
+    }
+
+    heapSize = 0;
+    windowSize = 0;
+    minPriority = eLOAD_BACKGROUND;
+    stopping = false;
+}
+
+void LoadScheduler_cleanup(void)
+{
+    assert(initialized);
+
+    free(heap);
+    heap = NULL;
+    free(heapPos);
+    heapPos = NULL;
+    heapSize = 0;
+
+    initialized = false;
+}
+
+static bool goesBefore(sLoadJob_t *a, sLoadJob_t *b)
+{
+    if (a->priority != b->priority) return a->priority > b->priority;
+    return a->order < b->order;
+}
+
+static void swapJobs(int i, int j)
+{
+    sLoadJob_t temp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = temp;
+    heapPos[heap[i].fileInd] = i;
+    heapPos[heap[j].fileInd] = j;
+}
+
+static void siftUp(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!goesBefore(&heap[i], &heap[parent])) break;
+        swapJobs(i, parent);
+        i = parent;
+    }
+}
+
+static void siftDown(int i)
+{
+    while (true)
+    {
+        int left = 2*i + 1;
+        int right = left + 1;
+        int first = i;
+        if (left < heapSize && goesBefore(&heap[left], &heap[first])) first = left;
+        if (right < heapSize && goesBefore(&heap[right], &heap[first])) first = right;
+        if (first == i) break;
+        swapJobs(i, first);
+        i = first;
+    }
+}
+
+static void removeAt(int i)
+{
+    heapPos[heap[i].fileInd] = NOT_PENDING;
+    heapSize--;
+    if (i == heapSize) return;
+
+    int movedInd = heap[heapSize].fileInd;
+    heap[i] = heap[heapSize];
+    heapPos[movedInd] = i;
+    siftUp(i);
+    siftDown(heapPos[movedInd]);
+}
+
+static int getHeapPos(int fileInd)
+{
+    if (fileInd < 0 || fileInd >= heapPosCapacity) return NOT_PENDING;
+    return heapPos[fileInd];
+}
+
+// Changes a pending job's priority. Caller holds schedulerMutex.
+static void setPriority(int pos, enum eLoadPriority priority, unsigned long order)
+{
+    int fileInd = heap[pos].fileInd;
+    heap[pos].priority = priority;
+    heap[pos].order = order;
+    siftUp(pos);
+    siftDown(heapPos[fileInd]);
+}
+
+static bool isInWindow(int fileInd)
+{
+    for (int i=0; i<windowSize; i++)
+    {
+        if (windowInds[i] == fileInd) return true;
+    }
+    return false;
+}
+
+static void growFor(int fileInd)
+{
+    if (heapSize == heapCapacity)
+    {
+        heapCapacity *= 2;
+        heap = realloc(heap, heapCapacity * sizeof(sLoadJob_t));
+    }
+    if (fileInd >= heapPosCapacity)
+    {
+        int newCapacity = heapPosCapacity;
+        while (fileInd >= newCapacity) newCapacity *= 2;
+        heapPos = realloc(heapPos, newCapacity * sizeof(int));
+        for (int i=heapPosCapacity; i<newCapacity && heapPos; i++)
+        {
+            heapPos[i] = NOT_PENDING;
+        }
+        heapPosCapacity = newCapacity;
+    }
+    if (!heap || !heapPos)
+    {
+        perror("ERROR: Unable to grow load scheduler");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void LoadScheduler_add(int fileInd)
+{
+    assert(initialized);
+    assert(fileInd >= 0);
+
+    pthread_mutex_lock(&schedulerMutex);
+    if (getHeapPos(fileInd) == NOT_PENDING)
+    {
+        growFor(fileInd);
+
+        int pos = heapSize++;
+        heap[pos].fileInd = fileInd;
+        heap[pos].priority = isInWindow(fileInd) ? eLOAD_NEAR_CURSOR : eLOAD_BACKGROUND;
+        heap[pos].order = nextOrder++;
+        heapPos[fileInd] = pos;
+        siftUp(pos);
+
+        pthread_cond_signal(&schedulerCond);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+}
+
+bool LoadScheduler_raise(int fileInd, enum eLoadPriority priority)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    int pos = getHeapPos(fileInd);
+    bool isPending = pos != NOT_PENDING;
+    if (isPending && heap[pos].priority < priority)
+    {
+        setPriority(pos, priority, nextOrder++);
+        pthread_cond_signal(&schedulerCond);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+
+    return isPending;
+}
+
+void LoadScheduler_reset(int fileInd)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    int pos = getHeapPos(fileInd);
+    if (pos != NOT_PENDING)
+    {
+        setPriority(pos, isInWindow(fileInd) ? eLOAD_NEAR_CURSOR : eLOAD_BACKGROUND, heap[pos].order);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+}
+
+void LoadScheduler_cancel(int fileInd)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    int pos = getHeapPos(fileInd);
+    if (pos != NOT_PENDING)
+    {
+        removeAt(pos);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+}
+
+void LoadScheduler_setWindow(const int *fileInds, int numFiles)
+{
+    assert(initialized);
+    if (numFiles > LOAD_SCHEDULER_MAX_WINDOW) numFiles = LOAD_SCHEDULER_MAX_WINDOW;
+
+    pthread_mutex_lock(&schedulerMutex);
+
+    int oldInds[LOAD_SCHEDULER_MAX_WINDOW];
+    int numOld = windowSize;
+    memcpy(oldInds, windowInds, numOld * sizeof(int));
+    memcpy(windowInds, fileInds, numFiles * sizeof(int));
+    windowSize = numFiles;
+
+    // Files leaving the window go back to background
+    for (int i=0; i<numOld; i++)
+    {
+        int pos = getHeapPos(oldInds[i]);
+        if (pos != NOT_PENDING && heap[pos].priority == eLOAD_NEAR_CURSOR && !isInWindow(oldInds[i]))
+        {
+            setPriority(pos, eLOAD_BACKGROUND, heap[pos].order);
+        }
+    }
+
+    // Nearest to the cursor first
+    for (int i=0; i<numFiles; i++)
+    {
+        int pos = getHeapPos(fileInds[i]);
+        if (pos != NOT_PENDING && heap[pos].priority <= eLOAD_NEAR_CURSOR)
+        {
+            setPriority(pos, eLOAD_NEAR_CURSOR, nextOrder++);
+        }
+    }
+    pthread_cond_signal(&schedulerCond);
+
+    pthread_mutex_unlock(&schedulerMutex);
+}
+
+int LoadScheduler_waitForNext(enum eLoadPriority *pPriority)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    while ((heapSize == 0 || heap[0].priority < minPriority) && !stopping)
+    {
+        pthread_cond_wait(&schedulerCond, &schedulerMutex);
+    }
+
+    int fileInd = -1;
+    if (!stopping)
+    {
+        fileInd = heap[0].fileInd;
+        *pPriority = heap[0].priority;
+        removeAt(0);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+
+    return fileInd;
+}
+
+int LoadScheduler_peek(int *fileInds, int maxFiles)
+{
+    assert(initialized);
+    if (maxFiles > MAX_PEEK) maxFiles = MAX_PEEK;
+
+    pthread_mutex_lock(&schedulerMutex);
+
+    // The next job is always the root or a child of one already taken,
+    // so only those need to be compared
+    int candidates[MAX_PEEK + 1];
+    int numCandidates = heapSize > 0 ? 1 : 0;
+    candidates[0] = 0;
+
+    int numFound = 0;
+    while (numFound < maxFiles && numCandidates > 0)
+    {
+        int best = 0;
+        for (int i=1; i<numCandidates; i++)
+        {
+            if (goesBefore(&heap[candidates[i]], &heap[candidates[best]])) best = i;
+        }
+        int pos = candidates[best];
+        if (heap[pos].priority < minPriority) break;
+
+        fileInds[numFound++] = heap[pos].fileInd;
+        candidates[best] = candidates[--numCandidates];
+        for (int child = 2*pos + 1; child <= 2*pos + 2 && child < heapSize; child++)
+        {
+            candidates[numCandidates++] = child;
+        }
+    }
+
+    pthread_mutex_unlock(&schedulerMutex);
+
+    return numFound;
+}
+
+void LoadScheduler_setMinPriority(enum eLoadPriority priority)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    if (priority != minPriority)
+    {
+        minPriority = priority;
+        pthread_cond_broadcast(&schedulerCond);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+}
+
+void LoadScheduler_stop(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&schedulerMutex);
+    stopping = true;
+    pthread_cond_broadcast(&schedulerCond);
+    pthread_mutex_unlock(&schedulerMutex);
+}
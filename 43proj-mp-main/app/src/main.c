@@ -17,7 +17,13 @@
 #include <unistd.h>
 #include "effect_loader.h"
 #include "file_loader.h"
+#include "file_reader.h"
+#include "library.h"
+#include "search_index.h"
+#include "string_arena.h"
 #include "app.h"
+#include "boot.h"
+#include "session.h"
 
 #include "audio_mixer.h"
 
@@ -56,40 +62,67 @@ int main()
   return EXIT_SUCCESS;
 }
 
-void init(void) {
+static void loadR5(void) {
   system("/mnt/remote/myApps/r5/load_r5_mcu.sh");
-  // Initialize all modules; HAL modules first
-  Gpio_init();
-  Joystick_init();
-  RotaryStateMachine_init();
-  BtnStateMachine_init();
-
-  Visualizer_init();
-  Accelerometer_init();
-  
+}
+
+static void initDisplay(void) {
   Display_init(DISPLAY_OPTS);
+}
 
-  AudioMixer_init();
-  AudioPlayback_init();
-  EffectLoader_init();
-  App_init(); 
-  FileLoader_init();
-  Volume_init();
-  Tilting_init();
-  
+// Each module starts as soon as the modules it uses are up; see boot.h
+static const sBootStep_t BOOT_STEPS[] = {
+  { "gpio",          Gpio_init,                { NULL } },
+  { "joystick",      Joystick_init,            { NULL } },
+  { "rotary",        RotaryStateMachine_init,  { "gpio" } },
+  { "buttons",       BtnStateMachine_init,     { "gpio" } },
+  { "accelerometer", Accelerometer_init,       { NULL } },
+  { "r5",            loadR5,                   { NULL } },
+  { "visualizer",    Visualizer_init,          { "r5" } },
+  { "display",       initDisplay,              { "gpio" } },
 
-  signal(SIGINT, signal_exit);
+  { "strings",       StringArena_init,         { NULL } },
+  { "reader",        FileReader_init,          { NULL } },
+  { "mixer",         AudioMixer_init,          { "visualizer", "reader", "strings" } },
+  { "playback",      AudioPlayback_init,       { "mixer" } },
+  { "effects",       EffectLoader_init,        { "mixer" } },
+  { "search",        SearchIndex_init,         { "strings" } },
+  { "library",       Library_init,             { "strings", "search" } },
+  // Reads the saved queue so the loader resumes the current song before scanning
+  { "restore",       Session_load,             { "reader" } },
+  { "loader",        FileLoader_init,          { "library", "reader", "playback", "restore" } },
+  { "app",           App_init,                 { "display", "buttons", "rotary", "joystick",
+                                                 "effects", "loader" } },
+  // Reports every volume change to the app
+  { "volume",        Volume_init,              { "app" } },
+  { "tilting",       Tilting_init,             { "accelerometer", "app" } },
+  { "session",       Session_init,             { "app", "volume" } },
+};
+#define NUM_BOOT_STEPS (sizeof(BOOT_STEPS) / sizeof(BOOT_STEPS[0]))
+
+void init(void) {
+  // Before the modules: their threads check for shutdown as soon as they start
   shutdown_init();
+
+  Boot_run(BOOT_STEPS, NUM_BOOT_STEPS);
+
+  // After the display, which installs its own handler
+  signal(SIGINT, signal_exit);
 }
 void cleanup(void) {
   // Cleanup all modules (HAL modules last)
+  Session_cleanup();
   Tilting_cleanup();
   Volume_cleanup();
   App_cleanup();
   FileLoader_cleanup();
+  Library_cleanup();
+  SearchIndex_cleanup();
   EffectLoader_cleanup();
   AudioPlayback_cleanup();
   AudioMixer_cleanup();
+  FileReader_cleanup();
+  StringArena_cleanup();
 
   Display_cleanup();
   Accelerometer_cleanup();
@@ -0,0 +1,415 @@
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <mpg123.h>
+
+#include "music_stream.h"
+#include "codec.h"
+#include "codec_mp3.h"
+
+// Only the playing song and a prefetched song or two need a ring buffer at once.
+#define MAX_ACTIVE_STREAMS 4
+#define DEFAULT_NUM_CHANNELS 2
+#define RING_NUM_SAMPLES (44100 * DEFAULT_NUM_CHANNELS) // ~1 second of stereo audio
+#define DECODE_THREAD_TIMEOUT_MS 10
+#define NO_SEEK_REQUEST -1
+
+struct sMusicStream {
+    unsigned char *pBytes;
+    size_t numBytes;
+
+    // Held by the decode thread while it services this stream.
+    pthread_mutex_t lock;
+    sCodecDecoder_t *decoder;
+    short *ring;
+    int numChannels;
+
+    // Single producer (decode thread), single consumer (mixer).
+    // Counters only grow until a seek resets them; ring index is count % RING_NUM_SAMPLES.
+    atomic_size_t writeCount;
+    atomic_size_t readCount;
+    size_t baseLocation; // song sample index that readCount == 0 corresponds to
+    atomic_bool decoderDone;
+
+    atomic_long seekRequest; // song sample index to seek to, or NO_SEEK_REQUEST
+    atomic_bool wanted;
+    atomic_bool ready;       // ring allocated and positioned; consumer may copy out of it
+    atomic_int numReaders;   // consumers currently copying out of the ring
+};
+
+static void* decodeThreadFunc();
+
+static bool initialized = false;
+
+// Only the decode thread and destroy() touch these, under streamsMutex.
+static sMusicStream_t *activeStreams[MAX_ACTIVE_STREAMS];
+static pthread_mutex_t streamsMutex = PTHREAD_MUTEX_INITIALIZER;
+// Streams the mixer wants a slot for. It fills these without taking a lock and the
+// decode thread moves them into activeStreams.
+static _Atomic(sMusicStream_t*) requestedStreams[MAX_ACTIVE_STREAMS];
+static pthread_cond_t decodeCond = PTHREAD_COND_INITIALIZER;
+
+static bool runDecodeThread = false;
+static pthread_t decodeThread;
+
+
+void MusicStream_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    for (int i=0; i<MAX_ACTIVE_STREAMS; i++)
+    {
+        activeStreams[i] = NULL;
+        atomic_init(&requestedStreams[i], NULL);
+    }
+
+    runDecodeThread = true;
+    if (pthread_create(&decodeThread, NULL, decodeThreadFunc, NULL) != 0)
+    {
+        perror("Failed to spawn thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void MusicStream_cleanup(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&streamsMutex);
+    runDecodeThread = false;
+    pthread_cond_signal(&decodeCond);
+    pthread_mutex_unlock(&streamsMutex);
+    pthread_join(decodeThread, NULL);
+
+    initialized = false;
+}
+
+sMusicStream_t* MusicStream_create(unsigned char *pBytes, size_t numBytes)
+{
+    assert(initialized);
+    assert(pBytes);
+
+    sMusicStream_t *pStream = malloc(sizeof(sMusicStream_t));
+    if (!pStream)
+    {
+        perror("ERROR: Unable to allocate music stream");
+        exit(EXIT_FAILURE);
+    }
+
+    pStream->pBytes = pBytes;
+    pStream->numBytes = numBytes;
+    pthread_mutex_init(&pStream->lock, NULL);
+    pStream->decoder = NULL;
+    pStream->ring = NULL;
+    pStream->numChannels = DEFAULT_NUM_CHANNELS;
+    atomic_init(&pStream->writeCount, 0);
+    atomic_init(&pStream->readCount, 0);
+    pStream->baseLocation = 0;
+    atomic_init(&pStream->decoderDone, false);
+    atomic_init(&pStream->seekRequest, NO_SEEK_REQUEST);
+    atomic_init(&pStream->wanted, false);
+    atomic_init(&pStream->ready, false);
+    atomic_init(&pStream->numReaders, 0);
+
+    return pStream;
+}
+
+// Frees the ring and decoder. Caller holds pStream->lock.
+static void freeDecodeState(sMusicStream_t *pStream)
+{
+    atomic_store(&pStream->ready, false);
+    // Wait for the mixer to finish any copy it started before ready was cleared
+    while (atomic_load(&pStream->numReaders) > 0)
+    {
+        sched_yield();
+    }
+
+    free(pStream->ring);
+    pStream->ring = NULL;
+
+    Codec_close(pStream->decoder);
+    pStream->decoder = NULL;
+}
+
+void MusicStream_destroy(sMusicStream_t *pStream)
+{
+    assert(initialized);
+    if (pStream == NULL) return;
+
+    pthread_mutex_lock(&streamsMutex);
+    for (int i=0; i<MAX_ACTIVE_STREAMS; i++)
+    {
+        if (activeStreams[i] == pStream) activeStreams[i] = NULL;
+        sMusicStream_t *pExpected = pStream;
+        atomic_compare_exchange_strong(&requestedStreams[i], &pExpected, NULL);
+    }
+    pthread_mutex_unlock(&streamsMutex);
+
+    // The decode thread takes a stream's lock before letting go of streamsMutex, so
+    // once the slot is cleared it is either servicing this stream or never will again.
+    // Waiting for it here without streamsMutex keeps other streams decoding meanwhile.
+    pthread_mutex_lock(&pStream->lock);
+    freeDecodeState(pStream);
+    pthread_mutex_unlock(&pStream->lock);
+
+    pthread_mutex_destroy(&pStream->lock);
+    free(pStream->pBytes);
+    free(pStream);
+}
+
+size_t MusicStream_getCompressedSize(sMusicStream_t *pStream)
+{
+    return pStream->numBytes;
+}
+
+bool MusicStream_attachDecoder(sMusicStream_t *pStream, mpg123_handle *mp3Handle)
+{
+    return CodecMp3_attach(mp3Handle, pStream->pBytes, pStream->numBytes);
+}
+
+// Marks the stream as wanted and asks the decode thread for a slot. Takes no lock, so
+// the mixer can call it while holding its own.
+static void requestActivation(sMusicStream_t *pStream, size_t location)
+{
+    atomic_store(&pStream->seekRequest, (long)location);
+    // Wanted before it is visible, so the decode thread never drops a fresh request
+    atomic_store(&pStream->wanted, true);
+
+    for (int i=0; i<MAX_ACTIVE_STREAMS; i++)
+    {
+        sMusicStream_t *pExpected = NULL;
+        if (atomic_compare_exchange_strong(&requestedStreams[i], &pExpected, pStream))
+        {
+            pthread_cond_signal(&decodeCond);
+            return;
+        }
+    }
+
+    // Try again on the next read
+    atomic_store(&pStream->wanted, false);
+}
+
+// Moves requested streams into decode slots. Caller holds streamsMutex.
+static void takeRequests(void)
+{
+    for (int i=0; i<MAX_ACTIVE_STREAMS; i++)
+    {
+        sMusicStream_t *pStream = atomic_exchange(&requestedStreams[i], NULL);
+        if (pStream == NULL) continue;
+
+        int freeSlot = -1;
+        for (int j=0; j<MAX_ACTIVE_STREAMS; j++)
+        {
+            if (activeStreams[j] == pStream)
+            {
+                freeSlot = j;
+                break;
+            }
+            if (activeStreams[j] == NULL && freeSlot < 0) freeSlot = j;
+        }
+
+        if (freeSlot < 0)
+        {
+            printf("WARNING: No available slots for new music streams.\n");
+            atomic_store(&pStream->wanted, false);
+            continue;
+        }
+        activeStreams[freeSlot] = pStream;
+    }
+}
+
+size_t MusicStream_read(sMusicStream_t *pStream, size_t location, short *dest, size_t numSamples, bool *pFinished)
+{
+    assert(initialized);
+    *pFinished = false;
+
+    if (!atomic_load(&pStream->wanted))
+    {
+        requestActivation(pStream, location);
+        return 0;
+    }
+
+    if (atomic_load(&pStream->seekRequest) != NO_SEEK_REQUEST) return 0;
+
+    size_t numCopied = 0;
+    atomic_fetch_add(&pStream->numReaders, 1);
+    if (atomic_load(&pStream->ready))
+    {
+        size_t readCount = atomic_load(&pStream->readCount);
+        if (pStream->baseLocation + readCount != location)
+        {
+            // Restarted, skipped back, or resumed elsewhere
+            atomic_store(&pStream->seekRequest, (long)location);
+        }
+        else
+        {
+            // Load done before writeCount: if done is set, writeCount is final
+            bool decoderDone = atomic_load(&pStream->decoderDone);
+            size_t available = atomic_load(&pStream->writeCount) - readCount;
+            numCopied = available < numSamples ? available : numSamples;
+
+            if (numCopied > 0)
+            {
+                size_t ringPos = readCount % RING_NUM_SAMPLES;
+                size_t firstPart = RING_NUM_SAMPLES - ringPos;
+                if (firstPart > numCopied) firstPart = numCopied;
+                memcpy(dest, pStream->ring + ringPos, firstPart * sizeof(short));
+                memcpy(dest + firstPart, pStream->ring, (numCopied - firstPart) * sizeof(short));
+            }
+
+            atomic_store(&pStream->readCount, readCount + numCopied);
+            *pFinished = decoderDone && numCopied == available;
+        }
+    }
+    atomic_fetch_sub(&pStream->numReaders, 1);
+
+    pthread_cond_signal(&decodeCond);
+    return numCopied;
+}
+
+void MusicStream_prefetch(sMusicStream_t *pStream, size_t location)
+{
+    assert(initialized);
+    if (atomic_load(&pStream->wanted)) return;
+
+    requestActivation(pStream, location);
+}
+
+void MusicStream_release(sMusicStream_t *pStream)
+{
+    assert(initialized);
+
+    // The decode thread frees the ring the next time it looks at the stream
+    atomic_store(&pStream->wanted, false);
+    pthread_cond_signal(&decodeCond);
+}
+
+// Opens the decoder, handles seeks and tops up the ring.
+// Caller holds pStream->lock. Returns true if any work was done.
+static bool serviceStream(sMusicStream_t *pStream)
+{
+    if (pStream->ring == NULL)
+    {
+        pStream->ring = malloc(RING_NUM_SAMPLES * sizeof(short));
+        if (!pStream->ring)
+        {
+            perror("ERROR: Unable to allocate music stream ring buffer");
+            exit(EXIT_FAILURE);
+        }
+
+        // A stream that cannot be opened plays as an empty song
+        pStream->decoder = Codec_open(pStream->pBytes, pStream->numBytes);
+        if (pStream->decoder)
+        {
+            sCodecFormat_t format;
+            Codec_getFormat(pStream->decoder, &format);
+            pStream->numChannels = format.numChannels;
+        }
+    }
+
+    bool didWork = false;
+
+    long seekRequest = atomic_load(&pStream->seekRequest);
+    if (seekRequest != NO_SEEK_REQUEST)
+    {
+        atomic_store(&pStream->ready, false);
+        while (atomic_load(&pStream->numReaders) > 0)
+        {
+            sched_yield();
+        }
+
+        if (pStream->decoder) Codec_seek(pStream->decoder, seekRequest);
+        atomic_store(&pStream->writeCount, 0);
+        atomic_store(&pStream->readCount, 0);
+        atomic_store(&pStream->decoderDone, pStream->decoder == NULL);
+        pStream->baseLocation = seekRequest;
+
+        // A newer request may have arrived while seeking; it is handled next pass
+        atomic_compare_exchange_strong(&pStream->seekRequest, &seekRequest, NO_SEEK_REQUEST);
+        atomic_store(&pStream->ready, true);
+        didWork = true;
+    }
+
+    size_t writeCount = atomic_load(&pStream->writeCount);
+    size_t freeSpace = RING_NUM_SAMPLES - (writeCount - atomic_load(&pStream->readCount));
+    while (freeSpace > 0 && !atomic_load(&pStream->decoderDone))
+    {
+        size_t ringPos = writeCount % RING_NUM_SAMPLES;
+        size_t contiguous = RING_NUM_SAMPLES - ringPos;
+        if (contiguous > freeSpace) contiguous = freeSpace;
+
+        bool finished;
+        size_t numDecoded = Codec_read(pStream->decoder, pStream->ring + ringPos, contiguous, &finished);
+
+        writeCount += numDecoded;
+        atomic_store(&pStream->writeCount, writeCount);
+        freeSpace -= numDecoded;
+        didWork = true;
+
+        if (finished) atomic_store(&pStream->decoderDone, true);
+    }
+
+    return didWork;
+}
+
+static void* decodeThreadFunc()
+{
+    while (runDecodeThread)
+    {
+        bool didWork = false;
+
+        pthread_mutex_lock(&streamsMutex);
+        takeRequests();
+        pthread_mutex_unlock(&streamsMutex);
+
+        for (int i=0; i<MAX_ACTIVE_STREAMS; i++)
+        {
+            pthread_mutex_lock(&streamsMutex);
+            sMusicStream_t *pStream = activeStreams[i];
+            if (pStream == NULL)
+            {
+                pthread_mutex_unlock(&streamsMutex);
+                continue;
+            }
+
+            pthread_mutex_lock(&pStream->lock);
+            if (!atomic_load(&pStream->wanted))
+            {
+                activeStreams[i] = NULL;
+                freeDecodeState(pStream);
+                pthread_mutex_unlock(&pStream->lock);
+                pthread_mutex_unlock(&streamsMutex);
+                continue;
+            }
+            pthread_mutex_unlock(&streamsMutex);
+
+            didWork |= serviceStream(pStream);
+            pthread_mutex_unlock(&pStream->lock);
+        }
+
+        if (!didWork)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += DECODE_THREAD_TIMEOUT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            pthread_mutex_lock(&streamsMutex);
+            if (runDecodeThread) pthread_cond_timedwait(&decodeCond, &streamsMutex, &deadline);
+            pthread_mutex_unlock(&streamsMutex);
+        }
+    }
+
+    return NULL;
+}
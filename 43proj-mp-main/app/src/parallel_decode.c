@@ -0,0 +1,285 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <mpg123.h>
+
+#include "parallel_decode.h"
+#include "timing.h"
+
+// Layer III main data can reach 511 bytes back, which is several frames at low bitrates.
+// Decoding this many frames before a segment also settles the synthesis filter state.
+#define OVERLAP_FRAMES 8
+// Below this a segment is not worth a thread (~6.7 s at 44.1 kHz)
+#define MIN_FRAMES_PER_SEGMENT 256
+#define MAX_DECODE_THREADS 16
+// mpg123 trims its own decoder delay on top of the encoder delay from the LAME tag
+#define MPG123_DECODER_DELAY 529
+
+typedef struct {
+    sMusicStream_t *pStream;
+    off_t *pIndex;
+    off_t indexStep;
+    size_t indexFill;
+    int frameSamples; // samples per frame over all channels
+
+    off_t startFrame;
+    off_t endFrame;
+    off_t prerollFrames;
+    short *pcm; // whole song; the segment writes [startFrame, endFrame)
+
+    // This segment's decode of frame startFrame-1, compared with the previous segment's
+    short *seamCheck;
+    bool seamDecoded;
+    bool ok;
+} sSegment_t;
+
+static mpg123_handle* openDecoder(sMusicStream_t *pStream, off_t *pIndex, off_t indexStep, size_t indexFill, bool isGapless)
+{
+    mpg123_handle *mp3Handle = mpg123_new(NULL, NULL);
+    if (mp3Handle == NULL) return NULL;
+
+    // Both must be set before opening
+    if (!isGapless) mpg123_param(mp3Handle, MPG123_REMOVE_FLAGS, MPG123_GAPLESS, 0);
+    mpg123_param(mp3Handle, MPG123_PREFRAMES, OVERLAP_FRAMES, 0);
+
+    if (!MusicStream_attachDecoder(pStream, mp3Handle))
+    {
+        mpg123_delete(mp3Handle);
+        return NULL;
+    }
+
+    // Reuse the frame index from the scan so seeking does not rescan the song
+    if (pIndex != NULL)
+    {
+        mpg123_set_index(mp3Handle, pIndex, indexStep, indexFill);
+    }
+
+    return mp3Handle;
+}
+
+static void* decodeSegmentFunc(void *arg)
+{
+    sSegment_t *pSeg = arg;
+    pSeg->ok = false;
+    pSeg->seamDecoded = false;
+
+    mpg123_handle *mp3Handle = openDecoder(pSeg->pStream, pSeg->pIndex, pSeg->indexStep, pSeg->indexFill, false);
+    if (mp3Handle == NULL) return NULL;
+
+    off_t firstFrame = pSeg->startFrame - pSeg->prerollFrames;
+    if (firstFrame > 0 && mpg123_seek_frame(mp3Handle, firstFrame, SEEK_SET) < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to seek to frame %ld: %s\n", (long)firstFrame, mpg123_strerror(mp3Handle));
+        mpg123_close(mp3Handle);
+        mpg123_delete(mp3Handle);
+        return NULL;
+    }
+
+    size_t frameBytes = pSeg->frameSamples * sizeof(short);
+    bool ok = true;
+    while (true)
+    {
+        off_t frameNum;
+        unsigned char *audio;
+        size_t bytes;
+        int err = mpg123_decode_frame(mp3Handle, &frameNum, &audio, &bytes);
+
+        if (err == MPG123_NEW_FORMAT) continue;
+        if (err == MPG123_DONE) break;
+        if (err != MPG123_OK)
+        {
+            fprintf(stderr, "ERROR: Decoding frame failed: %s\n", mpg123_strerror(mp3Handle));
+            ok = false;
+            break;
+        }
+        if (frameNum >= pSeg->endFrame) break;
+        if (bytes > frameBytes) bytes = frameBytes;
+
+        if (frameNum == pSeg->startFrame - 1 && pSeg->seamCheck != NULL)
+        {
+            memcpy(pSeg->seamCheck, audio, bytes);
+            pSeg->seamDecoded = true;
+        }
+        else if (frameNum >= pSeg->startFrame)
+        {
+            memcpy(pSeg->pcm + frameNum * pSeg->frameSamples, audio, bytes);
+        }
+    }
+
+    mpg123_close(mp3Handle);
+    mpg123_delete(mp3Handle);
+    pSeg->ok = ok;
+    return NULL;
+}
+
+static int getNumThreads(int maxThreads, off_t numFrames)
+{
+    int numThreads = maxThreads > 0 ? maxThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads > MAX_DECODE_THREADS) numThreads = MAX_DECODE_THREADS;
+
+    off_t maxSegments = numFrames / MIN_FRAMES_PER_SEGMENT;
+    if (numThreads > maxSegments) numThreads = maxSegments;
+    if (numThreads < 1) numThreads = 1;
+
+    return numThreads;
+}
+
+short* ParallelDecode_decodeMp3(sMusicStream_t *pStream, int maxThreads, size_t *pNumSamples)
+{
+    assert(pStream);
+    long long startMs = getTimeInMs();
+
+    // Scan frame headers once to get the frame count and a seek index. The scan keeps
+    // gapless on, like the serial decoder, so its length is the trimmed one.
+    mpg123_handle *scanHandle = openDecoder(pStream, NULL, 0, 0, true);
+    if (scanHandle == NULL) return NULL;
+
+    long sampleRate;
+    int channels, encoding;
+    off_t *pIndex;
+    off_t indexStep;
+    size_t indexFill;
+    if (mpg123_scan(scanHandle) != MPG123_OK ||
+        mpg123_getformat(scanHandle, &sampleRate, &channels, &encoding) != MPG123_OK ||
+        mpg123_index(scanHandle, &pIndex, &indexStep, &indexFill) != MPG123_OK)
+    {
+        fprintf(stderr, "ERROR: Unable to scan MP3 stream: %s\n", mpg123_strerror(scanHandle));
+        mpg123_close(scanHandle);
+        mpg123_delete(scanHandle);
+        return NULL;
+    }
+
+    // Resampled frames come out at varying lengths, so they have no fixed offsets
+    struct mpg123_frameinfo frameInfo;
+    if (mpg123_info(scanHandle, &frameInfo) != MPG123_OK || frameInfo.rate != sampleRate)
+    {
+        mpg123_close(scanHandle);
+        mpg123_delete(scanHandle);
+        return NULL;
+    }
+
+    off_t numFrames = mpg123_framelength(scanHandle);
+    int frameSamples = mpg123_spf(scanHandle) * channels;
+    if (numFrames <= 0 || frameSamples <= 0)
+    {
+        mpg123_close(scanHandle);
+        mpg123_delete(scanHandle);
+        return NULL;
+    }
+
+    // Segments decode untrimmed so every frame lands at a fixed offset; the samples
+    // the serial decoder drops are cut from the ends afterwards
+    off_t numFramesOut = numFrames * mpg123_spf(scanHandle);
+    off_t trimmedLength = mpg123_length(scanHandle);
+    off_t skipStart = 0;
+    if (trimmedLength > 0 && trimmedLength < numFramesOut)
+    {
+        long encoderDelay;
+        if (mpg123_getstate(scanHandle, MPG123_ENC_DELAY, &encoderDelay, NULL) != MPG123_OK || encoderDelay < 0)
+        {
+            fprintf(stderr, "ERROR: Unable to read the gapless delay of the MP3 stream\n");
+            mpg123_close(scanHandle);
+            mpg123_delete(scanHandle);
+            return NULL;
+        }
+        skipStart = encoderDelay + MPG123_DECODER_DELAY;
+        if (skipStart > numFramesOut - trimmedLength) skipStart = numFramesOut - trimmedLength;
+    }
+    else
+    {
+        trimmedLength = numFramesOut;
+    }
+
+    size_t numSamples = (size_t)numFrames * frameSamples;
+    short *pcm = calloc(numSamples, sizeof(short));
+    if (!pcm)
+    {
+        perror("ERROR: Unable to allocate bytes for file");
+        exit(EXIT_FAILURE);
+    }
+
+    int numThreads = getNumThreads(maxThreads, numFrames);
+    sSegment_t segments[MAX_DECODE_THREADS];
+    pthread_t threads[MAX_DECODE_THREADS];
+
+    for (int i=0; i<numThreads; i++)
+    {
+        sSegment_t *pSeg = &segments[i];
+        pSeg->pStream = pStream;
+        pSeg->pIndex = pIndex;
+        pSeg->indexStep = indexStep;
+        pSeg->indexFill = indexFill;
+        pSeg->frameSamples = frameSamples;
+        pSeg->startFrame = numFrames * i / numThreads;
+        pSeg->endFrame = numFrames * (i + 1) / numThreads;
+        pSeg->prerollFrames = pSeg->startFrame < OVERLAP_FRAMES ? pSeg->startFrame : OVERLAP_FRAMES;
+        pSeg->pcm = pcm;
+        pSeg->seamCheck = i > 0 ? malloc(frameSamples * sizeof(short)) : NULL;
+    }
+
+    // The first segment runs on this thread
+    for (int i=1; i<numThreads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, decodeSegmentFunc, &segments[i]) != 0)
+        {
+            perror("Failed to spawn thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    decodeSegmentFunc(&segments[0]);
+    for (int i=1; i<numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Seams are checked in order so a re-decoded segment is final before the next is compared
+    int numRedecoded = 0;
+    bool ok = segments[0].ok;
+    for (int i=1; i<numThreads; i++)
+    {
+        sSegment_t *pSeg = &segments[i];
+        short *pPrevLastFrame = pcm + (pSeg->startFrame - 1) * frameSamples;
+        bool seamMatches = pSeg->ok && pSeg->seamDecoded &&
+            memcmp(pSeg->seamCheck, pPrevLastFrame, frameSamples * sizeof(short)) == 0;
+
+        if (!seamMatches)
+        {
+            // Decoding from the first frame is exactly what a serial decode does
+            pSeg->prerollFrames = pSeg->startFrame;
+            free(pSeg->seamCheck);
+            pSeg->seamCheck = NULL;
+            decodeSegmentFunc(pSeg);
+            numRedecoded++;
+        }
+
+        ok = ok && pSeg->ok;
+        free(pSeg->seamCheck);
+    }
+
+    mpg123_close(scanHandle);
+    mpg123_delete(scanHandle);
+
+    if (!ok)
+    {
+        free(pcm);
+        return NULL;
+    }
+
+    if (skipStart > 0 || trimmedLength < numFramesOut)
+    {
+        numSamples = (size_t)trimmedLength * channels;
+        memmove(pcm, pcm + (size_t)skipStart * channels, numSamples * sizeof(short));
+        short *shrunk = realloc(pcm, numSamples > 0 ? numSamples * sizeof(short) : 1);
+        if (shrunk) pcm = shrunk;
+    }
+
+    printf("Decoded %ld frames on %d threads in %lld ms (%d seams re-decoded)\n",
+            (long)numFrames, numThreads, getTimeInMs() - startMs, numRedecoded);
+
+    *pNumSamples = numSamples;
+    return pcm;
+}
@@ -0,0 +1,876 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "play_queue.h"
+#include "audio_playback.h"
+
+#define INITIAL_CAPACITY 64
+#define NIL -1
+#define RANDOM_SEED 0x9e3779b9
+
+// The low 32 bits of an id are the node's slot + 1; the high 32 count how often the slot
+// was reused, so a stale id doesn't find the entry that took its slot.
+#define ID_SLOT_BITS 32
+#define ID_SLOT_MASK ((1ull << ID_SLOT_BITS) - 1)
+// Slots are ints, and the pool doubles
+#define MAX_ENTRIES (1 << 30)
+
+// A treap node: ordered by position in the queue, heap ordered by a random priority,
+// which keeps the tree balanced in expectation. Nodes refer to each other by slot so
+// the pool can grow with realloc().
+typedef struct {
+    sLoadedFile *pFile;
+    size_t startFrame;
+    uint32_t priority;
+    int size; // nodes in this subtree
+    int left;
+    int right;
+    int parent; // also links free slots
+    uint32_t generation;
+    bool inUse;
+} sQueueNode_t;
+
+static sQueueNode_t *nodes = NULL;
+static int capacity = 0;
+static int numUsed = 0;
+static int freeList = NIL;
+static int root = NIL;
+// Slot of the current song, or NIL if every song has played
+static int current = NIL;
+static uint32_t randomState = RANDOM_SEED;
+
+static bool shuffle = false;
+static eRepeatMode_t repeatMode = eREPEAT_OFF;
+// Play order while shuffling, as entry ids: the current song at shufflePos, songs played
+// before it, then the rest of the cycle in a Fisher–Yates order. Ids of removed entries are
+// skipped. shufflePos is shuffleLen once every song has played.
+static playQueueId_t *shuffleOrder = NULL;
+static int shuffleLen = 0;
+static int shuffleCapacity = 0;
+static int shufflePos = 0;
+
+// Published snapshots for display (see acquireSnapshot()). A buffer is only rewritten once
+// it is neither published nor held by a reader.
+#define NUM_SNAPSHOTS 3
+static sQueueSnapshot_t snapshots[NUM_SNAPSHOTS];
+static atomic_int snapshotReaders[NUM_SNAPSHOTS];
+static atomic_int publishedSnapshot = 0;
+static _Atomic uint64_t snapshotVersion = 0;
+
+static void publishSnapshot(void);
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint32_t nextRandom(void)
+{
+    // xorshift32; balances the tree and shuffles
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static int sizeOf(int node)
+{
+    return node == NIL ? 0 : nodes[node].size;
+}
+
+static void update(int node)
+{
+    nodes[node].size = 1 + sizeOf(nodes[node].left) + sizeOf(nodes[node].right);
+    if (nodes[node].left != NIL) nodes[nodes[node].left].parent = node;
+    if (nodes[node].right != NIL) nodes[nodes[node].right].parent = node;
+}
+
+// Splits tree t into its first k nodes and the rest
+static void split(int t, int k, int *pFirst, int *pRest)
+{
+    if (t == NIL)
+    {
+        *pFirst = *pRest = NIL;
+        return;
+    }
+
+    int leftSize = sizeOf(nodes[t].left);
+    if (k <= leftSize)
+    {
+        split(nodes[t].left, k, pFirst, &nodes[t].left);
+        *pRest = t;
+    }
+    else
+    {
+        split(nodes[t].right, k - leftSize - 1, &nodes[t].right, pRest);
+        *pFirst = t;
+    }
+    update(t);
+}
+
+static int merge(int a, int b)
+{
+    if (a == NIL) return b;
+    if (b == NIL) return a;
+
+    if (nodes[a].priority > nodes[b].priority)
+    {
+        nodes[a].right = merge(nodes[a].right, b);
+        update(a);
+        return a;
+    }
+    nodes[b].left = merge(a, nodes[b].left);
+    update(b);
+    return b;
+}
+
+static void setRoot(int node)
+{
+    root = node;
+    if (root != NIL) nodes[root].parent = NIL;
+}
+
+// Position of a node in the queue, found by walking up to the root
+static int positionOf(int node)
+{
+    int position = sizeOf(nodes[node].left);
+    while (nodes[node].parent != NIL)
+    {
+        int parent = nodes[node].parent;
+        if (nodes[parent].right == node) position += sizeOf(nodes[parent].left) + 1;
+        node = parent;
+    }
+    return position;
+}
+
+static int nodeAt(int position)
+{
+    int node = root;
+    while (node != NIL)
+    {
+        int leftSize = sizeOf(nodes[node].left);
+        if (position == leftSize) return node;
+        if (position < leftSize)
+        {
+            node = nodes[node].left;
+        }
+        else
+        {
+            position -= leftSize + 1;
+            node = nodes[node].right;
+        }
+    }
+    return NIL;
+}
+
+static int successor(int node)
+{
+    if (nodes[node].right != NIL)
+    {
+        node = nodes[node].right;
+        while (nodes[node].left != NIL) node = nodes[node].left;
+        return node;
+    }
+    while (nodes[node].parent != NIL && nodes[nodes[node].parent].right == node)
+    {
+        node = nodes[node].parent;
+    }
+    return nodes[node].parent;
+}
+
+static int predecessor(int node)
+{
+    if (nodes[node].left != NIL)
+    {
+        node = nodes[node].left;
+        while (nodes[node].right != NIL) node = nodes[node].right;
+        return node;
+    }
+    while (nodes[node].parent != NIL && nodes[nodes[node].parent].left == node)
+    {
+        node = nodes[node].parent;
+    }
+    return nodes[node].parent;
+}
+
+static int lastNode(void)
+{
+    int node = root;
+    while (node != NIL && nodes[node].right != NIL) node = nodes[node].right;
+    return node;
+}
+
+static playQueueId_t idOf(int node)
+{
+    return node == NIL ? PLAY_QUEUE_NO_ID : ((playQueueId_t)nodes[node].generation << ID_SLOT_BITS) | (playQueueId_t)(node + 1);
+}
+
+// Slot of the entry with this id, or NIL if it is not in the queue
+static int findNode(playQueueId_t id)
+{
+    long long node = (long long)(id & ID_SLOT_MASK) - 1;
+    if (node < 0 || node >= capacity || !nodes[node].inUse || idOf(node) != id) return NIL;
+    return node;
+}
+
+static int allocNode(sLoadedFile *pFile, size_t startFrame)
+{
+    if (freeList == NIL)
+    {
+        int newCapacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+        if (capacity >= MAX_ENTRIES)
+        {
+            fprintf(stderr, "ERROR: Play queue is full\n");
+            exit(EXIT_FAILURE);
+        }
+        if (newCapacity > MAX_ENTRIES) newCapacity = MAX_ENTRIES;
+
+        sQueueNode_t *pNewNodes = realloc(nodes, newCapacity * sizeof(sQueueNode_t));
+        if (pNewNodes == NULL)
+        {
+            perror("ERROR: Unable to grow play queue");
+            exit(EXIT_FAILURE);
+        }
+        nodes = pNewNodes;
+        for (int i = newCapacity - 1; i >= capacity; i--)
+        {
+            nodes[i].inUse = false;
+            nodes[i].generation = 0;
+            nodes[i].parent = freeList;
+            freeList = i;
+        }
+        capacity = newCapacity;
+    }
+
+    int node = freeList;
+    freeList = nodes[node].parent;
+
+    nodes[node].pFile = pFile;
+    nodes[node].startFrame = startFrame;
+    nodes[node].priority = nextRandom();
+    nodes[node].size = 1;
+    nodes[node].left = NIL;
+    nodes[node].right = NIL;
+    nodes[node].parent = NIL;
+    nodes[node].inUse = true;
+    numUsed++;
+
+    pFile->queueRefs++;
+    return node;
+}
+
+static void freeNode(int node)
+{
+    nodes[node].pFile->queueRefs--;
+    nodes[node].pFile = NULL;
+    nodes[node].inUse = false;
+    nodes[node].generation++;
+    nodes[node].parent = freeList;
+    freeList = node;
+    numUsed--;
+}
+
+static void insertAt(int node, int position)
+{
+    int first, rest;
+    split(root, position, &first, &rest);
+    setRoot(merge(merge(first, node), rest));
+}
+
+// Takes a node out of the tree without freeing it
+static void detach(int node)
+{
+    int first, middle, rest;
+    split(root, positionOf(node), &first, &rest);
+    split(rest, 1, &middle, &rest);
+    setRoot(merge(first, rest));
+    nodes[node].parent = NIL;
+}
+
+
+static int firstNode(void)
+{
+    int node = root;
+    while (node != NIL && nodes[node].left != NIL) node = nodes[node].left;
+    return node;
+}
+
+static uint32_t randomBelow(uint32_t n)
+{
+    return nextRandom() % n;
+}
+
+static bool isLive(int orderInd)
+{
+    return findNode(shuffleOrder[orderInd]) != NIL;
+}
+
+// Drops removed entries from the shuffle order, and played ones beyond a queue's
+// length of history
+static void compactShuffle(void)
+{
+    int firstKept = shufflePos - numUsed > 0 ? shufflePos - numUsed : 0;
+    int newLen = 0;
+    int newPos = -1;
+    for (int i = firstKept; i < shuffleLen; i++)
+    {
+        if (i == shufflePos) newPos = newLen;
+        if (isLive(i)) shuffleOrder[newLen++] = shuffleOrder[i];
+    }
+    shufflePos = newPos >= 0 ? newPos : newLen;
+    shuffleLen = newLen;
+}
+
+static void pushShuffle(playQueueId_t id)
+{
+    if (shuffleLen >= 2 * numUsed + 64) compactShuffle();
+
+    if (shuffleLen == shuffleCapacity)
+    {
+        int newCapacity = shuffleCapacity == 0 ? INITIAL_CAPACITY : shuffleCapacity * 2;
+        playQueueId_t *pNewOrder = realloc(shuffleOrder, newCapacity * sizeof(playQueueId_t));
+        if (pNewOrder == NULL)
+        {
+            perror("ERROR: Unable to grow shuffle order");
+            exit(EXIT_FAILURE);
+        }
+        shuffleOrder = pNewOrder;
+        shuffleCapacity = newCapacity;
+    }
+    shuffleOrder[shuffleLen++] = id;
+}
+
+// Appends every entry except skip, then Fisher–Yates shuffles what was appended
+static void appendShuffledCycle(int skip)
+{
+    int start = shuffleLen;
+    for (int node = firstNode(); node != NIL; node = successor(node))
+    {
+        if (node != skip) pushShuffle(idOf(node));
+    }
+
+    for (int i = shuffleLen - 1; i > start; i--)
+    {
+        int j = start + randomBelow(i - start + 1);
+        playQueueId_t swap = shuffleOrder[i];
+        shuffleOrder[i] = shuffleOrder[j];
+        shuffleOrder[j] = swap;
+    }
+}
+
+// Under repeat-all, queues the next shuffled cycle once the current one has no
+// songs left to play, so the song after the current one is always known ahead.
+static void extendShuffle(void)
+{
+    if (!shuffle || repeatMode != eREPEAT_ALL || current == NIL) return;
+    for (int i = shufflePos + 1; i < shuffleLen; i++)
+    {
+        if (isLive(i)) return;
+    }
+
+    compactShuffle();
+    int start = shuffleLen;
+    appendShuffledCycle(NIL);
+
+    // Don't play the song that just finished the last cycle straight away again
+    if (shuffleLen - start > 1 && shuffleOrder[start] == idOf(current))
+    {
+        int j = start + 1 + randomBelow(shuffleLen - start - 1);
+        shuffleOrder[start] = shuffleOrder[j];
+        shuffleOrder[j] = idOf(current);
+    }
+}
+
+// Index in the shuffle order of the next song still in the queue, or shuffleLen
+static int nextShuffled(void)
+{
+    int i = shufflePos + 1;
+    while (i < shuffleLen && !isLive(i)) i++;
+    return i;
+}
+
+// The node that plays after the current one. songEnded is false for a skip,
+// which moves on even under repeat-one.
+static int playOrderNext(bool songEnded)
+{
+    if (current == NIL) return NIL;
+    if (songEnded && repeatMode == eREPEAT_ONE) return current;
+
+    if (shuffle)
+    {
+        int i = nextShuffled();
+        return i < shuffleLen ? findNode(shuffleOrder[i]) : NIL;
+    }
+
+    int node = successor(current);
+    if (node == NIL && repeatMode == eREPEAT_ALL) node = firstNode();
+    return node;
+}
+
+// Makes the next song in play order current
+static void moveToNext(bool songEnded)
+{
+    int next = playOrderNext(songEnded);
+    if (next == current) return;
+
+    if (shuffle) shufflePos = nextShuffled();
+    current = next;
+    extendShuffle();
+}
+
+
+void PlayQueue_clear(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    for (int node = 0; node < capacity; node++)
+    {
+        if (nodes[node].inUse) freeNode(node);
+    }
+    root = NIL;
+    current = NIL;
+    shuffleLen = 0;
+    shufflePos = 0;
+    publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void PlayQueue_cleanup(void)
+{
+    PlayQueue_clear();
+
+    pthread_mutex_lock(&queueMutex);
+    free(nodes);
+    nodes = NULL;
+    capacity = 0;
+    freeList = NIL;
+    free(shuffleOrder);
+    shuffleOrder = NULL;
+    shuffleCapacity = 0;
+    pthread_mutex_unlock(&queueMutex);
+}
+
+// Places a new entry in the shuffle order: next if playNext, otherwise at a random
+// point among the songs not yet played this cycle
+static void shuffleInNew(int node, bool playNext)
+{
+    pushShuffle(idOf(node));
+    if (current == node)
+    {
+        shufflePos = shuffleLen - 1;
+        extendShuffle();
+        return;
+    }
+
+    int last = shuffleLen - 1;
+    int j = playNext ? shufflePos + 1 : shufflePos + 1 + (int)randomBelow(last - shufflePos);
+    shuffleOrder[last] = shuffleOrder[j];
+    shuffleOrder[j] = idOf(node);
+}
+
+playQueueId_t PlayQueue_append(sLoadedFile *pFile, size_t startFrame)
+{
+    pthread_mutex_lock(&queueMutex);
+    int node = allocNode(pFile, startFrame);
+    setRoot(merge(root, node));
+    if (current == NIL) current = node;
+    if (shuffle) shuffleInNew(node, false);
+    playQueueId_t id = idOf(node);
+    publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return id;
+}
+
+playQueueId_t PlayQueue_insertNext(sLoadedFile *pFile)
+{
+    pthread_mutex_lock(&queueMutex);
+    int node = allocNode(pFile, 0);
+    if (current == NIL)
+    {
+        setRoot(merge(root, node));
+        current = node;
+    }
+    else
+    {
+        insertAt(node, positionOf(current) + 1);
+    }
+    if (shuffle) shuffleInNew(node, true);
+    playQueueId_t id = idOf(node);
+    publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return id;
+}
+
+// Caller holds queueMutex
+static void removeNode(int node)
+{
+    if (node == current)
+    {
+        moveToNext(false);
+        // Under repeat-all the only song left comes round to itself
+        if (current == node)
+        {
+            current = NIL;
+            shufflePos = shuffleLen;
+        }
+    }
+    detach(node);
+    freeNode(node);
+    if (current == NIL) shufflePos = shuffleLen;
+    // It may have been the last song left in the shuffle cycle
+    extendShuffle();
+}
+
+bool PlayQueue_remove(playQueueId_t id)
+{
+    pthread_mutex_lock(&queueMutex);
+    int node = findNode(id);
+    if (node != NIL)
+    {
+        removeNode(node);
+        publishSnapshot();
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return node != NIL;
+}
+
+int PlayQueue_removeFile(sLoadedFile *pFile)
+{
+    int numRemoved = 0;
+    pthread_mutex_lock(&queueMutex);
+    for (int node = 0; node < capacity && pFile->queueRefs > 0; node++)
+    {
+        if (!nodes[node].inUse || nodes[node].pFile != pFile) continue;
+        removeNode(node);
+        numRemoved++;
+    }
+    if (numRemoved > 0) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return numRemoved;
+}
+
+bool PlayQueue_move(playQueueId_t id, int position)
+{
+    pthread_mutex_lock(&queueMutex);
+    int node = findNode(id);
+    if (node != NIL)
+    {
+        detach(node);
+        if (position < 0) position = 0;
+        if (position > sizeOf(root)) position = sizeOf(root);
+        insertAt(node, position);
+    }
+    if (node != NIL) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return node != NIL;
+}
+
+int PlayQueue_getLength(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    int length = numUsed;
+    pthread_mutex_unlock(&queueMutex);
+
+    return length;
+}
+
+void PlayQueue_setShuffle(bool enabled)
+{
+    pthread_mutex_lock(&queueMutex);
+    if (enabled && !shuffle)
+    {
+        if (randomState == RANDOM_SEED) randomState ^= (uint32_t)time(NULL);
+
+        // The current song stays current; the rest are shuffled after it
+        shuffleLen = 0;
+        shufflePos = 0;
+        if (current != NIL)
+        {
+            pushShuffle(idOf(current));
+            appendShuffledCycle(current);
+        }
+    }
+    shuffle = enabled;
+    extendShuffle();
+    publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+}
+
+bool PlayQueue_getShuffle(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    bool enabled = shuffle;
+    pthread_mutex_unlock(&queueMutex);
+
+    return enabled;
+}
+
+void PlayQueue_setRepeat(eRepeatMode_t mode)
+{
+    pthread_mutex_lock(&queueMutex);
+    repeatMode = mode;
+    extendShuffle();
+    publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+}
+
+eRepeatMode_t PlayQueue_getRepeat(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    eRepeatMode_t mode = repeatMode;
+    pthread_mutex_unlock(&queueMutex);
+
+    return mode;
+}
+
+sLoadedFile* PlayQueue_getCurrent(playQueueId_t *pId, size_t *pStartFrame)
+{
+    sLoadedFile *pFile = NULL;
+
+    pthread_mutex_lock(&queueMutex);
+    *pId = idOf(current);
+    *pStartFrame = 0;
+    if (current != NIL)
+    {
+        pFile = nodes[current].pFile;
+        *pStartFrame = nodes[current].startFrame;
+        nodes[current].startFrame = 0;
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return pFile;
+}
+
+sLoadedFile* PlayQueue_getAfter(playQueueId_t id)
+{
+    sLoadedFile *pFile = NULL;
+
+    pthread_mutex_lock(&queueMutex);
+    // Only the current song's next is known; the caller catches up next time
+    if (current != NIL && idOf(current) == id)
+    {
+        int node = playOrderNext(true);
+        if (node != NIL) pFile = nodes[node].pFile;
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return pFile;
+}
+
+bool PlayQueue_advance(playQueueId_t id)
+{
+    pthread_mutex_lock(&queueMutex);
+    // A skip from the user at the same moment moves it only once
+    bool moved = current != NIL && idOf(current) == id;
+    if (moved) moveToNext(true);
+    if (moved) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return moved;
+}
+
+bool PlayQueue_skip(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    bool moved = current != NIL;
+    if (moved) moveToNext(false);
+    if (moved) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return moved;
+}
+
+bool PlayQueue_previous(void)
+{
+    pthread_mutex_lock(&queueMutex);
+    int node = NIL;
+    if (shuffle)
+    {
+        int i = shufflePos - 1;
+        while (i >= 0 && !isLive(i)) i--;
+        if (i >= 0)
+        {
+            shufflePos = i;
+            node = findNode(shuffleOrder[i]);
+        }
+    }
+    else
+    {
+        node = current == NIL ? lastNode() : predecessor(current);
+    }
+    if (node != NIL) current = node;
+    if (node != NIL) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+
+    return node != NIL;
+}
+
+bool PlayQueue_contains(sLoadedFile *pFile)
+{
+    pthread_mutex_lock(&queueMutex);
+    bool found = pFile->queueRefs > 0;
+    pthread_mutex_unlock(&queueMutex);
+
+    return found;
+}
+
+bool PlayQueue_getCurrentMetadata(musicMetadata_t *pMetadata)
+{
+    pthread_mutex_lock(&queueMutex);
+    bool playing = current != NIL;
+    if (playing) *pMetadata = *nodes[current].pFile->metadata;
+    pthread_mutex_unlock(&queueMutex);
+
+    return playing;
+}
+
+void PlayQueue_fileChanged(sLoadedFile *pFile, double lengthSeconds)
+{
+    pthread_mutex_lock(&queueMutex);
+    pFile->metadata->lengthSeconds = lengthSeconds;
+    if (pFile->queueRefs > 0)
+    {
+        const sQueueSnapshot_t *pSnapshot = &snapshots[atomic_load(&publishedSnapshot)];
+        bool shown = false;
+        for (int i = 0; i < pSnapshot->numEntries && !shown; i++)
+        {
+            int node = findNode(pSnapshot->entries[i].id);
+            shown = node != NIL && nodes[node].pFile == pFile;
+        }
+        if (shown) publishSnapshot();
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void PlayQueue_setTags(sLoadedFile *pFile, const musicMetadata_t *pMetadata)
+{
+    pthread_mutex_lock(&queueMutex);
+    pFile->metadata->title = pMetadata->title;
+    pFile->metadata->artist = pMetadata->artist;
+    pFile->metadata->album = pMetadata->album;
+    // The published snapshot may hold the old title
+    if (pFile->queueRefs > 0) publishSnapshot();
+    pthread_mutex_unlock(&queueMutex);
+}
+
+// Slots of up to maxBefore played songs, the current song and the songs after it,
+// in play order. Caller holds queueMutex
+static int collectWindow(int maxBefore, int *windowNodes, int maxNodes, int *pNumBefore)
+{
+    int numBefore = 0;
+    int numNodes = 0;
+
+    if (shuffle)
+    {
+        int start = shufflePos;
+        for (int i = shufflePos - 1; i >= 0 && numBefore < maxBefore && numBefore < maxNodes; i--)
+        {
+            if (!isLive(i)) continue;
+            start = i;
+            numBefore++;
+        }
+        for (int i = start; i < shuffleLen && numNodes < maxNodes; i++)
+        {
+            int node = findNode(shuffleOrder[i]);
+            if (node != NIL) windowNodes[numNodes++] = node;
+        }
+    }
+    else
+    {
+        int position = current == NIL ? numUsed : positionOf(current);
+        numBefore = position < maxBefore ? position : maxBefore;
+        if (numBefore > maxNodes) numBefore = maxNodes;
+
+        for (int node = nodeAt(position - numBefore); node != NIL && numNodes < maxNodes; node = successor(node))
+        {
+            windowNodes[numNodes++] = node;
+        }
+    }
+
+    *pNumBefore = numBefore;
+    return numNodes;
+}
+
+int PlayQueue_getWindow(int maxBefore, sLoadedFile **files, int maxFiles, int *pNumBefore)
+{
+    int *windowNodes = malloc((maxFiles > 0 ? maxFiles : 1) * sizeof(int));
+    if (windowNodes == NULL)
+    {
+        perror("ERROR: Unable to allocate queue window");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&queueMutex);
+    int numFiles = collectWindow(maxBefore, windowNodes, maxFiles, pNumBefore);
+    for (int i = 0; i < numFiles; i++)
+    {
+        files[i] = nodes[windowNodes[i]].pFile;
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    free(windowNodes);
+    return numFiles;
+}
+
+// Fills a snapshot buffer no reader holds and makes it the published one.
+// Caller holds queueMutex, which makes this the only writer.
+static void publishSnapshot(void)
+{
+    int published = atomic_load(&publishedSnapshot);
+    int target = -1;
+    while (target < 0)
+    {
+        for (int i = 0; i < NUM_SNAPSHOTS && target < 0; i++)
+        {
+            if (i != published && atomic_load(&snapshotReaders[i]) == 0) target = i;
+        }
+        // Only when several readers each hold a snapshot; they let go within a frame
+        if (target < 0) sched_yield();
+    }
+
+    sQueueSnapshot_t *pSnapshot = &snapshots[target];
+    int windowNodes[PLAY_QUEUE_SNAPSHOT_LEN];
+    pSnapshot->numEntries = collectWindow(PLAY_QUEUE_SNAPSHOT_BEFORE, windowNodes, PLAY_QUEUE_SNAPSHOT_LEN, &pSnapshot->numBefore);
+    for (int i = 0; i < pSnapshot->numEntries; i++)
+    {
+        sQueueSnapshotEntry_t *pEntry = &pSnapshot->entries[i];
+        pEntry->id = idOf(windowNodes[i]);
+        pEntry->title = nodes[windowNodes[i]].pFile->metadata->title;
+        pEntry->lengthSeconds = nodes[windowNodes[i]].pFile->metadata->lengthSeconds;
+    }
+    pSnapshot->length = numUsed;
+    pSnapshot->shuffle = shuffle;
+    pSnapshot->repeatMode = repeatMode;
+    pSnapshot->version = atomic_load(&snapshotVersion) + 1;
+
+    atomic_store(&publishedSnapshot, target);
+    atomic_store(&snapshotVersion, pSnapshot->version);
+}
+
+uint64_t PlayQueue_getSnapshotVersion(void)
+{
+    return atomic_load(&snapshotVersion);
+}
+
+const sQueueSnapshot_t* PlayQueue_acquireSnapshot(void)
+{
+    while (true)
+    {
+        int i = atomic_load(&publishedSnapshot);
+        atomic_fetch_add(&snapshotReaders[i], 1);
+        // If a newer one was published in between, this buffer may be being rewritten
+        if (atomic_load(&publishedSnapshot) == i) return &snapshots[i];
+        atomic_fetch_sub(&snapshotReaders[i], 1);
+    }
+}
+
+void PlayQueue_releaseSnapshot(const sQueueSnapshot_t *pSnapshot)
+{
+    atomic_fetch_sub(&snapshotReaders[pSnapshot - snapshots], 1);
+}
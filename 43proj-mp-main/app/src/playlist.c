@@ -0,0 +1,300 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "playlist.h"
+
+static const char *PLAYLIST_EXTENSIONS[] = { ".m3u", ".m3u8", ".pls" };
+#define NUM_PLAYLIST_EXTENSIONS (sizeof(PLAYLIST_EXTENSIONS) / sizeof(PLAYLIST_EXTENSIONS[0]))
+
+static bool hasExtension(const char *path, const char *extension)
+{
+    size_t len = strlen(path);
+    size_t extLen = strlen(extension);
+    return len > extLen && strcasecmp(path + len - extLen, extension) == 0;
+}
+
+bool Playlist_isPlaylistFile(const char *path)
+{
+    for (size_t i=0; i<NUM_PLAYLIST_EXTENSIONS; i++)
+    {
+        if (hasExtension(path, PLAYLIST_EXTENSIONS[i])) return true;
+    }
+    return false;
+}
+
+// Length of the directory part of path, without the last '/'. 0 if there is none.
+static size_t getDirLen(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Removes "." and empty parts and resolves ".." in place
+static void normalizePath(char *path)
+{
+    bool isAbsolute = path[0] == '/';
+    char *out = path + isAbsolute;
+    char *start = out;
+    char *in = out;
+    // Leading ".." parts of a relative path are kept, and can't be dropped again
+    char *kept = start;
+
+    while (in != NULL)
+    {
+        // Written parts end in '/', which can land on the terminator, so find the
+        // next part before writing
+        char *end = strchr(in, '/');
+        size_t len = end ? (size_t)(end - in) : strlen(in);
+        char *next = end ? end + 1 : NULL;
+        bool isParent = len == 2 && in[0] == '.' && in[1] == '.';
+
+        if (len == 0 || (len == 1 && in[0] == '.') || (isParent && isAbsolute && out == start))
+        {
+            // Nothing to keep
+        }
+        else if (isParent && out > kept)
+        {
+            // Drop the last part written
+            out--;
+            while (out > kept && out[-1] != '/') out--;
+        }
+        else if (isParent)
+        {
+            memmove(out, "../", 3);
+            out += 3;
+            kept = out;
+        }
+        else
+        {
+            memmove(out, in, len);
+            out += len;
+            *out++ = '/';
+        }
+        in = next;
+    }
+
+    if (out > start) out--; // no trailing '/'
+    *out = '\0';
+}
+
+// Turns one playlist entry into a path the library would use. Returns false if the
+// entry is not a local file.
+static bool resolveEntry(const char *playlistPath, const char *entry, char *resolved, size_t resolvedLen)
+{
+    if (strncasecmp(entry, "file://", 7) == 0)
+    {
+        entry += 7;
+        if (strncasecmp(entry, "localhost/", 10) == 0) entry += 9;
+    }
+    else if (strstr(entry, "://") != NULL)
+    {
+        return false;
+    }
+
+    char decoded[PATH_MAX];
+    size_t len = 0;
+    for (const char *p = entry; *p && len < sizeof(decoded) - 1; p++)
+    {
+        // Windows separators, and %XX escapes from file:// URLs
+        if (*p == '\\')
+        {
+            decoded[len++] = '/';
+        }
+        else if (*p == '%' && hexValue(p[1]) >= 0 && hexValue(p[2]) >= 0)
+        {
+            decoded[len++] = hexValue(p[1]) * 16 + hexValue(p[2]);
+            p += 2;
+        }
+        else
+        {
+            decoded[len++] = *p;
+        }
+    }
+    decoded[len] = '\0';
+
+    size_t dirLen = getDirLen(playlistPath);
+    int written;
+    if (decoded[0] == '/' || dirLen == 0)
+    {
+        written = snprintf(resolved, resolvedLen, "%s", decoded);
+    }
+    else
+    {
+        written = snprintf(resolved, resolvedLen, "%.*s/%s", (int)dirLen, playlistPath, decoded);
+    }
+    if (written < 0 || (size_t)written >= resolvedLen) return false;
+
+    normalizePath(resolved);
+    return resolved[0] != '\0';
+}
+
+// Strips surrounding whitespace and the line ending in place
+static char* trim(char *line)
+{
+    while (isspace((unsigned char)*line)) line++;
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len-1])) line[--len] = '\0';
+    return line;
+}
+
+// The path of a PLS "FileN=path" line, or NULL for any other line
+static char* getPlsFile(char *line)
+{
+    if (strncasecmp(line, "file", 4) != 0) return NULL;
+    char *p = line + 4;
+    if (!isdigit((unsigned char)*p)) return NULL;
+    while (isdigit((unsigned char)*p)) p++;
+    return *p == '=' ? trim(p + 1) : NULL;
+}
+
+int Playlist_read(const char *path, void (*onEntry)(const char *entryPath, void *pContext), void *pContext)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror("WARNING: Unable to open playlist");
+        return -1;
+    }
+
+    // The first line tells PLS apart even without the extension
+    bool isPls = hasExtension(path, ".pls");
+    bool isFirstLine = true;
+    int numEntries = 0;
+    char resolved[PATH_MAX];
+
+    char *buffer = NULL;
+    size_t bufferLen = 0;
+    while (getline(&buffer, &bufferLen, file) >= 0)
+    {
+        char *line = buffer;
+        // UTF-8 byte order mark, common in M3U8 files
+        if (isFirstLine && strncmp(line, "\xEF\xBB\xBF", 3) == 0) line += 3;
+        line = trim(line);
+        if (line[0] == '\0') continue;
+
+        if (isFirstLine && strcasecmp(line, "[playlist]") == 0) isPls = true;
+        isFirstLine = false;
+
+        char *entry = isPls ? getPlsFile(line) : (line[0] == '#' ? NULL : line);
+        if (entry == NULL || entry[0] == '\0') continue;
+
+        if (resolveEntry(path, entry, resolved, sizeof(resolved)))
+        {
+            onEntry(resolved, pContext);
+            numEntries++;
+        }
+    }
+
+    free(buffer);
+    fclose(file);
+    return numEntries;
+}
+
+// Entry path as written to the playlist: relative to its directory if it is below it
+static const char* getRelativePath(const char *playlistPath, const char *entryPath)
+{
+    size_t dirLen = getDirLen(playlistPath);
+    if (dirLen > 0 && strncmp(entryPath, playlistPath, dirLen) == 0 && entryPath[dirLen] == '/')
+    {
+        return entryPath + dirLen + 1;
+    }
+    return entryPath;
+}
+
+static void writeEntries(FILE *file, const char *path, const sPlaylistEntry_t *entries, int numEntries)
+{
+    bool isPls = hasExtension(path, ".pls");
+    fprintf(file, isPls ? "[playlist]\n" : "#EXTM3U\n");
+
+    for (int i=0; i<numEntries; i++)
+    {
+        const sPlaylistEntry_t *pEntry = &entries[i];
+        const char *title = pEntry->title ? pEntry->title : "";
+        const char *entryPath = getRelativePath(path, pEntry->path);
+        // Players read -1 as an unknown length
+        int seconds = pEntry->lengthSeconds > 0 ? (int)(pEntry->lengthSeconds + 0.5) : -1;
+
+        if (isPls)
+        {
+            fprintf(file, "File%d=%s\n", i + 1, entryPath);
+            if (title[0]) fprintf(file, "Title%d=%s\n", i + 1, title);
+            fprintf(file, "Length%d=%d\n", i + 1, seconds);
+        }
+        else if (pEntry->artist && pEntry->artist[0])
+        {
+            fprintf(file, "#EXTINF:%d,%s - %s\n%s\n", seconds, pEntry->artist, title, entryPath);
+        }
+        else
+        {
+            fprintf(file, "#EXTINF:%d,%s\n%s\n", seconds, title, entryPath);
+        }
+    }
+
+    if (isPls) fprintf(file, "NumberOfEntries=%d\nVersion=2\n", numEntries);
+}
+
+bool Playlist_write(const char *path, const sPlaylistEntry_t *entries, int numEntries)
+{
+    char tempPath[PATH_MAX];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    FILE *file = fopen(tempPath, "w");
+    if (file == NULL)
+    {
+        perror("WARNING: Unable to save playlist");
+        return false;
+    }
+
+    writeEntries(file, path, entries, numEntries);
+
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath, path) != 0)
+    {
+        perror("WARNING: Unable to save playlist");
+        unlink(tempPath);
+        return false;
+    }
+    return true;
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int Playlist_find(const char *dir, char **paths, int maxPaths)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) return 0;
+
+    int numPaths = 0;
+    struct dirent *pEntry;
+    while ((pEntry = readdir(d)) != NULL && numPaths < maxPaths)
+    {
+        if (pEntry->d_name[0] == '.' || !Playlist_isPlaylistFile(pEntry->d_name)) continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, pEntry->d_name);
+        paths[numPaths++] = strdup(path);
+    }
+    closedir(d);
+
+    qsort(paths, numPaths, sizeof(char*), comparePaths);
+    return numPaths;
+}
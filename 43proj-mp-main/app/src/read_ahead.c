@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "read_ahead.h"
+
+static long numFilesOpened = 0;
+static long numFilesPrefetched = 0;
+static long long numPagesCached = 0;
+static long long numPagesTotal = 0;
+// Protects the counters above
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void ReadAhead_prefetch(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    // On Linux this queues reads for the whole file and returns without waiting for them
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+
+    pthread_mutex_lock(&statsMutex);
+    numFilesPrefetched++;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Counts the file's pages and how many of them are in the page cache
+static void countCachedPages(int fd, long long *pNumCached, long long *pNumTotal)
+{
+    *pNumCached = 0;
+    *pNumTotal = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) return;
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t numPages = (st.st_size + pageSize - 1) / pageSize;
+
+    // Mapping the file does not read it; mincore only reports what is already resident
+    void *pMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (pMap == MAP_FAILED) return;
+
+    unsigned char *residency = malloc(numPages);
+    if (residency && mincore(pMap, st.st_size, residency) == 0)
+    {
+        for (size_t i=0; i<numPages; i++)
+        {
+            *pNumCached += residency[i] & 1;
+        }
+        *pNumTotal = numPages;
+    }
+
+    free(residency);
+    munmap(pMap, st.st_size);
+}
+
+int ReadAhead_openSequential(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    long long numCached, numTotal;
+    countCachedPages(fd, &numCached, &numTotal);
+
+    // Lets the kernel read further ahead than it would for random access
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pthread_mutex_lock(&statsMutex);
+    numFilesOpened++;
+    numPagesCached += numCached;
+    numPagesTotal += numTotal;
+    pthread_mutex_unlock(&statsMutex);
+
+    return fd;
+}
+
+void ReadAhead_release(int fd)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+void ReadAhead_printStats(void)
+{
+    pthread_mutex_lock(&statsMutex);
+    printf("Page cache: %lld of %lld pages already cached (%.1f%%) over %ld files, %ld files prefetched\n",
+        numPagesCached, numPagesTotal, numPagesTotal > 0 ? 100.0 * numPagesCached / numPagesTotal : 0.0,
+        numFilesOpened, numFilesPrefetched);
+    pthread_mutex_unlock(&statsMutex);
+}
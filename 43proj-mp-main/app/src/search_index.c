@@ -0,0 +1,407 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "search_index.h"
+#include "string_arena.h"
+
+#define INITIAL_CAPACITY 256
+#define NO_NODE 0 // the root is never a child
+#define NO_LIST UINT32_MAX
+// Words of one song past this are not indexed
+#define MAX_WORDS_PER_TRACK 64
+
+// Letters and digits; 0 separates words
+#define SEPARATOR 0
+
+// One letter of a word. Children are linked through nextSibling.
+typedef struct {
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    uint32_t list; // songs with the word that ends here, or NO_LIST
+    uint8_t symbol;
+} sTrieNode_t;
+
+typedef struct {
+    uint32_t *ids; // unordered
+    uint32_t numIds;
+    uint32_t capacity;
+} sIdList_t;
+
+static bool initialized = false;
+
+static sTrieNode_t *nodes = NULL; // nodes[0] is the root
+static int numNodes = 0;
+static int nodesCapacity = 0;
+
+static sIdList_t *lists = NULL;
+static int numLists = 0;
+static int listsCapacity = 0;
+
+// One bit per id, for combining the songs each query word matches
+static uint64_t *matchBits = NULL;
+static uint64_t *wordBits = NULL;
+static int bitsCapacity = 0;
+static int idLimit = 0;
+
+static _Atomic uint64_t version = 0;
+
+static pthread_mutex_t indexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Grows *pArray (of elemSize elements) so it holds at least needed elements
+static void ensureCapacity(void **pArray, int *pCapacity, int needed, size_t elemSize)
+{
+    if (needed <= *pCapacity) return;
+
+    int newCapacity = *pCapacity > 0 ? *pCapacity : INITIAL_CAPACITY;
+    while (newCapacity < needed) newCapacity *= 2;
+
+    void *pNew = realloc(*pArray, newCapacity * elemSize);
+    if (!pNew)
+    {
+        perror("ERROR: Unable to grow search index");
+        exit(EXIT_FAILURE);
+    }
+    *pArray = pNew;
+    *pCapacity = newCapacity;
+}
+
+// Caller holds indexMutex
+static uint32_t addNode(uint8_t symbol)
+{
+    ensureCapacity((void**)&nodes, &nodesCapacity, numNodes + 1, sizeof(sTrieNode_t));
+    sTrieNode_t *pNode = &nodes[numNodes];
+    pNode->firstChild = NO_NODE;
+    pNode->nextSibling = NO_NODE;
+    pNode->list = NO_LIST;
+    pNode->symbol = symbol;
+    return numNodes++;
+}
+
+// Caller holds indexMutex
+static void reset(void)
+{
+    for (int i=0; i<numLists; i++)
+    {
+        free(lists[i].ids);
+    }
+    numLists = 0;
+    numNodes = 0;
+    idLimit = 0;
+    addNode(SEPARATOR);
+}
+
+void SearchIndex_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    pthread_mutex_lock(&indexMutex);
+    reset();
+    pthread_mutex_unlock(&indexMutex);
+}
+
+void SearchIndex_cleanup(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&indexMutex);
+    reset();
+    free(nodes);
+    nodes = NULL;
+    numNodes = 0;
+    nodesCapacity = 0;
+
+    free(lists);
+    lists = NULL;
+    listsCapacity = 0;
+
+    free(matchBits);
+    free(wordBits);
+    matchBits = NULL;
+    wordBits = NULL;
+    bitsCapacity = 0;
+    pthread_mutex_unlock(&indexMutex);
+
+    initialized = false;
+}
+
+static uint8_t toSymbol(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z') return c - 'a' + 1;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 1;
+    if (c >= '0' && c <= '9') return c - '0' + 27;
+    return SEPARATOR;
+}
+
+// Reads the next word of *pStr as symbols and moves *pStr past it. Only the first
+// SEARCH_INDEX_MAX_QUERY_LEN letters are kept. Returns 0 at the end of the string.
+static int nextWord(const char **pStr, uint8_t *word)
+{
+    const unsigned char *p = (const unsigned char*)*pStr;
+    while (*p && toSymbol(*p) == SEPARATOR) p++;
+
+    int len = 0;
+    for (; *p && toSymbol(*p) != SEPARATOR; p++)
+    {
+        if (len < SEARCH_INDEX_MAX_QUERY_LEN) word[len++] = toSymbol(*p);
+    }
+    *pStr = (const char*)p;
+    return len;
+}
+
+// The node for word, or NO_NODE if it has never been indexed unless create is set.
+// Caller holds indexMutex
+static uint32_t findNode(const uint8_t *word, int len, bool create)
+{
+    uint32_t node = 0;
+    for (int i=0; i<len; i++)
+    {
+        uint32_t child = nodes[node].firstChild;
+        while (child != NO_NODE && nodes[child].symbol != word[i])
+        {
+            child = nodes[child].nextSibling;
+        }
+        if (child == NO_NODE)
+        {
+            if (!create) return NO_NODE;
+            // addNode() may move nodes
+            child = addNode(word[i]);
+            nodes[child].nextSibling = nodes[node].firstChild;
+            nodes[node].firstChild = child;
+        }
+        node = child;
+    }
+    return node;
+}
+
+// Fills wordLists with the lists of every distinct word in the song's tags, adding
+// words and lists that are missing if create is set. Returns the number filled in.
+// Caller holds indexMutex
+static int collectWords(const musicMetadata_t *pMetadata, bool create, uint32_t *wordLists)
+{
+    uint32_t tags[] = { pMetadata->title, pMetadata->artist, pMetadata->album };
+    uint8_t word[SEARCH_INDEX_MAX_QUERY_LEN];
+    int numWords = 0;
+
+    for (size_t t=0; t<sizeof(tags)/sizeof(tags[0]); t++)
+    {
+        const char *str = StringArena_get(tags[t]);
+        int len;
+        while ((len = nextWord(&str, word)) > 0 && numWords < MAX_WORDS_PER_TRACK)
+        {
+            uint32_t node = findNode(word, len, create);
+            if (node == NO_NODE) continue;
+            if (nodes[node].list == NO_LIST)
+            {
+                if (!create) continue;
+                ensureCapacity((void**)&lists, &listsCapacity, numLists + 1, sizeof(sIdList_t));
+                lists[numLists] = (sIdList_t){ NULL, 0, 0 };
+                nodes[node].list = numLists++;
+            }
+
+            // A word repeated in the title, or an artist who named an album after
+            // themselves, lists the song once
+            uint32_t list = nodes[node].list;
+            bool isNew = true;
+            for (int i=0; i<numWords && isNew; i++)
+            {
+                isNew = wordLists[i] != list;
+            }
+            if (isNew) wordLists[numWords++] = list;
+        }
+    }
+    return numWords;
+}
+
+void SearchIndex_addTrack(int id, const musicMetadata_t *pMetadata)
+{
+    assert(initialized);
+    assert(id >= 0);
+
+    pthread_mutex_lock(&indexMutex);
+
+    uint32_t wordLists[MAX_WORDS_PER_TRACK];
+    int numWords = collectWords(pMetadata, true, wordLists);
+    for (int i=0; i<numWords; i++)
+    {
+        sIdList_t *pList = &lists[wordLists[i]];
+        if (pList->numIds == pList->capacity)
+        {
+            // Most words belong to a handful of songs, so lists start small
+            uint32_t newCapacity = pList->capacity > 0 ? pList->capacity * 2 : 2;
+            uint32_t *pNew = realloc(pList->ids, newCapacity * sizeof(uint32_t));
+            if (!pNew)
+            {
+                perror("ERROR: Unable to grow search index");
+                exit(EXIT_FAILURE);
+            }
+            pList->ids = pNew;
+            pList->capacity = newCapacity;
+        }
+        pList->ids[pList->numIds++] = id;
+    }
+    if (id >= idLimit) idLimit = id + 1;
+    atomic_fetch_add(&version, 1);
+
+    pthread_mutex_unlock(&indexMutex);
+}
+
+void SearchIndex_removeTrack(int id, const musicMetadata_t *pMetadata)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&indexMutex);
+
+    uint32_t wordLists[MAX_WORDS_PER_TRACK];
+    int numWords = collectWords(pMetadata, false, wordLists);
+    for (int i=0; i<numWords; i++)
+    {
+        sIdList_t *pList = &lists[wordLists[i]];
+        for (uint32_t j=0; j<pList->numIds; j++)
+        {
+            if (pList->ids[j] != (uint32_t)id) continue;
+            pList->ids[j] = pList->ids[--pList->numIds];
+            break;
+        }
+    }
+    // The words stay in the trie with no songs; they cost nothing to search
+    atomic_fetch_add(&version, 1);
+
+    pthread_mutex_unlock(&indexMutex);
+}
+
+// Sets the bit of every song with a word starting with node's letters.
+// Caller holds indexMutex
+static void markSubtree(uint32_t node, uint64_t *bits)
+{
+    if (nodes[node].list != NO_LIST)
+    {
+        const sIdList_t *pList = &lists[nodes[node].list];
+        for (uint32_t i=0; i<pList->numIds; i++)
+        {
+            bits[pList->ids[i] >> 6] |= (uint64_t)1 << (pList->ids[i] & 63);
+        }
+    }
+    for (uint32_t child = nodes[node].firstChild; child != NO_NODE; child = nodes[child].nextSibling)
+    {
+        markSubtree(child, bits);
+    }
+}
+
+// Walks the trie below node keeping the edit distance from word to each node's letters
+// (prevRow is node's row), and marks every subtree whose letters are within maxEdits.
+// Branches that can no longer get within maxEdits are skipped.
+// Caller holds indexMutex
+static void markFuzzy(uint32_t node, const uint8_t *word, int len, int maxEdits, const int *prevRow, uint64_t *bits)
+{
+    for (uint32_t child = nodes[node].firstChild; child != NO_NODE; child = nodes[child].nextSibling)
+    {
+        int row[SEARCH_INDEX_MAX_QUERY_LEN + 1];
+        row[0] = prevRow[0] + 1;
+        int best = row[0];
+        for (int j=1; j<=len; j++)
+        {
+            int replace = prevRow[j-1] + (word[j-1] != nodes[child].symbol);
+            int insert = prevRow[j] + 1;
+            int delete = row[j-1] + 1;
+            row[j] = replace < insert ? replace : insert;
+            if (delete < row[j]) row[j] = delete;
+            if (row[j] < best) best = row[j];
+        }
+
+        if (row[len] <= maxEdits) markSubtree(child, bits);
+        else if (best <= maxEdits) markFuzzy(child, word, len, maxEdits, row, bits);
+    }
+}
+
+static int getMaxEdits(int len)
+{
+    if (len < 3) return 0;
+    if (len < 6) return 1;
+    return 2;
+}
+
+int SearchIndex_query(const char *query, bool fuzzy, int *ids, int maxIds)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&indexMutex);
+
+    int numBitWords = (idLimit + 63) / 64;
+    int capacity = bitsCapacity;
+    ensureCapacity((void**)&matchBits, &capacity, numBitWords, sizeof(uint64_t));
+    capacity = bitsCapacity;
+    ensureCapacity((void**)&wordBits, &capacity, numBitWords, sizeof(uint64_t));
+    bitsCapacity = capacity;
+
+    uint8_t word[SEARCH_INDEX_MAX_QUERY_LEN];
+    int len;
+    bool isFirstWord = true;
+    while ((len = nextWord(&query, word)) > 0)
+    {
+        // The first word's matches go straight into matchBits
+        uint64_t *bits = isFirstWord ? matchBits : wordBits;
+        memset(bits, 0, numBitWords * sizeof(uint64_t));
+
+        int maxEdits = fuzzy ? getMaxEdits(len) : 0;
+        if (maxEdits > 0)
+        {
+            int row[SEARCH_INDEX_MAX_QUERY_LEN + 1];
+            for (int j=0; j<=len; j++) row[j] = j;
+            markFuzzy(0, word, len, maxEdits, row, bits);
+        }
+        else
+        {
+            uint32_t node = findNode(word, len, false);
+            if (node != NO_NODE) markSubtree(node, bits);
+        }
+
+        if (!isFirstWord)
+        {
+            for (int i=0; i<numBitWords; i++) matchBits[i] &= wordBits[i];
+        }
+        isFirstWord = false;
+    }
+
+    int numMatches = 0;
+    for (int i=0; i<numBitWords && !isFirstWord; i++)
+    {
+        uint64_t bitWord = matchBits[i];
+        while (bitWord)
+        {
+            if (numMatches < maxIds) ids[numMatches] = i * 64 + __builtin_ctzll(bitWord);
+            numMatches++;
+            bitWord &= bitWord - 1;
+        }
+    }
+
+    pthread_mutex_unlock(&indexMutex);
+
+    return numMatches;
+}
+
+uint64_t SearchIndex_getVersion(void)
+{
+    return atomic_load(&version);
+}
+
+size_t SearchIndex_getMemoryUsage(void)
+{
+    pthread_mutex_lock(&indexMutex);
+    size_t bytes = nodesCapacity * sizeof(sTrieNode_t) +
+        listsCapacity * sizeof(sIdList_t) +
+        2 * bitsCapacity * sizeof(uint64_t);
+    for (int i=0; i<numLists; i++)
+    {
+        bytes += lists[i].capacity * sizeof(uint32_t);
+    }
+    pthread_mutex_unlock(&indexMutex);
+    return bytes;
+}
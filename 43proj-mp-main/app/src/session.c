@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "session.h"
+#include "app.h"
+#include "file_loader.h"
+#include "file_reader.h"
+#include "library.h"
+#include "read_ahead.h"
+#include "volume.h"
+
+// Plain text, one "key value" per line, so it can be read and fixed by hand
+#define SESSION_FILE "session.state"
+#define SESSION_TEMP_FILE SESSION_FILE ".tmp"
+#define SESSION_VERSION 1
+#define SAVE_INTERVAL_MS 5000
+#define MAX_LINE_LEN 1100
+
+static bool initialized = false;
+
+// Read by load() for init() to apply; -1 if the snapshot didn't have them
+static int restoredVolume = -1;
+static int restoredPage = -1;
+static int restoredShuffle = -1;
+static int restoredRepeat = -1;
+
+// The last snapshot written, so unchanged state isn't rewritten every interval
+static char *pLastSnapshot = NULL;
+static size_t lastSnapshotLen = 0;
+
+static bool runSaveThread = false;
+static pthread_t saveThread;
+static pthread_mutex_t saveMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t saveCond = PTHREAD_COND_INITIALIZER;
+
+
+// Strips the newline; returns the value after "key ", or NULL if the line is another key
+static const char* getValue(char *line, const char *key)
+{
+    line[strcspn(line, "\n")] = '\0';
+
+    size_t keyLen = strlen(key);
+    if (strncmp(line, key, keyLen) != 0 || line[keyLen] != ' ') return NULL;
+    return line + keyLen + 1;
+}
+
+void Session_load(void)
+{
+    FILE *file = fopen(SESSION_FILE, "r");
+    if (file == NULL) return;
+
+    char line[MAX_LINE_LEN];
+    int version = 0;
+    if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "session %d", &version) != 1 || version != SESSION_VERSION)
+    {
+        fprintf(stderr, "WARNING: Ignoring %s, unknown format\n", SESSION_FILE);
+        fclose(file);
+        return;
+    }
+
+    char **queue = NULL;
+    int numQueued = 0;
+    int queueCapacity = 0;
+    char *cursor = NULL;
+    size_t position = 0;
+
+    const char *value;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if ((value = getValue(line, "volume")) != NULL) restoredVolume = atoi(value);
+        else if ((value = getValue(line, "page")) != NULL) restoredPage = atoi(value);
+        else if ((value = getValue(line, "shuffle")) != NULL) restoredShuffle = atoi(value);
+        else if ((value = getValue(line, "repeat")) != NULL) restoredRepeat = atoi(value);
+        else if ((value = getValue(line, "position")) != NULL) position = strtoull(value, NULL, 10);
+        else if ((value = getValue(line, "cursor")) != NULL)
+        {
+            free(cursor);
+            cursor = strdup(value);
+        }
+        else if ((value = getValue(line, "track")) != NULL)
+        {
+            if (numQueued == queueCapacity)
+            {
+                queueCapacity = queueCapacity > 0 ? queueCapacity * 2 : 64;
+                queue = realloc(queue, queueCapacity * sizeof(char*));
+                if (!queue)
+                {
+                    perror("ERROR: Unable to allocate restored queue");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            queue[numQueued++] = strdup(value);
+        }
+    }
+    fclose(file);
+
+    // The current song is read while the rest of the system starts
+    if (numQueued > 0)
+    {
+        ReadAhead_prefetch(queue[0]);
+        FileReader_request(queue[0]);
+    }
+    FileLoader_restoreSession(queue, numQueued, position, cursor);
+    printf("Restored session: %d songs queued, %zu frames into the first\n", numQueued, position);
+
+    for (int i=0; i<numQueued; i++)
+    {
+        free(queue[i]);
+    }
+    free(queue);
+    free(cursor);
+}
+
+// Writes the current state to a string. Returns its length; the caller frees *ppSnapshot.
+static size_t formatSnapshot(char **ppSnapshot)
+{
+    size_t len = 0;
+    FILE *stream = open_memstream(ppSnapshot, &len);
+    if (stream == NULL)
+    {
+        perror("ERROR: Unable to allocate session snapshot");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t position = 0;
+    int numQueued = 0;
+    char **queue = FileLoader_getQueue(&numQueued, &position);
+
+    fprintf(stream, "session %d\n", SESSION_VERSION);
+    fprintf(stream, "volume %d\n", Volume_getVolume());
+    fprintf(stream, "page %d\n", App_getPage());
+    fprintf(stream, "shuffle %d\n", AudioPlayback_getShuffle());
+    fprintf(stream, "repeat %d\n", AudioPlayback_getRepeat());
+
+    int cursor = App_getSelectedTrack();
+    if (cursor >= 0) fprintf(stream, "cursor %s\n", Library_getPath(cursor));
+
+    fprintf(stream, "position %zu\n", position);
+    for (int i=0; i<numQueued; i++)
+    {
+        // A newline would split the entry; such a song is simply not restored
+        if (strchr(queue[i], '\n') == NULL) fprintf(stream, "track %s\n", queue[i]);
+        free(queue[i]);
+    }
+    free(queue);
+
+    fclose(stream);
+    return len;
+}
+
+// Replaces the snapshot file only once the new one is completely on storage,
+// so a power cut leaves either the old snapshot or the new one.
+static bool writeSnapshot(const char *pSnapshot, size_t len)
+{
+    FILE *file = fopen(SESSION_TEMP_FILE, "w");
+    if (file == NULL)
+    {
+        perror("WARNING: Unable to save session");
+        return false;
+    }
+
+    bool ok = fwrite(pSnapshot, 1, len, file) == len && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(SESSION_TEMP_FILE, SESSION_FILE) != 0)
+    {
+        perror("WARNING: Unable to save session");
+        unlink(SESSION_TEMP_FILE);
+        return false;
+    }
+    return true;
+}
+
+static void save(void)
+{
+    char *pSnapshot = NULL;
+    size_t len = formatSnapshot(&pSnapshot);
+
+    // Playback position changes while music plays, so this mostly skips paused or idle time
+    if (pLastSnapshot != NULL && len == lastSnapshotLen && memcmp(pSnapshot, pLastSnapshot, len) == 0)
+    {
+        free(pSnapshot);
+        return;
+    }
+
+    if (writeSnapshot(pSnapshot, len))
+    {
+        free(pLastSnapshot);
+        pLastSnapshot = pSnapshot;
+        lastSnapshotLen = len;
+    }
+    else
+    {
+        free(pSnapshot);
+    }
+}
+
+static void* saveThreadFunc()
+{
+    pthread_mutex_lock(&saveMutex);
+    while (runSaveThread)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SAVE_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (SAVE_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&saveCond, &saveMutex, &deadline);
+        if (runSaveThread) save();
+    }
+    pthread_mutex_unlock(&saveMutex);
+
+    return NULL;
+}
+
+void Session_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    if (restoredVolume >= 0) Volume_setVolume(restoredVolume);
+    if (restoredPage >= 0) App_setPage(restoredPage);
+    if (restoredShuffle >= 0) AudioPlayback_setShuffle(restoredShuffle != 0);
+    if (restoredRepeat >= 0 && restoredRepeat < eNUM_REPEAT_MODES) AudioPlayback_setRepeat(restoredRepeat);
+
+    runSaveThread = true;
+    if (pthread_create(&saveThread, NULL, saveThreadFunc, NULL) != 0)
+    {
+        perror("Failed to create session thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Session_cleanup(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&saveMutex);
+    runSaveThread = false;
+    pthread_cond_signal(&saveCond);
+    pthread_mutex_unlock(&saveMutex);
+    pthread_join(saveThread, NULL);
+
+    save();
+    free(pLastSnapshot);
+    pLastSnapshot = NULL;
+
+    initialized = false;
+}
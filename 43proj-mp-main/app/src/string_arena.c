@@ -0,0 +1,268 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "string_arena.h"
+
+// Offsets are (chunk number << CHUNK_BITS) | position in chunk
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+// 4096 chunks of 64 KB is 256 MB of strings, counting the generation kept for
+// readers; the table itself is 32 KB
+#define MAX_CHUNKS 4096
+// Must be a power of 2
+#define INITIAL_INTERN_CAPACITY 1024
+
+static bool initialized = false;
+
+// A chunk is only freed a whole generation after it was retired, so readers can
+// index this without the lock. NULL slots are free.
+static char *_Atomic chunks[MAX_CHUNKS];
+static bool retired[MAX_CHUNKS]; // holds the previous generation's strings
+static int numChunks = 0;
+static int currentChunk = 0; // the chunk strings are appended to
+static size_t chunkUsed = 0; // bytes used in the current chunk
+static size_t usedBytes = 0;
+static size_t savedBytes = 0;
+
+// Open addressing hash set of interned offsets. STRING_ARENA_EMPTY marks a free slot;
+// the empty string itself is never stored here.
+static uint32_t *internTable = NULL;
+static size_t internCapacity = 0;
+static size_t numInterned = 0;
+
+static pthread_mutex_t arenaMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void addChunk(void)
+{
+    int slot = 0;
+    while (slot < MAX_CHUNKS && atomic_load(&chunks[slot]) != NULL) slot++;
+    if (slot == MAX_CHUNKS)
+    {
+        fprintf(stderr, "ERROR: String arena is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *pChunk = malloc(CHUNK_SIZE);
+    if (!pChunk)
+    {
+        perror("ERROR: Unable to allocate string arena");
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&chunks[slot], pChunk);
+    numChunks++;
+    currentChunk = slot;
+    // Offset 0 is always the empty string, so nothing is stored there
+    chunkUsed = slot == 0 ? 1 : 0;
+}
+
+static void allocateInternTable(size_t capacity)
+{
+    internTable = calloc(capacity, sizeof(uint32_t));
+    if (!internTable)
+    {
+        perror("ERROR: Unable to allocate string intern table");
+        exit(EXIT_FAILURE);
+    }
+    internCapacity = capacity;
+    numInterned = 0;
+}
+
+void StringArena_init(void)
+{
+    assert(!initialized);
+    initialized = true;
+
+    numChunks = 0;
+    addChunk();
+    usedBytes = 1; // the empty string
+    savedBytes = 0;
+    allocateInternTable(INITIAL_INTERN_CAPACITY);
+}
+
+void StringArena_cleanup(void)
+{
+    assert(initialized);
+
+    for (int i=0; i<MAX_CHUNKS; i++)
+    {
+        free(atomic_load(&chunks[i]));
+        atomic_store(&chunks[i], NULL);
+        retired[i] = false;
+    }
+    numChunks = 0;
+    usedBytes = 0;
+
+    free(internTable);
+    internTable = NULL;
+    internCapacity = 0;
+    numInterned = 0;
+
+    initialized = false;
+}
+
+void StringArena_startGeneration(void)
+{
+    assert(initialized);
+
+    pthread_mutex_lock(&arenaMutex);
+
+    // Nothing uses the generation before the last one any more
+    for (int i=0; i<MAX_CHUNKS; i++)
+    {
+        if (!retired[i]) continue;
+        free(atomic_load(&chunks[i]));
+        atomic_store(&chunks[i], NULL);
+        retired[i] = false;
+        numChunks--;
+    }
+
+    // The last generation stays readable until the next call
+    for (int i=0; i<MAX_CHUNKS; i++)
+    {
+        retired[i] = atomic_load(&chunks[i]) != NULL;
+    }
+    addChunk();
+    usedBytes = 1;
+    savedBytes = 0;
+
+    memset(internTable, 0, internCapacity * sizeof(uint32_t));
+    numInterned = 0;
+
+    pthread_mutex_unlock(&arenaMutex);
+}
+
+// Caller holds arenaMutex
+static uint32_t append(const char *str, size_t len)
+{
+    // Strings never straddle two chunks
+    if (chunkUsed + len + 1 > CHUNK_SIZE) addChunk();
+
+    uint32_t offset = ((uint32_t)currentChunk << CHUNK_BITS) | chunkUsed;
+    char *dest = chunks[currentChunk] + chunkUsed;
+    memcpy(dest, str, len);
+    dest[len] = '\0';
+    chunkUsed += len + 1;
+    usedBytes += len + 1;
+
+    return offset;
+}
+
+static size_t getLength(const char *str)
+{
+    size_t len = strlen(str);
+    return len > CHUNK_SIZE - 1 ? CHUNK_SIZE - 1 : len;
+}
+
+uint32_t StringArena_add(const char *str)
+{
+    assert(initialized);
+
+    size_t len = getLength(str);
+    if (len == 0) return STRING_ARENA_EMPTY;
+
+    pthread_mutex_lock(&arenaMutex);
+    uint32_t offset = append(str, len);
+    pthread_mutex_unlock(&arenaMutex);
+
+    return offset;
+}
+
+// FNV-1a
+static uint32_t hashString(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Caller holds arenaMutex
+static void growInternTable(void)
+{
+    uint32_t *oldTable = internTable;
+    size_t oldCapacity = internCapacity;
+    allocateInternTable(oldCapacity * 2);
+
+    for (size_t i=0; i<oldCapacity; i++)
+    {
+        if (oldTable[i] == STRING_ARENA_EMPTY) continue;
+
+        const char *str = StringArena_get(oldTable[i]);
+        size_t slot = hashString(str, strlen(str)) & (internCapacity - 1);
+        while (internTable[slot] != STRING_ARENA_EMPTY) slot = (slot + 1) & (internCapacity - 1);
+        internTable[slot] = oldTable[i];
+        numInterned++;
+    }
+
+    free(oldTable);
+}
+
+uint32_t StringArena_intern(const char *str)
+{
+    assert(initialized);
+
+    size_t len = getLength(str);
+    if (len == 0) return STRING_ARENA_EMPTY;
+
+    pthread_mutex_lock(&arenaMutex);
+
+    // Keep the table at most half full
+    if ((numInterned + 1) * 2 > internCapacity) growInternTable();
+
+    size_t slot = hashString(str, len) & (internCapacity - 1);
+    while (internTable[slot] != STRING_ARENA_EMPTY)
+    {
+        const char *existing = StringArena_get(internTable[slot]);
+        if (strncmp(existing, str, len) == 0 && existing[len] == '\0')
+        {
+            uint32_t offset = internTable[slot];
+            savedBytes += len + 1;
+            pthread_mutex_unlock(&arenaMutex);
+            return offset;
+        }
+        slot = (slot + 1) & (internCapacity - 1);
+    }
+
+    uint32_t offset = append(str, len);
+    internTable[slot] = offset;
+    numInterned++;
+
+    pthread_mutex_unlock(&arenaMutex);
+
+    return offset;
+}
+
+const char* StringArena_get(uint32_t offset)
+{
+    // Its chunk may have been freed with an old generation
+    if (offset == STRING_ARENA_EMPTY) return "";
+
+    char *pChunk = atomic_load(&chunks[offset >> CHUNK_BITS]);
+    assert(pChunk);
+    return pChunk + (offset & (CHUNK_SIZE - 1));
+}
+
+size_t StringArena_getUsedBytes(void)
+{
+    pthread_mutex_lock(&arenaMutex);
+    size_t bytes = usedBytes;
+    pthread_mutex_unlock(&arenaMutex);
+    return bytes;
+}
+
+size_t StringArena_getSavedBytes(void)
+{
+    pthread_mutex_lock(&arenaMutex);
+    size_t bytes = savedBytes;
+    pthread_mutex_unlock(&arenaMutex);
+    return bytes;
+}
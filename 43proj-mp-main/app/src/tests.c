@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tests.h"
 #include "hal/btn_statemachine.h"
@@ -8,6 +9,16 @@
 #include "audio_playback.h"
 #include "volume.h"
 #include "file_loader.h"
+#include "music_stream.h"
+#include "parallel_decode.h"
+#include "timing.h"
+#include "string_arena.h"
+#include "search_index.h"
+#include "library.h"
+#include "playlist.h"
+#include "crawler.h"
+#include "codec.h"
+#include "load_scheduler.h"
 
 
 void Tests_buttons(int seconds)
@@ -49,7 +60,13 @@ static void audioSleepPrintCurrentSongInfo(int seconds)
     for (int i=0; i<(seconds/3); i++)
     {
 
-        musicMetadata_t* metadata = AudioPlayback_getCurrentMetadata();
+        musicMetadata_t metadata;
+        if (!AudioPlayback_getCurrentMetadata(&metadata))
+        {
+            printf("Nothing playing\n");
+            sleep(3);
+            continue;
+        }
 
         printf(
             "Current song details:\n\
@@ -57,7 +74,8 @@ static void audioSleepPrintCurrentSongInfo(int seconds)
                 Artist: %s\n\
                 Album: %s\n\
                 Duration: %4.2f seconds\n", 
-            metadata->title, metadata->artist, metadata->album, metadata->lengthSeconds);
+            StringArena_get(metadata.title), StringArena_get(metadata.artist),
+            StringArena_get(metadata.album), metadata.lengthSeconds);
         sleep(3);
     }
 
@@ -131,4 +149,670 @@ void Tests_audioPlayback(void)
 
 
     printf("Done audio testing. Songs still in queue\n");
-}
\ No newline at end of file
+}
+
+// Reads a whole file into a malloc'd buffer. Returns NULL if it can't be read.
+static unsigned char* readWholeFile(const char *filename, size_t *pNumBytes)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open file %s.\n", filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t numBytes = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *pBytes = malloc(numBytes);
+    if (fread(pBytes, 1, numBytes, file) != numBytes)
+    {
+        fprintf(stderr, "ERROR: Unable to read file %s.\n", filename);
+        fclose(file);
+        free(pBytes);
+        return NULL;
+    }
+    fclose(file);
+
+    *pNumBytes = numBytes;
+    return pBytes;
+}
+
+// Decodes a whole file on one thread through the codec module, as the loader does
+static short* decodeSerially(unsigned char *pBytes, size_t numBytes, size_t *pNumSamples)
+{
+    sCodecDecoder_t *pDecoder = Codec_open(pBytes, numBytes);
+    if (pDecoder == NULL) return NULL;
+
+    size_t capacity = 1 << 20;
+    short *pcm = malloc(capacity * sizeof(short));
+    size_t numSamples = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        if (numSamples == capacity)
+        {
+            capacity *= 2;
+            pcm = realloc(pcm, capacity * sizeof(short));
+        }
+        numSamples += Codec_read(pDecoder, pcm + numSamples, capacity - numSamples, &finished);
+    }
+    Codec_close(pDecoder);
+
+    *pNumSamples = numSamples;
+    return pcm;
+}
+
+void Tests_parallelDecode(char* filename)
+{
+    printf("Testing parallel decode of %s\n", filename);
+
+    size_t numBytes;
+    unsigned char *pBytes = readWholeFile(filename, &numBytes);
+    if (pBytes == NULL) return;
+
+    // Decoders each get their own reader, so one stream serves every run
+    sMusicStream_t *pStream = MusicStream_create(pBytes, numBytes);
+
+    // The reference is the serial codec, so gapless trimming must match too
+    size_t serialNumSamples = 0;
+    long long startMs = getTimeInMs();
+    short *serialPcm = decodeSerially(pBytes, numBytes, &serialNumSamples);
+    long long serialMs = getTimeInMs() - startMs;
+    printf("Serial codec: %lld ms, %zu samples\n", serialMs, serialNumSamples);
+
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int numThreads=1; numThreads<=numCores && serialPcm != NULL; numThreads++)
+    {
+        size_t numSamples = 0;
+        startMs = getTimeInMs();
+        short *pcm = ParallelDecode_decodeMp3(pStream, numThreads, &numSamples);
+        long long elapsedMs = getTimeInMs() - startMs;
+
+        bool matches = pcm != NULL && numSamples == serialNumSamples &&
+            memcmp(pcm, serialPcm, numSamples * sizeof(short)) == 0;
+        printf("%d threads: %lld ms (%.2fx), %s\n", numThreads, elapsedMs,
+            elapsedMs > 0 ? (double)serialMs / elapsedMs : 0.0,
+            matches ? "bit-exact" : "MISMATCH");
+        free(pcm);
+    }
+
+    free(serialPcm);
+    MusicStream_destroy(pStream);
+
+    printf("Done testing parallel decode\n");
+}
+
+// Old layout: every song's tags strdup'd into their own allocations
+typedef struct {
+    char* title;
+    char* artist;
+    char* album;
+    double lengthSeconds;
+} sHeapMetadata_t;
+
+// malloc() adds a header to every allocation and rounds up to 16 bytes
+static size_t heapBytes(size_t numBytes)
+{
+    return (numBytes + sizeof(size_t) + 15) & ~(size_t)15;
+}
+
+void Tests_metadataStrings(int numTracks)
+{
+    printf("Testing metadata strings for %d songs\n", numTracks);
+
+    const int NUM_WALKS = 100;
+    int numArtists = numTracks / 10 + 1;
+    int numAlbums = numTracks / 4 + 1;
+    char title[64], artist[64], album[64];
+
+    sHeapMetadata_t **heapSongs = malloc(numTracks * sizeof(sHeapMetadata_t*));
+    musicMetadata_t *arenaSongs = malloc(numTracks * sizeof(musicMetadata_t));
+    size_t oldBytes = numTracks * sizeof(sHeapMetadata_t*);
+    size_t arenaBytesBefore = StringArena_getUsedBytes();
+
+    for (int i=0; i<numTracks; i++)
+    {
+        snprintf(title, sizeof(title), "Song number %d", i);
+        snprintf(artist, sizeof(artist), "Artist %d", i % numArtists);
+        snprintf(album, sizeof(album), "Album %d", i % numAlbums);
+
+        sHeapMetadata_t *pSong = malloc(sizeof(sHeapMetadata_t));
+        pSong->title = strdup(title);
+        pSong->artist = strdup(artist);
+        pSong->album = strdup(album);
+        pSong->lengthSeconds = i;
+        heapSongs[i] = pSong;
+        oldBytes += heapBytes(sizeof(sHeapMetadata_t)) + heapBytes(strlen(title) + 1) +
+            heapBytes(strlen(artist) + 1) + heapBytes(strlen(album) + 1);
+
+        arenaSongs[i].title = StringArena_add(title);
+        arenaSongs[i].artist = StringArena_intern(artist);
+        arenaSongs[i].album = StringArena_intern(album);
+        arenaSongs[i].lengthSeconds = i;
+    }
+    size_t newBytes = numTracks * sizeof(musicMetadata_t) + StringArena_getUsedBytes() - arenaBytesBefore;
+    printf("strdup: %zu bytes, arena: %zu bytes (%zu saved)\n", oldBytes, newBytes, oldBytes - newBytes);
+
+    // Walk the list the way the FILES page does, touching each title and artist
+    size_t checksum = 0;
+    long long startMs = getTimeInMs();
+    for (int walk=0; walk<NUM_WALKS; walk++)
+    {
+        for (int i=0; i<numTracks; i++)
+        {
+            checksum += strlen(heapSongs[i]->title) + strlen(heapSongs[i]->artist);
+        }
+    }
+    long long heapMs = getTimeInMs() - startMs;
+
+    startMs = getTimeInMs();
+    for (int walk=0; walk<NUM_WALKS; walk++)
+    {
+        for (int i=0; i<numTracks; i++)
+        {
+            checksum -= strlen(StringArena_get(arenaSongs[i].title)) + strlen(StringArena_get(arenaSongs[i].artist));
+        }
+    }
+    long long arenaMs = getTimeInMs() - startMs;
+
+    printf("%d list walks: strdup %lld ms, arena %lld ms (%.2fx), %s\n", NUM_WALKS, heapMs, arenaMs,
+        arenaMs > 0 ? (double)heapMs / arenaMs : 0.0, checksum == 0 ? "same strings" : "MISMATCH");
+
+    for (int i=0; i<numTracks; i++)
+    {
+        free(heapSongs[i]->title);
+        free(heapSongs[i]->artist);
+        free(heapSongs[i]->album);
+        free(heapSongs[i]);
+    }
+    free(heapSongs);
+    // The arena copies stay until shutdown
+    free(arenaSongs);
+
+    printf("Done testing metadata strings\n");
+}
+
+void Tests_crawler(char *rootDir)
+{
+    printf("Testing crawl of %s\n", rootDir);
+
+    const int MAX_THREADS = 8;
+
+    int numExpected = 0;
+    char **expected = NULL;
+    for (int numThreads=1; numThreads<=MAX_THREADS; numThreads*=2)
+    {
+        int numFiles;
+        long long startMs = getTimeInMs();
+        char **files = Crawler_findMusicFiles(rootDir, numThreads, NULL, &numFiles);
+        long long elapsedMs = getTimeInMs() - startMs;
+
+        bool match = true;
+        if (expected == NULL)
+        {
+            expected = files;
+            numExpected = numFiles;
+        }
+        else
+        {
+            match = numFiles == numExpected;
+            for (int i=0; match && i<numFiles; i++)
+            {
+                match = strcmp(files[i], expected[i]) == 0;
+            }
+            Crawler_freeFiles(files, numFiles);
+        }
+
+        printf("%d threads: %d files in %lld ms, %s\n", numThreads, numFiles, elapsedMs,
+            match ? "same order" : "MISMATCH");
+    }
+
+    Crawler_freeFiles(expected, numExpected);
+
+    printf("Done testing crawl\n");
+}
+
+#define DECODE_CHUNK_SAMPLES 8192
+
+void Tests_decodeThroughput(char *filename)
+{
+    printf("Testing decode throughput of %s\n", filename);
+
+    size_t numBytes;
+    unsigned char *pBytes = readWholeFile(filename, &numBytes);
+    if (pBytes == NULL) return;
+
+    long long startMs = getTimeInMs();
+    sCodecDecoder_t *pDecoder = Codec_open(pBytes, numBytes);
+    if (pDecoder == NULL)
+    {
+        free(pBytes);
+        return;
+    }
+
+    // Decoded samples are thrown away; only the decode time matters
+    short chunk[DECODE_CHUNK_SAMPLES];
+    size_t numSamples = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        numSamples += Codec_read(pDecoder, chunk, DECODE_CHUNK_SAMPLES, &finished);
+    }
+    long long elapsedMs = getTimeInMs() - startMs;
+
+    sCodecFormat_t format;
+    Codec_getFormat(pDecoder, &format);
+    double seconds = (double)numSamples / format.numChannels / format.sampleRate;
+    printf("%s: %.1f s of audio (%ld Hz, %d channels) in %lld ms, %.1fx realtime\n",
+        Codec_getCodec(pDecoder)->name, seconds, format.sampleRate, format.numChannels, elapsedMs,
+        elapsedMs > 0 ? seconds * 1000 / elapsedMs : 0.0);
+
+    Codec_close(pDecoder);
+    free(pBytes);
+
+    printf("Done testing decode throughput\n");
+}
+
+// Whether every word of query starts a word of text. The slow way, to check the index.
+static bool hasWordPrefixes(const char *text, const char *query)
+{
+    char queryCopy[64];
+    snprintf(queryCopy, sizeof(queryCopy), "%s", query);
+    char *savePtr;
+    for (char *pWord = strtok_r(queryCopy, " ", &savePtr); pWord; pWord = strtok_r(NULL, " ", &savePtr))
+    {
+        bool found = false;
+        for (const char *p = text; *p && !found; p++)
+        {
+            bool wordStart = p == text || p[-1] == ' ';
+            found = wordStart && strncasecmp(p, pWord, strlen(pWord)) == 0;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+void Tests_searchIndex(int numTracks)
+{
+    printf("Testing search index with %d songs\n", numTracks);
+
+    const int NUM_QUERIES = 1000;
+    const char *WORDS[] = { "love", "night", "blue", "river", "fire", "heart", "dream", "road", "star", "rain" };
+    const int NUM_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+    const char *QUERIES[] = { "l", "lo", "night", "blue ri", "star 12", "dreem" };
+    const int NUM_TEST_QUERIES = sizeof(QUERIES) / sizeof(QUERIES[0]);
+
+    // Ids past the library's so the test songs can be taken out again
+    int firstId = Library_getIdLimit();
+    musicMetadata_t *songs = malloc(numTracks * sizeof(musicMetadata_t));
+    int *ids = malloc((firstId + numTracks) * sizeof(int));
+    char title[64], artist[64], album[64];
+
+    long long startMs = getTimeInMs();
+    for (int i=0; i<numTracks; i++)
+    {
+        snprintf(title, sizeof(title), "%s %s %d", WORDS[i % NUM_WORDS], WORDS[i / 7 % NUM_WORDS], i);
+        snprintf(artist, sizeof(artist), "Artist %d", i % 1000);
+        snprintf(album, sizeof(album), "%s album", WORDS[i / 3 % NUM_WORDS]);
+        songs[i].title = StringArena_add(title);
+        songs[i].artist = StringArena_intern(artist);
+        songs[i].album = StringArena_intern(album);
+        SearchIndex_addTrack(firstId + i, &songs[i]);
+    }
+    long long addMs = getTimeInMs() - startMs;
+    printf("Indexed in %lld ms, %zu KB\n", addMs, SearchIndex_getMemoryUsage() / 1024);
+
+    for (int q=0; q<NUM_TEST_QUERIES; q++)
+    {
+        bool fuzzy = q == NUM_TEST_QUERIES - 1;
+        int numMatches = 0;
+        startMs = getTimeInMs();
+        for (int i=0; i<NUM_QUERIES; i++)
+        {
+            numMatches = SearchIndex_query(QUERIES[q], fuzzy, ids, firstId + numTracks);
+        }
+        long long queryMs = getTimeInMs() - startMs;
+
+        // Only the test songs are checked; the library's own may match too.
+        // The fuzzy query is a typo away from "dream", so it finds at least those songs.
+        const char *checkQuery = fuzzy ? "dream" : QUERIES[q];
+        int numExpected = 0;
+        int numFound = 0;
+        for (int i=0; i<numTracks; i++)
+        {
+            char text[200];
+            snprintf(text, sizeof(text), "%s %s %s", StringArena_get(songs[i].title),
+                StringArena_get(songs[i].artist), StringArena_get(songs[i].album));
+            if (hasWordPrefixes(text, checkQuery)) numExpected++;
+        }
+        for (int i=0; i<numMatches; i++)
+        {
+            if (ids[i] >= firstId) numFound++;
+        }
+
+        // NUM_QUERIES is 1000, so total ms is us per query
+        printf("'%s'%s: %d matches in %lld us, %s\n", QUERIES[q], fuzzy ? " (fuzzy)" : "", numFound, queryMs,
+            fuzzy ? (numFound >= numExpected ? "ok" : "MISSING") : (numFound == numExpected ? "ok" : "MISMATCH"));
+    }
+
+    for (int i=0; i<numTracks; i++)
+    {
+        SearchIndex_removeTrack(firstId + i, &songs[i]);
+    }
+    free(songs);
+    free(ids);
+
+    printf("Done testing search index\n");
+}
+
+void Tests_libraryViews(int numTracks)
+{
+    printf("Testing library views with %d songs\n", numTracks);
+
+    const int NUM_BATCHES = 10;
+    const int NUM_WINDOWS = 10000;
+    // Each batch must add a song, or there would be nothing to list
+    if (numTracks < NUM_BATCHES)
+    {
+        printf("Need at least %d songs to test library views\n", NUM_BATCHES);
+        return;
+    }
+
+    musicMetadata_t *songs = malloc(numTracks * sizeof(musicMetadata_t));
+    int *ids = malloc(numTracks * sizeof(int));
+    char title[64], artist[64], album[64], path[64];
+
+    for (int i=0; i<numTracks; i++)
+    {
+        snprintf(title, sizeof(title), "Song %d", rand() % numTracks);
+        snprintf(artist, sizeof(artist), "Artist %d", rand() % (numTracks / 30 + 1));
+        snprintf(album, sizeof(album), "Album %d", rand() % (numTracks / 10 + 1));
+        songs[i].title = StringArena_add(title);
+        songs[i].artist = StringArena_intern(artist);
+        songs[i].album = StringArena_intern(album);
+        songs[i].lengthSeconds = 60 + rand() % 480;
+    }
+
+    // Adding a song also indexes its words; time that alone to take it out
+    int firstId = Library_getIdLimit() + numTracks;
+    long long startMs = getTimeInMs();
+    for (int i=0; i<numTracks; i++)
+    {
+        SearchIndex_addTrack(firstId + i, &songs[i]);
+    }
+    long long indexMs = getTimeInMs() - startMs;
+    for (int i=0; i<numTracks; i++)
+    {
+        SearchIndex_removeTrack(firstId + i, &songs[i]);
+    }
+
+    // The cost per song should stay flat as the views grow
+    int batchSize = numTracks / NUM_BATCHES;
+    long long totalMs = 0;
+    for (int batch=0; batch<NUM_BATCHES; batch++)
+    {
+        startMs = getTimeInMs();
+        for (int i=batch*batchSize; i<(batch+1)*batchSize; i++)
+        {
+            snprintf(path, sizeof(path), "/test/%d.mp3", i);
+            ids[i] = Library_addTrack(path, &songs[i]);
+        }
+        long long batchMs = getTimeInMs() - startMs;
+        totalMs += batchMs;
+        printf("Songs %d-%d: %.2f us each\n", batch * batchSize, (batch + 1) * batchSize,
+            batchSize > 0 ? batchMs * 1000.0 / batchSize : 0.0);
+    }
+    int numAdded = batchSize * NUM_BATCHES;
+    printf("Adding: %.2f us per song, of which search index %.2f us\n", numAdded > 0 ? totalMs * 1000.0 / numAdded : 0.0,
+        numTracks > 0 ? indexMs * 1000.0 / numTracks : 0.0);
+
+    // Every view must be in order
+    bool sorted = true;
+    int numListed = Library_getNumTracks();
+    for (int view=eLIBRARY_VIEW_ARTIST; view<eNUM_LIBRARY_VIEWS; view++)
+    {
+        musicMetadata_t prev, curr;
+        Library_getMetadata(Library_getTrackAt(view, 0), &prev);
+        for (int position=1; position<numListed && sorted; position++)
+        {
+            Library_getMetadata(Library_getTrackAt(view, position), &curr);
+            if (view == eLIBRARY_VIEW_ARTIST)
+            {
+                sorted = strcasecmp(StringArena_get(prev.artist), StringArena_get(curr.artist)) <= 0;
+            }
+            else if (view == eLIBRARY_VIEW_ALBUM)
+            {
+                sorted = strcasecmp(StringArena_get(prev.album), StringArena_get(curr.album)) <= 0;
+            }
+            else
+            {
+                sorted = prev.lengthSeconds <= curr.lengthSeconds;
+            }
+            prev = curr;
+        }
+    }
+
+    // Scrolling a view the way the FILES page does
+    char rows[7][64];
+    char *titles[7];
+    double lengths[7];
+    for (int i=0; i<7; i++) titles[i] = rows[i];
+    startMs = getTimeInMs();
+    for (int i=0; i<NUM_WINDOWS; i++)
+    {
+        Library_getWindow(i % eNUM_LIBRARY_VIEWS, rand() % numListed, 7, titles, 64, lengths);
+    }
+    long long windowMs = getTimeInMs() - startMs;
+    printf("Views %s, %.2f us per window of 7 songs, %zu KB for the library\n", sorted ? "sorted" : "NOT SORTED",
+        windowMs * 1000.0 / NUM_WINDOWS, Library_getMemoryUsage() / 1024);
+
+    startMs = getTimeInMs();
+    for (int i=0; i<numAdded; i++)
+    {
+        Library_removeTrack(ids[i], NULL);
+        Library_releaseTrack(ids[i]);
+    }
+    long long removeMs = getTimeInMs() - startMs;
+    printf("Removing: %.2f us per song\n", numAdded > 0 ? removeMs * 1000.0 / numAdded : 0.0);
+
+    free(songs);
+    free(ids);
+
+    printf("Done testing library views\n");
+}
+
+typedef struct {
+    const int *ids; // expected library id of each entry, in order
+    int numEntries;
+    int numFound;
+    int numInOrder;
+} sPlaylistCheck_t;
+
+static void checkPlaylistEntry(const char *path, void *pContext)
+{
+    sPlaylistCheck_t *pCheck = pContext;
+    int id = Library_findTrack(path);
+    if (id < 0 || pCheck->numFound >= pCheck->numEntries) return;
+    if (id == pCheck->ids[pCheck->numFound]) pCheck->numInOrder++;
+    pCheck->numFound++;
+}
+
+void Tests_playlist(int numEntries)
+{
+    printf("Testing a playlist of %d songs\n", numEntries);
+
+    const char *PLAYLIST_PATH = "/tmp/tests-playlist.m3u8";
+    sPlaylistEntry_t *entries = malloc(numEntries * sizeof(sPlaylistEntry_t));
+    char **paths = malloc(numEntries * sizeof(char*));
+    int *ids = malloc(numEntries * sizeof(int));
+    char path[64];
+
+    // Songs below the playlist's directory, so they are written relative to it
+    musicMetadata_t metadata = { StringArena_add("Song"), StringArena_intern("Artist"), StringArena_intern("Album"), 180 };
+    for (int i=0; i<numEntries; i++)
+    {
+        snprintf(path, sizeof(path), "/tmp/tests-playlist/%d.mp3", i);
+        paths[i] = strdup(path);
+        ids[i] = Library_addTrack(path, &metadata);
+        entries[i] = (sPlaylistEntry_t){ paths[i], "Song", "Artist", 180 };
+    }
+
+    long long startMs = getTimeInMs();
+    bool written = Playlist_write(PLAYLIST_PATH, entries, numEntries);
+    long long writeMs = getTimeInMs() - startMs;
+
+    // Reading resolves every entry back to its library id, the way loading one does
+    sPlaylistCheck_t check = { ids, numEntries, 0, 0 };
+    startMs = getTimeInMs();
+    int numRead = Playlist_read(PLAYLIST_PATH, checkPlaylistEntry, &check);
+    long long readMs = getTimeInMs() - startMs;
+
+    printf("Write %s in %lld ms, read %d entries in %lld ms (%.2f us each)\n", written ? "done" : "FAILED",
+        writeMs, numRead, readMs, numRead > 0 ? readMs * 1000.0 / numRead : 0.0);
+    printf("%d of %d found in the library, %d in order\n", check.numFound, numEntries, check.numInOrder);
+
+    for (int i=0; i<numEntries; i++)
+    {
+        Library_removeTrack(ids[i], NULL);
+        Library_releaseTrack(ids[i]);
+        free(paths[i]);
+    }
+    unlink(PLAYLIST_PATH);
+    free(entries);
+    free(paths);
+    free(ids);
+
+    printf("Done testing playlists\n");
+}
+
+void Tests_queueDuringScan(void)
+{
+    // The directory the file loader scans
+    const char *MUSIC_DIR = "mp3-files";
+    const long long TIMEOUT_MS = 60000;
+
+    int numFiles;
+    char **files = Crawler_findMusicFiles(MUSIC_DIR, 0, NULL, &numFiles);
+    Crawler_freeFiles(files, numFiles);
+    printf("Testing a song queued while %d songs are scanned\n", numFiles);
+
+    FileLoader_init();
+    AudioPlayback_clearQueue();
+    while (Library_getNumTracks() < 2 && Library_getNumTracks() < numFiles)
+    {
+        usleep(1000);
+    }
+    if (Library_getNumTracks() >= numFiles)
+    {
+        printf("The scan finished before a song could be queued; try a larger library\n");
+        return;
+    }
+
+    // The song listed last is the least likely to have been decoded already
+    int id = Library_getIdLimit() - 1;
+    long long startMs = getTimeInMs();
+    FileLoader_queueFile(id);
+    sLoadedFile *pFile = NULL;
+    AudioPlayback_getQueue(&pFile, 1);
+    if (pFile == NULL || pFile->musicData->numSamples > 0)
+    {
+        printf("%s was decoded before it was queued; try a larger library\n", Library_getPath(id));
+        return;
+    }
+
+    // Nothing the scan listed may be decoded ahead of it
+    int next;
+    bool isNext = LoadScheduler_peek(&next, 1) == 1 && next == id;
+    while (pFile->musicData->numSamples == 0 && getTimeInMs() - startMs < TIMEOUT_MS)
+    {
+        usleep(1000);
+    }
+    int numListed = Library_getNumTracks();
+    bool decoded = pFile->musicData->numSamples > 0;
+
+    printf("%s: %s in %lld ms, %d of %d songs listed by then, %s\n", Library_getPath(id),
+        decoded ? "decoded" : "NOT DECODED", getTimeInMs() - startMs, numListed, numFiles,
+        isNext ? "next to decode" : "NOT NEXT");
+    printf("%s\n", decoded && isNext && numListed < numFiles ? "Decoded during the scan" : "FAILED: waited for the scan");
+
+    printf("Done testing queue during scan\n");
+}
+
+#define STREAM_CHUNK_SAMPLES 4096
+
+void Tests_compressedPlayback(char *filename)
+{
+    printf("Testing compressed playback of %s\n", filename);
+
+    const long long TIMEOUT_MS = 60000;
+
+    sLoadedFile *pPcmFile = malloc(sizeof(sLoadedFile));
+    sLoadedFile *pCompressedFile = malloc(sizeof(sLoadedFile));
+    FileLoader_initFileType(pPcmFile);
+    FileLoader_initFileType(pCompressedFile);
+    pPcmFile->filename = filename;
+    pCompressedFile->filename = filename;
+
+    AudioPlayback_setStorageMode(eMUSIC_STORAGE_PCM);
+    AudioPlayback_loadSong(filename, pPcmFile);
+    AudioPlayback_setStorageMode(eMUSIC_STORAGE_COMPRESSED);
+    AudioPlayback_loadSong(filename, pCompressedFile);
+    AudioPlayback_setStorageMode(eMUSIC_STORAGE_PCM);
+
+    musicData_t *pPcm = pPcmFile->musicData;
+    musicData_t *pCompressed = pCompressedFile->musicData;
+    if (pPcm->numSamples == 0 || pCompressed->storage != eMUSIC_STORAGE_COMPRESSED)
+    {
+        printf("FAILED: unable to load %s both ways\n", filename);
+    }
+    else
+    {
+        // Read the whole stream a chunk at a time, as the mixer does
+        const short *pSamples = pPcm->pData;
+        short chunk[STREAM_CHUNK_SAMPLES];
+        size_t location = 0;
+        size_t numMismatched = 0;
+        bool finished = false;
+        long long startMs = getTimeInMs();
+        while (!finished && getTimeInMs() - startMs < TIMEOUT_MS)
+        {
+            size_t numRead = MusicStream_read(pCompressed->pStream, location, chunk, STREAM_CHUNK_SAMPLES, &finished);
+            if (numRead == 0)
+            {
+                usleep(1000);
+                continue;
+            }
+            for (size_t i=0; i<numRead; i++)
+            {
+                if (location + i >= pPcm->numSamples || chunk[i] != pSamples[location + i]) numMismatched++;
+            }
+            location += numRead;
+        }
+        MusicStream_release(pCompressed->pStream);
+
+        bool match = finished && location == pPcm->numSamples && numMismatched == 0;
+        printf("%zu samples streamed from %zu compressed bytes in %lld ms, %zu decoded up front, %zu differ: %s\n",
+            location, MusicStream_getCompressedSize(pCompressed->pStream), getTimeInMs() - startMs,
+            pPcm->numSamples, numMismatched, match ? "same samples" : "MISMATCH");
+
+        printf("Playing the compressed song\n");
+        AudioPlayback_clearQueue();
+        AudioPlayback_queueSong(pCompressedFile);
+        audioSleepPrintCurrentSongInfo(9);
+        AudioPlayback_clearQueue();
+        while (pCompressed->playingInMixer)
+        {
+            usleep(1000);
+        }
+    }
+
+    AudioPlayback_unloadSong(pPcmFile);
+    AudioPlayback_unloadSong(pCompressedFile);
+    FileLoader_freeFileType(pPcmFile);
+    FileLoader_freeFileType(pCompressedFile);
+    free(pPcmFile);
+    free(pCompressedFile);
+
+    printf("Done testing compressed playback\n");
+}
@@ -81,6 +81,10 @@ void Volume_setVolume(int newVolume) {
   snd_mixer_close(mixerHandle);
 }
 
+int Volume_getVolume(void) {
+  return volume;
+}
+
 void Volume_init(void)
 {
   assert(!s_initialized);
@@ -79,7 +79,7 @@ static void on_release(enum eBtnStatemachines statemachine)
         {
             // Might cause issues with initialization errors in specific cases
             // Should be good enough though
-            App_togglePlaybackStatus();
+            App_rotaryPressed();
         }
     }
     else
@@ -1,6 +1,6 @@
 #include "hal/rotary_encoder.h"
 #include "hal/gpio.h"
-#include "../../app/include/volume.h"
+#include "../../app/include/app.h"
 #include <assert.h>
 #include <pthread.h>
 #include <stdatomic.h>
@@ -67,7 +67,7 @@ static void set_counterclockwise(void) {
 }
 static void reset_clockwise(void) {
   if (isClockwise) {
-    Volume_increaseVolume();
+    App_rotaryTurned(1);
   }
   isClockwise = false;
   isCounterClockwise = false;
@@ -76,7 +76,7 @@ static void reset_clockwise(void) {
 }
 static void reset_counterclockwise(void) {
   if (isCounterClockwise) {
-    Volume_decreaseVolume();
+    App_rotaryTurned(-1);
   }
   isClockwise = false;
   isCounterClockwise = false;